@@ -7,7 +7,19 @@ to a custom 16bit format for use on embedded devices.
 
 ===========================================================================================================
 Format Image File 4bit:
-1. RAW greyscale image data, 4 bits per pixel
+1. 32bit-word number of 8bit words comprising the data (header excluded)
+2. 16bit-word dimension X in pixels
+3. 16bit-word dimension Y in pixels
+4. 16bit-word configuration data
+     Bit0 = 0 uncompressed
+	 Bit1 = 1 RLE compressed
+	 Bit2 = 1 PackBits-style RLE (see below)
+	 Bit3 = 1 4 bits per pixel
+5. Data to EOF (8bit)
+	 - Either raw or RLE compressed (8-bit wise)
+	 - 2 pixels per byte, the first in the low nibble
+	 - greyscale luminance 0-15, or with -Q an index into a palette file
+	   of 16 entries (index 0 = transparent, 1 = black)
 
 Format Image File 8bit:
 1. 32bit-word number of 8bit words comprising the data (header excluded)
@@ -16,6 +28,7 @@ Format Image File 8bit:
 4. 16bit-word configuration data
      Bit0 = 0 uncompressed
 	 Bit1 = 1 RLE compressed
+	 Bit2 = 1 PackBits-style RLE (see below)
 5. Data to EOF (8bit)
 	 - Either raw or RLE compressed (8-bit wise)
 	 - index 0 = transparent
@@ -31,11 +44,13 @@ Format Image File 16bit:
 4. 16bit-word configuration data
      Bit0 = 0 uncompressed
 	 Bit1 = 1 RLE compressed
+	 Bit2 = 1 PackBits-style RLE (see below)
 5. Data to EOF 
    - Either raw or RLE compressed (16-bit wise) according to Bit0 of config word
-   - Starting with the placeholder value if RLE compressed 
+   - Starting with the placeholder value if RLE compressed (not for PackBits-style RLE),
+     always 0x0421 for RGB555 (-6, -7 and -O choose the least common value)
    - RGB555 Data
-   - Big-endian
+   - Little-endian, big-endian with -b (header fields as well)
    - Bit16 = 0 - Pixel completely transparent (Alpha == 0)
    - Bit16 = 1 - Pixel is not completely transparent (Alpha != 0)
 
@@ -46,9 +61,252 @@ Format Alpha File:
 4. 16bit-word configuration data
      Bit0 = 0 uncompressed
 	 Bit0 = 1 RLE compressed
+	 Bit2 = 1 PackBits-style RLE (see below)
 5. Data to EOF (8bit)
 	 - Either raw or RLE compressed (8-bit wise)
-     - Containts 8bit alpha data for each pixel
+     - Containts 8bit alpha data for each pixel, 4 or 2 bits with -A,
+       spans with -S (see below)
+
+Format PackBits-style RLE (-k):
+1. Sequence of control codes, each followed by its data. No placeholder value.
+2. 8-bit data:
+	 0x00..0x7F  literal run, (code + 1) bytes follow
+	 0x80..0xFF  repeat run, the next byte is repeated (code & 0x7F) + 3 times
+3. 16-bit data:
+	 0x0000..0x7FFF  literal run, (code + 1) words follow
+	 0x8000..0xFFFF  repeat run, the next word is repeated (code & 0x7FFF) + 3 times
+
+Format Version 2 Header (-x):
+Replaces the header of image and alpha files. All fields in the byte order
+given by the endianness flag, which is also the order of 16-bit data (-b).
+1. 4 bytes magic "A2DS"
+2. 8bit-word version (2)
+3. 8bit-word endianness (0 = little-endian, 1 = big-endian)
+4. 16bit-word header size, the data starts at this offset
+5. 32bit-word dimension X in pixels
+6. 32bit-word dimension Y in pixels
+7. 16bit-word codec (0 = raw, 1 = RLE, 2 = PackBits-style RLE)
+8. 16bit-word format (see archive.h)
+9. 16bit-word configuration data (as in the version 1 header)
+10. 16bit-word tile size (0 = not tiled)
+11. 32bit-word payload alignment (-l), the header is padded to a multiple
+12. 32bit-word number of words comprising the data (as in version 1)
+13. 32bit-word size of the data in bytes
+14. 32bit-word size of the uncompressed data in bytes
+
+Output as C Source or ELF Object (-s c, -s elf):
+Each output is written as a.rle.c or a.rle.o instead of a.rle.bin, without
+file header. The data is aligned to -l bytes. Symbols (from the file name):
+     const unsigned char a_rle_data[]        the data
+     const struct alpha2ds_info a_rle_info   its metadata:
+         32bit-word size of the data in bytes
+         32bit-word dimension X in pixels
+         32bit-word dimension Y in pixels
+         16bit-word configuration data
+         16bit-word format (see archive.h)
+The object file is ELF32 for ARM EABI, big-endian with -b.
+
+Pipeline Mode (-f -):
+A single image is read from stdin and the outputs are written to stdout,
+one after the other: image, alpha (-a), palette (-8), width and height (-w).
+Each is written as it would be written to its file. Messages go to stderr.
+With -o or -s the outputs go to files named after "stdin" instead.
+
+Library (libalpha2ds):
+The conversion is built as a static library, the tool is a thin wrapper
+around it. convert.h takes a CONVERTOPTIONS struct (the switches of the
+tool) and an RGBA buffer and returns the encoded outputs:
+     ConvertDefaults(&options);
+     std::vector<unsigned char> file = ConvertToBytes(options, rgba, w, h);
+ConvertImage / ConvertSerialize return every output (alpha, palette, ...)
+separately. loader.h loads files through FreeImage.
+The round-trip tests in alpha2ds/test convert images through the library
+and decode the outputs again; they run with "make check" (Makefile for
+POSIX builds) or as the alpha2ds_test project of the solution.
+
+Watch Mode (-W):
+After converting all files the tool keeps running and converts each file
+matching the filter (-f) again when it has been written. Changes are
+collected until the directory has been quiet for 100 ms, so a file saved
+in several steps is converted once. A shared palette (-p) keeps growing
+over all conversions. Not available with -o or -f -.
+
+Input Lists (-R, -m):
+With -R the images matching the filter are collected in all subdirectories
+as well. The outputs of an image are written into its directory, archive
+entries (-o) are named with the relative path.
+With -m the images are listed in a manifest file instead, one per line,
+relative to the current directory, with optional overrides:
+     # comment
+     sprites/hero.png format=8 palette=sprites.pal
+     "ui/big font.png" format=1 tile=16
+     format=1|4|5|6|7|8|16    output format, like the switch (16 = RGB555)
+     tile=<size>              make tiles of this size (-t -d)
+     palette=<file>           palette file shared by the images naming it (-p)
+Images are converted in the order of the list, directories sorted by name.
+
+Pipelined Conversion (-j):
+Images are loaded, converted and written overlapped: while one image is
+converted the next one is loaded and the previous one is written. -j sets
+the number of convert threads. Outputs, archive entries and messages come
+out in the same order as with one thread. At most 2 x threads + 2 images
+are held in memory. Images sharing a palette (-p, palette=) are converted
+one after the other, verbose mode (-v) converts without the pipeline.
+The pixels of a large image are split by lines over the cores left by the
+convert threads, unless the image extends a palette or is written as
+16-bit RGB555 with -r.
+
+Batched File I/O (-u):
+Input images are read and loose outputs are written in groups of 64
+files instead of one file at a time. On Linux each group is a few
+io_uring submissions (open, read or write, close, rename) through a
+registered buffer; elsewhere, or if the kernel lacks io_uring, the same
+groups run with plain reads and writes. Outputs are still replaced
+atomically. Archives (-o), emitted sources (-e) and stdout (-f -) are
+written as before.
+
+Fixed Palettes (-F):
+With -F the palette file (-p, palette=) is not extended: every color is
+mapped to the nearest entry (squared distance of the RGB555 components),
+black to entry 1 and transparent pixels to entry 0 as before. The file
+must exist. The mapping is a table with one index per RGB555 color,
+built once per palette and cached next to the palette file:
+1. 32bit-word magic "A2LT"
+2. 256 x 16bit palette the table was built from (little-endian)
+3. 32768 x 8bit palette index per RGB555 color
+The cache is rebuilt when the palette changes. Images mapped onto a fixed
+palette are converted in parallel with -j.
+
+Color Quantization (-Q):
+Without -Q colors that do not fit into the 8-bit palette are written as
+entry 255. With -Q the opaque pixels are counted in a histogram of the
+RGB555 colors first. If the image has more new colors than the palette
+has free entries, the new colors are reduced by median cut into the free
+entries and every pixel is mapped to its nearest entry. Images whose
+colors fit are converted as without -Q. Palettes written with -6 or -7
+are extended in that format. Histogram and mapping of large images run
+on the cores left by the convert threads (-j); the result does not
+depend on the number of threads.
+
+Batch Palette (-G):
+With -G all 8-bit images of the run share one palette, written once to
+the palette file of -p. The run has two passes: first the colors of all
+images are counted (loaded and counted in parallel with -j) and one
+palette is chosen from the sum, exactly if the colors fit and by median
+cut (see -Q) otherwise; then every image is mapped onto that palette and
+converted in parallel. With -6 or -7 the palette is written in that
+format. The result does not depend on the order of the images. Images
+with their own palette= in a manifest are converted as without -G. -G
+cannot be combined with -F, watch mode (-W) or stdin (-f -).
+
+Tile Palette Banks (-B):
+With -B <banks> -8 -t the tiles are written as 4-bit indices: the 256
+entry palette is split into banks of 16 colors, bank b being entries
+16 * b to 16 * b + 15, and every tile uses one of the first <banks>
+banks (1-16). Entry 0 of each bank is transparent. Tiles sharing colors
+are grouped into the same bank; a bank needing more than 15 colors is
+reduced by median cut (see -Q) and each tile finally takes the bank
+showing it with the least error. The image data has two pixels per
+byte, the first in the low nibble, in tile order, and configuration
+Bit3 set; the bank of every tile is written to a separate file
+<name>.bank.bin, one byte per tile in row order. Each image gets its own
+palette with -B, in the format of -6 or -7 if one is given; -p, -F
+and -G do not apply to it.
+
+4 Bit Output (-4):
+-4 writes 4 bits per pixel, greyscale from the luminance of the colors
+(ITU-R BT.601 weights) or, with -Q, indexed into a palette of 16 colors
+reduced by median cut. The alpha channel is not part of greyscale data,
+write it with -a if needed. The data is packed two pixels per byte and
+can be compressed with -r and -k and tiled with -t like 8-bit data.
+
+Direct Color Formats (-O):
+-O <format> writes one of the direct color formats below instead of
+RGB555, without palette and, if the format has alpha bits, without the
+need for a separate alpha file. Each channel keeps its most significant
+bits; with -c the alpha bits are either all set or all clear.
+     rgb332     8 bits   RRRGGGBB
+     argb4444   16 bits  AAAARRRR GGGGBBBB
+     argb1555   16 bits  ARRRRRGG GGGBBBBB (A set from alpha 128)
+     rgb555     16 bits  the default format
+     rgb565     16 bits  as -7
+     bgr565     16 bits  as -6
+RGB332 is 8-bit data like the 8-bit format and can be tiled with -t,
+16-bit formats are written in the byte order of -b. All formats are
+described by a table in pixelformat.cpp and share one converter.
+
+Alpha Precision (-A):
+-A 4 or -A 2 rounds the alpha file (-a) to 16 or 4 levels and packs it
+to 4 or 2 bits per pixel, the first pixel in the low bits of a byte.
+The configuration word of the alpha file then has Bit3 (4 bits) or
+Bit4 (2 bits) set instead of the bits of the image. The packed data is
+compressed with -r and -k, and with -t it is packed after the pixels
+have been put into tile order. -A 8 is the default.
+
+Alpha Spans (-S):
+-S writes the alpha file (-a) as spans instead of a value per pixel, so
+a blitter can skip transparent pixels and copy opaque ones without
+testing them. Each span is a control byte, type in Bit6-7 and length - 1
+in Bit0-5 (1 to 64 pixels):
+     0 = transparent (alpha 0)
+     1 = opaque (alpha 255)
+     2 = partial, followed by the alpha value of each of its pixels
+Spans end at the end of every row, with -t at the end of every row of a
+tile. The configuration word of the alpha file has Bit5 set instead of
+the bits of the image, and the format is 19 in the version 2 header.
+The spans are compressed with -r and -k. -A is ignored with -S.
+
+Premultiplied Alpha (-M):
+-M multiplies red, green and blue by alpha before a direct color format
+(RGB555, -6, -7, -5, -O) is packed, each rounded to the nearest value,
+so the device blends with dst * (1 - alpha) + src. With -c every pixel
+that is not fully opaque counts as transparent and becomes black. The
+transparency bit and the alpha bits are set as without -M, from the
+alpha of the pixel. 8-bit, 4-bit and 1-bit files are not changed.
+
+Interleaved Alpha (-I):
+-I 24 or -I 20 writes the 16-bit file as RGB565 interleaved with alpha,
+so a blender reads color and alpha of a pixel from one place:
+     24  per pixel the 16-bit color word, then the 8-bit alpha
+     20  per block of 8 pixels the 8 color words, then 4 bytes of 4-bit
+         alpha (first pixel in the low nibble, rounded to 16 levels);
+         the last block is filled with 0
+The color words are in the byte order of -b, the configuration word has
+Bit6 set together with Bit1 (24) or Bit3 (20), and the formats are 20
+and 21 in the version 2 header. The data is compressed 8-bit wise with
+-r and -k and put into tile order with -t. The colors are RGB565 even
+with -6 and -O, -M premultiplies them, and the alpha is that of the
+alpha file (-a) before -A.
+
+Format Archive File (-o):
+All fields are little-endian. The archive is written to a temporary file
+and replaces an existing one only when it is complete.
+1. Header (32 bytes)
+     32bit-word magic "A2DP"
+     16bit-word version (1)
+     16bit-word header size
+     32bit-word payload alignment in bytes (-l, default 4)
+     32bit-word number of entries
+     32bit-word offset of index
+     32bit-word offset of names table
+     32bit-word size of names table
+     32bit-word flags (Bit0 = 1 16-bit data big-endian, -b)
+2. Payloads, each starting at a multiple of the alignment
+     - Data of the output files, without their headers
+     - Palettes last, entries with equal palettes share one payload
+3. Index, sorted by name hash (32 bytes per entry)
+     32bit-word FNV-1a hash of the name
+     32bit-word offset of the name in the names table
+     32bit-word offset of the payload
+     32bit-word size of the payload in bytes
+     32bit-word dimension X in pixels
+     32bit-word dimension Y in pixels
+     16bit-word codec (0 = raw, 1 = RLE, 2 = PackBits-style RLE)
+     16bit-word format (see archive.h)
+     16bit-word configuration data
+     16bit-word reserved
+4. Names table
+     - NUL-terminated names of the output files the entries replace
 
 Format RGB444 Packed File:
 1. 32bit-word number of 16bit words comprising the data (header excluded)
@@ -130,107 +388,130 @@ Otherwise the code is unaltered.
 
 #include <assert.h>
 #include <stdio.h>
+#ifdef _WIN32
 #include <io.h>
+#endif
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <stdarg.h>
+
+#include <map>
+#include <string>
+#include <vector>
+#include <thread>
 
 #include "FreeImage.h"
 #include "rle.h"
+#include "archive.h"
+#include "outfile.h"
+#include "byteorder.h"
+#include "emit.h"
+#include "convert.h"
+#include "loader.h"
+#include "watch.h"
+#include "scan.h"
+#include "pipeline.h"
+#include "fileio.h"
+#include "palmap.h"
+#include "quantize.h"
+#include "tilebank.h"
+#include "pixelformat.h"
 
 #ifndef MAX_PATH
 #define MAX_PATH	260
 #endif
 
-#define FI16_555_RED_MASK		0x7C00
-#define FI16_555_GREEN_MASK		0x03E0
-#define FI16_555_BLUE_MASK		0x001F
-#define FI16_555_RED_SHIFT		10
-#define FI16_555_GREEN_SHIFT	5
-#define FI16_555_BLUE_SHIFT		0
-
-#define RGB555(b, g, r) ((((b) >> 3) << FI16_555_BLUE_SHIFT) | (((g) >> 3) << FI16_555_GREEN_SHIFT) | (((r) >> 3) << FI16_555_RED_SHIFT))
-
-
-#define FI16_444_RED_MASK		0x7C00
-#define FI16_444_GREEN_MASK		0x03E0
-#define FI16_444_BLUE_MASK		0x001F
-#define FI16_444_RED_SHIFT		0
-#define FI16_444_GREEN_SHIFT	4
-#define FI16_444_BLUE_SHIFT		8
-
-#define RGB444(b, g, r) ((((b) >> 4) << FI16_444_BLUE_SHIFT) | (((g) >> 4) << FI16_444_GREEN_SHIFT) | (((r) >> 4) << FI16_444_RED_SHIFT))
-
-
-
-#define FI16_565_RED_MASK		0xF800
-#define FI16_565_GREEN_MASK		0x07C0
-#define FI16_565_BLUE_MASK		0x001F
-#define FI16_565_RED_SHIFT		0
-#define FI16_565_GREEN_SHIFT	6
-#define FI16_565_BLUE_SHIFT		11
-
-#define BGR565(r, g, b) ((((b) >> 3) << FI16_565_BLUE_SHIFT) | (((g) >> 3) << FI16_565_GREEN_SHIFT) | (((r) >> 3) << FI16_565_RED_SHIFT))
-
-#define FI16_R565_RED_MASK		0xF800
-#define FI16_R565_GREEN_MASK	0x07E0
-#define FI16_R565_BLUE_MASK		0x001F
-#define FI16_R565_RED_SHIFT		11
-#define FI16_R565_GREEN_SHIFT	6
-#define FI16_R565_BLUE_SHIFT	0
-
-#define RGB565(r, g, b) ((((b) >> 3) << FI16_R565_BLUE_SHIFT) | (((g) >> 3) << FI16_R565_GREEN_SHIFT) | (((r) >> 3) << FI16_R565_RED_SHIFT))
-
-
-#define RGBFROMBE555(v) (unsigned short int)( (((unsigned short int)v & 0x7C00) >> 10) | (((unsigned short int)v & 0x3E0) << 1) | (((unsigned short int)v & 0x1F) << 11) )
-
-
-//=======================================================
-// max
-//=======================================================
-
-unsigned char max(unsigned char a, unsigned char b)
-{
-	if (a > b) return a;
-	return b;
-}
-
 //=======================================================
 // Parm
 //=======================================================
 
-enum OutputWidth
-{
-	OutputWidth1Bit,
-	OutputWidth8Bit,
-	OutputWidth16Bit,
-	OutputWidth4Bit,
-	OutputWidth3x4Bit
-
-};
-
 struct ALPHA2DSPARMS
 {
 	bool optQuiet;
 	bool optHelp;
-	bool optAlphaExternal;
 	bool optAlphaInternal;
-	bool optDebug;
-	bool optRLE;
-	bool optTile;
-	bool optAlphaTransparent;
-	bool optNoHeader;
-	bool optWidthmap;
-	bool optBGR565;
-	bool optRGB565;
-	unsigned short int TileSize;
-	OutputWidth OutputWidth;
+	bool optWatch;
+	bool optRecursive;
+	bool optFixedPalette;
+	bool optGlobalPalette;
+	unsigned int Workers;
+	bool optBatchIO;
+	CONVERTOPTIONS Options;
+	int EmitMode;
 	char ExtensionImage[MAX_PATH];
 	char ExtensionAlpha[MAX_PATH];
 	char Palettepath[MAX_PATH];
 	char Filefilter[MAX_PATH];
+	char Archivepath[MAX_PATH];
+	char Manifestpath[MAX_PATH];
 
 } Parm;
 
+ARCHIVE Archive;
+
+// stdout in pipeline mode (-f -), -1 otherwise
+int PipeOutput = -1;
+
+// queue of loose outputs with -u, NULL otherwise
+FILEIO * Writer = NULL;
+
+// palettes shared by several images, by file name
+struct PALETTE
+{
+	unsigned short entries[256];
+	bool loaded;					// read from its file
+	std::vector<unsigned char> map;	// -F, nearest entry per RGB555 color
+};
+
+std::map<std::string, PALETTE> SharedPalettes;
+
+// -G, chosen from all images of the run before they are converted
+PALETTE GlobalPalette;
+
+/** State of one image on its way through the stages
+*/
+struct JOB
+{
+	CONVERTOPTIONS options;		// with the overrides of the entry
+	char sourcefile_name[MAX_PATH];
+	char imagefile_name[MAX_PATH];
+	char alphafile_name[MAX_PATH];
+	char palettefile_name[MAX_PATH];
+	char widthfile_name[MAX_PATH];
+	char heightfile_name[MAX_PATH];
+	char bankfile_name[MAX_PATH];
+	unsigned short own_palette[256];
+	unsigned short * palette;	// own_palette or a shared one
+	bool global_palette;		// -G, the palette is written once for the run
+	std::vector<unsigned int> histogram;	// -G, colors of the image in the counting pass, empty if not counted
+	FIBITMAP * dib;
+	FIBITMAP * dib32;			// NULL if the image is not converted
+	CONVERTIMAGE image;
+	CONVERTRESULT result;
+	bool converted;				// result holds the outputs
+	int exitcode;
+	bool buffered;				// messages are kept in log until the write stage
+	std::string log;
+};
+
+//=======================================================
+// TracePrint
+//=======================================================
+/** Trace of the library (-v), printed to stdout as it comes: verbose
+	mode converts without the pipeline
+*/
+void TracePrint(void * context, const char * format, ...)
+{
+	va_list args;
+
+	(void)context;
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+}
+
 //=======================================================
 // parminit
 //=======================================================
@@ -238,22 +519,21 @@ void parminit()
 {
 	Parm.optHelp = 0;
 	Parm.optQuiet = 0;
-	Parm.optAlphaExternal = 0;
 	Parm.optAlphaInternal = 0;
-	Parm.optDebug = 0;
-	Parm.optRLE = 0;
-	Parm.optTile = 0;
-	Parm.optNoHeader = false;
-	Parm.optBGR565 = false;
-	Parm.TileSize = 8;
-	Parm.OutputWidth = OutputWidth16Bit;
-	Parm.optAlphaTransparent = 0;
-	Parm.optWidthmap = false;
-	Parm.optRGB565 = false;
+	Parm.optWatch = false;
+	Parm.optRecursive = false;
+	Parm.optFixedPalette = false;
+	Parm.optGlobalPalette = false;
+	Parm.Workers = 1;
+	Parm.optBatchIO = false;
+	ConvertDefaults(&Parm.Options);
+	Parm.EmitMode = EMIT_NONE;
 	strcpy(Parm.ExtensionImage,"bin");
 	strcpy(Parm.ExtensionAlpha,"bin");
 	strcpy(Parm.Filefilter,"*.png");
 	strcpy(Parm.Palettepath ,"");
+	strcpy(Parm.Archivepath ,"");
+	strcpy(Parm.Manifestpath ,"");
 }
 //=======================================================
 // showsyntax
@@ -265,25 +545,46 @@ void showsyntax ( void )
 	printf(FreeImage_GetCopyrightMessage());
 	printf("\n");
 	printf("Basic Compression Library 1.20\n\n");
-	printf("Usage:   alpha2ds [-f filter (default: *.png)]\n");
+	printf("Usage:   alpha2ds [-f filter (default: *.png), - to convert stdin to stdout]\n");
 	printf("                  [-e extension for image file (default: .bin)]\n");
 	printf("                  [-g extension for alpha file (default: .bin)]\n");
 	printf("                  [-p palette file for import/export]\n");
+	printf("                  [-m manifest file listing the images and their options]\n");
+	printf("                  [-o archive file for all outputs]\n");
+	printf("                  [-l payload alignment in archive, -x header and -s output (default: 4)]\n");
+	printf("                  [-s c|elf write C source or ELF object instead of .bin]\n");
+	printf("                  [-j number of convert threads (default: 1)]\n");
 	printf("                  [options]\n\n"); 
 	printf("Options: -a   output separate alpha files\n");
+	printf("         -A   bits per pixel of alpha files: 8, 4 or 2 (default: 8)\n");
+	printf("         -S   write alpha files as transparent, opaque and partial spans\n");
 //	printf("         -i   embed alpha information\n");
 	printf("         -r   compress output by RLE\n");
+	printf("         -k   compress output by RLE with literal runs (PackBits style)\n");
 	printf("         -1   make 1 bit file using alpha value\n");
 	printf("         -8   make 8 bit file and optimal palette (cut after 256 colors)\n");
-	printf("         -4   make 4 bit greyscale file\n");
+	printf("         -Q   reduce colors of 8 bit file by median cut instead of cutting,\n");
+	printf("              16 color 4 bit file instead of greyscale\n");
+	printf("         -G   one palette file (-p) for all 8 bit files, chosen from all images\n");
+	printf("         -B   4 bit tiles with this number of 16 color palette banks (1-16, -8 -t)\n");
+	printf("         -F   map colors to the nearest entry of the palette file (-p, -8)\n");
+	printf("         -4   make 4 bit greyscale file (16 colors with -Q)\n");
 	printf("         -5   make RGB444 packed file without transparency\n");
 	printf("         -6   make BGR565 file without transparency \n");
 	printf("         -7   make RGB565 file without transparency \n");
+	printf("         -O   make file of this format: rgb332, argb4444, argb1555\n");
+	printf("         -M   premultiply colors by alpha\n");
+	printf("         -I   interleave RGB565 and alpha: 24 (8 bit alpha) or 20 (4 bit alpha)\n");
 	printf("         -t   make tiles (default: off)\n");
 	printf("         -d   tilesize (must be even, default: 8)\n");
 	printf("         -c   alpha pixels fully transparent\n");
 	printf("         -w   write width file for tiles (requires -t)\n");
 	printf("         -n   no header output\n");
+	printf("         -x   write version 2 header (32 bit dimensions, codec, format)\n");
+	printf("         -b   write header and 16 bit data big-endian\n");
+	printf("         -u   read and write files in batches (io_uring on Linux)\n");
+	printf("         -R   convert images in subdirectories as well\n");
+	printf("         -W   keep running and convert changed files again (watch mode)\n");
 	printf("         -q   quiet operation\n");
 	printf("         -v   print verbose information\n");
 	printf("         -h   print this\n\n");
@@ -296,14 +597,15 @@ void showsyntax ( void )
 //=======================================================
 // check2args
 //=======================================================
-int check2args(int argc, int i, char *next, char *message)
+int check2args(int argc, int i, char *next, const char *message)
 {
 	if (argc == (i + 1)){
 		if (!Parm.optQuiet) printf("%s\n",message);
 		return(0);
 	}
 	else {
-	 if ( next[0] == '-' ) {
+	 // a lone "-" is a value (stdin), not an option
+	 if ( (next[0] == '-') && (next[1] != '\0') ) {
 			if (!Parm.optQuiet) printf("%s\n",message);
 			return(0);
 	}
@@ -357,59 +659,175 @@ int processcmdline (int argc, char *argv[])
 		 } else result = 0;
 		 break;
 
+	  case 'm':
+		  if (check2args(argc, i, argv[i+1], "-m must be followed by a valid file path")) {
+				if (strlen(argv[i+1]) < MAX_PATH) strcpy(Parm.Manifestpath,argv[i+1]);
+				else {
+					if (!Parm.optQuiet) printf("-m path is too long\n");
+					result = 0;
+				}
+				i++;
+		 } else result = 0;
+		 break;
+
+	  case 'o':
+		  if (check2args(argc, i, argv[i+1], "-o must be followed by a valid file path")) {
+				if (strlen(argv[i+1]) < MAX_PATH) strcpy(Parm.Archivepath,argv[i+1]);
+				else {
+					if (!Parm.optQuiet) printf("-o path is too long\n");
+					result = 0;
+				}
+				i++;
+		 } else result = 0;
+		 break;
+
+	  case 'l':
+		  if (check2args(argc, i, argv[i+1], "-l must be followed by a power of two (e.g. 4, 32, 512)")) {
+				Parm.Options.Alignment = atoi(argv[i+1]);
+				i++;
+		 } else result = 0;
+		 break;
+
+	  case 's':
+		  if (check2args(argc, i, argv[i+1], "-s must be followed by c or elf")) {
+				if (!strcmp(argv[i+1],"c")) Parm.EmitMode = EMIT_C;
+				else if (!strcmp(argv[i+1],"elf")) Parm.EmitMode = EMIT_ELF;
+				else {
+					if (!Parm.optQuiet) printf("-s must be followed by c or elf\n");
+					result = 0;
+				}
+				i++;
+		 } else result = 0;
+		 break;
+
+	  case 'j':
+		  if (check2args(argc, i, argv[i+1], "-j must be followed by the number of convert threads")) {
+				Parm.Workers = atoi(argv[i+1]);
+				if (Parm.Workers < 1) Parm.Workers = 1;
+				i++;
+		 } else result = 0;
+		 break;
+
+	  case 'B':
+		  if (check2args(argc, i, argv[i+1], "-B must be followed by the number of palette banks (1-16)")) {
+				Parm.Options.TileBanks = atoi(argv[i+1]);
+				if (Parm.Options.TileBanks < 1) Parm.Options.TileBanks = 1;
+				if (Parm.Options.TileBanks > TILEBANK_MAX) Parm.Options.TileBanks = TILEBANK_MAX;
+				i++;
+		 } else result = 0;
+		 break;
+
+	  case 'M':
+		 Parm.Options.optPremultiply = true;
+		 break;
+
+	  case 'S':
+		 Parm.Options.optAlphaSpans = true;
+		 break;
+
+	  case 'I':
+		  if (check2args(argc, i, argv[i+1], "-I must be followed by the bits per pixel of interleaved files (24 or 20)")) {
+				unsigned int bits = atoi(argv[i+1]);
+				if ((bits == 24) || (bits == 20)) Parm.Options.Interleave = bits;
+				else {
+					if (!Parm.optQuiet) printf("invalid interleave bits %s\n",argv[i+1]);
+					result = 0;
+				}
+				i++;
+		 } else result = 0;
+		 break;
+
+	  case 'A':
+		  if (check2args(argc, i, argv[i+1], "-A must be followed by the bits per pixel of alpha files (8, 4 or 2)")) {
+				unsigned int bits = atoi(argv[i+1]);
+				if ((bits == 8) || (bits == 4) || (bits == 2)) Parm.Options.AlphaBits = bits;
+				else {
+					if (!Parm.optQuiet) printf("invalid alpha bits %s\n",argv[i+1]);
+					result = 0;
+				}
+				i++;
+		 } else result = 0;
+		 break;
+
+	  case 'O':
+		  if (check2args(argc, i, argv[i+1], "-O must be followed by rgb332, argb4444 or argb1555")) {
+				const PIXELFORMAT * format = PixelFormatFind(argv[i+1]);
+				if (format) Parm.Options.DirectFormat = format->format;
+				else {
+					if (!Parm.optQuiet) printf("invalid format %s\n",argv[i+1]);
+					result = 0;
+				}
+				i++;
+		 } else result = 0;
+		 break;
+
 	  case 'd':
 		  if (check2args(argc, i, argv[i+1], "-d must be followed by an even integer number <= 64")) {
-				Parm.TileSize = atoi(argv[i+1]);
+				int tilesize = atoi(argv[i+1]);
+				if ( (tilesize < 2) || (tilesize > 64) || (tilesize & 1) ) {
+					if (!Parm.optQuiet) printf("-d must be followed by an even integer number <= 64\n");
+					result = 0;
+				}
+				else Parm.Options.TileSize = (unsigned short int)tilesize;
 				i++;
 		 } else result = 0;
 		 break;
 
 	  case 'c': 
-		  Parm.optAlphaTransparent = 1;
+		  Parm.Options.optAlphaTransparent = 1;
 		 break;
 
 	  case 't': 
-		  Parm.optTile = 1;
+		  Parm.Options.optTile = 1;
 		 break;
 
 	  case '8': 
-		 Parm.OutputWidth = OutputWidth8Bit;
+		 Parm.Options.OutputWidth = OutputWidth8Bit;
 		 break;
 
 	  case '1': 
-		 Parm.OutputWidth = OutputWidth1Bit;
+		 Parm.Options.OutputWidth = OutputWidth1Bit;
 		 break;
 
 	  case '4': 
-		 Parm.OutputWidth = OutputWidth4Bit;
+		 Parm.Options.OutputWidth = OutputWidth4Bit;
 		 break;
 
 	  case '5': 
-		 Parm.OutputWidth = OutputWidth3x4Bit;
+		 Parm.Options.OutputWidth = OutputWidth3x4Bit;
 		 break;
 
 	  case '6': 
-		 Parm.optBGR565 = true;
+		 Parm.Options.optBGR565 = true;
 		 break;		 
 
 	  case '7': 
-		  Parm.optRGB565 = true;
+		  Parm.Options.optRGB565 = true;
 		 break;		 
 
 	  case 'w': 
-		  Parm.optWidthmap = 1;
+		  Parm.Options.optWidthmap = 1;
 		 break;
 
 	  case 'v': 
-		 Parm.optDebug  = 1;
+		 Parm.Options.optDebug  = 1;
+		 Parm.Options.Trace = TracePrint;
 		 break;
 
 	  case 'a': 
-		 Parm.optAlphaExternal = 1;
+		 Parm.Options.optAlphaExternal = 1;
 		 break;
 
 	  case 'n': 
-		 Parm.optNoHeader = true;
+		 Parm.Options.optNoHeader = true;
+		 break;
+
+	  case 'x': 
+		 Parm.Options.optHeaderV2 = true;
+		 break;
+
+	  case 'b': 
+		 Parm.Options.optBigEndian = true;
 		 break;
 
 	  case 'i': 
@@ -417,13 +835,42 @@ int processcmdline (int argc, char *argv[])
 		 break;
 
 	  case 'r': 
-		 Parm.optRLE = 1;
+		 Parm.Options.optRLE = 1;
+		 break;
+
+	  case 'k': 
+		 Parm.Options.optRLE = 1;
+		 Parm.Options.optPackBits = true;
 		 break;
 
 	  case 'h': 
 		 Parm.optHelp = 1;
 		 break;
 
+	  case 'W': 
+		 Parm.optWatch = true;
+		 break;
+
+	  case 'R': 
+		 Parm.optRecursive = true;
+		 break;
+
+	  case 'F': 
+		 Parm.optFixedPalette = true;
+		 break;
+
+	  case 'Q': 
+		 Parm.Options.optQuantize = true;
+		 break;
+
+	  case 'G': 
+		 Parm.optGlobalPalette = true;
+		 break;
+
+	  case 'u': 
+		 Parm.optBatchIO = true;
+		 break;
+
 	  default:
 	 	 if (!Parm.optQuiet) printf("invalid argument %s\n",argv[i]);
 		 result = 0;
@@ -436,32 +883,38 @@ int processcmdline (int argc, char *argv[])
 
 
 //=======================================================
-// GenericLoader
+// StdinLoader
 //=======================================================
-/** Generic image loader
-	@param lpszPathName Pointer to the full file name
+/** Image loader reading the whole file image from stdin
 	@param flag Optional load flag constant
 	@return Returns the loaded dib if successful, returns NULL otherwise
 */
-FIBITMAP* GenericLoader(const char* lpszPathName, int flag) {
-	FREE_IMAGE_FORMAT fif = FIF_UNKNOWN;
+FIBITMAP* StdinLoader(int flag) {
+	BYTE *data = NULL;
+	DWORD size = 0;
+	DWORD capacity = 0;
 
-	// check the file signature and deduce its format
-	// (the second argument is currently not used by FreeImage)
-	fif = FreeImage_GetFileType(lpszPathName, 0);
-	if(fif == FIF_UNKNOWN) {
-		// no signature ?
-		// try to guess the file format from the file extension
-		fif = FreeImage_GetFIFFromFilename(lpszPathName);
-	}
-	// check that the plugin has reading capabilities ...
-	if((fif != FIF_UNKNOWN) && FreeImage_FIFSupportsReading(fif)) {
-		// ok, let's load the file
-		FIBITMAP *dib = FreeImage_Load(fif, lpszPathName, flag);
-		// unless a bad file format, we are done !
-		return dib;
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+#endif
+	for (;;) {
+		if (size == capacity) {
+			capacity = capacity ? capacity * 2 : 65536;
+			BYTE *grown = (BYTE *)realloc(data, capacity);
+			if (!grown) {
+				free(data);
+				return NULL;
+			}
+			data = grown;
+		}
+		size_t count = fread(data + size, 1, capacity - size, stdin);
+		if (count == 0) break;
+		size += (DWORD)count;
 	}
-	return NULL;
+
+	FIBITMAP *dib = size ? GenericLoaderMemory(data, size, flag) : NULL;
+	free(data);
+	return dib;
 }
 
 //=======================================================
@@ -522,623 +975,994 @@ bool WriteBufferToFile(void * buffer, int size, int count,const char filename[])
 	return true;
 }
 
-#define CONFIG_UNCOMPRESSED (0)
-#define CONFIG_COMPRESSED	(1)
-#define CONFIG_16BIT		(0)
-#define CONFIG_8BIT			(1 << 1)
+//=======================================================
+// WriteDestination
+//=======================================================
+/** Write a loose output to its file, or to stdout in pipeline mode. With
+	-u the output is queued and written with the next group.
+*/
+bool WriteDestination(const char * filename, const void * header, unsigned int headersize, const void * data, unsigned int size)
+{
+	if (PipeOutput >= 0) return OutFileWriteTo(PipeOutput, header, headersize, data, size);
+
+	if (Writer) {
+		if (FileIOQueueWrite(Writer, filename, header, headersize, data, size)) return true;
+		if (!Parm.optQuiet) printf("Error writing %s\n",FileIOFailed(Writer));
+		return false;
+	}
+
+	return OutFileWrite(filename, header, headersize, data, size);
+}
 
 //=======================================================
-// main
+// WriteOutput
 //=======================================================
-int 
-main(int argc, char *argv[]) {
+/** Write one output, either as a file or as an entry of the archive
+	@param options Options of the image
+	@param filename Name of the output file, used as entry name in the archive
+	@param output Output of the conversion
+	@return Returns true if successful
+*/
+bool WriteOutput(const CONVERTOPTIONS * options, const char * filename, const CONVERTOUTPUT * output)
+{
+	CONVERTFILE file;
+	bool loose = !Archive.open && (Parm.EmitMode == EMIT_NONE);
+	bool result;
 
-	char sourcefile_name[MAX_PATH];
-	char base_name[MAX_PATH];
-	char imagefile_name[MAX_PATH];
-	char alphafile_name[MAX_PATH];
-	char image_path[MAX_PATH];
-	unsigned short palette[256];
-	char palettefile_name[MAX_PATH];
-	char widthfile_name[MAX_PATH];
-	char heightfile_name[MAX_PATH];
+	if (ConvertSerialize(options, output, loose, &file) != CONVERT_OK) return false;
 
+	if (Archive.open)
+	{
+		unsigned short codec = ARCHIVE_CODEC_RAW;
+		if (output->config & CONFIG_COMPRESSED) codec = (output->config & CONFIG_PACKBITS) ? ARCHIVE_CODEC_PACKBITS : ARCHIVE_CODEC_RLE;
+		result = ArchiveAdd(&Archive, filename, file.data, file.size, codec, output->format, output->width, output->height, output->config);
+	}
+	else if (Parm.EmitMode != EMIT_NONE)
+	{
+		EMITINFO info;
+
+		info.size = file.size;
+		info.width = output->width;
+		info.height = output->height;
+		info.config = output->config;
+		info.format = output->format;
+		result = EmitOutput(Parm.EmitMode, filename, file.data, &info, options->Alignment, options->optBigEndian);
+	}
+	else
+	{
+		result = WriteDestination(filename, file.header, file.headersize, file.data, file.size);
+	}
 
+	ConvertFreeFile(&file);
+	return result;
+}
 
-	parminit();
-	processcmdline(argc, argv);
+//=======================================================
+// DecodeImage
+//=======================================================
+/** Decode image data with the RLE decoder matching the options
+	@param options Options the data was encoded with
+	@param compressed Compressed data as produced by the selected encoder
+	@param outsize Number of symbols in compressed
+	@param decompressed Buffer for the uncompressed data
+	@param capacity Number of symbols that fit into decompressed
+	@param decoded Receives the number of symbols decoded
+	@return Returns RLE_OK or one of the RLE_ERROR codes
+*/
+int DecodeImage(const CONVERTOPTIONS * options, void * compressed, unsigned int outsize, void * decompressed, unsigned int capacity, unsigned int * decoded)
+{
+	bool wide = (options->OutputWidth == OutputWidth3x4Bit) || ConvertFormatWordSized(ConvertImageFormat(options));
 
-	if (Parm.optHelp) {
-		showsyntax();
-		return 0;
+	if (options->optPackBits) {
+		if (wide) return RLE_DecodePB16((unsigned short int *)compressed,outsize,(unsigned short int *)decompressed,capacity,decoded);
+		return RLE_DecodePB8((unsigned char *)compressed,outsize,(unsigned char *)decompressed,capacity,decoded);
 	}
+	if (wide) return RLE_Decode16((unsigned short int *)compressed,outsize,(unsigned short int *)decompressed,capacity,decoded);
+	return RLE_Decode8((unsigned char *)compressed,outsize,(unsigned char *)decompressed,capacity,decoded);
+}
 
+//=======================================================
+// DecodeSpeed
+//=======================================================
+/** Measure decoder throughput for verbose mode
+	@param options Options the data was encoded with
+	@param compressed Compressed data as produced by the selected encoder
+	@param outsize Number of symbols in compressed
+	@param decompressed Buffer for the uncompressed data
+	@param capacity Number of symbols that fit into decompressed
+	@param uncompressed_size Size of the uncompressed data in bytes
+	@return Returns the decode speed in MB/s
+*/
+double DecodeSpeed(const CONVERTOPTIONS * options, void * compressed, unsigned int outsize, void * decompressed, unsigned int capacity, unsigned int uncompressed_size)
+{
+	clock_t start = clock();
+	clock_t elapsed;
+	unsigned int rounds = 0;
+	unsigned int decoded;
+
+	// repeat until the measurement is long enough for clock() resolution
+	do {
+		DecodeImage(options,compressed,outsize,decompressed,capacity,&decoded);
+		rounds++;
+		elapsed = clock() - start;
+	} while (elapsed < CLOCKS_PER_SEC / 10);
+
+	return ((double)uncompressed_size * rounds / (1024.0 * 1024.0)) / ((double)elapsed / CLOCKS_PER_SEC);
+}
 
-	const char *input_dir = ".\\";
-	FIBITMAP *dib = NULL;
-	int id = 1;
+//=======================================================
+// SharedPalette
+//=======================================================
+/** Palette shared by several images (-p, palette= of the manifest),
+	loaded from its file on first use and extended by each image
+	@param filename Name of the palette file
+	@param bigendian The file was written with -b
+	@return Returns the palette
+*/
+PALETTE * SharedPalette(const char * filename, bool bigendian)
+{
+	std::map<std::string, PALETTE>::iterator shared = SharedPalettes.find(filename);
 
-	// call this ONLY when linking with FreeImage as a static library
-#ifdef FREEIMAGE_LIB
-	FreeImage_Initialise();
-#endif // FREEIMAGE_LIB
+	if (shared == SharedPalettes.end())
+	{
+		FILE * oldpalettefile;
+
+		shared = SharedPalettes.insert(std::make_pair(std::string(filename), PALETTE())).first;
+		for (int i = 0; i < 256; i++) shared->second.entries[i] = 0;
+		shared->second.loaded = false;
+
+		oldpalettefile = fopen(filename,"rb");
+		if (oldpalettefile)	{
+			shared->second.loaded = true;
+			fread(shared->second.entries,2,256,oldpalettefile);
+			fclose(oldpalettefile);
+			if (bigendian != HostBigEndian()) SwapBytes16(shared->second.entries,shared->second.entries,256);
+		}
+	}
 
-	// initialize your own FreeImage error handler
-	FreeImage_SetOutputMessage(FreeImageErrorHandler);
+	return &shared->second;
+}
 
-	// batch convert all supported bitmaps
-	_finddata_t finddata;
-	intptr_t handle;
-
-
-	// scan all files
-	strcpy(image_path, input_dir);
-	strcat(image_path, Parm.Filefilter);
-
-
-	if ((handle = _findfirst(image_path, &finddata)) != -1) {
-		do {
-			
-
-			strcpy(sourcefile_name, input_dir);
-			strcat(sourcefile_name, finddata.name);
-
-			strcpy(base_name, finddata.name);
-			if (strcspn(base_name,".") != strlen(base_name)) base_name[strcspn(base_name,".")] = '\0';
-
-			strcpy(imagefile_name, base_name);
-			strcat(imagefile_name, ".");
-			if (Parm.optRLE) strcat(imagefile_name, "rle.");
-			strcat(imagefile_name, Parm.ExtensionImage);
-
-			for (int i = 0; i < 256; i++) palette[i] = 0;
-
-			if (Parm.OutputWidth == OutputWidth8Bit)
-			{
-				if (*Parm.Palettepath)
-				{
-					FILE * oldpalettefile;
-					oldpalettefile = fopen(Parm.Palettepath,"rb");
-					if (oldpalettefile)	{
-						fread(&palette,2,256,oldpalettefile);
-						fclose(oldpalettefile);
-					}
-					strcpy(palettefile_name,Parm.Palettepath);
-				} else {
-					strcpy(palettefile_name, base_name);
-					strcat(palettefile_name, ".pal.bin");
-				}
-			}
+//=======================================================
+// FixedPalette
+//=======================================================
+/** Shared palette that is not extended (-F), with the table mapping
+	each color to its nearest entry. The table is read from the cache
+	next to the palette file, or built and cached if that is missing or
+	was built from a different palette.
+	@param filename Name of the palette file
+	@param bigendian The file was written with -b
+	@return Returns the palette, NULL if the file cannot be read
+*/
+PALETTE * FixedPalette(const char * filename, bool bigendian)
+{
+	PALETTE * palette = SharedPalette(filename, bigendian);
 
-			if (Parm.optWidthmap && Parm.optTile)
-			{
-				strcpy(widthfile_name, base_name);
-				strcat(widthfile_name, ".width.bin");
-				strcpy(heightfile_name, base_name);
-				strcat(heightfile_name, ".height.bin");
-			}
+	if (!palette->loaded) return NULL;
+
+	if (palette->map.empty())
+	{
+		std::string cachename = std::string(filename) + ".lut";
+		// entries are in the format the palette is written in (-6, -7)
+		const PIXELFORMAT * format = PixelFormatGet(ConvertPaletteFormat(&Parm.Options));
+
+		palette->map.resize(PALMAP_COLORS);
+		if (!PalMapLoad(cachename.c_str(), palette->entries, format, &palette->map[0]))
+		{
+			PalMapBuild(palette->entries, format, &palette->map[0]);
+
+			// without a cache the table is built again on the next run
+			if (!PalMapSave(cachename.c_str(), palette->entries, format, &palette->map[0]) && Parm.Options.optDebug)
+				printf("Warning: cannot write palette map %s\n",cachename.c_str());
+		}
+	}
+
+	return palette;
+}
 
+//=======================================================
+// JobPrint
+//=======================================================
+/** Print a message of a job, or keep it for the write stage if the job
+	runs in the pipeline
+*/
+void JobPrint(JOB * job, const char * format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	if (job->buffered) {
+		char message[2 * MAX_PATH + 128];
+		vsnprintf(message, sizeof(message), format, args);
+		message[sizeof(message) - 1] = '\0';
+		job->log += message;
+	} else {
+		vprintf(format, args);
+	}
+	va_end(args);
+}
 
-			if (Parm.optAlphaExternal) {
-				strcpy(alphafile_name, "alpha");
-				strcat(alphafile_name, base_name);
-				if (Parm.optRLE) strcat(alphafile_name, ".rle");
-				strcat(alphafile_name, ".");
-				strcat(alphafile_name, Parm.ExtensionAlpha);
+//=======================================================
+// LoadStage
+//=======================================================
+/** First stage: derive the output names and load the image
+	@param job Job to fill in, dib32 is NULL if the image is skipped
+	@param input_dir Prefix of the directory of the image, with trailing separator
+	@param entry Image and its overrides, "stdin" in pipeline mode
+	@param from_stdin Read the image from stdin instead of the file
+	@param read File contents read in advance (-u), NULL to load the file
+*/
+void LoadStage(JOB * job, const char * input_dir, const SCANENTRY * entry, bool from_stdin, const FILEIOREAD * read)
+{
+	char base_name[MAX_PATH];
+
+	job->dib = NULL;
+	job->dib32 = NULL;
+	job->converted = false;
+	job->exitcode = 0;
+	job->global_palette = false;
+	job->log.clear();
+
+	if (strlen(input_dir) + entry->directory.size() + entry->name.size() + 16 > MAX_PATH) {
+		if (!Parm.optQuiet) JobPrint(job, "Error: path of %s%s too long\n",entry->directory.c_str(),entry->name.c_str());
+		return;
+	}
+
+	job->options = Parm.Options;
+	ScanApply(entry, &job->options);
+
+	// a palette file of the manifest entry replaces the one of -p
+	const char * palette_path = entry->palette.empty() ? Parm.Palettepath : entry->palette.c_str();
+	bool shared_palette = (job->options.OutputWidth == OutputWidth8Bit) && !ConvertTileBanked(&job->options) && *palette_path;
+
+	if (from_stdin) {
+		strcpy(job->sourcefile_name, entry->name.c_str());
+	} else {
+		strcpy(job->sourcefile_name, input_dir);
+		strcat(job->sourcefile_name, entry->directory.c_str());
+		strcat(job->sourcefile_name, entry->name.c_str());
+	}
+
+	strcpy(base_name, entry->name.c_str());
+	if (strcspn(base_name,".") != strlen(base_name)) base_name[strcspn(base_name,".")] = '\0';
+
+	strcpy(job->imagefile_name, entry->directory.c_str());
+	strcat(job->imagefile_name, base_name);
+	strcat(job->imagefile_name, ".");
+	if (job->options.optRLE) strcat(job->imagefile_name, "rle.");
+	strcat(job->imagefile_name, Parm.ExtensionImage);
+
+	// a shared palette is carried over from image to image, it is looked
+	// up by the convert stage, which runs in list order then. A fixed
+	// palette (-F) is only read and looked up here, images mapped onto it
+	// are converted in parallel, as are those using the palette of -G.
+	job->palette = NULL;
+	if (shared_palette) {
+		strcpy(job->palettefile_name,palette_path);
+
+		if (Parm.optGlobalPalette && entry->palette.empty()) {
+			job->global_palette = true;
+			job->palette = GlobalPalette.entries;
+			job->options.PaletteMap = GlobalPalette.map.empty() ? NULL : &GlobalPalette.map[0];
+		} else if (Parm.optFixedPalette) {
+			PALETTE * fixed = FixedPalette(palette_path, job->options.optBigEndian);
+			if (!fixed) {
+				if (!Parm.optQuiet) JobPrint(job, "Error reading palette file %s\n",palette_path);
+				job->exitcode = 3;
+				return;
 			}
+			job->palette = fixed->entries;
+			job->options.PaletteMap = &fixed->map[0];
+		}
+	} else {
+		for (int i = 0; i < 256; i++) job->own_palette[i] = 0;
+		job->palette = job->own_palette;
+		strcpy(job->palettefile_name, entry->directory.c_str());
+		strcat(job->palettefile_name, base_name);
+		strcat(job->palettefile_name, ".pal.bin");
+	}
 
-			// open and load the file using the default load option
-			dib = GenericLoader(sourcefile_name, 0);
+	if (job->options.optWidthmap && job->options.optTile)
+	{
+		strcpy(job->widthfile_name, entry->directory.c_str());
+		strcat(job->widthfile_name, base_name);
+		strcat(job->widthfile_name, ".width.bin");
+		strcpy(job->heightfile_name, entry->directory.c_str());
+		strcat(job->heightfile_name, base_name);
+		strcat(job->heightfile_name, ".height.bin");
+	}
 
-			if (dib != NULL) {
+	if (ConvertTileBanked(&job->options))
+	{
+		strcpy(job->bankfile_name, entry->directory.c_str());
+		strcat(job->bankfile_name, base_name);
+		strcat(job->bankfile_name, ".bank.bin");
+	}
 
-				/********************************************************************************/
-				/* Init handling of single image                                                */
-				/********************************************************************************/
-				FILE *imagefile = 0;
-				FILE *alphafile = 0;
-				FILE *palettefile = 0;
-				FILE *widthfile = 0;
-				FILE *heightfile = 0;
 
-				int bytespp = FreeImage_GetLine(dib) / FreeImage_GetWidth(dib);
+	if (job->options.optAlphaExternal) {
+		strcpy(job->alphafile_name, entry->directory.c_str());
+		strcat(job->alphafile_name, "alpha");
+		strcat(job->alphafile_name, base_name);
+		if (job->options.optRLE) strcat(job->alphafile_name, ".rle");
+		strcat(job->alphafile_name, ".");
+		strcat(job->alphafile_name, Parm.ExtensionAlpha);
+	}
 
-				unsigned int x = FreeImage_GetWidth(dib);
-				unsigned int y = FreeImage_GetHeight(dib);
-				unsigned int pixel_count = x*y;
-				unsigned int config = 0;
+	// open and load the file using the default load option
+	if (from_stdin) job->dib = StdinLoader(0);
+	else if (!read) job->dib = GenericLoader(job->sourcefile_name, 0);
+	else if (read->ok) {
+		// formats without a signature are only known by their extension
+		job->dib = GenericLoaderMemory((BYTE *)read->data, read->size, 0);
+		if (!job->dib) job->dib = GenericLoader(job->sourcefile_name, 0);
+	}
+
+	if (job->dib == NULL) {
+		if (!Parm.optQuiet) JobPrint(job, "Error loading %s\n",job->sourcefile_name);
+		return;
+	}
 
-				unsigned short int * image_buffer16;
-				unsigned char * image_buffer8;
-				unsigned short * image_buffer4;
-				unsigned char * image_buffer1;
-				unsigned char * alpha_buffer;
-				unsigned char * tile_width_buffer;
-				unsigned char * tile_height_buffer;
-				unsigned char * image_buffer_4bitpacked;
+	/********************************************************************************/
+	/* Init handling of single image                                                */
+	/********************************************************************************/
+	job->dib32 = LoaderImage(job->dib, &job->image);
 
-				unsigned int color_count = 0;
+	if (job->dib32 == NULL) {
+		if (!Parm.optQuiet) JobPrint(job, "Error converting %s to 32 bits per pixel\n",job->sourcefile_name);
+		FreeImage_Unload(job->dib);
+		return;
+	}
 
-				image_buffer16 = (unsigned short int *)malloc(pixel_count*2);
-				memset(image_buffer16,0,pixel_count * 2);
+	unsigned int x = job->image.width;
+	unsigned int y = job->image.height;
 
-				image_buffer8 = (unsigned char *)malloc(pixel_count);
-				memset(image_buffer8,0,pixel_count);
+	// the version 1 header stores the dimensions as 16-bit words
+	if (!job->options.optHeaderV2 && !job->options.optNoHeader && !Archive.open && (Parm.EmitMode == EMIT_NONE) && ((x > 0xFFFF) || (y > 0xFFFF)))
+	{
+		if (!Parm.optQuiet) JobPrint(job, "Error: %s is too large for the version 1 header (%u x %u), use -x\n",job->sourcefile_name,x,y);
+		if (job->dib32 != job->dib) FreeImage_Unload(job->dib32);
+		FreeImage_Unload(job->dib);
+		job->dib32 = NULL;
+	}
+}
 
-				image_buffer4 = (unsigned short *)malloc(pixel_count);
-				memset(image_buffer4,0,pixel_count);
+//=======================================================
+// ConvertStage
+//=======================================================
+/** Second stage: convert and compress a loaded image, the image is
+	unloaded afterwards
+	@param job Job filled in by LoadStage
+*/
+void ConvertStage(JOB * job)
+{
+	if (job->dib32 == NULL) return;
 
-				image_buffer1 = (unsigned char *)malloc(pixel_count/4);
-				memset(image_buffer1,0,pixel_count/4);
+	CONVERTOPTIONS & options = job->options;
+	unsigned int x = job->image.width;
+	unsigned int y = job->image.height;
+	unsigned int pixel_count = x*y;
 
-				alpha_buffer = (unsigned char *)malloc(pixel_count);
-				memset(alpha_buffer,0,pixel_count);
+	/********************************************************************************/
+	/* Provide image information for verbose mode                                   */
+	/********************************************************************************/
+	if (options.optDebug)
+	{
+		printf ("File %s Width %u Height %d\n",job->sourcefile_name,x,y);
+	}
 
-				tile_width_buffer = (unsigned char *)malloc( (x/Parm.TileSize) * (y/Parm.TileSize));
-				memset(tile_width_buffer, 0, (x/Parm.TileSize) * (y/Parm.TileSize));
+	/********************************************************************************/
+	/* Convert pixels and encode                                                    */
+	/********************************************************************************/
+	CONVERTPIXELS pixels;
+	CONVERTRESULT & result = job->result;
 
-				tile_height_buffer = (unsigned char *)malloc( (x/Parm.TileSize) * (y/Parm.TileSize));
-				memset(tile_height_buffer, 0, (x/Parm.TileSize) * (y/Parm.TileSize));
+	if (job->palette == NULL) job->palette = SharedPalette(job->palettefile_name, options.optBigEndian)->entries;
 
-				image_buffer_4bitpacked = (unsigned char *)malloc(pixel_count*2);
-				memset(image_buffer_4bitpacked,0,pixel_count * 2);
-				
-					
+	int error = ConvertPixels(&options, &job->image, job->palette, &pixels);
+	if (error == CONVERT_OK) {
+		error = ConvertEncode(&options, &pixels, job->palette, &result);
+		if (error != CONVERT_OK) ConvertFreePixels(&pixels);
+	}
 
-				unsigned int pos = 0;
+	if (job->dib32 != job->dib) FreeImage_Unload(job->dib32);
+	FreeImage_Unload(job->dib);
+	job->dib32 = NULL;
 
-				/********************************************************************************/
-				/* Provide image information for verbose mode                                   */
-				/********************************************************************************/
-				if (Parm.optDebug)
-				{
-					printf ("File %s Width %u Height %d\n",sourcefile_name,x,y);
-				}
+	if (error == CONVERT_ERROR_TILE) {
+		if (!Parm.optQuiet) JobPrint(job, "Error: invalid tile size %u converting %s\n",options.TileSize,job->sourcefile_name);
+		job->exitcode = 1;
+		return;
+	}
+	if (error != CONVERT_OK) {
+		if (!Parm.optQuiet) JobPrint(job, "Error: out of memory converting %s\n",job->sourcefile_name);
+		job->exitcode = 6;
+		return;
+	}
 
-				/********************************************************************************/
-				/* Walk through pixels and fill buffers                                         */
-				/********************************************************************************/
-				for(unsigned y_c = FreeImage_GetHeight(dib); y_c > 0 ; y_c--) // reverse order of lines
-				{ 
+	if (options.OutputWidth == OutputWidth8Bit) 
+	{
+		if (result.color_count > 255)
+		 if (!Parm.optQuiet) JobPrint(job, "Warning: Palette overflow, %u colors detected in %u pixels.\n",result.color_count,pixel_count);
+	}
 
-					BYTE *bits = FreeImage_GetScanLine(dib, y_c-1);
-					unsigned short int pixel;
-					for(unsigned x_c = 0; x_c < FreeImage_GetWidth(dib); x_c++) {
-						 printf("bpp %u  X %u Y %u  alpha %u  R %u G %u B %u\n",bytespp,x,y,bits[FI_RGBA_ALPHA],bits[FI_RGBA_RED],bits[FI_RGBA_GREEN],bits[FI_RGBA_BLUE]);
+	if (options.optRLE)
+	{
+		unsigned int outsize = result.image.count;
+
+		if (!Parm.optQuiet) JobPrint(job, "%s (Size %u) -> %s (Size %u)\n",job->sourcefile_name,pixel_count*2,job->imagefile_name,outsize);
+
+		//debug only
+		if (options.optDebug)
+		{
+			// For debugging, decompress data after compression and write the decompressed image
+			unsigned char * decompress_buffer;
+			decompress_buffer = (unsigned char *)malloc(pixel_count*2*257/256+1 + pixels.interleaved_size);
+			printf("WARNING: Output decompressed for debugging\n"); 
+			printf("pixel_count %u outsize %u\n",pixel_count,outsize);
+
+			// decode with bounds checking and compare against the source data
+			void * source_buffer = pixels.image16;
+			unsigned int symbols = pixel_count;
+			unsigned int symbol_size = 2;
+			unsigned int decoded = 0;
+
+			if (ConvertTileBanked(&options) || (options.OutputWidth == OutputWidth4Bit)) {
+				source_buffer = pixels.image4;
+				symbols = (pixel_count + 1)/2;
+				symbol_size = 1;
+			} else if (ConvertInterleaved(&options)) {
+				source_buffer = pixels.interleaved;
+				symbols = pixels.interleaved_size;
+				symbol_size = 1;
+			} else if ((options.OutputWidth == OutputWidth8Bit) || ((options.OutputWidth == OutputWidth16Bit) && !ConvertFormatWordSized(ConvertImageFormat(&options)))) {
+				source_buffer = pixels.image8;
+				symbol_size = 1;
+			} else if (options.OutputWidth == OutputWidth1Bit) {
+				source_buffer = pixels.image1;
+				symbols = pixel_count/8;
+				symbol_size = 1;
+			}
 
-						
-						image_buffer4[pos] = RGB444(bits[FI_RGBA_RED],bits[FI_RGBA_GREEN],bits[FI_RGBA_BLUE]);
-						
+			int result_code = DecodeImage(&options,result.image.data,outsize,decompress_buffer,symbols,&decoded);
+			if ( (result_code != RLE_OK) || (decoded != symbols) || memcmp(decompress_buffer,source_buffer,symbols*symbol_size) )
+				printf("Error: RLE check failed (result %d, %u of %u symbols decoded)\n",result_code,decoded,symbols);
+			else
+				printf("decode %.1f MB/s\n",DecodeSpeed(&options,result.image.data,outsize,decompress_buffer,symbols,symbols*symbol_size));
 
-						if (Parm.optBGR565) {
-							pixel = RGB555(bits[FI_RGBA_RED],bits[FI_RGBA_GREEN],bits[FI_RGBA_BLUE]);
-							pixel = RGBFROMBE555(pixel);
-						} else if (Parm.optRGB565) {
-							pixel = RGB565(bits[FI_RGBA_RED],bits[FI_RGBA_GREEN],bits[FI_RGBA_BLUE]);
-						} else {
-							pixel = RGB555(bits[FI_RGBA_RED],bits[FI_RGBA_GREEN],bits[FI_RGBA_BLUE]);
-						}
+			// the decompressed data replaces the image output
+			free(result.image.data);
+			result.image.data = decompress_buffer;
+			result.image.size = decoded*symbol_size;
+		}
+	} else {
+		if (!Parm.optQuiet) JobPrint(job, "%s -> %s (Size %u)\n",job->sourcefile_name,job->imagefile_name,pixel_count*2);
+	}
 
-						// 8-bit w/ palette
-						if ( (bits[FI_RGBA_ALPHA] == 0) || (Parm.optAlphaTransparent && bits[FI_RGBA_ALPHA] != 255) )
-							image_buffer8[pos] = 0; // fully transparent pixels always position 0
-						else {
+	ConvertFreePixels(&pixels);
 
-							if (pixel == 0) image_buffer8[pos] = 1; // color 0,0,0 always at position 1
-							else
-							{
+	if (options.OutputWidth == OutputWidth8Bit)
+	{
+		if (options.optDebug) for (int i = 2; (i<256) && (job->palette[i] != 0);i++) printf("pal %x - %x\n",i,job->palette[i]);
+	}
 
-								image_buffer8[pos] = 0;
+	job->converted = true;
+}
 
-								int i = 2; // first two palette entries are fixed
+//=======================================================
+// WriteStage
+//=======================================================
+/** Last stage: print the messages of the job and write its outputs
+	@param job Job processed by ConvertStage
+	@return Returns 0 if successful or the image was skipped, the exit code otherwise
+*/
+int WriteStage(JOB * job)
+{
+	if (!job->log.empty()) {
+		fputs(job->log.c_str(), stdout);
+		job->log.clear();
+	}
 
-								while ( (i < 256) && (palette[i] != 0) && (image_buffer8[pos] == 0) )
-								{
-									if (palette[i] == pixel) image_buffer8[pos] = i;
-									i++;
-								}
+	if (!job->converted) return job->exitcode;
+	job->converted = false;
 
-								if (image_buffer8[pos] == 0)
-								{
-									color_count ++;
-									if (i < 256) {
-										palette[i] = pixel;
-										image_buffer8[pos] = i;
-									} else {
-										image_buffer8[pos] = 255;
-										
-									}
-								}
-							}
+	CONVERTOPTIONS & options = job->options;
+	CONVERTRESULT & result = job->result;
+	int exitcode = 0;
 
-						}
+	/********************************************************************************/
+	/* Save image and alpha data                                                    */
+	/********************************************************************************/
+	if (!WriteOutput(&options,job->imagefile_name,&result.image)) {
+		if (!Parm.optQuiet) printf("Error opening image file %s for writing.\n",job->imagefile_name);
+		exitcode = 1;
+	}
 
-						// 1-bit bw 
-						if (bits[FI_RGBA_ALPHA] == 0)
-							image_buffer1[pos/8] = (image_buffer1[pos/8] & ~(1 << (pos % 8) ) );
-						else 
-							image_buffer1[pos/8] = (image_buffer1[pos/8] |  (1 << (pos % 8) ) );
+	else if (options.optAlphaExternal && !WriteOutput(&options,job->alphafile_name,&result.alpha)) {
+		if (!Parm.optQuiet) printf("Error opening alpha file %s for writing.\n",job->alphafile_name);
+		exitcode = 2;
+	}
 
-						
-						if (Parm.optBGR565) {
+	/********************************************************************************/
+	/* Save palette data                                                            */
+	/********************************************************************************/
+	else if (ConvertPaletteSize(&options) && !job->global_palette && !WriteOutput(&options,job->palettefile_name,&result.palette)) {
+		if (!Parm.optQuiet) printf("Error opening palette file %s for writing.\n",job->palettefile_name);
+		exitcode = 3;
+	}
 
-							// BGR565: 16-bit w/o transparency bit
-							image_buffer16[pos] = pixel;
+	/********************************************************************************/
+	/* Save tile dimension data                                                     */
+	/********************************************************************************/
+	else if (options.optWidthmap && options.optTile)
+	{
+		if (!WriteOutput(&options,job->widthfile_name,&result.tile_width)) {
+			if (!Parm.optQuiet) printf("Error opening width file %s for writing.\n",job->widthfile_name);
+			exitcode = 2;
+		}
 
-						} else if (Parm.optRGB565) {
+		else if (!WriteOutput(&options,job->heightfile_name,&result.tile_height)) {
+			if (!Parm.optQuiet) printf("Error opening height file %s for writing.\n",job->heightfile_name);
+			exitcode = 2;
+		}
+	}
 
-							// RGB565: 16-bit w/o transparency bit
-							image_buffer16[pos] = pixel;
+	/********************************************************************************/
+	/* Save palette bank of each tile                                               */
+	/********************************************************************************/
+	if (!exitcode && ConvertTileBanked(&options) && !WriteOutput(&options,job->bankfile_name,&result.tile_bank)) {
+		if (!Parm.optQuiet) printf("Error opening bank file %s for writing.\n",job->bankfile_name);
+		exitcode = 3;
+	}
 
+	/********************************************************************************/
+	/* Free resources                                                               */
+	/********************************************************************************/
+	ConvertFreeResult(&result);
 
-						} else if ( (bits[FI_RGBA_ALPHA] == 0)  || (Parm.optAlphaTransparent && bits[FI_RGBA_ALPHA] != 255) ) {
+	return exitcode;
+}
 
-							// 16-bit w/ transparency bit (unset)
-							image_buffer16[pos] = pixel & ~(1 << 15);
+//=======================================================
+// ConvertFile
+//=======================================================
+/** Convert one image and write its outputs next to it
+	@param input_dir Prefix of the directory of the image, with trailing separator
+	@param entry Image and its overrides, "stdin" in pipeline mode
+	@param from_stdin Read the image from stdin instead of the file
+	@return Returns 0 if successful or the image was skipped, the exit code otherwise
+*/
+int ConvertFile(const char * input_dir, const SCANENTRY * entry, bool from_stdin)
+{
+	JOB job;
 
-						} else {
+	job.buffered = false;
+	LoadStage(&job, input_dir, entry, from_stdin, NULL);
+	ConvertStage(&job);
+	return WriteStage(&job);
+}
 
-							// 16-bit w/ transparency bit (set)
-							image_buffer16[pos] = pixel | (1 << 15);
+//=======================================================
+// Batch stages
+//=======================================================
+/** Stages of the pipeline, job i of the batch uses slot i % depth. With
+	-u the load stage reads FILEIO_BATCH files at once.
+*/
+struct BATCH
+{
+	const char * input_dir;
+	const std::vector<SCANENTRY> * entries;
+	std::vector<JOB> slots;
+	FILEIO * reader;			// NULL without -u
+	unsigned int * histogram;	// -G counting pass, sum of all images
+	std::string names[FILEIO_BATCH];
+	FILEIOREAD reads[FILEIO_BATCH];
+};
 
-						}
+int BatchLoad(void * context, size_t index)
+{
+	BATCH * batch = (BATCH *)context;
+	JOB * job = &batch->slots[index % batch->slots.size()];
+	const FILEIOREAD * read = NULL;
 
-						// alpha data
-						alpha_buffer[pos] = bits[FI_RGBA_ALPHA];
+	if (batch->reader)
+	{
+		size_t group = index % FILEIO_BATCH;
 
-						// jump to next pixel
-						pos++;
-						bits += bytespp;
-					}
-				}
+		// read the next group when its first image is loaded
+		if (group == 0) {
+			size_t count = batch->entries->size() - index;
+			if (count > FILEIO_BATCH) count = FILEIO_BATCH;
 
-				if (Parm.OutputWidth == OutputWidth8Bit) 
-				{
-					if (color_count > 255)
-					 if (!Parm.optQuiet) printf("Warning: Palette overflow, %u colors detected in %u pixels.\n",color_count,pixel_count);
-				}
+			for (size_t i = 0; i < count; i++) {
+				const SCANENTRY & entry = (*batch->entries)[index + i];
+				batch->names[i] = batch->input_dir + entry.directory + entry.name;
+				batch->reads[i].filename = batch->names[i].c_str();
+			}
+			FileIORead(batch->reader, batch->reads, (unsigned int)count);
+		}
+		read = &batch->reads[group];
+	}
 
-				/********************************************************************************/
-				/* Rearrange 8-bit, 1-bit and alpha buffers into tiles if requested             */
-				/********************************************************************************/
-				if (Parm.optTile)
-				{
-					if (Parm.OutputWidth == OutputWidth8Bit) 
-					{
-						unsigned char * tilebuffer;
-						tilebuffer = new unsigned char[pixel_count];
-						unsigned char * tilepointer = tilebuffer;
-
-						int tilecount_x = x / Parm.TileSize;
-						int tilecount_y = y / Parm.TileSize;
-
-
-						for (int tiley = 0; tiley < tilecount_y; tiley++)
-						{
-							for (int tilex = 0; tilex < tilecount_x; tilex++)
-							{
-
-								int tilestarty = tiley * Parm.TileSize;
-								int tilestartx = tilex * Parm.TileSize;
-
-								for (int i = 0; i < Parm.TileSize; i++)
-								{
-
-									for (int j = 0; j < Parm.TileSize; j++)
-									{
-										tilepointer[0] = image_buffer8[ ((tilestarty + i) *x) + (tilestartx + j)  ];
-										tilepointer++;
-									}
-								}
-							}
-						}
-
-						image_buffer8 = tilebuffer;
-					} // if (Parm.OutputWidth == OutputWidth8Bit) 
-
-					if (Parm.OutputWidth == OutputWidth1Bit) 
-					{
-						unsigned char * tilebuffer;
-						tilebuffer = new unsigned char[pixel_count/8];
-						unsigned char * tilepointer = tilebuffer;
-						memset(tilebuffer,0,pixel_count/8);
-						unsigned char last_pixel_x = 0;
-						unsigned char last_pixel_y = 0;
-
-						int tilecount_x = x / Parm.TileSize;
-						int tilecount_y = y / Parm.TileSize;
-
-						for (int tiley = 0; tiley < tilecount_y; tiley++)
-						{
-							for (int tilex = 0; tilex < tilecount_x; tilex++)
-							{
-								last_pixel_x = 0;
-								last_pixel_y = 0;
-
-								for (int i = 0; i < Parm.TileSize; i++)
-								{
-									for (int j = 0; j < Parm.TileSize / 8; j++)
-									{ 
-										tilepointer[0] = image_buffer1[ 
-											(tiley * (x / 8) * Parm.TileSize) +    // Start of Tilerow
-											(tilex * (Parm.TileSize / 8))  +	   // Start of Tilecolumn
-											(i * (x / 8)) +						   // Line within Tile
-											j									   // Pixel within Line
-										];
-										
-										unsigned char pixcount = tilepointer[0];
-
-										if (pixcount & 0x80) last_pixel_x = max(last_pixel_x,(8*j) + 8);
-										else if (pixcount & 0x40) last_pixel_x = max(last_pixel_x,(8*j) + 7);
-										else if (pixcount & 0x20) last_pixel_x = max(last_pixel_x,(8*j) + 6);
-										else if (pixcount & 0x10) last_pixel_x = max(last_pixel_x,(8*j) + 5);
-										else if (pixcount & 0x08) last_pixel_x = max(last_pixel_x,(8*j) + 4);
-										else if (pixcount & 0x04) last_pixel_x = max(last_pixel_x,(8*j) + 3);
-										else if (pixcount & 0x02) last_pixel_x = max(last_pixel_x,(8*j) + 2);
-										else if (pixcount & 0x01) last_pixel_x = max(last_pixel_x,(8*j) + 1);
-
-										if (pixcount) last_pixel_y = i;
-
-										tilepointer++;
-									}
-								}
-
-								if (Parm.optDebug)
-								{
-									printf("Tile %d - w %d h %d\n",(tiley*tilecount_x)+tilex,last_pixel_x,last_pixel_y);
-								}
-
-								tile_width_buffer[(tiley*tilecount_x)+tilex] = last_pixel_x;
-								tile_height_buffer[(tiley*tilecount_x)+tilex] = last_pixel_y;
-							}
-						}
-						
-
-						image_buffer1 = tilebuffer;
-					} // if (Parm.OutputWidth == OutputWidth1Bit) 
-
-					if (Parm.optAlphaExternal) 
-					{
-						unsigned char * tilebuffer;
-						tilebuffer = new unsigned char[pixel_count];
-						unsigned char * tilepointer = tilebuffer;
-
-						int tilecount_x = x / Parm.TileSize;
-						int tilecount_y = y / Parm.TileSize;
-
-						for (int tiley = 0; tiley < tilecount_y; tiley++)		// for each tilerow
-						{
-							for (int tilex = 0; tilex < tilecount_x; tilex++)	// for each tile column
-							{
-								for (int i = 0; i < Parm.TileSize; i++)			// for each line within tile
-								{
-									for (int j = 0; j < Parm.TileSize; j++)		// for pixel within line
-									{ 
-										tilepointer[0] = alpha_buffer[ 
-											(tiley * (x) * Parm.TileSize) +    // Start of Tilerow
-											(tilex * (Parm.TileSize))  +	   // Start of Tilecolumn
-											(i * (x)) +						   // Line within Tile
-											j								   // Pixel within Line
-										];
-										tilepointer++;
-									}
-								}
-							}
-						}
-						alpha_buffer = tilebuffer;
-					} // if (Parm.OutputWidth == OutputWidth1Bit) 
+	job->buffered = true;
+	LoadStage(job, batch->input_dir, &(*batch->entries)[index], false, read);
+	return 0;
+}
 
+int BatchConvert(void * context, size_t index)
+{
+	BATCH * batch = (BATCH *)context;
 
-				}
+	ConvertStage(&batch->slots[index % batch->slots.size()]);
+	return 0;
+}
 
-				/********************************************************************************/
-				/* Pack data for RGB444 file format                                             */
-				/********************************************************************************/
-				if (Parm.OutputWidth == OutputWidth3x4Bit)
-				{
-					int i,j;
-					
-					j = 0;
-
-					for (i=0; i<pixel_count/2; i++)
-					{
-						image_buffer_4bitpacked[j]   = ((image_buffer4[i*2]   & 0xFF0) >> 4);
-						image_buffer_4bitpacked[j+1] = ((image_buffer4[i*2]   & 0x00F) << 4) | ((image_buffer4[i*2+1] & 0xF00) >> 8);
-						image_buffer_4bitpacked[j+2] = ((image_buffer4[i*2+1] & 0x0FF));
-
-						j += 3;
-					}
-				}
+int BatchWrite(void * context, size_t index)
+{
+	BATCH * batch = (BATCH *)context;
 
-				/********************************************************************************/
-				/* Open files according to option settings                                      */
-				/********************************************************************************/
-				imagefile = fopen(imagefile_name, "wb");
-				if (!imagefile) {
-					if (!Parm.optQuiet) printf("Error opening image file %s\n for writing.",imagefile_name);
-					return 1;
-				}
+	return WriteStage(&batch->slots[index % batch->slots.size()]);
+}
 
-				if (Parm.optAlphaExternal)
-				{
-					alphafile = fopen(alphafile_name, "wb");
-					if (!alphafile) {
-						if (!Parm.optQuiet) printf("Error opening alpha file %s\n for writing.",alphafile_name);
-						return 2;
-					}
-				}
+//=======================================================
+// CountStage
+//=======================================================
+/** Counting pass of -G: count the colors of a loaded image using the
+	global palette, the image is unloaded afterwards
+	@param job Job filled in by LoadStage
+*/
+void CountStage(JOB * job)
+{
+	job->histogram.clear();
+	if (job->dib32 == NULL) return;
 
+	if (job->global_palette)
+	{
+		job->histogram.assign(PALMAP_COLORS, 0);
+		if (QuantizeHistogram(&job->options, &job->image, &job->histogram[0]) != CONVERT_OK) job->exitcode = 6;
+	}
 
+	if (job->dib32 != job->dib) FreeImage_Unload(job->dib32);
+	FreeImage_Unload(job->dib);
+	job->dib32 = NULL;
+}
 
-				/********************************************************************************/
-				/* Save image and alpha data                                                    */
-				/********************************************************************************/
-				if (Parm.optRLE)
-				{
-					config = CONFIG_COMPRESSED;
-
-					if (Parm.OutputWidth == OutputWidth8Bit) config |= CONFIG_8BIT;
-					else config |= CONFIG_16BIT;
-
-					unsigned short int * compress_buffer;
-					compress_buffer = (unsigned short int *)malloc(pixel_count*2*257/256+1);
-					
-
-					unsigned int outsize;
-
-					if (Parm.OutputWidth == OutputWidth8Bit) outsize = RLE_Compress8(image_buffer8,(unsigned char *)compress_buffer,pixel_count);
-					else if (Parm.OutputWidth == OutputWidth1Bit) outsize = RLE_Compress8(image_buffer1,(unsigned char *)compress_buffer,pixel_count/8);
-					else outsize = RLE_Compress16(image_buffer16,compress_buffer,pixel_count);
-
-					if (!Parm.optQuiet) printf("%s (Size %u) -> %s (Size %u)\n",sourcefile_name,pixel_count*2,imagefile_name,outsize);
-
-					unsigned int uncompressed_size = pixel_count*2;
-
-
-					if (!Parm.optNoHeader)
-					{
-						fwrite(&outsize,4,1,imagefile);
-						fwrite(&x,2,1,imagefile);
-						fwrite(&y,2,1,imagefile);
-						fwrite(&config,2,1,imagefile);
-					}
-
-					//debug only
-					if (Parm.optDebug)
-					{
-						// For debugging, decompress data after compression and write the decompressed image
-						unsigned short int * decompress_buffer;
-						decompress_buffer = (unsigned short int *)malloc(pixel_count*2*257/256+1);
-						printf("WARNING: Output decompressed for debugging\n"); 
-						printf("pixel_count %u outsize %u\n",pixel_count,outsize);
-						if (Parm.OutputWidth == OutputWidth8Bit) RLE_Uncompress8((unsigned char *)compress_buffer,(unsigned char *)decompress_buffer,outsize);
-						else RLE_Uncompress16(compress_buffer,decompress_buffer,outsize);
-						if (Parm.OutputWidth == OutputWidth8Bit) fwrite(decompress_buffer,1,pixel_count,imagefile);
-						else fwrite(decompress_buffer,2,pixel_count,imagefile);
-						free(decompress_buffer);
-
-					} else {
-						// regular operation, write compressed data to disc
-						if (Parm.OutputWidth == OutputWidth8Bit) fwrite(compress_buffer,1,outsize,imagefile);
-						else if (Parm.OutputWidth == OutputWidth1Bit) fwrite(compress_buffer,1,outsize,imagefile);
-						else fwrite(compress_buffer,2,outsize,imagefile);
-
-					}
-
-					if (Parm.optAlphaExternal) {
-						int outsize = RLE_Compress8(alpha_buffer,(unsigned char *)compress_buffer,pixel_count);
-						fwrite(&outsize,4,1,alphafile);
-						fwrite(&x,2,1,alphafile);
-						fwrite(&y,2,1,alphafile);
-						fwrite(&config,2,1,alphafile);
-						fwrite(compress_buffer,1,outsize,alphafile);
-					}
-
-					free(compress_buffer);
-
-				} else {
-
-					config = CONFIG_UNCOMPRESSED;
-
-					if (Parm.OutputWidth == OutputWidth8Bit) config |= CONFIG_8BIT;
-					else config |= CONFIG_16BIT;
-
-					if (!Parm.optQuiet) printf("%s -> %s (Size %u)\n",sourcefile_name,imagefile_name,pixel_count*2);
-
-					if (!Parm.optNoHeader)
-					{
-						fwrite(&pixel_count,4,1,imagefile);
-						fwrite(&x,2,1,imagefile);
-						fwrite(&y,2,1,imagefile);
-						fwrite(&config,2,1,imagefile);
-					}
-
-					if (Parm.OutputWidth == OutputWidth8Bit) fwrite(image_buffer8,1,pixel_count,imagefile);
-					else if (Parm.OutputWidth == OutputWidth1Bit) fwrite(image_buffer1,1,pixel_count/8,imagefile);
-					else if (Parm.OutputWidth == OutputWidth3x4Bit)  fwrite(image_buffer_4bitpacked,1,pixel_count*3/2,imagefile);
-					else fwrite(image_buffer16,2,pixel_count,imagefile);
-
-					if (Parm.optAlphaExternal) {
-						fwrite(&pixel_count,4,1,alphafile);
-						fwrite(&x,2,1,alphafile);
-						fwrite(&y,2,1,alphafile);
-						fwrite(&config,2,1,alphafile);
-						fwrite(alpha_buffer,1,pixel_count,alphafile);
-					}
-				}
+//=======================================================
+// CountMerge
+//=======================================================
+/** Add the colors of a counted image to the sum, messages are dropped
+	since the converting pass prints them
+	@param job Job processed by CountStage
+	@param histogram Sum of all images
+	@return Returns 0 if successful or the image was skipped, the exit code otherwise
+*/
+int CountMerge(JOB * job, unsigned int * histogram)
+{
+	job->log.clear();
 
-				/********************************************************************************/
-				/* Save palette data                                                            */
-				/********************************************************************************/
-				if (Parm.OutputWidth == OutputWidth8Bit)
-				{
-					if (Parm.optDebug) for (int i = 2; (i<256) && (palette[i] != 0);i++) printf("pal %x - %x\n",i,palette[i]);
-
-					palettefile = fopen(palettefile_name,"wb");
-					if (!palettefile) {
-						if (!Parm.optQuiet) printf("Error opening palette file %s for writing.\n",palettefile_name);
-						return 3;
-					}
-					fwrite(&palette,2,256,palettefile);
-					fclose(palettefile);
-				}
+	if (job->exitcode == 6) {
+		if (!Parm.optQuiet) printf("Error: out of memory counting colors of %s\n",job->sourcefile_name);
+		return 6;
+	}
 
+	if (!job->histogram.empty())
+		for (unsigned int c = 0; c < PALMAP_COLORS; c++) histogram[c] += job->histogram[c];
 
-				/********************************************************************************/
-				/* Save tile dimension data                                                     */
-				/********************************************************************************/
-				if (Parm.optWidthmap && Parm.optTile)
-				{
-					widthfile = fopen(widthfile_name, "wb");
-					if (!widthfile) {
-						if (!Parm.optQuiet) printf("Error opening width file %s for writing.",widthfile_name);
-						return 2;
-					}
-					fwrite(tile_width_buffer,1,(x/Parm.TileSize) * (y/Parm.TileSize), widthfile);
-					fclose(widthfile);
-
-					heightfile = fopen(heightfile_name, "wb");
-					if (!heightfile) {
-						if (!Parm.optQuiet) printf("Error opening height file %s for writing.",heightfile_name);
-						return 2;
-					}
-					fwrite(tile_height_buffer,1,(x/Parm.TileSize) * (y/Parm.TileSize), heightfile);
-					fclose(heightfile);
-				}
+	return 0;
+}
 
+int BatchCount(void * context, size_t index)
+{
+	BATCH * batch = (BATCH *)context;
 
+	CountStage(&batch->slots[index % batch->slots.size()]);
+	return 0;
+}
 
-				/********************************************************************************/
-				/* Free resources                                                               */
-				/********************************************************************************/
-				if (alphafile) fclose(alphafile);
-				if (imagefile) fclose(imagefile);
+int BatchMerge(void * context, size_t index)
+{
+	BATCH * batch = (BATCH *)context;
 
-				alphafile = 0;
-				imagefile = 0;
-/*
-				free(tile_height_buffer);
-				free(tile_width_buffer);
-				free(alpha_buffer);
-				free(image_buffer16);
-				free(image_buffer8);
-//				free(image_buffer1);
-				free(image_buffer4);
-				free(image_buffer_4bitpacked);
+	return CountMerge(&batch->slots[index % batch->slots.size()], batch->histogram);
+}
+
+//=======================================================
+// ChooseGlobalPalette
+//=======================================================
+/** -G: count the colors of all images in the stages of the pipeline,
+	choose the palette from the sum and write it once
+	@param input_dir Prefix of the directory of the images, with trailing separator
+	@param entries Images of the run
+	@return Returns 0 if successful, the exit code otherwise
+*/
+int ChooseGlobalPalette(const char * input_dir, const std::vector<SCANENTRY> & entries)
+{
+	std::vector<unsigned int> histogram(PALMAP_COLORS, 0);
+	int exitcode = 0;
+
+	if (!Parm.Options.optDebug && (entries.size() > 1))
+	{
+		BATCH batch;
+		PIPELINE pipeline;
+
+		pipeline.load = BatchLoad;
+		pipeline.convert = BatchCount;
+		pipeline.write = BatchMerge;
+		pipeline.context = &batch;
+		pipeline.workers = Parm.Workers;
+		pipeline.depth = 2 * pipeline.workers + 2;
+
+		batch.input_dir = input_dir;
+		batch.entries = &entries;
+		batch.slots.resize(pipeline.depth);
+		batch.reader = Parm.optBatchIO ? FileIOCreate(true) : NULL;
+		batch.histogram = &histogram[0];
+
+		exitcode = PipelineRun(&pipeline, entries.size());
+		FileIODestroy(batch.reader);
+	}
+	else
+	{
+		JOB job;
+
+		job.buffered = true;
+		for (size_t i = 0; (i < entries.size()) && !exitcode; i++)
+		{
+			LoadStage(&job, input_dir, &entries[i], false, NULL);
+			CountStage(&job);
+			exitcode = CountMerge(&job, &histogram[0]);
+		}
+	}
+
+	if (exitcode) return exitcode;
+
+	for (int i = 0; i < 256; i++) GlobalPalette.entries[i] = 0;
+	GlobalPalette.loaded = false;
+	GlobalPalette.map.resize(PALMAP_COLORS);
+
+	if (QuantizePalette(&Parm.Options, &histogram[0], GlobalPalette.entries, &GlobalPalette.map[0], NULL) != CONVERT_OK)
+	{
+		if (!Parm.optQuiet) printf("Error: out of memory choosing the palette\n");
+		return 6;
+	}
+
+	// QuantizePalette maps the counted colors only, the others would read
+	// entry 0 (transparent) if an image differs from the counted one;
+	// entries are in the format the palette is written in (-6, -7)
+	PalMapBuild(GlobalPalette.entries, PixelFormatGet(ConvertPaletteFormat(&Parm.Options)), &GlobalPalette.map[0]);
+
+	// the palette output of ConvertEncode, written once
+	CONVERTOUTPUT output;
+	output.data = (unsigned char *)GlobalPalette.entries;
+	output.size = 256*2;
+	output.count = 0;
+	output.width = 256;
+	output.height = 1;
+	output.config = CONFIG_UNCOMPRESSED;
+	output.format = ARCHIVE_FORMAT_PALETTE;
+	output.header = false;
+	output.raw_size = 256*2;
+
+	if (!WriteOutput(&Parm.Options,Parm.Palettepath,&output)) {
+		if (!Parm.optQuiet) printf("Error opening palette file %s for writing.\n",Parm.Palettepath);
+		return 3;
+	}
+
+	if (!Parm.optQuiet) {
+		int used = 2;
+		while ( (used < 256) && (GlobalPalette.entries[used] != 0) ) used++;
+		printf("Palette %s (%d colors)\n",Parm.Palettepath,used - 2);
+	}
+
+	return 0;
+}
+
+//=======================================================
+// WatchConvert
+//=======================================================
+/** Watch mode callback, converts a changed image. A failed conversion is
+	reported and watching goes on.
+	@param context Prefix of the watched directory (const char *), with trailing separator
+	@param name File name of the image in the watched directory
 */
-				FreeImage_Unload(dib);
+void WatchConvert(void * context, const char * name)
+{
+	const char * input_dir = (const char *)context;
+	SCANENTRY entry;
+
+	entry.name = name;
+	entry.format = SCAN_FORMAT_DEFAULT;
+	entry.tilesize = 0;
+
+	int exitcode = ConvertFile(input_dir, &entry, false);
+	if (exitcode && !Parm.optQuiet) printf("Error converting %s%s (exit code %d), still watching.\n",input_dir,name,exitcode);
+}
+
+//=======================================================
+// main
+//=======================================================
+int 
+main(int argc, char *argv[]) {
+
+	parminit();
+	processcmdline(argc, argv);
+
+	if (Parm.optHelp) {
+		showsyntax();
+		return 0;
+	}
+
 
-			} else {
-				if (!Parm.optQuiet) printf("Error loading %s\n",sourcefile_name);
+	// scanned and listed images are named relative to the current directory
+	const char *input_dir = "";
+
+	// large images are split over the cores left by the convert threads
+	unsigned int cores = std::thread::hardware_concurrency();
+	Parm.Options.Threads = (cores > Parm.Workers) ? cores / Parm.Workers : 1;
+
+	// call this ONLY when linking with FreeImage as a static library
+#ifdef FREEIMAGE_LIB
+	FreeImage_Initialise();
+#endif // FREEIMAGE_LIB
+
+	// initialize your own FreeImage error handler
+	FreeImage_SetOutputMessage(FreeImageErrorHandler);
+
+	// watch mode converts single files, it cannot extend an archive or read stdin
+	if (Parm.optWatch && (*Parm.Archivepath || !strcmp(Parm.Filefilter, "-")))
+	{
+		if (!Parm.optQuiet) printf("Error: -W cannot be combined with -o or -f -\n");
+		return 7;
+	}
+
+	// the palette of -G is chosen from all images before any is converted,
+	// images changed later in watch mode were not counted
+	if (Parm.optGlobalPalette && (!*Parm.Palettepath || Parm.optFixedPalette || Parm.optWatch || !strcmp(Parm.Filefilter, "-")))
+	{
+		if (!Parm.optQuiet) printf("Error: -G requires -p and cannot be combined with -F, -W or -f -\n");
+		return 3;
+	}
+
+	// the version 2 header is padded to the payload alignment, C and ELF
+	// output align the payload
+	if ( ((Parm.Options.optHeaderV2 && !Parm.Options.optNoHeader) || (Parm.EmitMode != EMIT_NONE)) &&
+		( (Parm.Options.Alignment == 0) || (Parm.Options.Alignment & (Parm.Options.Alignment - 1)) || (Parm.Options.Alignment > HEADER_V2_MAXALIGNMENT) ))
+	{
+		if (!Parm.optQuiet) printf("Error: -l must be a power of two up to %u\n",HEADER_V2_MAXALIGNMENT);
+		return 5;
+	}
+
+	// batch convert all supported bitmaps
+	std::vector<SCANENTRY> entries;
+
+	// pipeline mode: a single image from stdin, outputs go to stdout in the
+	// order image, alpha, palette, width, height; messages go to stderr
+	bool from_stdin = !strcmp(Parm.Filefilter, "-");
+
+	if (from_stdin)
+	{
+		SCANENTRY entry;
+		entry.name = "stdin";
+		entry.format = SCAN_FORMAT_DEFAULT;
+		entry.tilesize = 0;
+		entries.push_back(entry);
+
+		if (!*Parm.Archivepath && (Parm.EmitMode == EMIT_NONE))
+		{
+			PipeOutput = OutFileRedirectStdout();
+			if (PipeOutput < 0) {
+				if (!Parm.optQuiet) printf("Error redirecting stdout.\n");
+				return 1;
+			}
+		}
+	}
+
+	// the images of a manifest are named relative to the current directory
+	else if (*Parm.Manifestpath)
+	{
+		unsigned int errorline;
+		if (!ScanManifest(Parm.Manifestpath, entries, &errorline)) {
+			if (!Parm.optQuiet) {
+				if (errorline) printf("Error in manifest %s line %u\n",Parm.Manifestpath,errorline);
+				else printf("Error reading manifest %s\n",Parm.Manifestpath);
 			}
+			return 8;
+		}
+	}
+
+	// scan all files, with -R in all subdirectories as well
+	else if (!ScanDirectory("", Parm.Filefilter, Parm.optRecursive, entries))
+	{
+		if (!Parm.optQuiet) printf("Error reading directory.\n");
+		return 8;
+	}
+
+	// collect all outputs in one archive if requested, it replaces an
+	// existing one only when it is complete
+	if (*Parm.Archivepath)
+	{
+		if (!ArchiveOpen(&Archive, Parm.Archivepath, Parm.Options.Alignment)) {
+			if (!Parm.optQuiet) printf("Error opening archive file %s for writing.\n",Parm.Archivepath);
+			return 4;
+		}
+		if (Parm.Options.optBigEndian) Archive.flags |= ARCHIVE_FLAG_BIGENDIAN;
+	}
+
+	// loose outputs are queued and written in groups with -u
+	if (Parm.optBatchIO && (PipeOutput < 0) && !Archive.open && (Parm.EmitMode == EMIT_NONE))
+	{
+		Writer = FileIOCreate(true);
+		if (Parm.Options.optDebug && Writer) printf("File I/O: %s\n",FileIOUring(Writer) ? "io_uring" : "read/write");
+	}
 
+	int exitcode = Parm.optGlobalPalette ? ChooseGlobalPalette(input_dir, entries) : 0;
 
+	// images are loaded, converted and written overlapped; verbose output
+	// is printed while converting and needs the sequential order
+	if (!exitcode && !from_stdin && !Parm.Options.optDebug && (entries.size() > 1))
+	{
+		BATCH batch;
+		PIPELINE pipeline;
+
+		// a shared palette is extended image by image, in list order
+		bool shared_palette = (*Parm.Palettepath != '\0') && !Parm.optGlobalPalette;
+		for (size_t i = 0; i < entries.size(); i++)
+			if (!entries[i].palette.empty()) shared_palette = true;
+		if (Parm.optFixedPalette) shared_palette = false;
+
+		pipeline.load = BatchLoad;
+		pipeline.convert = BatchConvert;
+		pipeline.write = BatchWrite;
+		pipeline.context = &batch;
+		pipeline.workers = shared_palette ? 1 : Parm.Workers;
+		pipeline.depth = 2 * pipeline.workers + 2;
+
+		batch.input_dir = input_dir;
+		batch.entries = &entries;
+		batch.slots.resize(pipeline.depth);
+		batch.reader = Parm.optBatchIO ? FileIOCreate(true) : NULL;
+		batch.histogram = NULL;
+
+		exitcode = PipelineRun(&pipeline, entries.size());
+		FileIODestroy(batch.reader);
+	}
+	else
+	{
+		for (size_t i = 0; (i < entries.size()) && !exitcode; i++)
+			exitcode = ConvertFile(input_dir, &entries[i], from_stdin);
+	}
 
+	// write what is left in the queue, watch mode writes directly
+	if (Writer)
+	{
+		bool flushed = FileIOFlush(Writer);
+		if (!flushed && !Parm.optQuiet) printf("Error writing %s\n",FileIOFailed(Writer));
+		FileIODestroy(Writer);
+		Writer = NULL;
+		if (!flushed && !exitcode) exitcode = 1;
+	}
 
+	if (exitcode) {
+		ArchiveAbort(&Archive);
+		return exitcode;
+	}
 
-		} while (_findnext(handle, &finddata) == 0);
+	// keep FreeImage and the palette loaded and convert files as they change
+	if (Parm.optWatch)
+	{
+		if (!Parm.optQuiet) printf("Watching for changes to %s\n",Parm.Filefilter);
+		if (!WatchDirectory(".", Parm.Filefilter, WATCH_DEBOUNCE, WatchConvert, (void *)"")) {
+			if (!Parm.optQuiet) printf("Error watching the current directory.\n");
+			return 7;
+		}
+	}
 
-		_findclose(handle);
+	if (Archive.open)
+	{
+		if (!ArchiveClose(&Archive)) {
+			if (!Parm.optQuiet) printf("Error writing archive file %s.\n",Parm.Archivepath);
+			return 4;
+		}
 	}
 
 	// call this ONLY when linking with FreeImage as a static library
@@ -0,0 +1,368 @@
+//=======================================================
+// archive.cpp
+//
+// Writes all outputs of a run into a single container with an index
+// sorted by name hash, so the device can locate an asset with a binary
+// search and map or DMA the payload directly.
+//=======================================================
+
+#include "stdafx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "archive.h"
+#include "byteorder.h"
+
+//=======================================================
+// ArchiveHash
+//=======================================================
+/** FNV-1a hash of an entry name
+	@param name NUL-terminated entry name
+	@return Returns the 32-bit hash
+*/
+unsigned int ArchiveHash(const char * name)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*name)
+	{
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+//=======================================================
+// ArchivePad
+//=======================================================
+/** Write zero bytes up to the next multiple of the alignment
+*/
+static bool ArchivePad(ARCHIVE * archive)
+{
+	static const unsigned char zero[512] = { 0 };
+	unsigned int padding = (archive->alignment - (archive->position % archive->alignment)) % archive->alignment;
+
+	while (padding > 0)
+	{
+		unsigned int chunk = padding < sizeof(zero) ? padding : sizeof(zero);
+		if (!OutFileAppend(&archive->file, zero, chunk)) return false;
+		archive->position += chunk;
+		padding -= chunk;
+	}
+	return true;
+}
+
+//=======================================================
+// ArchiveStoreHeader
+//=======================================================
+/** Header fields in file order, little-endian
+*/
+static void ArchiveStoreHeader(const ARCHIVEHEADER * header, unsigned char dest[ARCHIVE_HEADER_SIZE])
+{
+	Store32(dest + 0, header->magic, false);
+	Store16(dest + 4, header->version, false);
+	Store16(dest + 6, header->header_size, false);
+	Store32(dest + 8, header->alignment, false);
+	Store32(dest + 12, header->entry_count, false);
+	Store32(dest + 16, header->index_offset, false);
+	Store32(dest + 20, header->names_offset, false);
+	Store32(dest + 24, header->names_size, false);
+	Store32(dest + 28, header->flags, false);
+}
+
+//=======================================================
+// ArchiveStoreEntry
+//=======================================================
+/** Index entry fields in file order, little-endian
+*/
+static void ArchiveStoreEntry(const ARCHIVEENTRY * entry, unsigned char dest[ARCHIVE_ENTRY_SIZE])
+{
+	Store32(dest + 0, entry->hash, false);
+	Store32(dest + 4, entry->name_offset, false);
+	Store32(dest + 8, entry->offset, false);
+	Store32(dest + 12, entry->size, false);
+	Store32(dest + 16, entry->width, false);
+	Store32(dest + 20, entry->height, false);
+	Store16(dest + 24, entry->codec, false);
+	Store16(dest + 26, entry->format, false);
+	Store16(dest + 28, entry->config, false);
+	Store16(dest + 30, entry->reserved, false);
+}
+
+//=======================================================
+// ArchiveGrow
+//=======================================================
+/** Grow a buffer by doubling until it holds the needed number of items.
+	On failure the buffer and its capacity are left as they are.
+	@param data Buffer, NULL for none
+	@param capacity Capacity of the buffer in items
+	@param needed Number of items the buffer has to hold
+	@param first Capacity of a new buffer
+	@param item Item size in bytes
+	@return Returns true if successful
+*/
+static bool ArchiveGrow(void ** data, unsigned int * capacity, unsigned int needed, unsigned int first, unsigned int item)
+{
+	unsigned int grown = *capacity;
+
+	if (needed <= grown) return true;
+	while (needed > grown) grown = grown ? grown * 2 : first;
+
+	void * buffer = realloc(*data, (size_t)grown * item);
+	if (!buffer) return false;
+	*data = buffer;
+	*capacity = grown;
+	return true;
+}
+
+//=======================================================
+// ArchiveOpen
+//=======================================================
+/** Create the temporary file of an archive
+	@param archive Archive state
+	@param filename Path of the archive file
+	@param alignment Payload alignment in bytes (power of two)
+	@return Returns true if successful
+*/
+bool ArchiveOpen(ARCHIVE * archive, const char * filename, unsigned int alignment)
+{
+	unsigned char header[ARCHIVE_HEADER_SIZE];
+
+	memset(archive, 0, sizeof(ARCHIVE));
+	if ( (alignment == 0) || (alignment & (alignment - 1)) ) return false;
+
+	if (!OutFileOpen(&archive->file, filename)) return false;
+	archive->open = true;
+	archive->alignment = alignment;
+
+	// placeholder, completed by ArchiveClose
+	memset(header, 0, sizeof(header));
+	if (!OutFileAppend(&archive->file, header, sizeof(header))) {
+		ArchiveAbort(archive);
+		return false;
+	}
+	archive->position = sizeof(header);
+
+	return true;
+}
+
+//=======================================================
+// ArchiveAdd
+//=======================================================
+/** Append a payload to the archive, palettes are held until ArchiveClose
+	@param archive Archive state
+	@param name Entry name (the file name the output would have as a loose file)
+	@param data Payload
+	@param size Payload size in bytes
+	@param codec ARCHIVE_CODEC_*
+	@param format ARCHIVE_FORMAT_*
+	@param width Image width in pixels
+	@param height Image height in pixels
+	@param config Configuration word of the image header
+	@return Returns true if successful
+*/
+bool ArchiveAdd(ARCHIVE * archive, const char * name, const void * data, unsigned int size,
+				unsigned short codec, unsigned short format, unsigned int width, unsigned int height, unsigned short config)
+{
+	unsigned int name_size = (unsigned int)strlen(name) + 1;
+	bool palette = (format == ARCHIVE_FORMAT_PALETTE);
+
+	if (!palette && !ArchivePad(archive)) return false;
+
+	if (!ArchiveGrow((void **)&archive->entries, &archive->entry_capacity, archive->entry_count + 1, 64, sizeof(ARCHIVEENTRY))) return false;
+	if (!ArchiveGrow((void **)&archive->names, &archive->names_capacity, archive->names_size + name_size, 4096, 1)) return false;
+	if (palette && !ArchiveGrow((void **)&archive->palettes, &archive->palettes_capacity, archive->palettes_size + size, 4096, 1)) return false;
+
+	ARCHIVEENTRY * entry = &archive->entries[archive->entry_count++];
+	entry->hash = ArchiveHash(name);
+	entry->name_offset = archive->names_size;
+	entry->offset = palette ? archive->palettes_size : archive->position;
+	entry->size = size;
+	entry->width = width;
+	entry->height = height;
+	entry->codec = codec;
+	entry->format = format;
+	entry->config = config;
+	entry->reserved = 0;
+
+	memcpy(archive->names + archive->names_size, name, name_size);
+	archive->names_size += name_size;
+
+	if (palette)
+	{
+		memcpy(archive->palettes + archive->palettes_size, data, size);
+		archive->palettes_size += size;
+		return true;
+	}
+
+	if (size && !OutFileAppend(&archive->file, data, size)) return false;
+	archive->position += size;
+
+	return true;
+}
+
+//=======================================================
+// ArchiveWritePalettes
+//=======================================================
+/** Write the palettes held in memory after the other payloads. Entries
+	whose palettes are equal share the payload of the first one.
+	@param archive Archive state
+	@param count Number of entries left in the index
+	@return Returns true if successful
+*/
+static bool ArchiveWritePalettes(ARCHIVE * archive, unsigned int count)
+{
+	if (!count) return true;
+
+	unsigned int * written = (unsigned int *)malloc(count * sizeof(unsigned int));
+	unsigned int * sources = (unsigned int *)malloc(count * sizeof(unsigned int));
+	unsigned int written_count = 0;
+	bool result = (written && sources);
+
+	for (unsigned int i = 0; result && (i < count); i++)
+	{
+		ARCHIVEENTRY * entry = &archive->entries[i];
+		unsigned int source = entry->offset;
+		unsigned int w;
+
+		if (entry->format != ARCHIVE_FORMAT_PALETTE) continue;
+
+		for (w = 0; w < written_count; w++)
+		{
+			const ARCHIVEENTRY * other = &archive->entries[written[w]];
+			if ( (other->size == entry->size) && !memcmp(archive->palettes + sources[w], archive->palettes + source, entry->size) ) break;
+		}
+
+		if (w < written_count) {
+			entry->offset = archive->entries[written[w]].offset;
+			continue;
+		}
+
+		result = ArchivePad(archive);
+		if (result && entry->size) result = OutFileAppend(&archive->file, archive->palettes + source, entry->size);
+		entry->offset = archive->position;
+		archive->position += entry->size;
+		written[written_count] = i;
+		sources[written_count++] = source;
+	}
+
+	free(written);
+	free(sources);
+	return result;
+}
+
+// names table used by ArchiveCompare
+static const char * sort_names;
+
+//=======================================================
+// ArchiveCompare
+//=======================================================
+/** qsort order: hash, name, then order of addition
+*/
+static int ArchiveCompare(const void * a, const void * b)
+{
+	const ARCHIVEENTRY * entry_a = (const ARCHIVEENTRY *)a;
+	const ARCHIVEENTRY * entry_b = (const ARCHIVEENTRY *)b;
+
+	if (entry_a->hash != entry_b->hash) return entry_a->hash < entry_b->hash ? -1 : 1;
+
+	int result = strcmp(sort_names + entry_a->name_offset, sort_names + entry_b->name_offset);
+	if (result) return result;
+
+	// payloads are written in order of addition
+	return entry_a->offset < entry_b->offset ? -1 : 1;
+}
+
+//=======================================================
+// ArchiveClose
+//=======================================================
+/** Write palettes, index and names table, complete the header and rename
+	the file into place. If a name was added more than once (e.g. a shared
+	palette), the last payload wins, as it would when writing loose files.
+	@param archive Archive state
+	@return Returns true if successful
+*/
+bool ArchiveClose(ARCHIVE * archive)
+{
+	ARCHIVEHEADER header;
+	unsigned char stored[ARCHIVE_HEADER_SIZE];
+	unsigned int count = 0;
+	bool result = archive->open;
+
+	if (archive->entry_count)
+	{
+		sort_names = archive->names;
+		qsort(archive->entries, archive->entry_count, sizeof(ARCHIVEENTRY), ArchiveCompare);
+
+		// drop all but the last of each run of equal names
+		for (unsigned int i = 0; i < archive->entry_count; i++)
+		{
+			if ( (i + 1 < archive->entry_count) &&
+				 (archive->entries[i].hash == archive->entries[i+1].hash) &&
+				 !strcmp(archive->names + archive->entries[i].name_offset, archive->names + archive->entries[i+1].name_offset) )
+				continue;
+			archive->entries[count++] = archive->entries[i];
+		}
+	}
+
+	if (result)
+	{
+		result = ArchiveWritePalettes(archive, count) && ArchivePad(archive);
+
+		header.magic = ARCHIVE_MAGIC;
+		header.version = ARCHIVE_VERSION;
+		header.header_size = ARCHIVE_HEADER_SIZE;
+		header.alignment = archive->alignment;
+		header.entry_count = count;
+		header.index_offset = archive->position;
+		header.names_offset = archive->position + count * ARCHIVE_ENTRY_SIZE;
+		header.names_size = archive->names_size;
+		header.flags = archive->flags;
+
+		if (result && count)
+		{
+			unsigned char * index = (unsigned char *)malloc(count * ARCHIVE_ENTRY_SIZE);
+
+			result = (index != NULL);
+			for (unsigned int i = 0; result && (i < count); i++) ArchiveStoreEntry(&archive->entries[i], index + i * ARCHIVE_ENTRY_SIZE);
+			if (result) result = OutFileAppend(&archive->file, index, count * ARCHIVE_ENTRY_SIZE);
+			free(index);
+		}
+		if (result && archive->names_size) result = OutFileAppend(&archive->file, archive->names, archive->names_size);
+
+		ArchiveStoreHeader(&header, stored);
+		if (result) result = OutFilePatch(&archive->file, 0, stored, sizeof(stored));
+		if (!result) archive->file.failed = true;
+		if (!OutFileClose(&archive->file)) result = false;
+	}
+
+	free(archive->entries);
+	free(archive->names);
+	free(archive->palettes);
+	memset(archive, 0, sizeof(ARCHIVE));
+
+	return result;
+}
+
+//=======================================================
+// ArchiveAbort
+//=======================================================
+/** Remove the temporary file of an archive that is not completed, an
+	existing archive of the same name is kept
+	@param archive Archive state
+*/
+void ArchiveAbort(ARCHIVE * archive)
+{
+	if (archive->open)
+	{
+		archive->file.failed = true;
+		OutFileClose(&archive->file);
+	}
+
+	free(archive->entries);
+	free(archive->names);
+	free(archive->palettes);
+	memset(archive, 0, sizeof(ARCHIVE));
+}
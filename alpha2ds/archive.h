@@ -0,0 +1,108 @@
+//=======================================================
+// archive.h
+//
+// Container for all outputs of a conversion run.
+//
+// Layout (all fields little-endian, stored field by field):
+//   ARCHIVEHEADER (ARCHIVE_HEADER_SIZE bytes)
+//   payloads, each starting at a multiple of the alignment
+//   index: ARCHIVEENTRY[entry_count] (ARCHIVE_ENTRY_SIZE bytes each), sorted by name hash
+//   names: NUL-terminated entry names
+//
+// The archive is written to a temporary file and renamed into place by
+// ArchiveClose (outfile.h). Palettes are kept in memory until then and
+// written once per distinct content, entries with equal palettes share
+// one payload.
+//=======================================================
+
+#pragma once
+
+#include "outfile.h"
+
+#define ARCHIVE_MAGIC			(0x50443241)	// "A2DP"
+#define ARCHIVE_VERSION			(1)
+#define ARCHIVE_HEADER_SIZE		(32)
+#define ARCHIVE_ENTRY_SIZE		(32)
+
+// Archive flags
+#define ARCHIVE_FLAG_BIGENDIAN	(1)		// 16-bit payload data is big-endian
+
+// Codec of an entry
+#define ARCHIVE_CODEC_RAW		(0)
+#define ARCHIVE_CODEC_RLE		(1)
+#define ARCHIVE_CODEC_PACKBITS	(2)
+
+// Pixel format of an entry
+#define ARCHIVE_FORMAT_RGB555		(1)		// 16-bit RGB555 with transparency bit
+#define ARCHIVE_FORMAT_BGR565		(2)
+#define ARCHIVE_FORMAT_RGB565		(3)
+#define ARCHIVE_FORMAT_INDEX8		(4)		// 8-bit palette index
+#define ARCHIVE_FORMAT_MONO1		(5)		// 1-bit from alpha
+#define ARCHIVE_FORMAT_RGB444		(6)		// 2 pixels packed in 3 bytes
+#define ARCHIVE_FORMAT_ALPHA8		(7)
+#define ARCHIVE_FORMAT_PALETTE		(8)		// 256 x RGB555, 16 x with 4-bit index
+#define ARCHIVE_FORMAT_TILEWIDTH	(9)
+#define ARCHIVE_FORMAT_TILEHEIGHT	(10)
+#define ARCHIVE_FORMAT_INDEX4		(11)	// 4-bit palette index, 2 pixels per byte, first in the low nibble
+#define ARCHIVE_FORMAT_TILEBANK		(12)	// palette bank per tile
+#define ARCHIVE_FORMAT_GREY4		(13)	// 4-bit luminance, 2 pixels per byte, first in the low nibble
+#define ARCHIVE_FORMAT_RGB332		(14)	// 8-bit direct color
+#define ARCHIVE_FORMAT_ARGB4444		(15)
+#define ARCHIVE_FORMAT_ARGB1555		(16)
+#define ARCHIVE_FORMAT_ALPHA4		(17)	// 2 pixels per byte, first in the low bits
+#define ARCHIVE_FORMAT_ALPHA2		(18)	// 4 pixels per byte, first in the low bits
+#define ARCHIVE_FORMAT_ALPHASPAN	(19)	// transparent, opaque and partial spans per row
+#define ARCHIVE_FORMAT_RGB565A8		(20)	// RGB565 word and alpha byte per pixel
+#define ARCHIVE_FORMAT_RGB565A4		(21)	// 8 RGB565 words and 4 bytes of 4-bit alpha per 8 pixels
+
+struct ARCHIVEHEADER
+{
+	unsigned int magic;
+	unsigned short version;
+	unsigned short header_size;
+	unsigned int alignment;
+	unsigned int entry_count;
+	unsigned int index_offset;
+	unsigned int names_offset;
+	unsigned int names_size;
+	unsigned int flags;			// ARCHIVE_FLAG_*
+};
+
+struct ARCHIVEENTRY
+{
+	unsigned int hash;			// FNV-1a of the name
+	unsigned int name_offset;	// relative to names_offset
+	unsigned int offset;		// payload, from start of file
+	unsigned int size;			// payload size in bytes
+	unsigned int width;
+	unsigned int height;
+	unsigned short codec;
+	unsigned short format;
+	unsigned short config;		// configuration word of the image header
+	unsigned short reserved;
+};
+
+struct ARCHIVE
+{
+	bool open;
+	OUTFILE file;
+	unsigned int alignment;
+	unsigned int flags;
+	unsigned int position;
+	ARCHIVEENTRY * entries;
+	unsigned int entry_count;
+	unsigned int entry_capacity;
+	char * names;
+	unsigned int names_size;
+	unsigned int names_capacity;
+	unsigned char * palettes;		// palette payloads, entry offsets point here until ArchiveClose
+	unsigned int palettes_size;
+	unsigned int palettes_capacity;
+};
+
+unsigned int ArchiveHash(const char * name);
+bool ArchiveOpen(ARCHIVE * archive, const char * filename, unsigned int alignment);
+bool ArchiveAdd(ARCHIVE * archive, const char * name, const void * data, unsigned int size,
+				unsigned short codec, unsigned short format, unsigned int width, unsigned int height, unsigned short config);
+bool ArchiveClose(ARCHIVE * archive);
+void ArchiveAbort(ARCHIVE * archive);
@@ -0,0 +1,81 @@
+//=======================================================
+// byteorder.cpp
+//
+// Byte order helpers. 16-bit data is swapped eight words at a time with
+// SSE2 where available, so big-endian targets get their data in native
+// order without a swap pass at load time.
+//=======================================================
+
+#include "stdafx.h"
+
+#include <string.h>
+
+#if (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(_M_X64) || defined(__SSE2__)
+#define BYTEORDER_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "byteorder.h"
+
+//=======================================================
+// HostBigEndian
+//=======================================================
+bool HostBigEndian()
+{
+	const unsigned short probe = 0x0100;
+	return *(const unsigned char *)&probe != 0;
+}
+
+//=======================================================
+// Store16
+//=======================================================
+void Store16(unsigned char * dest, unsigned int value, bool bigendian)
+{
+	if (bigendian)
+	{
+		dest[0] = (unsigned char)(value >> 8);
+		dest[1] = (unsigned char)value;
+	} else {
+		dest[0] = (unsigned char)value;
+		dest[1] = (unsigned char)(value >> 8);
+	}
+}
+
+//=======================================================
+// Store32
+//=======================================================
+void Store32(unsigned char * dest, unsigned int value, bool bigendian)
+{
+	if (bigendian)
+	{
+		Store16(dest, value >> 16, true);
+		Store16(dest + 2, value, true);
+	} else {
+		Store16(dest, value, false);
+		Store16(dest + 2, value >> 16, false);
+	}
+}
+
+//=======================================================
+// SwapBytes16
+//=======================================================
+/** Copy 16-bit words, swapping the bytes of each
+	@param dest Destination, may be equal to source
+	@param source Source words
+	@param count Number of words
+*/
+void SwapBytes16(unsigned short * dest, const unsigned short * source, unsigned int count)
+{
+	unsigned int i = 0;
+
+#ifdef BYTEORDER_USE_SSE2
+	for ( ; i + 8 <= count; i += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)&source[i]);
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i *)&dest[i], v);
+	}
+#endif
+	for ( ; i < count; i++)
+		dest[i] = (unsigned short)((source[i] << 8) | (source[i] >> 8));
+}
@@ -0,0 +1,27 @@
+//=======================================================
+// byteorder.h
+//
+// Byte order helpers for the output files: explicit little/big-endian
+// stores for header fields and bulk byte swapping of 16-bit data.
+//=======================================================
+
+#pragma once
+
+/** Returns true if the host stores words big-endian
+*/
+bool HostBigEndian();
+
+/** Store a 16-bit value at dest in the requested byte order
+*/
+void Store16(unsigned char * dest, unsigned int value, bool bigendian);
+
+/** Store a 32-bit value at dest in the requested byte order
+*/
+void Store32(unsigned char * dest, unsigned int value, bool bigendian);
+
+/** Copy 16-bit words, swapping the bytes of each
+	@param dest Destination, may be equal to source
+	@param source Source words
+	@param count Number of words
+*/
+void SwapBytes16(unsigned short * dest, const unsigned short * source, unsigned int count);
@@ -0,0 +1,1337 @@
+//=======================================================
+// convert.cpp
+//
+// libalpha2ds conversion stages, see convert.h
+//=======================================================
+
+#include "stdafx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include <thread>
+#include <vector>
+
+#if (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(_M_X64) || defined(__SSE2__)
+#define CONVERT_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "rle.h"
+#include "byteorder.h"
+#include "convert.h"
+#include "quantize.h"
+#include "tilebank.h"
+#include "pixelformat.h"
+
+// images with fewer pixels per thread are converted on the calling thread
+#define CONVERT_THREAD_PIXELS	(65536)
+
+// palette entries and the keys of palette maps are RGB555, red in the low bits
+#define RGB555(r, g, b) ((((r) >> 3) << 0) | (((g) >> 3) << 5) | (((b) >> 3) << 10))
+
+//=======================================================
+// max
+//=======================================================
+
+static unsigned char max(unsigned char a, unsigned char b)
+{
+	if (a > b) return a;
+	return b;
+}
+
+//=======================================================
+// OutBuffer
+//=======================================================
+/** RLE sink appending encoded data to an OUTBUFFER
+	@param context Pointer to the OUTBUFFER
+	@param data Encoded data
+	@param size Number of bytes in data
+*/
+void OutBufferSink(void * context, const void * data, unsigned int size)
+{
+	OUTBUFFER * buffer = (OUTBUFFER *)context;
+
+	if (buffer->size + size > buffer->capacity)
+	{
+		unsigned int capacity = buffer->capacity ? buffer->capacity : 4096;
+		while (buffer->size + size > capacity) capacity *= 2;
+		buffer->data = (unsigned char *)realloc(buffer->data, capacity);
+		buffer->capacity = capacity;
+	}
+	memcpy(buffer->data + buffer->size, data, size);
+	buffer->size += size;
+}
+
+//=======================================================
+// ConvertDefaults
+//=======================================================
+/** Options of the tool without any switches: 16-bit RGB555 files
+*/
+void ConvertDefaults(CONVERTOPTIONS * options)
+{
+	options->OutputWidth = OutputWidth16Bit;
+	options->optRLE = false;
+	options->optPackBits = false;
+	options->optTile = false;
+	options->optAlphaTransparent = false;
+	options->optAlphaExternal = false;
+	options->optWidthmap = false;
+	options->optBGR565 = false;
+	options->optRGB565 = false;
+	options->optNoHeader = false;
+	options->optHeaderV2 = false;
+	options->optBigEndian = false;
+	options->optDebug = false;
+	options->Trace = NULL;
+	options->TraceContext = NULL;
+	options->TileSize = 8;
+	options->Alignment = 4;
+	options->PaletteMap = NULL;
+	options->optQuantize = false;
+	options->Threads = 1;
+	options->TileBanks = 0;
+	options->DirectFormat = 0;
+	options->AlphaBits = 8;
+	options->optAlphaSpans = false;
+	options->optPremultiply = false;
+	options->Interleave = 0;
+}
+
+//=======================================================
+// ConvertInitRGBA
+//=======================================================
+/** Describe a top-down RGBA buffer without padding between lines
+*/
+void ConvertInitRGBA(CONVERTIMAGE * image, const unsigned char * rgba, unsigned int width, unsigned int height)
+{
+	image->pixels = rgba;
+	image->width = width;
+	image->height = height;
+	image->pitch = (int)(width * 4);
+	image->bytespp = 4;
+	image->red = 0;
+	image->green = 1;
+	image->blue = 2;
+	image->alpha = 3;
+}
+
+//=======================================================
+// ConvertTileBanked
+//=======================================================
+/** Returns true if 8-bit tiles are written as 4-bit indices into
+	palette banks (-B)
+*/
+bool ConvertTileBanked(const CONVERTOPTIONS * options)
+{
+	return options->TileBanks && options->optTile && (options->OutputWidth == OutputWidth8Bit);
+}
+
+//=======================================================
+// ConvertInterleaved
+//=======================================================
+/** Returns true if 16-bit output is written as RGB565 interleaved with
+	its alpha (-I)
+*/
+bool ConvertInterleaved(const CONVERTOPTIONS * options)
+{
+	return options->Interleave && (options->OutputWidth == OutputWidth16Bit);
+}
+
+//=======================================================
+// ConvertPaletteSize
+//=======================================================
+/** Number of palette entries of the output, 0 if it has no palette.
+	4-bit output is indexed with -Q and greyscale otherwise.
+*/
+unsigned int ConvertPaletteSize(const CONVERTOPTIONS * options)
+{
+	if (options->OutputWidth == OutputWidth8Bit) return 256;
+	if ((options->OutputWidth == OutputWidth4Bit) && options->optQuantize) return 16;
+	return 0;
+}
+
+//=======================================================
+// ConvertImageFormat
+//=======================================================
+/** Archive format of the image data for the given options
+*/
+unsigned short ConvertImageFormat(const CONVERTOPTIONS * options)
+{
+	if (ConvertTileBanked(options)) return ARCHIVE_FORMAT_INDEX4;
+	if (ConvertInterleaved(options)) return (options->Interleave == 20) ? ARCHIVE_FORMAT_RGB565A4 : ARCHIVE_FORMAT_RGB565A8;
+	if (options->OutputWidth == OutputWidth8Bit) return ARCHIVE_FORMAT_INDEX8;
+	if (options->OutputWidth == OutputWidth1Bit) return ARCHIVE_FORMAT_MONO1;
+	if (options->OutputWidth == OutputWidth4Bit) return ConvertPaletteSize(options) ? ARCHIVE_FORMAT_INDEX4 : ARCHIVE_FORMAT_GREY4;
+	if (options->OutputWidth == OutputWidth3x4Bit) return ARCHIVE_FORMAT_RGB444;
+	return ConvertDirectFormat(options);
+}
+
+//=======================================================
+// ConvertDirectFormat
+//=======================================================
+/** Direct color format of the options, the output format if no other
+	output width is selected
+*/
+unsigned short ConvertDirectFormat(const CONVERTOPTIONS * options)
+{
+	if (options->DirectFormat) return options->DirectFormat;
+	if (options->optBGR565) return ARCHIVE_FORMAT_BGR565;
+	if (options->optRGB565) return ARCHIVE_FORMAT_RGB565;
+	return ARCHIVE_FORMAT_RGB555;
+}
+
+//=======================================================
+// ConvertPaletteFormat
+//=======================================================
+/** Direct color format of the palette entries (-6, -7)
+*/
+unsigned short ConvertPaletteFormat(const CONVERTOPTIONS * options)
+{
+	if (options->optBGR565) return ARCHIVE_FORMAT_BGR565;
+	if (options->optRGB565) return ARCHIVE_FORMAT_RGB565;
+	return ARCHIVE_FORMAT_RGB555;
+}
+
+//=======================================================
+// ConvertAlphaFormat
+//=======================================================
+/** Archive format of the alpha file for the given options
+*/
+unsigned short ConvertAlphaFormat(const CONVERTOPTIONS * options)
+{
+	if (options->optAlphaSpans) return ARCHIVE_FORMAT_ALPHASPAN;
+	if (options->AlphaBits == 4) return ARCHIVE_FORMAT_ALPHA4;
+	if (options->AlphaBits == 2) return ARCHIVE_FORMAT_ALPHA2;
+	return ARCHIVE_FORMAT_ALPHA8;
+}
+
+//=======================================================
+// ConvertFormatWordSized
+//=======================================================
+/** Returns true if data of the given ARCHIVE_FORMAT_* consists of 16-bit
+	words, which are written in the selected byte order
+*/
+bool ConvertFormatWordSized(unsigned short format)
+{
+	const PIXELFORMAT * direct = PixelFormatGet(format);
+
+	if (direct) return (direct->bits == 16);
+	return (format == ARCHIVE_FORMAT_PALETTE);
+}
+
+//=======================================================
+// ConvertFormatSize
+//=======================================================
+/** Uncompressed size in bytes of x * y units of the given ARCHIVE_FORMAT_*
+*/
+unsigned int ConvertFormatSize(unsigned short format, unsigned int x, unsigned int y)
+{
+	const PIXELFORMAT * direct = PixelFormatGet(format);
+
+	if (direct) return (unsigned int)((unsigned long long)x * y * direct->bits / 8);
+
+	switch (format)
+	{
+	case ARCHIVE_FORMAT_PALETTE:
+		return x * y * 2;
+	case ARCHIVE_FORMAT_MONO1:
+		return x * y / 8;
+	case ARCHIVE_FORMAT_INDEX4:
+	case ARCHIVE_FORMAT_GREY4:
+	case ARCHIVE_FORMAT_ALPHA4:
+		return (x * y + 1) / 2;
+	case ARCHIVE_FORMAT_ALPHA2:
+		return (x * y + 3) / 4;
+	case ARCHIVE_FORMAT_RGB565A8:
+		return x * y * 3;
+	case ARCHIVE_FORMAT_RGB565A4:
+		return (x * y + 7) / 8 * 20;
+	default:
+		return x * y;
+	}
+}
+
+//=======================================================
+// ConvertTile
+//=======================================================
+/** Rearrange an 8-bit buffer into tiles of size x size pixels
+	@return Returns the tiled buffer, NULL if out of memory
+*/
+static unsigned char * ConvertTile(const unsigned char * buffer, unsigned int x, unsigned int y, int size)
+{
+	unsigned char * tilebuffer = (unsigned char *)calloc(x * y + 1, 1);
+	unsigned char * tilepointer = tilebuffer;
+
+	if (!tilebuffer) return NULL;
+
+	int tilecount_x = x / size;
+	int tilecount_y = y / size;
+
+	for (int tiley = 0; tiley < tilecount_y; tiley++)		// for each tilerow
+	{
+		for (int tilex = 0; tilex < tilecount_x; tilex++)	// for each tile column
+		{
+			for (int i = 0; i < size; i++)					// for each line within tile
+			{
+				for (int j = 0; j < size; j++)				// for pixel within line
+				{
+					tilepointer[0] = buffer[
+						(tiley * (x) * size) +    // Start of Tilerow
+						(tilex * (size))  +	      // Start of Tilecolumn
+						(i * (x)) +				  // Line within Tile
+						j						  // Pixel within Line
+					];
+					tilepointer++;
+				}
+			}
+		}
+	}
+	return tilebuffer;
+}
+
+//=======================================================
+// ConvertTile16
+//=======================================================
+/** Rearrange a 16-bit buffer into tiles of size x size pixels
+	@return Returns the tiled buffer, NULL if out of memory
+*/
+static unsigned short * ConvertTile16(const unsigned short * buffer, unsigned int x, unsigned int y, int size)
+{
+	unsigned short * tilebuffer = (unsigned short *)calloc(x * y + 1, 2);
+	unsigned short * tilepointer = tilebuffer;
+
+	if (!tilebuffer) return NULL;
+
+	int tilecount_x = x / size;
+	int tilecount_y = y / size;
+
+	for (int tiley = 0; tiley < tilecount_y; tiley++)
+		for (int tilex = 0; tilex < tilecount_x; tilex++)
+			for (int i = 0; i < size; i++, tilepointer += size)
+				memcpy(tilepointer, buffer + (size_t)(tiley * size + i) * x + tilex * size, size * 2);
+
+	return tilebuffer;
+}
+
+//=======================================================
+// ConvertPackPairs
+//=======================================================
+/** Pack values of 4 or 2 bits two to a byte, the first in the low bits.
+	An odd count leaves the high bits of the last byte 0. dest may be
+	equal to src. 32 values are packed at a time with SSE2 where available.
+*/
+static void ConvertPackPairs(const unsigned char * src, unsigned char * dest, unsigned int count, unsigned int bits)
+{
+	unsigned char mask = (unsigned char)((1 << bits) - 1);
+	unsigned int i = 0;
+
+#ifdef CONVERT_USE_SSE2
+	const __m128i low = _mm_set1_epi16(mask);
+	const __m128i high = _mm_set1_epi16((short)(mask << bits));
+	const __m128i shift = _mm_cvtsi32_si128(8 - bits);
+
+	for ( ; i + 32 <= count; i += 32)
+	{
+		// each 16-bit lane holds a pair, first value in its low byte
+		__m128i a = _mm_loadu_si128((const __m128i *)&src[i]);
+		__m128i b = _mm_loadu_si128((const __m128i *)&src[i + 16]);
+		a = _mm_or_si128(_mm_and_si128(a, low), _mm_and_si128(_mm_srl_epi16(a, shift), high));
+		b = _mm_or_si128(_mm_and_si128(b, low), _mm_and_si128(_mm_srl_epi16(b, shift), high));
+		_mm_storeu_si128((__m128i *)&dest[i / 2], _mm_packus_epi16(a, b));
+	}
+#endif
+	for ( ; i + 2 <= count; i += 2)
+		dest[i / 2] = (unsigned char)((src[i] & mask) | ((src[i + 1] & mask) << bits));
+	if (i < count)
+		dest[i / 2] = (unsigned char)(src[i] & mask);
+}
+
+//=======================================================
+// ConvertAlphaLevel
+//=======================================================
+/** round(alpha * levels / 255), which is (x + (x >> 8)) >> 8 with
+	x = alpha * levels + 128
+*/
+static unsigned char ConvertAlphaLevel(unsigned char alpha, unsigned int levels)
+{
+	unsigned int x = alpha * levels + 128;
+	return (unsigned char)((x + (x >> 8)) >> 8);
+}
+
+//=======================================================
+// ConvertReduceAlpha
+//=======================================================
+/** Round alpha values to the nearest of the levels of the given number
+	of bits, in place. 16 values at a time with SSE2 where available.
+*/
+static void ConvertReduceAlpha(unsigned char * alpha, unsigned int count, unsigned int bits)
+{
+	unsigned int levels = (1 << bits) - 1;
+	unsigned int i = 0;
+
+	// same rounding as ConvertAlphaLevel
+#ifdef CONVERT_USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i factor = _mm_set1_epi16((short)levels);
+	const __m128i half = _mm_set1_epi16(128);
+
+	for ( ; i + 16 <= count; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)&alpha[i]);
+		__m128i a = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), factor), half);
+		__m128i b = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), factor), half);
+		a = _mm_srli_epi16(_mm_add_epi16(a, _mm_srli_epi16(a, 8)), 8);
+		b = _mm_srli_epi16(_mm_add_epi16(b, _mm_srli_epi16(b, 8)), 8);
+		_mm_storeu_si128((__m128i *)&alpha[i], _mm_packus_epi16(a, b));
+	}
+#endif
+	for ( ; i < count; i++) alpha[i] = ConvertAlphaLevel(alpha[i], levels);
+}
+
+//=======================================================
+// ConvertInterleave
+//=======================================================
+/** Interleave RGB565 colors with their alpha (-I), the color words in
+	the byte order of the output
+	@param color RGB565 colors
+	@param alpha Alpha values
+	@param count Number of pixels
+	@param layout 24: a color word and an alpha byte per pixel,
+	20: per block of 8 pixels 8 color words and 4 bytes of 4-bit alpha,
+	the first pixel in the low bits; the last block is filled with 0
+	@param bigendian Color words big-endian (-b)
+	@param dest Receives ConvertFormatSize of the layout bytes
+*/
+static void ConvertInterleave(const unsigned short * color, const unsigned char * alpha, unsigned int count, unsigned int layout, bool bigendian, unsigned char * dest)
+{
+	if (layout != 20)
+	{
+		for (unsigned int i = 0; i < count; i++, dest += 3)
+		{
+			Store16(dest, color[i], bigendian);
+			dest[2] = alpha[i];
+		}
+		return;
+	}
+
+	for (unsigned int block = 0; block < count; block += 8, dest += 20)
+	{
+		memset(dest, 0, 20);
+		for (unsigned int j = 0; (j < 8) && (block + j < count); j++)
+		{
+			Store16(dest + j * 2, color[block + j], bigendian);
+			dest[16 + j / 2] |= (unsigned char)(ConvertAlphaLevel(alpha[block + j], 15) << ((j & 1) * 4));
+		}
+	}
+}
+
+//=======================================================
+// ConvertSpanType
+//=======================================================
+/** Span type of an alpha value, ALPHASPAN_*
+*/
+static int ConvertSpanType(unsigned char alpha)
+{
+	if (alpha == 0) return ALPHASPAN_TRANSPARENT;
+	if (alpha == 255) return ALPHASPAN_OPAQUE;
+	return ALPHASPAN_PARTIAL;
+}
+
+//=======================================================
+// ConvertSpanLength
+//=======================================================
+/** Number of values from the start of alpha that have the given span
+	type, at most count. Whole blocks of 16 values are tested at a time
+	with SSE2 where available.
+*/
+static unsigned int ConvertSpanLength(const unsigned char * alpha, unsigned int count, int type)
+{
+	unsigned int n = 0;
+
+#ifdef CONVERT_USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i full = _mm_set1_epi8((char)0xFF);
+
+	for ( ; n + 16 <= count; n += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)&alpha[n]);
+		int transparent = _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+		int opaque = _mm_movemask_epi8(_mm_cmpeq_epi8(v, full));
+		int same;
+
+		if (type == ALPHASPAN_TRANSPARENT) same = transparent;
+		else if (type == ALPHASPAN_OPAQUE) same = opaque;
+		else same = ~(transparent | opaque) & 0xFFFF;
+
+		if (same != 0xFFFF) break;
+	}
+#endif
+	while ( (n < count) && (ConvertSpanType(alpha[n]) == type) ) n++;
+	return n;
+}
+
+//=======================================================
+// ConvertAlphaSpans
+//=======================================================
+/** Encode alpha values as spans (-S) in a single pass. Spans do not
+	cross the end of a row and are split after ALPHASPAN_MAX values.
+	@param alpha Alpha values, in tile order with -t
+	@param count Number of values
+	@param row Values per row, the tile size with -t
+	@param dest Receives the spans, up to 2 * count bytes
+	@return Returns the number of bytes in dest
+*/
+static unsigned int ConvertAlphaSpans(const unsigned char * alpha, unsigned int count, unsigned int row, unsigned char * dest)
+{
+	unsigned char * spanpointer = dest;
+
+	for (unsigned int start = 0; start < count; start += row)
+	{
+		unsigned int end = (count - start > row) ? start + row : count;
+
+		for (unsigned int i = start; i < end; )
+		{
+			int type = ConvertSpanType(alpha[i]);
+			unsigned int length = ConvertSpanLength(alpha + i, end - i, type);
+
+			for (unsigned int done = 0; done < length; )
+			{
+				unsigned int part = length - done;
+				if (part > ALPHASPAN_MAX) part = ALPHASPAN_MAX;
+
+				*spanpointer++ = (unsigned char)((type << 6) | (part - 1));
+				if (type == ALPHASPAN_PARTIAL) {
+					memcpy(spanpointer, alpha + i + done, part);
+					spanpointer += part;
+				}
+				done += part;
+			}
+			i += length;
+		}
+	}
+	return (unsigned int)(spanpointer - dest);
+}
+
+//=======================================================
+// ConvertRows
+//=======================================================
+/** State of the pixel loop of ConvertPixels
+*/
+struct CONVERTROWS
+{
+	const CONVERTOPTIONS * options;
+	const CONVERTIMAGE * image;
+	unsigned short * palette;			// extended unless palette_map is set
+	const PIXELFORMAT * direct;
+	const PIXELFORMAT * packed;
+	const PIXELFORMAT * palette_format;
+	const unsigned char * palette_map;
+	RLE_Stream16 * stream;				// 16-bit lines are fed into it, NULL if not streamed
+	bool narrow;
+	bool wide;
+	bool banked;
+	bool grey;
+	bool indexed;
+	unsigned int palette_size;
+	unsigned short * image_buffer4;
+	unsigned short int * image_buffer16;
+	unsigned char * image_buffer8;
+	unsigned char * image_buffer1;
+	unsigned char * alpha_buffer;
+};
+
+/** Convert a range of source lines into the buffers. Several ranges may
+	be converted at the same time if the palette is not extended, nothing
+	is streamed and each range starts at a multiple of 8 pixels (image1).
+	@param rows Loop state
+	@param first First line
+	@param last Line after the last one
+	@param colors Receives the number of colors missing from the palette
+*/
+static void ConvertRows(const CONVERTROWS * rows, unsigned int first, unsigned int last, unsigned int * colors)
+{
+	const CONVERTOPTIONS * options = rows->options;
+	const CONVERTIMAGE * image = rows->image;
+	unsigned short * palette = rows->palette;
+	const PIXELFORMAT * direct = rows->direct;
+	const PIXELFORMAT * packed = rows->packed;
+	const PIXELFORMAT * palette_format = rows->palette_format;
+	const unsigned char * palette_map = rows->palette_map;
+	RLE_Stream16 * stream = rows->stream;
+	bool narrow = rows->narrow;
+	bool wide = rows->wide;
+	bool banked = rows->banked;
+	bool grey = rows->grey;
+	bool indexed = rows->indexed;
+	unsigned int palette_size = rows->palette_size;
+	unsigned short * image_buffer4 = rows->image_buffer4;
+	unsigned short int * image_buffer16 = rows->image_buffer16;
+	unsigned char * image_buffer8 = rows->image_buffer8;
+	unsigned char * image_buffer1 = rows->image_buffer1;
+	unsigned char * alpha_buffer = rows->alpha_buffer;
+	unsigned int x = image->width;
+	unsigned int color_count = 0;
+	unsigned int pos = first * x;
+
+	for (unsigned y_c = first; y_c < last; y_c++)
+	{
+
+		const unsigned char *bits = image->pixels + (ptrdiff_t)image->pitch * (int)y_c;
+		unsigned short int pixel;
+		unsigned short int * line16 = stream ? image_buffer16 : image_buffer16 + pos;
+
+		if (narrow) PixelFormatConvert(direct, image, bits, options->optAlphaTransparent, options->optPremultiply, image_buffer8 + pos, x);
+		else if (wide) PixelFormatConvert(direct, image, bits, options->optAlphaTransparent, options->optPremultiply, line16, x);
+		if (packed) PixelFormatConvert(packed, image, bits, options->optAlphaTransparent, options->optPremultiply, image_buffer4 + pos, x);
+
+		for(unsigned x_c = 0; x_c < x; x_c++) {
+			unsigned char red = bits[image->red];
+			unsigned char green = bits[image->green];
+			unsigned char blue = bits[image->blue];
+			unsigned char alpha = bits[image->alpha];
+
+			if (options->optDebug && options->Trace) options->Trace(options->TraceContext,"bpp %u  X %u Y %u  alpha %u  R %u G %u B %u\n",image->bytespp,x_c,y_c,alpha,red,green,blue);
+
+
+			// 8-bit w/ palette
+			if (banked) {
+				// already mapped onto the banks
+			} else if (grey) {
+				// 4-bit luminance, ITU-R BT.601 weights
+				image_buffer8[pos] = (unsigned char)((red * 77 + green * 150 + blue * 29) >> 12);
+			} else if (!indexed) {
+				// direct colors only
+			} else if ( (alpha == 0) || (options->optAlphaTransparent && alpha != 255) )
+				image_buffer8[pos] = 0; // fully transparent pixels always position 0
+			else {
+
+				pixel = palette_format ? (unsigned short int)PixelFormatPack(palette_format, red, green, blue, 0) : RGB555(red, green, blue);
+
+				if (pixel == 0) image_buffer8[pos] = 1; // color 0,0,0 always at position 1
+				else if (palette_map) image_buffer8[pos] = palette_map[RGB555(red,green,blue)];
+				else
+				{
+
+					image_buffer8[pos] = 0;
+
+					int i = 2; // first two palette entries are fixed
+
+					while ( (i < (int)palette_size) && (palette[i] != 0) && (image_buffer8[pos] == 0) )
+					{
+						if (palette[i] == pixel) image_buffer8[pos] = i;
+						i++;
+					}
+
+					if (image_buffer8[pos] == 0)
+					{
+						color_count ++;
+						if (i < (int)palette_size) {
+							palette[i] = pixel;
+							image_buffer8[pos] = i;
+						} else {
+							image_buffer8[pos] = (unsigned char)(palette_size - 1);
+
+						}
+					}
+				}
+
+			}
+
+			// 1-bit bw
+			if (alpha == 0)
+				image_buffer1[pos/8] = (image_buffer1[pos/8] & ~(1 << (pos % 8) ) );
+			else
+				image_buffer1[pos/8] = (image_buffer1[pos/8] |  (1 << (pos % 8) ) );
+
+			// alpha data
+			alpha_buffer[pos] = alpha;
+
+			// jump to next pixel
+			pos++;
+			bits += image->bytespp;
+		}
+
+		if (stream) RLE_StreamFeed16(stream, image_buffer16, x);
+	}
+
+	*colors = color_count;
+}
+
+//=======================================================
+// ConvertPixels
+//=======================================================
+/** Pixel stage: convert the image into the uncompressed output buffers,
+	extend the palette and rearrange into tiles if requested
+	@param options Conversion options
+	@param image Source image
+	@param palette 8-bit palette, entries 2..255 are extended by new colors
+	(reduced ones with -Q) unless options->PaletteMap is set, replaced by
+	the banks with -B; entries 2..15 with 4-bit output and -Q
+	@param pixels Receives the buffers, release with ConvertFreePixels
+	@return Returns CONVERT_OK or a CONVERT_ERROR code
+*/
+int ConvertPixels(const CONVERTOPTIONS * options, const CONVERTIMAGE * image, unsigned short palette[256], CONVERTPIXELS * pixels)
+{
+	unsigned int x = image->width;
+	unsigned int y = image->height;
+	unsigned int pixel_count = x*y;
+
+	memset(pixels, 0, sizeof(CONVERTPIXELS));
+	if ( (options->TileSize < 2) || (options->TileSize > 64) || (options->TileSize & 1) ) return CONVERT_ERROR_TILE;
+
+	unsigned int tile_count = (x/options->TileSize) * (y/options->TileSize);
+	pixels->width = x;
+	pixels->height = y;
+
+	// direct colors (pixelformat.h) are converted line by line, 8-bit
+	// RGB332 into the 8-bit buffer
+	// colors interleaved with alpha (-I) are always RGB565
+	bool interleaved = ConvertInterleaved(options);
+	const PIXELFORMAT * direct = PixelFormatGet(interleaved ? ARCHIVE_FORMAT_RGB565 : ConvertDirectFormat(options));
+	const PIXELFORMAT * packed = (options->OutputWidth == OutputWidth3x4Bit) ? PixelFormatGet(ARCHIVE_FORMAT_RGB444) : NULL;
+	bool narrow = (options->OutputWidth == OutputWidth16Bit) && (direct->bits <= 8);
+	bool wide = ((options->OutputWidth == OutputWidth16Bit) || (options->OutputWidth == OutputWidth3x4Bit)) && (direct->bits == 16);
+
+	// 16-bit RLE output of RGB555 is compressed line by line during
+	// conversion, so only a single line of 16-bit pixels has to be kept
+	bool stream_rle = options->optRLE && !options->optPackBits && !options->optDebug && (options->OutputWidth == OutputWidth16Bit) &&
+		(direct->format == ARCHIVE_FORMAT_RGB555) && !interleaved;
+	unsigned int buffer16_count = stream_rle ? x : pixel_count;
+	RLE_Stream16 stream;
+
+	if (stream_rle) RLE_StreamInit16(&stream, STREAM_MARKER16, OutBufferSink, &pixels->stream_output);
+	pixels->streamed = stream_rle;
+
+	// 8-bit colors that do not fit into the palette are reduced (-Q),
+	// 4-bit output is always reduced to its 16 entries
+	bool banked = ConvertTileBanked(options);
+	bool nibbles = banked || (options->OutputWidth == OutputWidth4Bit);
+	bool grey = (options->OutputWidth == OutputWidth4Bit) && !ConvertPaletteSize(options);
+	bool indexed = (ConvertPaletteSize(options) != 0);
+	unsigned int palette_size = (options->OutputWidth == OutputWidth4Bit) ? 16 : 256;
+	const PIXELFORMAT * palette_format = NULL;
+
+	if (options->optBGR565) palette_format = PixelFormatGet(ARCHIVE_FORMAT_BGR565);
+	else if (options->optRGB565) palette_format = PixelFormatGet(ARCHIVE_FORMAT_RGB565);
+	const unsigned char * palette_map = options->PaletteMap;
+	unsigned char * quantize_map = NULL;
+
+	if (options->optQuantize && ConvertPaletteSize(options) && !banked && !palette_map)
+	{
+		bool quantized;
+
+		quantize_map = (unsigned char *)malloc(PALMAP_COLORS);
+		if (!quantize_map || (QuantizeImage(options, image, palette, quantize_map, &quantized) != CONVERT_OK)) {
+			free(quantize_map);
+			return CONVERT_ERROR_MEMORY;
+		}
+		if (quantized) palette_map = quantize_map;
+	}
+
+	unsigned short * image_buffer4 = (unsigned short *)calloc(pixel_count, 2);
+
+	pixels->image16 = (unsigned short int *)calloc(buffer16_count, 2);
+	pixels->image8 = (unsigned char *)calloc(pixel_count, 1);
+	pixels->image1 = (unsigned char *)calloc(pixel_count/4 + 1, 1);
+	pixels->alpha = (unsigned char *)calloc(pixel_count, 1);
+	pixels->tile_width = (unsigned char *)calloc(tile_count + 1, 1);
+	pixels->tile_height = (unsigned char *)calloc(tile_count + 1, 1);
+	pixels->image_4bitpacked = (unsigned char *)calloc(pixel_count*2 + 1, 1);
+	if (nibbles) pixels->image4 = (unsigned char *)calloc(pixel_count/2 + 1, 1);
+	if (banked) pixels->tile_bank = (unsigned char *)calloc(tile_count + 1, 1);
+	if (interleaved) {
+		pixels->interleaved_size = ConvertFormatSize(ConvertImageFormat(options), x, y);
+		pixels->interleaved = (unsigned char *)malloc(pixels->interleaved_size + 1);
+	}
+
+	if (!image_buffer4 || !pixels->image16 || !pixels->image8 || !pixels->image1 || !pixels->alpha ||
+		!pixels->tile_width || !pixels->tile_height || !pixels->image_4bitpacked ||
+		(nibbles && !pixels->image4) || (banked && !pixels->tile_bank) || (interleaved && !pixels->interleaved))
+	{
+		free(quantize_map);
+		free(image_buffer4);
+		ConvertFreePixels(pixels);
+		return CONVERT_ERROR_MEMORY;
+	}
+
+	// 4-bit tiles (-B) are mapped onto their banks in tile order beforehand
+	if (banked && (TileBankImage(options, image, palette, pixels->image8, pixels->tile_bank) != CONVERT_OK))
+	{
+		free(image_buffer4);
+		ConvertFreePixels(pixels);
+		return CONVERT_ERROR_MEMORY;
+	}
+
+	unsigned short int * image_buffer16 = pixels->image16;
+	unsigned char * image_buffer8 = pixels->image8;
+	unsigned char * image_buffer1 = pixels->image1;
+	unsigned char * alpha_buffer = pixels->alpha;
+
+	CONVERTROWS rows;
+	rows.options = options;
+	rows.image = image;
+	rows.palette = palette;
+	rows.direct = direct;
+	rows.packed = packed;
+	rows.palette_format = palette_format;
+	rows.palette_map = palette_map;
+	rows.stream = stream_rle ? &stream : NULL;
+	rows.narrow = narrow;
+	rows.wide = wide;
+	rows.banked = banked;
+	rows.grey = grey;
+	rows.indexed = indexed;
+	rows.palette_size = palette_size;
+	rows.image_buffer4 = image_buffer4;
+	rows.image_buffer16 = image_buffer16;
+	rows.image_buffer8 = image_buffer8;
+	rows.image_buffer1 = image_buffer1;
+	rows.alpha_buffer = alpha_buffer;
+
+	/********************************************************************************/
+	/* Walk through pixels and fill buffers                                         */
+	/********************************************************************************/
+	// large images are split into ranges of lines on options->Threads
+	// threads, unless the palette is extended pixel by pixel, the lines are
+	// streamed or traced (-v); ranges start at multiples of 8 lines, so no
+	// byte of the 1-bit buffer is shared
+	unsigned int threads = options->Threads ? options->Threads : 1;
+	if ((indexed && !palette_map && !banked && !grey) || stream_rle || options->optDebug) threads = 1;
+	if (threads > pixel_count / CONVERT_THREAD_PIXELS) threads = pixel_count / CONVERT_THREAD_PIXELS;
+	if (threads > y / 8) threads = y / 8;
+	if (threads < 1) threads = 1;
+
+	std::vector<std::thread> workers;
+	std::vector<unsigned int> color_counts(threads, 0);
+
+	for (unsigned int t = 1; t < threads; t++)
+		workers.push_back(std::thread(ConvertRows, &rows, (y * t / threads) & ~7u, (t + 1 < threads) ? ((y * (t + 1) / threads) & ~7u) : y, &color_counts[t]));
+	ConvertRows(&rows, 0, (threads > 1) ? ((y / threads) & ~7u) : y, &color_counts[0]);
+	for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+
+	if (stream_rle) pixels->stream_count = RLE_StreamFinish16(&stream);
+	pixels->color_count = color_counts[0];
+	free(quantize_map);
+
+	/********************************************************************************/
+	/* Rearrange 8-bit, 1-bit, alpha and -I colors into tiles if requested          */
+	/********************************************************************************/
+	if (options->optTile)
+	{
+		// the banks (-B) are mapped in tile order already
+		if ( ((options->OutputWidth == OutputWidth8Bit) && !banked) || (options->OutputWidth == OutputWidth4Bit) || narrow )
+		{
+			pixels->image8 = ConvertTile(image_buffer8, x, y, options->TileSize);
+			free(image_buffer8);
+			if (!pixels->image8) {
+				free(image_buffer4);
+				ConvertFreePixels(pixels);
+				return CONVERT_ERROR_MEMORY;
+			}
+		} // if 8-bit, 4-bit or RGB332
+
+		if (options->OutputWidth == OutputWidth1Bit)
+		{
+			unsigned char * tilebuffer;
+			tilebuffer = (unsigned char *)calloc(pixel_count/8 + 1, 1);
+			if (!tilebuffer) {
+				free(image_buffer4);
+				ConvertFreePixels(pixels);
+				return CONVERT_ERROR_MEMORY;
+			}
+			unsigned char * tilepointer = tilebuffer;
+			unsigned char last_pixel_x = 0;
+			unsigned char last_pixel_y = 0;
+
+			int tilecount_x = x / options->TileSize;
+			int tilecount_y = y / options->TileSize;
+
+			for (int tiley = 0; tiley < tilecount_y; tiley++)
+			{
+				for (int tilex = 0; tilex < tilecount_x; tilex++)
+				{
+					last_pixel_x = 0;
+					last_pixel_y = 0;
+
+					for (int i = 0; i < options->TileSize; i++)
+					{
+						for (int j = 0; j < options->TileSize / 8; j++)
+						{
+							tilepointer[0] = image_buffer1[
+								(tiley * (x / 8) * options->TileSize) +    // Start of Tilerow
+								(tilex * (options->TileSize / 8))  +	   // Start of Tilecolumn
+								(i * (x / 8)) +							   // Line within Tile
+								j										   // Pixel within Line
+							];
+
+							unsigned char pixcount = tilepointer[0];
+
+							if (pixcount & 0x80) last_pixel_x = max(last_pixel_x,(8*j) + 8);
+							else if (pixcount & 0x40) last_pixel_x = max(last_pixel_x,(8*j) + 7);
+							else if (pixcount & 0x20) last_pixel_x = max(last_pixel_x,(8*j) + 6);
+							else if (pixcount & 0x10) last_pixel_x = max(last_pixel_x,(8*j) + 5);
+							else if (pixcount & 0x08) last_pixel_x = max(last_pixel_x,(8*j) + 4);
+							else if (pixcount & 0x04) last_pixel_x = max(last_pixel_x,(8*j) + 3);
+							else if (pixcount & 0x02) last_pixel_x = max(last_pixel_x,(8*j) + 2);
+							else if (pixcount & 0x01) last_pixel_x = max(last_pixel_x,(8*j) + 1);
+
+							if (pixcount) last_pixel_y = i;
+
+							tilepointer++;
+						}
+					}
+
+					if (options->optDebug && options->Trace)
+					{
+						options->Trace(options->TraceContext,"Tile %d - w %d h %d\n",(tiley*tilecount_x)+tilex,last_pixel_x,last_pixel_y);
+					}
+
+					pixels->tile_width[(tiley*tilecount_x)+tilex] = last_pixel_x;
+					pixels->tile_height[(tiley*tilecount_x)+tilex] = last_pixel_y;
+				}
+			}
+
+
+			pixels->image1 = tilebuffer;
+			free(image_buffer1);
+		} // if (options->OutputWidth == OutputWidth1Bit)
+
+		if (interleaved)
+		{
+			pixels->image16 = ConvertTile16(image_buffer16, x, y, options->TileSize);
+			free(image_buffer16);
+			if (!pixels->image16) {
+				free(image_buffer4);
+				ConvertFreePixels(pixels);
+				return CONVERT_ERROR_MEMORY;
+			}
+		}
+
+		if (options->optAlphaExternal || interleaved)
+		{
+			pixels->alpha = ConvertTile(alpha_buffer, x, y, options->TileSize);
+			free(alpha_buffer);
+			if (!pixels->alpha) {
+				free(image_buffer4);
+				ConvertFreePixels(pixels);
+				return CONVERT_ERROR_MEMORY;
+			}
+		}
+	}
+
+	/********************************************************************************/
+	/* Interleave colors and alpha (-I)                                             */
+	/********************************************************************************/
+	if (interleaved) ConvertInterleave(pixels->image16, pixels->alpha, pixel_count, options->Interleave, options->optBigEndian, pixels->interleaved);
+
+	/********************************************************************************/
+	/* Pack 4-bit indices and luminance two to a byte                               */
+	/********************************************************************************/
+	if (nibbles) ConvertPackPairs(pixels->image8, pixels->image4, pixel_count, 4);
+
+	/********************************************************************************/
+	/* Alpha data as spans (-S), or reduced and packed to 4 or 2 bits (-A)          */
+	/********************************************************************************/
+	pixels->alpha_size = ConvertFormatSize(ConvertAlphaFormat(options), x, y);
+
+	if (options->optAlphaExternal && options->optAlphaSpans)
+	{
+		unsigned char * spanbuffer = (unsigned char *)malloc(pixel_count*2 + 1);
+		if (!spanbuffer) {
+			free(image_buffer4);
+			ConvertFreePixels(pixels);
+			return CONVERT_ERROR_MEMORY;
+		}
+		pixels->alpha_size = ConvertAlphaSpans(pixels->alpha, pixel_count, options->optTile ? options->TileSize : x, spanbuffer);
+		free(pixels->alpha);
+		pixels->alpha = spanbuffer;
+	}
+	else if (options->optAlphaExternal && (options->AlphaBits < 8))
+	{
+		ConvertReduceAlpha(pixels->alpha, pixel_count, options->AlphaBits);
+		ConvertPackPairs(pixels->alpha, pixels->alpha, pixel_count, options->AlphaBits);
+		if (options->AlphaBits == 2) ConvertPackPairs(pixels->alpha, pixels->alpha, (pixel_count + 1) / 2, 4);
+	}
+
+	/********************************************************************************/
+	/* Pack data for RGB444 file format                                             */
+	/********************************************************************************/
+	if (options->OutputWidth == OutputWidth3x4Bit)
+	{
+		unsigned char * image_buffer_4bitpacked = pixels->image_4bitpacked;
+		unsigned int i,j;
+
+		j = 0;
+
+		for (i=0; i<pixel_count/2; i++)
+		{
+			image_buffer_4bitpacked[j]   = ((image_buffer4[i*2]   & 0xFF0) >> 4);
+			image_buffer_4bitpacked[j+1] = ((image_buffer4[i*2]   & 0x00F) << 4) | ((image_buffer4[i*2+1] & 0xF00) >> 8);
+			image_buffer_4bitpacked[j+2] = ((image_buffer4[i*2+1] & 0x0FF));
+
+			j += 3;
+		}
+	}
+
+	free(image_buffer4);
+	return CONVERT_OK;
+}
+
+//=======================================================
+// ConvertSetOutput
+//=======================================================
+/** Fill in an output, data is copied
+	@return Returns false if out of memory
+*/
+static bool ConvertSetOutput(CONVERTOUTPUT * output, const void * data, unsigned int size, unsigned int count,
+							 unsigned int x, unsigned int y, unsigned int config, unsigned short format, bool header)
+{
+	output->data = (unsigned char *)malloc(size ? size : 1);
+	if (!output->data) return false;
+	memcpy(output->data, data, size);
+	output->size = size;
+	output->count = count;
+	output->width = x;
+	output->height = y;
+	output->config = (unsigned short)config;
+	output->format = format;
+	output->header = header;
+	output->raw_size = ConvertFormatSize(format, x, y);
+	return true;
+}
+
+//=======================================================
+// ConvertAlphaConfig
+//=======================================================
+/** Configuration word of the alpha file: that of the image, the width
+	bits replaced for spans (-S) and 4 and 2 bit alpha (-A)
+*/
+static unsigned int ConvertAlphaConfig(const CONVERTOPTIONS * options, unsigned int config)
+{
+	if (options->optAlphaSpans) return (config & (CONFIG_COMPRESSED | CONFIG_PACKBITS)) | CONFIG_SPANS;
+	if (options->AlphaBits == 4) return (config & (CONFIG_COMPRESSED | CONFIG_PACKBITS)) | CONFIG_4BIT;
+	if (options->AlphaBits == 2) return (config & (CONFIG_COMPRESSED | CONFIG_PACKBITS)) | CONFIG_2BIT;
+	return config;
+}
+
+//=======================================================
+// ConvertEncode
+//=======================================================
+/** Encoding stage: compress the buffers of the pixel stage and collect
+	all outputs of the image
+	@param options Conversion options
+	@param pixels Buffers of ConvertPixels
+	@param palette 8-bit palette
+	@param result Receives the outputs, release with ConvertFreeResult
+	@return Returns CONVERT_OK or a CONVERT_ERROR code
+*/
+int ConvertEncode(const CONVERTOPTIONS * options, const CONVERTPIXELS * pixels, const unsigned short palette[256], CONVERTRESULT * result)
+{
+	unsigned int x = pixels->width;
+	unsigned int y = pixels->height;
+	unsigned int pixel_count = x*y;
+	unsigned int config;
+	unsigned short format = ConvertImageFormat(options);
+	bool banked = ConvertTileBanked(options);
+	bool nibbles = banked || (options->OutputWidth == OutputWidth4Bit);
+	bool interleaved = ConvertInterleaved(options);
+	bool narrow = (options->OutputWidth == OutputWidth16Bit) && !ConvertFormatWordSized(format) && !interleaved;
+	bool bytes = narrow || (options->OutputWidth == OutputWidth8Bit);
+	unsigned int interleaved_config = CONFIG_INTERLEAVED | ((options->Interleave == 20) ? CONFIG_4BIT : CONFIG_8BIT);
+	unsigned int nibble_size = (pixel_count + 1) / 2;
+	unsigned int palette_size = ConvertPaletteSize(options);
+	unsigned short alpha_format = ConvertAlphaFormat(options);
+	unsigned int alpha_size = pixels->alpha_size;
+	bool ok = true;
+
+	memset(result, 0, sizeof(CONVERTRESULT));
+	result->color_count = pixels->color_count;
+
+	if (options->optRLE)
+	{
+		config = CONFIG_COMPRESSED;
+		if (options->optPackBits) config |= CONFIG_PACKBITS;
+
+		if (nibbles) config |= CONFIG_4BIT;
+		else if (interleaved) config |= interleaved_config;
+		else if (bytes) config |= CONFIG_8BIT;
+		else config |= CONFIG_16BIT;
+
+		// spans (-S) and interleaved colors (-I) take up to 3 bytes per
+		// pixel, PackBits adds one per 128
+		unsigned int largest = (alpha_size > pixels->interleaved_size) ? alpha_size : pixels->interleaved_size;
+		unsigned int compress_size = pixel_count*2*257/256+1;
+		if (largest + largest/128 + 2 > compress_size) compress_size = largest + largest/128 + 2;
+
+		unsigned short int * compress_buffer = 0;
+		if (!pixels->streamed || options->optAlphaExternal) {
+			compress_buffer = (unsigned short int *)malloc(compress_size);
+			if (!compress_buffer) return CONVERT_ERROR_MEMORY;
+		}
+
+		unsigned int outsize;
+
+		if (pixels->streamed) {
+			outsize = pixels->stream_count;
+		} else if (options->optPackBits) {
+			if (nibbles) outsize = RLE_CompressPB8(pixels->image4,(unsigned char *)compress_buffer,nibble_size);
+			else if (interleaved) outsize = RLE_CompressPB8(pixels->interleaved,(unsigned char *)compress_buffer,pixels->interleaved_size);
+			else if (bytes) outsize = RLE_CompressPB8(pixels->image8,(unsigned char *)compress_buffer,pixel_count);
+			else if (options->OutputWidth == OutputWidth1Bit) outsize = RLE_CompressPB8(pixels->image1,(unsigned char *)compress_buffer,pixel_count/8);
+			else outsize = RLE_CompressPB16(pixels->image16,compress_buffer,pixel_count);
+		} else {
+			if (nibbles) outsize = RLE_Compress8(pixels->image4,(unsigned char *)compress_buffer,nibble_size);
+			else if (interleaved) outsize = RLE_Compress8(pixels->interleaved,(unsigned char *)compress_buffer,pixels->interleaved_size);
+			else if (bytes) outsize = RLE_Compress8(pixels->image8,(unsigned char *)compress_buffer,pixel_count);
+			else if (options->OutputWidth == OutputWidth1Bit) outsize = RLE_Compress8(pixels->image1,(unsigned char *)compress_buffer,pixel_count/8);
+			else outsize = RLE_Compress16(pixels->image16,compress_buffer,pixel_count);
+		}
+
+		if (nibbles || interleaved || bytes || (options->OutputWidth == OutputWidth1Bit))
+			ok = ConvertSetOutput(&result->image,compress_buffer,outsize,outsize,x,y,config,format,true);
+		else if (pixels->streamed)
+			ok = ConvertSetOutput(&result->image,pixels->stream_output.data,outsize*2,outsize,x,y,config,format,true);
+		else
+			ok = ConvertSetOutput(&result->image,compress_buffer,outsize*2,outsize,x,y,config,format,true);
+
+		if (ok && options->optAlphaExternal) {
+			if (options->optPackBits) outsize = RLE_CompressPB8(pixels->alpha,(unsigned char *)compress_buffer,alpha_size);
+			else outsize = RLE_Compress8(pixels->alpha,(unsigned char *)compress_buffer,alpha_size);
+			ok = ConvertSetOutput(&result->alpha,compress_buffer,outsize,outsize,x,y,ConvertAlphaConfig(options,config),alpha_format,true);
+			result->alpha.raw_size = alpha_size;
+		}
+
+		free(compress_buffer);
+
+	} else {
+
+		config = CONFIG_UNCOMPRESSED;
+
+		if (nibbles) config |= CONFIG_4BIT;
+		else if (interleaved) config |= interleaved_config;
+		else if (bytes) config |= CONFIG_8BIT;
+		else config |= CONFIG_16BIT;
+
+		if (nibbles) ok = ConvertSetOutput(&result->image,pixels->image4,nibble_size,nibble_size,x,y,config,format,true);
+		else if (interleaved) ok = ConvertSetOutput(&result->image,pixels->interleaved,pixels->interleaved_size,pixels->interleaved_size,x,y,config,format,true);
+		else if (bytes) ok = ConvertSetOutput(&result->image,pixels->image8,pixel_count,pixel_count,x,y,config,format,true);
+		else if (options->OutputWidth == OutputWidth1Bit) ok = ConvertSetOutput(&result->image,pixels->image1,pixel_count/8,pixel_count,x,y,config,format,true);
+		else if (options->OutputWidth == OutputWidth3x4Bit) ok = ConvertSetOutput(&result->image,pixels->image_4bitpacked,pixel_count*3/2,pixel_count,x,y,config,format,true);
+		else ok = ConvertSetOutput(&result->image,pixels->image16,pixel_count*2,pixel_count,x,y,config,format,true);
+
+		if (ok && options->optAlphaExternal) {
+			ok = ConvertSetOutput(&result->alpha,pixels->alpha,alpha_size,alpha_size,x,y,ConvertAlphaConfig(options,config),alpha_format,true);
+			result->alpha.raw_size = alpha_size;
+		}
+	}
+
+	if (ok && palette_size)
+		ok = ConvertSetOutput(&result->palette,palette,palette_size*2,0,palette_size,1,CONFIG_UNCOMPRESSED,ARCHIVE_FORMAT_PALETTE,false);
+
+	if (ok && options->optWidthmap && options->optTile)
+	{
+		unsigned int tilecount_x = x/options->TileSize;
+		unsigned int tilecount_y = y/options->TileSize;
+
+		ok = ConvertSetOutput(&result->tile_width,pixels->tile_width,tilecount_x * tilecount_y,0,tilecount_x,tilecount_y,CONFIG_UNCOMPRESSED,ARCHIVE_FORMAT_TILEWIDTH,false) &&
+			 ConvertSetOutput(&result->tile_height,pixels->tile_height,tilecount_x * tilecount_y,0,tilecount_x,tilecount_y,CONFIG_UNCOMPRESSED,ARCHIVE_FORMAT_TILEHEIGHT,false);
+	}
+
+	if (ok && banked)
+	{
+		unsigned int tilecount_x = x/options->TileSize;
+		unsigned int tilecount_y = y/options->TileSize;
+
+		ok = ConvertSetOutput(&result->tile_bank,pixels->tile_bank,tilecount_x * tilecount_y,0,tilecount_x,tilecount_y,CONFIG_UNCOMPRESSED,ARCHIVE_FORMAT_TILEBANK,false);
+	}
+
+	if (!ok) {
+		ConvertFreeResult(result);
+		return CONVERT_ERROR_MEMORY;
+	}
+	return CONVERT_OK;
+}
+
+//=======================================================
+// ConvertImage
+//=======================================================
+/** Convert and encode an image
+	@param options Conversion options
+	@param image Source image
+	@param palette 8-bit palette, extended by new colors
+	@param result Receives the outputs, release with ConvertFreeResult
+	@return Returns CONVERT_OK or a CONVERT_ERROR code
+*/
+int ConvertImage(const CONVERTOPTIONS * options, const CONVERTIMAGE * image, unsigned short palette[256], CONVERTRESULT * result)
+{
+	CONVERTPIXELS pixels;
+	int error = ConvertPixels(options, image, palette, &pixels);
+
+	if (error != CONVERT_OK) return error;
+	error = ConvertEncode(options, &pixels, palette, result);
+	ConvertFreePixels(&pixels);
+	return error;
+}
+
+//=======================================================
+// ConvertSerialize
+//=======================================================
+/** Writer stage: header and byte order of an output
+	@param options Conversion options
+	@param output Output of ConvertEncode
+	@param header Build the header if the output has one and -n is not set
+	@param file Receives header and payload, release with ConvertFreeFile
+	@return Returns CONVERT_OK or a CONVERT_ERROR code
+*/
+int ConvertSerialize(const CONVERTOPTIONS * options, const CONVERTOUTPUT * output, bool header, CONVERTFILE * file)
+{
+	bool bigendian = options->optBigEndian;
+
+	memset(file, 0, sizeof(CONVERTFILE));
+	file->data = output->data;
+	file->size = output->size;
+
+	// 16-bit words (pixels, RLE codes, palette entries) in the requested byte order
+	if (ConvertFormatWordSized(output->format) && (bigendian != HostBigEndian()))
+	{
+		file->swapped = (unsigned short *)malloc(output->size + 1);
+		if (!file->swapped) return CONVERT_ERROR_MEMORY;
+		SwapBytes16(file->swapped, (const unsigned short *)output->data, output->size / 2);
+		file->data = file->swapped;
+	}
+
+	if (!header || !output->header || options->optNoHeader) return CONVERT_OK;
+
+	unsigned short codec = ARCHIVE_CODEC_RAW;
+	if (output->config & CONFIG_COMPRESSED) codec = (output->config & CONFIG_PACKBITS) ? ARCHIVE_CODEC_PACKBITS : ARCHIVE_CODEC_RLE;
+
+	if (options->optHeaderV2)
+	{
+		// header padded to the payload alignment
+		file->headersize = (HEADER_V2_SIZE + options->Alignment - 1) & ~(options->Alignment - 1);
+		file->header = (unsigned char *)calloc(file->headersize, 1);
+		if (!file->header) {
+			ConvertFreeFile(file);
+			return CONVERT_ERROR_MEMORY;
+		}
+
+		unsigned char * headerbytes = file->header;
+		memcpy(headerbytes, HEADER_V2_MAGIC, 4);
+		headerbytes[4] = HEADER_V2_VERSION;
+		headerbytes[5] = bigendian ? HEADER_V2_BIGENDIAN : HEADER_V2_LITTLEENDIAN;
+		Store16(headerbytes + 6, file->headersize, bigendian);
+		Store32(headerbytes + 8, output->width, bigendian);
+		Store32(headerbytes + 12, output->height, bigendian);
+		Store16(headerbytes + 16, codec, bigendian);
+		Store16(headerbytes + 18, output->format, bigendian);
+		Store16(headerbytes + 20, output->config, bigendian);
+		Store16(headerbytes + 22, options->optTile ? options->TileSize : 0, bigendian);
+		Store32(headerbytes + 24, options->Alignment, bigendian);
+		Store32(headerbytes + 28, output->count, bigendian);
+		Store32(headerbytes + 32, output->size, bigendian);
+		Store32(headerbytes + 36, output->raw_size, bigendian);
+	}
+	else
+	{
+		// the version 1 header stores the dimensions as 16-bit words
+		if ((output->width > 0xFFFF) || (output->height > 0xFFFF)) {
+			ConvertFreeFile(file);
+			return CONVERT_ERROR_SIZE;
+		}
+
+		file->headersize = HEADER_V1_SIZE;
+		file->header = (unsigned char *)malloc(HEADER_V1_SIZE);
+		if (!file->header) {
+			ConvertFreeFile(file);
+			return CONVERT_ERROR_MEMORY;
+		}
+
+		Store32(file->header, output->count, bigendian);
+		Store16(file->header + 4, output->width, bigendian);
+		Store16(file->header + 6, output->height, bigendian);
+		Store16(file->header + 8, output->config, bigendian);
+	}
+
+	return CONVERT_OK;
+}
+
+//=======================================================
+// ConvertFree
+//=======================================================
+/** Release the buffers of ConvertPixels
+*/
+void ConvertFreePixels(CONVERTPIXELS * pixels)
+{
+	free(pixels->image16);
+	free(pixels->image8);
+	free(pixels->image1);
+	free(pixels->image_4bitpacked);
+	free(pixels->image4);
+	free(pixels->alpha);
+	free(pixels->tile_width);
+	free(pixels->tile_height);
+	free(pixels->tile_bank);
+	free(pixels->interleaved);
+	free(pixels->stream_output.data);
+	memset(pixels, 0, sizeof(CONVERTPIXELS));
+}
+
+/** Release the outputs of ConvertEncode
+*/
+void ConvertFreeResult(CONVERTRESULT * result)
+{
+	free(result->image.data);
+	free(result->alpha.data);
+	free(result->palette.data);
+	free(result->tile_width.data);
+	free(result->tile_height.data);
+	free(result->tile_bank.data);
+	memset(result, 0, sizeof(CONVERTRESULT));
+}
+
+/** Release header and swapped payload of ConvertSerialize
+*/
+void ConvertFreeFile(CONVERTFILE * file)
+{
+	free(file->header);
+	free(file->swapped);
+	memset(file, 0, sizeof(CONVERTFILE));
+}
+
+//=======================================================
+// ConvertToBytes
+//=======================================================
+/** Convert an RGBA buffer into the image file the tool would write
+	@param options Conversion options
+	@param rgba Top-down RGBA pixels, 4 bytes per pixel
+	@param width Width in pixels
+	@param height Height in pixels
+	@return Returns header and payload, empty on error
+*/
+std::vector<unsigned char> ConvertToBytes(const CONVERTOPTIONS & options, const unsigned char * rgba, unsigned int width, unsigned int height)
+{
+	std::vector<unsigned char> bytes;
+	unsigned short palette[256] = { 0 };
+	CONVERTIMAGE image;
+	CONVERTRESULT result;
+	CONVERTFILE file;
+
+	ConvertInitRGBA(&image, rgba, width, height);
+	if (ConvertImage(&options, &image, palette, &result) != CONVERT_OK) return bytes;
+
+	if (ConvertSerialize(&options, &result.image, true, &file) == CONVERT_OK)
+	{
+		const unsigned char * data = (const unsigned char *)file.data;
+
+		bytes.reserve(file.headersize + file.size);
+		bytes.insert(bytes.end(), file.header, file.header + file.headersize);
+		bytes.insert(bytes.end(), data, data + file.size);
+		ConvertFreeFile(&file);
+	}
+
+	ConvertFreeResult(&result);
+	return bytes;
+}
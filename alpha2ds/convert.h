@@ -0,0 +1,225 @@
+//=======================================================
+// convert.h
+//
+// libalpha2ds: conversion of an image into the alpha2ds output formats,
+// independent of the command line tool. The stages can be run one by
+// one or all at once:
+//
+//   ConvertPixels     pixel conversion, palette, tiling (and line by
+//                     line RLE of 16-bit data)
+//   ConvertEncode     RLE / PackBits of the converted buffers
+//   ConvertSerialize  header and byte order of one output
+//
+//   ConvertImage      ConvertPixels + ConvertEncode
+//   ConvertToBytes    C++: RGBA buffer in, encoded image file out
+//
+// The stages keep their state in the structures passed to them, so
+// several threads may convert different images at the same time with one
+// CONVERTOPTIONS. The palette is extended by ConvertPixels and must not
+// be shared between threads.
+//=======================================================
+
+#pragma once
+
+#include <vector>
+
+#include "archive.h"
+
+// Result codes
+#define CONVERT_OK				(0)
+#define CONVERT_ERROR_MEMORY	(-1)	// out of memory
+#define CONVERT_ERROR_SIZE		(-2)	// dimensions do not fit into the version 1 header
+#define CONVERT_ERROR_TILE		(-3)	// tile size is not an even number from 2 to 64
+
+// Configuration word of the image header
+#define CONFIG_UNCOMPRESSED (0)
+#define CONFIG_COMPRESSED	(1)
+#define CONFIG_16BIT		(0)
+#define CONFIG_8BIT			(1 << 1)
+#define CONFIG_PACKBITS		(1 << 2)
+#define CONFIG_4BIT			(1 << 3)
+#define CONFIG_2BIT			(1 << 4)
+#define CONFIG_SPANS		(1 << 5)
+#define CONFIG_INTERLEAVED	(1 << 6)
+
+// Version 1 header
+#define HEADER_V1_SIZE			(10)
+
+// Version 2 header (-x)
+#define HEADER_V2_MAGIC			"A2DS"
+#define HEADER_V2_VERSION		(2)
+#define HEADER_V2_SIZE			(40)
+#define HEADER_V2_LITTLEENDIAN	(0)
+#define HEADER_V2_BIGENDIAN		(1)
+#define HEADER_V2_MAXALIGNMENT	(32768)
+
+// RLE marker for line by line compression of RGB555, where it cannot be
+// chosen from the whole image: transparent near-black is rare in converted
+// images. Other formats have no such value and are compressed as a whole.
+#define STREAM_MARKER16		(0x0421)
+
+// Alpha spans (-S): a control byte type << 6 | (length - 1) per span of
+// 1 to ALPHASPAN_MAX pixels, partial spans followed by their alpha values
+#define ALPHASPAN_TRANSPARENT	(0)
+#define ALPHASPAN_OPAQUE		(1)
+#define ALPHASPAN_PARTIAL		(2)
+#define ALPHASPAN_MAX			(64)
+
+enum OutputWidth
+{
+	OutputWidth1Bit,
+	OutputWidth8Bit,
+	OutputWidth16Bit,
+	OutputWidth4Bit,
+	OutputWidth3x4Bit
+
+};
+
+/** Receives the trace of -v, printf-style
+*/
+typedef void (*CONVERTTRACE)(void * context, const char * format, ...);
+
+/** Conversion options, set by the command line switches of the tool
+*/
+struct CONVERTOPTIONS
+{
+	enum OutputWidth OutputWidth;
+	bool optRLE;				// -r
+	bool optPackBits;			// -k
+	bool optTile;				// -t
+	bool optAlphaTransparent;	// -c
+	bool optAlphaExternal;		// -a
+	bool optWidthmap;			// -w
+	bool optBGR565;				// -6
+	bool optRGB565;				// -7
+	bool optNoHeader;			// -n
+	bool optHeaderV2;			// -x
+	bool optBigEndian;			// -b
+	bool optDebug;				// -v, traces every pixel and tile through Trace
+	CONVERTTRACE Trace;			// -v, NULL to trace nothing
+	void * TraceContext;		// passed to Trace
+	bool optQuantize;			// -Q, reduce the colors of 8-bit output by median cut, 16 color 4-bit output
+	unsigned short int TileSize;	// -d
+	unsigned int Alignment;		// -l, payload alignment of the version 2 header
+	const unsigned char * PaletteMap;	// -F, palette index per RGB555 color (palmap.h), NULL to extend the palette
+	unsigned int Threads;		// threads per image for the pixel loop and -Q, at least 1
+	unsigned int TileBanks;		// -B, 16 color palette banks of 4-bit tiles (-8 -t), 0 = off
+	unsigned short DirectFormat;	// -O, ARCHIVE_FORMAT_* of a direct color format (pixelformat.h), 0 = by -6 and -7
+	unsigned int AlphaBits;		// -A, bits per pixel of the alpha file: 8, 4 or 2
+	bool optAlphaSpans;			// -S, alpha file as transparent, opaque and partial spans
+	bool optPremultiply;		// -M, direct colors multiplied by alpha
+	unsigned int Interleave;	// -I, RGB565 and alpha interleaved: 24 or 20 bits per pixel, 0 = off
+};
+
+/** Source image, 8 bits per channel
+*/
+struct CONVERTIMAGE
+{
+	const unsigned char * pixels;	// top line
+	unsigned int width;
+	unsigned int height;
+	int pitch;						// bytes from one line to the next, negative for bottom-up
+	unsigned int bytespp;			// bytes per pixel
+	unsigned char red;				// offsets of the channels within a pixel
+	unsigned char green;
+	unsigned char blue;
+	unsigned char alpha;
+};
+
+/** Growable memory buffer, filled through OutBufferSink
+*/
+struct OUTBUFFER
+{
+	unsigned char * data;
+	unsigned int size;
+	unsigned int capacity;
+};
+
+/** Uncompressed buffers of the pixel stage
+*/
+struct CONVERTPIXELS
+{
+	unsigned int width;
+	unsigned int height;
+	unsigned short int * image16;	// one line only if streamed
+	unsigned char * image8;
+	unsigned char * image1;
+	unsigned char * image_4bitpacked;
+	unsigned char * image4;			// 4-bit indices or luminance, 2 pixels per byte
+	unsigned char * alpha;			// packed to options->AlphaBits, or spans with -S
+	unsigned int alpha_size;		// bytes in alpha
+	unsigned char * tile_width;
+	unsigned char * tile_height;
+	unsigned char * tile_bank;		// -B
+	unsigned char * interleaved;	// -I, colors and alpha
+	unsigned int interleaved_size;	// bytes in interleaved
+	unsigned int color_count;		// colors that did not fit into the palette included
+	bool streamed;					// 16-bit data was RLE compressed line by line
+	OUTBUFFER stream_output;
+	unsigned int stream_count;		// symbols in stream_output
+};
+
+/** One encoded output in host byte order, as written to a file
+*/
+struct CONVERTOUTPUT
+{
+	unsigned char * data;		// NULL if the output is not produced
+	unsigned int size;			// bytes in data
+	unsigned int count;			// count field of the image header
+	unsigned int width;
+	unsigned int height;
+	unsigned short config;		// configuration word
+	unsigned short format;		// ARCHIVE_FORMAT_*
+	bool header;				// preceded by the image header
+	unsigned int raw_size;		// bytes of the uncompressed data
+};
+
+/** All outputs of an image
+*/
+struct CONVERTRESULT
+{
+	CONVERTOUTPUT image;
+	CONVERTOUTPUT alpha;		// -a
+	CONVERTOUTPUT palette;		// -8
+	CONVERTOUTPUT tile_width;	// -w -t
+	CONVERTOUTPUT tile_height;	// -w -t
+	CONVERTOUTPUT tile_bank;	// -B -t
+	unsigned int color_count;
+};
+
+/** Header and payload of an output in the target byte order
+*/
+struct CONVERTFILE
+{
+	unsigned char * header;		// NULL if no header is written
+	unsigned int headersize;
+	const void * data;			// payload
+	unsigned int size;
+	unsigned short * swapped;	// byte swapped copy of the payload, owned
+};
+
+void OutBufferSink(void * context, const void * data, unsigned int size);
+
+void ConvertDefaults(CONVERTOPTIONS * options);
+void ConvertInitRGBA(CONVERTIMAGE * image, const unsigned char * rgba, unsigned int width, unsigned int height);
+
+unsigned short ConvertImageFormat(const CONVERTOPTIONS * options);
+unsigned short ConvertDirectFormat(const CONVERTOPTIONS * options);
+unsigned short ConvertPaletteFormat(const CONVERTOPTIONS * options);
+unsigned short ConvertAlphaFormat(const CONVERTOPTIONS * options);
+bool ConvertTileBanked(const CONVERTOPTIONS * options);
+bool ConvertInterleaved(const CONVERTOPTIONS * options);
+unsigned int ConvertPaletteSize(const CONVERTOPTIONS * options);
+bool ConvertFormatWordSized(unsigned short format);
+unsigned int ConvertFormatSize(unsigned short format, unsigned int x, unsigned int y);
+
+int ConvertPixels(const CONVERTOPTIONS * options, const CONVERTIMAGE * image, unsigned short palette[256], CONVERTPIXELS * pixels);
+int ConvertEncode(const CONVERTOPTIONS * options, const CONVERTPIXELS * pixels, const unsigned short palette[256], CONVERTRESULT * result);
+int ConvertImage(const CONVERTOPTIONS * options, const CONVERTIMAGE * image, unsigned short palette[256], CONVERTRESULT * result);
+int ConvertSerialize(const CONVERTOPTIONS * options, const CONVERTOUTPUT * output, bool header, CONVERTFILE * file);
+
+void ConvertFreePixels(CONVERTPIXELS * pixels);
+void ConvertFreeResult(CONVERTRESULT * result);
+void ConvertFreeFile(CONVERTFILE * file);
+
+std::vector<unsigned char> ConvertToBytes(const CONVERTOPTIONS & options, const unsigned char * rgba, unsigned int width, unsigned int height);
@@ -0,0 +1,343 @@
+//=======================================================
+// emit.cpp
+//
+// C source and ELF object output. Both are produced in large blocks
+// through OutFileAppend, so an asset costs a handful of writes no
+// matter how big it is.
+//=======================================================
+
+#include "stdafx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+
+#include "outfile.h"
+#include "byteorder.h"
+#include "emit.h"
+
+#define EMIT_BLOCK_SIZE		(65536)
+
+// bytes per line of the C array
+#define EMIT_LINE_BYTES		(16)
+
+//=======================================================
+// EmitNames
+//=======================================================
+/** Name of the emitted file and its symbol prefix
+	@param filename Name the output would have as a loose file
+	@param extension Extension of the emitted file, replacing the last one
+	@param symbol Receives the symbol prefix, stored behind the file name
+	@return Returns the malloc'ed file name, NULL if out of memory
+*/
+static char * EmitNames(const char * filename, const char * extension, const char ** symbol)
+{
+	size_t length = strlen(filename);
+	size_t start = length;
+	size_t stem = length;
+	char * names;
+	char * name;
+
+	// strip directory and last extension
+	while ( (start > 0) && (filename[start-1] != '/') && (filename[start-1] != '\\') ) start--;
+	for (size_t i = start; i < length; i++) if (filename[i] == '.') stem = i;
+
+	names = (char *)malloc(2 * length + strlen(extension) + 4);
+	if (!names) return NULL;
+
+	memcpy(names, filename, stem);
+	names[stem] = '.';
+	strcpy(names + stem + 1, extension);
+
+	// C identifier from the file name without directory and extension
+	name = names + strlen(names) + 1;
+	*symbol = name;
+	if ( (stem == start) || isdigit((unsigned char)filename[start]) ) *name++ = '_';
+	for (size_t i = start; i < stem; i++) *name++ = isalnum((unsigned char)filename[i]) ? filename[i] : '_';
+	*name = '\0';
+
+	return names;
+}
+
+//=======================================================
+// EmitBlock
+//=======================================================
+/** Text output collected into blocks of EMIT_BLOCK_SIZE bytes
+*/
+struct EMITBLOCK
+{
+	OUTFILE * file;
+	unsigned int fill;
+	char buffer[EMIT_BLOCK_SIZE];
+};
+
+static void EmitFlush(EMITBLOCK * block)
+{
+	OutFileAppend(block->file, block->buffer, block->fill);
+	block->fill = 0;
+}
+
+static void EmitText(EMITBLOCK * block, const char * text, unsigned int length)
+{
+	if (block->fill + length > EMIT_BLOCK_SIZE) EmitFlush(block);
+	memcpy(block->buffer + block->fill, text, length);
+	block->fill += length;
+}
+
+static void EmitPrintf(EMITBLOCK * block, const char * format, ...)
+{
+	char line[512];
+	va_list args;
+
+	va_start(args, format);
+	int length = vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+
+	if (length > 0) EmitText(block, line, (unsigned int)length < sizeof(line) ? length : sizeof(line) - 1);
+}
+
+//=======================================================
+// EmitC
+//=======================================================
+/** Write the payload as C/C++ source
+*/
+static bool EmitC(OUTFILE * file, const char * filename, const char * symbol, const unsigned char * data, const EMITINFO * info, unsigned int alignment)
+{
+	static const char digits[] = "0123456789abcdef";
+	EMITBLOCK * block = (EMITBLOCK *)malloc(sizeof(EMITBLOCK));
+
+	if (!block) return false;
+	block->file = file;
+	block->fill = 0;
+
+	EmitPrintf(block, "/* %s, generated by alpha2ds */\n\n", filename);
+	EmitPrintf(block,
+		"#ifndef ALPHA2DS_INFO_DEFINED\n"
+		"#define ALPHA2DS_INFO_DEFINED\n"
+		"struct alpha2ds_info\n"
+		"{\n"
+		"\tunsigned int size;\n"
+		"\tunsigned int width;\n"
+		"\tunsigned int height;\n"
+		"\tunsigned short config;\n"
+		"\tunsigned short format;\n"
+		"};\n"
+		"#endif\n\n");
+	EmitPrintf(block,
+		"#ifndef ALPHA2DS_ALIGN\n"
+		"#if defined(_MSC_VER)\n"
+		"#define ALPHA2DS_ALIGN(n) __declspec(align(n))\n"
+		"#else\n"
+		"#define ALPHA2DS_ALIGN(n) __attribute__((aligned(n)))\n"
+		"#endif\n"
+		"#endif\n\n");
+	EmitPrintf(block,
+		"#ifndef ALPHA2DS_EXTERN\n"
+		"#ifdef __cplusplus\n"
+		"#define ALPHA2DS_EXTERN extern \"C\"\n"
+		"#else\n"
+		"#define ALPHA2DS_EXTERN\n"
+		"#endif\n"
+		"#endif\n\n");
+
+	EmitPrintf(block, "ALPHA2DS_EXTERN ALPHA2DS_ALIGN(%u) const unsigned char %s_data[%u] = {\n",
+		alignment, symbol, info->size ? info->size : 1);
+
+	if (!info->size) EmitPrintf(block, "\t0\n");
+	for (unsigned int i = 0; i < info->size; i += EMIT_LINE_BYTES)
+	{
+		char line[EMIT_LINE_BYTES * 5 + 2];
+		unsigned int count = info->size - i < EMIT_LINE_BYTES ? info->size - i : EMIT_LINE_BYTES;
+		char * out = line;
+
+		*out++ = '\t';
+		for (unsigned int j = 0; j < count; j++)
+		{
+			unsigned char value = data[i + j];
+			out[0] = '0';
+			out[1] = 'x';
+			out[2] = digits[value >> 4];
+			out[3] = digits[value & 15];
+			out[4] = ',';
+			out += 5;
+		}
+		*out++ = '\n';
+		EmitText(block, line, (unsigned int)(out - line));
+	}
+
+	EmitPrintf(block, "};\n\n");
+	EmitPrintf(block, "ALPHA2DS_EXTERN const struct alpha2ds_info %s_info = { %uu, %uu, %uu, 0x%04x, %u };\n",
+		symbol, info->size, info->width, info->height, info->config, info->format);
+
+	EmitFlush(block);
+	free(block);
+	return !file->failed;
+}
+
+//=======================================================
+// EmitElf
+//=======================================================
+
+#define ELF_EHDR_SIZE		(52)
+#define ELF_SHDR_SIZE		(40)
+#define ELF_SYM_SIZE		(16)
+#define ELF_INFO_SIZE		(16)
+#define ELF_SECTIONS		(5)		// null, .rodata, .symtab, .strtab, .shstrtab
+
+static const char elf_section_names[] = "\0.rodata\0.symtab\0.strtab\0.shstrtab";
+
+static unsigned int EmitAlign(unsigned int value, unsigned int alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static void EmitSection(unsigned char * dest, unsigned int name, unsigned int type, unsigned int flags,
+						unsigned int offset, unsigned int size, unsigned int link, unsigned int info,
+						unsigned int alignment, unsigned int entsize, bool bigendian)
+{
+	Store32(dest, name, bigendian);
+	Store32(dest + 4, type, bigendian);
+	Store32(dest + 8, flags, bigendian);
+	Store32(dest + 12, 0, bigendian);
+	Store32(dest + 16, offset, bigendian);
+	Store32(dest + 20, size, bigendian);
+	Store32(dest + 24, link, bigendian);
+	Store32(dest + 28, info, bigendian);
+	Store32(dest + 32, alignment, bigendian);
+	Store32(dest + 36, entsize, bigendian);
+}
+
+/** Write the payload as ELF32 relocatable object with the symbols
+	<symbol>_data and <symbol>_info in .rodata
+*/
+static bool EmitElf(OUTFILE * file, const char * symbol, const unsigned char * data, const EMITINFO * info, unsigned int alignment, bool bigendian)
+{
+	unsigned int symbol_length = (unsigned int)strlen(symbol);
+	unsigned int rodata_align = alignment < 4 ? 4 : alignment;
+
+	// file layout
+	unsigned int rodata_offset = EmitAlign(ELF_EHDR_SIZE, rodata_align);
+	unsigned int info_offset = EmitAlign(info->size, 4);
+	unsigned int rodata_size = info_offset + ELF_INFO_SIZE;
+	unsigned int symtab_offset = EmitAlign(rodata_offset + rodata_size, 4);
+	unsigned int symtab_size = 3 * ELF_SYM_SIZE;
+	unsigned int strtab_offset = symtab_offset + symtab_size;
+	unsigned int strtab_size = 1 + 2 * (symbol_length + 6);
+	unsigned int shstrtab_offset = strtab_offset + strtab_size;
+	unsigned int shstrtab_size = sizeof(elf_section_names);
+	unsigned int shdr_offset = EmitAlign(shstrtab_offset + shstrtab_size, 4);
+	unsigned int end = shdr_offset + ELF_SECTIONS * ELF_SHDR_SIZE;
+
+	// everything before and after the payload
+	unsigned int tail_start = rodata_offset + info->size;
+	unsigned char * head = (unsigned char *)calloc(rodata_offset, 1);
+	unsigned char * tail = (unsigned char *)calloc(end - tail_start, 1);
+
+	if (!head || !tail)
+	{
+		free(head);
+		free(tail);
+		return false;
+	}
+
+	// ELF header
+	head[0] = 0x7F;
+	head[1] = 'E';
+	head[2] = 'L';
+	head[3] = 'F';
+	head[4] = 1;						// ELFCLASS32
+	head[5] = bigendian ? 2 : 1;		// ELFDATA2MSB / ELFDATA2LSB
+	head[6] = 1;						// EV_CURRENT
+	Store16(head + 16, 1, bigendian);	// ET_REL
+	Store16(head + 18, EMIT_ELF_MACHINE, bigendian);
+	Store32(head + 20, 1, bigendian);
+	Store32(head + 32, shdr_offset, bigendian);
+	Store32(head + 36, EMIT_ELF_FLAGS, bigendian);
+	Store16(head + 40, ELF_EHDR_SIZE, bigendian);
+	Store16(head + 46, ELF_SHDR_SIZE, bigendian);
+	Store16(head + 48, ELF_SECTIONS, bigendian);
+	Store16(head + 50, ELF_SECTIONS - 1, bigendian);
+
+	// metadata struct behind the payload
+	unsigned char * p = tail + rodata_offset + info_offset - tail_start;
+	Store32(p, info->size, bigendian);
+	Store32(p + 4, info->width, bigendian);
+	Store32(p + 8, info->height, bigendian);
+	Store16(p + 12, info->config, bigendian);
+	Store16(p + 14, info->format, bigendian);
+
+	// symbols: null, <symbol>_data, <symbol>_info (global objects in section 1)
+	p = tail + symtab_offset - tail_start + ELF_SYM_SIZE;
+	Store32(p, 1, bigendian);
+	Store32(p + 4, 0, bigendian);
+	Store32(p + 8, info->size, bigendian);
+	p[12] = 0x11;						// STB_GLOBAL, STT_OBJECT
+	Store16(p + 14, 1, bigendian);
+	p += ELF_SYM_SIZE;
+	Store32(p, 1 + symbol_length + 6, bigendian);
+	Store32(p + 4, info_offset, bigendian);
+	Store32(p + 8, ELF_INFO_SIZE, bigendian);
+	p[12] = 0x11;
+	Store16(p + 14, 1, bigendian);
+
+	char * names = (char *)tail + strtab_offset - tail_start + 1;
+	sprintf(names, "%s_data", symbol);
+	sprintf(names + symbol_length + 6, "%s_info", symbol);
+
+	memcpy(tail + shstrtab_offset - tail_start, elf_section_names, sizeof(elf_section_names));
+
+	// section headers, names index into elf_section_names
+	p = tail + shdr_offset - tail_start + ELF_SHDR_SIZE;
+	EmitSection(p, 1, 1, 2, rodata_offset, rodata_size, 0, 0, rodata_align, 0, bigendian);		// PROGBITS, ALLOC
+	p += ELF_SHDR_SIZE;
+	EmitSection(p, 9, 2, 0, symtab_offset, symtab_size, 3, 1, 4, ELF_SYM_SIZE, bigendian);		// SYMTAB
+	p += ELF_SHDR_SIZE;
+	EmitSection(p, 17, 3, 0, strtab_offset, strtab_size, 0, 0, 1, 0, bigendian);				// STRTAB
+	p += ELF_SHDR_SIZE;
+	EmitSection(p, 25, 3, 0, shstrtab_offset, shstrtab_size, 0, 0, 1, 0, bigendian);			// STRTAB
+
+	OutFileAppend(file, head, rodata_offset);
+	OutFileAppend(file, data, info->size);
+	OutFileAppend(file, tail, end - tail_start);
+
+	free(head);
+	free(tail);
+	return !file->failed;
+}
+
+//=======================================================
+// EmitOutput
+//=======================================================
+/** Write an output as C source (EMIT_C) or ELF object (EMIT_ELF)
+	@param mode EMIT_C or EMIT_ELF
+	@param filename Name the output would have as a loose file
+	@param data Payload, already in target byte order
+	@param info Metadata of the payload
+	@param alignment Alignment of the payload in bytes (power of two)
+	@param bigendian Write the ELF object for a big-endian target
+	@return Returns true if successful
+*/
+bool EmitOutput(int mode, const char * filename, const void * data, const EMITINFO * info, unsigned int alignment, bool bigendian)
+{
+	const char * symbol;
+	char * names = EmitNames(filename, mode == EMIT_ELF ? "o" : "c", &symbol);
+	OUTFILE file;
+	bool result;
+
+	if (!names) return false;
+	if (!OutFileOpen(&file, names)) {
+		free(names);
+		return false;
+	}
+
+	if (mode == EMIT_ELF) result = EmitElf(&file, symbol, (const unsigned char *)data, info, alignment, bigendian);
+	else result = EmitC(&file, filename, symbol, (const unsigned char *)data, info, alignment);
+
+	if (!result) file.failed = true;
+	result = OutFileClose(&file);
+
+	free(names);
+	return result;
+}
@@ -0,0 +1,36 @@
+//=======================================================
+// emit.h
+//
+// Writes an output as source or object file that is linked into the
+// firmware directly, replacing a separate bin2c step:
+//
+//   -s c    C/C++ source with an aligned const array <symbol>_data and
+//           a struct alpha2ds_info <symbol>_info
+//   -s elf  ELF32 relocatable object (ARM EABI) with the same two
+//           symbols in .rodata
+//
+// The symbol is derived from the name of the output file, e.g.
+// "a.rle.bin" becomes a_rle_data / a_rle_info in a.rle.c or a.rle.o.
+//=======================================================
+
+#pragma once
+
+#define EMIT_NONE		(0)
+#define EMIT_C			(1)
+#define EMIT_ELF		(2)
+
+#define EMIT_ELF_MACHINE	(40)			// EM_ARM
+#define EMIT_ELF_FLAGS		(0x05000000)	// EF_ARM_EABI_VER5
+
+/** Metadata written next to the payload, layout of struct alpha2ds_info
+*/
+struct EMITINFO
+{
+	unsigned int size;			// payload size in bytes
+	unsigned int width;
+	unsigned int height;
+	unsigned short config;		// configuration word of the image header
+	unsigned short format;		// ARCHIVE_FORMAT_*
+};
+
+bool EmitOutput(int mode, const char * filename, const void * data, const EMITINFO * info, unsigned int alignment, bool bigendian);
@@ -0,0 +1,750 @@
+//=======================================================
+// fileio.cpp
+//
+// Batched file I/O. The io_uring backend talks to the kernel directly
+// through the io_uring_setup / io_uring_enter / io_uring_register system
+// calls, so no additional library is needed. Each group is run as a few
+// submissions that are waited for completely before the next one; the
+// ring never holds more than 2 x FILEIO_BATCH requests.
+//=======================================================
+
+#include "stdafx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// decides the backend
+#include "fileio.h"
+
+#ifdef FILEIO_USE_URING
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "outfile.h"
+
+#define FILEIO_ALIGN(size)	(((size) + 7) & ~7u)
+#define FILEIO_RETRIES		(16)		// failed io_uring_enter calls in a row before giving up
+#define FILEIO_PENDING		(-0x7FFFFFFF - 1)	// result of a request whose completion was not seen
+
+/** Output queued in the arena
+*/
+struct FILEIOWRITE
+{
+	std::string filename;
+	unsigned int offset;		// in the arena
+	unsigned int size;
+};
+
+#ifdef FILEIO_USE_URING
+
+/** Submission and completion queue of an io_uring instance
+*/
+struct FILEIORING
+{
+	int fd;
+	unsigned int tail;			// local submission tail
+	unsigned int * sq_tail;
+	unsigned int * sq_mask;
+	unsigned int * sq_array;
+	struct io_uring_sqe * sqes;
+	unsigned int * cq_head;
+	unsigned int * cq_tail;
+	unsigned int * cq_mask;
+	struct io_uring_cqe * cqes;
+	bool failed;				// a run was given up, requests may still be in flight
+	void * sq_map;
+	size_t sq_map_size;
+	void * cq_map;
+	size_t cq_map_size;
+	size_t sqes_size;
+};
+
+#endif
+
+struct FILEIO
+{
+	bool uring;
+	unsigned char * arena;
+	unsigned int arena_used;				// bytes of queued outputs
+	std::vector<FILEIOWRITE> writes;
+	std::vector<unsigned char *> buffers;	// own buffers of the last read group
+	std::string failed;						// first output that could not be written
+#ifdef FILEIO_USE_URING
+	FILEIORING ring;
+	bool registered;						// the arena is a registered buffer
+#endif
+};
+
+#ifdef FILEIO_USE_URING
+
+//=======================================================
+// RingSetup
+//=======================================================
+/** Create an io_uring instance and map its queues
+	@return Returns false if io_uring is not available
+*/
+static bool RingSetup(FILEIORING * ring, unsigned int entries)
+{
+	struct io_uring_params params;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&params, 0, sizeof(params));
+
+	ring->failed = false;
+	ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0) return false;
+
+	ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	// both queues share one mapping on kernels with IORING_FEAT_SINGLE_MMAP
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_map_size > ring->sq_map_size) ring->sq_map_size = ring->cq_map_size;
+		ring->cq_map_size = ring->sq_map_size;
+	}
+
+	ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_map == MAP_FAILED) {
+		close(ring->fd);
+		return false;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_map = ring->sq_map;
+	} else {
+		ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_map == MAP_FAILED) {
+			munmap(ring->sq_map, ring->sq_map_size);
+			close(ring->fd);
+			return false;
+		}
+	}
+
+	ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		if (ring->cq_map != ring->sq_map) munmap(ring->cq_map, ring->cq_map_size);
+		munmap(ring->sq_map, ring->sq_map_size);
+		close(ring->fd);
+		return false;
+	}
+
+	unsigned char * sq = (unsigned char *)ring->sq_map;
+	unsigned char * cq = (unsigned char *)ring->cq_map;
+
+	ring->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *)(sq + params.sq_off.array);
+	ring->cq_head = (unsigned int *)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	ring->tail = *ring->sq_tail;
+
+	return true;
+}
+
+//=======================================================
+// RingClose
+//=======================================================
+static void RingClose(FILEIORING * ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_map != ring->sq_map) munmap(ring->cq_map, ring->cq_map_size);
+	munmap(ring->sq_map, ring->sq_map_size);
+	close(ring->fd);
+}
+
+//=======================================================
+// RingSupports
+//=======================================================
+/** Check that the kernel knows all operations the backend uses
+*/
+static bool RingSupports(FILEIORING * ring)
+{
+	static const unsigned char needed[] = {
+		IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_WRITE,
+		IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED, IORING_OP_CLOSE,
+		IORING_OP_RENAMEAT, IORING_OP_UNLINKAT
+	};
+	size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe * probe = (struct io_uring_probe *)calloc(1, size);
+	bool result = true;
+
+	if (!probe) return false;
+
+	if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+		result = false;
+	} else {
+		for (size_t i = 0; i < sizeof(needed); i++)
+			if ( (needed[i] > probe->last_op) || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED) ) result = false;
+	}
+
+	free(probe);
+	return result;
+}
+
+//=======================================================
+// RingPrep
+//=======================================================
+/** Add a request to the submission queue
+	@param user_data Index of the request in the results of RingRun
+*/
+static struct io_uring_sqe * RingPrep(FILEIORING * ring, unsigned char opcode, int fd, const void * addr, unsigned int len, unsigned long long offset, unsigned int user_data)
+{
+	unsigned int index = ring->tail & *ring->sq_mask;
+	struct io_uring_sqe * sqe = &ring->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long long)(size_t)addr;
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->user_data = user_data;
+
+	ring->sq_array[index] = index;
+	ring->tail++;
+	return sqe;
+}
+
+//=======================================================
+// RingRun
+//=======================================================
+/** Submit all prepared requests and wait until every one has completed.
+	Errors other than EINTR are retried FILEIO_RETRIES times in a row,
+	then the run is given up and ring->failed is set: the ring cannot be
+	used any more, as requests may still be queued or in flight.
+	@param count Number of prepared requests
+	@param results Receives the result of each request at the index given by its user_data,
+	FILEIO_PENDING for requests whose completion was not seen
+	@return Returns false if the kernel refused the submission
+*/
+static bool RingRun(FILEIORING * ring, unsigned int count, int * results)
+{
+	unsigned int submitted = 0;
+	unsigned int completed = 0;
+	unsigned int failures = 0;
+
+	for (unsigned int i = ring->tail - count; i != ring->tail; i++)
+		results[ring->sqes[i & *ring->sq_mask].user_data] = FILEIO_PENDING;
+
+	__atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+
+	while (completed < count)
+	{
+		int entered = (int)syscall(__NR_io_uring_enter, ring->fd, count - submitted, count - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (entered < 0) {
+			if (errno == EINTR) continue;
+			if ( (submitted == 0) || (++failures > FILEIO_RETRIES) ) {
+				ring->failed = true;
+				return false;
+			}
+			entered = 0;
+		} else {
+			failures = 0;
+		}
+		submitted += entered;
+
+		unsigned int head = *ring->cq_head;
+		unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		while (head != tail)
+		{
+			struct io_uring_cqe * cqe = &ring->cqes[head & *ring->cq_mask];
+			results[cqe->user_data] = cqe->res;
+			completed++;
+			head++;
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	return true;
+}
+
+//=======================================================
+// FileIOReadUring
+//=======================================================
+/** Read a group of at most FILEIO_BATCH files with two submissions.
+	If the ring fails, the group is left to the plain reads.
+*/
+static void FileIOReadUring(FILEIO * io, FILEIOREAD * reads, unsigned int count, unsigned int * offset)
+{
+	int results[2 * FILEIO_BATCH];
+	struct statx stats[FILEIO_BATCH];
+	int fds[FILEIO_BATCH];
+	unsigned int slots[FILEIO_BATCH];
+	unsigned int used = 0;
+
+	// open and stat all files
+	for (unsigned int i = 0; i < count; i++)
+	{
+		struct io_uring_sqe * sqe = RingPrep(&io->ring, IORING_OP_OPENAT, AT_FDCWD, reads[i].filename, 0, 0, 2 * i);
+		sqe->open_flags = O_RDONLY | O_CLOEXEC;
+		sqe = RingPrep(&io->ring, IORING_OP_STATX, AT_FDCWD, reads[i].filename, STATX_SIZE, (unsigned long long)(size_t)&stats[i], 2 * i + 1);
+		sqe->statx_flags = AT_STATX_SYNC_AS_STAT;
+	}
+	if (!RingRun(&io->ring, 2 * count, results)) {
+		// the group is read again with plain reads
+		for (unsigned int i = 0; i < count; i++) if (results[2 * i] >= 0) close(results[2 * i]);
+		return;
+	}
+
+	// read each file into the arena or its own buffer, then close it
+	for (unsigned int i = 0; i < count; i++)
+	{
+		int fd = results[2 * i];
+		if (fd < 0) continue;
+
+		if ( (results[2 * i + 1] < 0) || (stats[i].stx_size > 0x7FFFFFFF) ) {
+			close(fd);
+			continue;
+		}
+
+		unsigned int size = (unsigned int)stats[i].stx_size;
+		unsigned char * buffer;
+		bool fixed = false;
+
+		if (size <= FILEIO_ARENA_SIZE - *offset) {
+			buffer = io->arena + *offset;
+			*offset += FILEIO_ALIGN(size);
+			fixed = io->registered;
+		} else {
+			buffer = (unsigned char *)malloc(size);
+			if (!buffer) {
+				close(fd);
+				continue;
+			}
+			io->buffers.push_back(buffer);
+		}
+
+		struct io_uring_sqe * sqe = RingPrep(&io->ring, fixed ? IORING_OP_READ_FIXED : IORING_OP_READ, fd, buffer, size, 0, 2 * used);
+		sqe->flags |= IOSQE_IO_LINK;
+		RingPrep(&io->ring, IORING_OP_CLOSE, fd, NULL, 0, 0, 2 * used + 1);
+
+		reads[i].data = buffer;
+		reads[i].size = size;
+		slots[used] = i;
+		fds[used] = fd;
+		used++;
+	}
+	if (!used) return;
+
+	if (!RingRun(&io->ring, 2 * used, results)) {
+		// descriptors whose linked close has completed are gone already
+		for (unsigned int k = 0; k < used; k++)
+			if ( (results[2 * k + 1] == FILEIO_PENDING) || (results[2 * k + 1] == -ECANCELED) ) close(fds[k]);
+		return;
+	}
+
+	for (unsigned int k = 0; k < used; k++)
+	{
+		FILEIOREAD * read = &reads[slots[k]];
+		read->ok = (results[2 * k] >= 0) && ((unsigned int)results[2 * k] == read->size);
+
+		// a short read cancels the linked close
+		if (results[2 * k + 1] == -ECANCELED) close(fds[k]);
+	}
+}
+
+//=======================================================
+// FileIOFlushUring
+//=======================================================
+/** Write all queued outputs with three submissions
+*/
+static bool FileIOFlushUring(FILEIO * io)
+{
+	unsigned int count = (unsigned int)io->writes.size();
+	int results[2 * FILEIO_BATCH];
+	int fds[FILEIO_BATCH];
+	char * tempnames[FILEIO_BATCH];
+	bool written[FILEIO_BATCH];
+	bool result = true;
+
+	// open the temporary files
+	for (unsigned int i = 0; i < count; i++)
+	{
+		tempnames[i] = OutFileTempName(io->writes[i].filename.c_str());
+		fds[i] = -1;
+		written[i] = false;
+		if (!tempnames[i]) continue;
+
+		struct io_uring_sqe * sqe = RingPrep(&io->ring, IORING_OP_OPENAT, AT_FDCWD, tempnames[i], 0644, 0, i);
+		sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	}
+
+	unsigned int used = 0;
+	for (unsigned int i = 0; i < count; i++) if (tempnames[i]) used++;
+
+	if (used && RingRun(&io->ring, used, results))
+	{
+		for (unsigned int i = 0; i < count; i++) if (tempnames[i] && (results[i] >= 0)) fds[i] = results[i];
+	}
+	else if (used)
+	{
+		// remove the temporary files that were created
+		for (unsigned int i = 0; i < count; i++)
+		{
+			if (!tempnames[i] || (results[i] < 0)) continue;
+			close(results[i]);
+			unlink(tempnames[i]);
+		}
+	}
+
+	// write and close them
+	used = 0;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		if (fds[i] < 0) continue;
+
+		const FILEIOWRITE & write = io->writes[i];
+		struct io_uring_sqe * sqe = RingPrep(&io->ring, io->registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, fds[i], io->arena + write.offset, write.size, 0, 2 * i);
+		sqe->flags |= IOSQE_IO_LINK;
+		RingPrep(&io->ring, IORING_OP_CLOSE, fds[i], NULL, 0, 0, 2 * i + 1);
+		used += 2;
+	}
+
+	if (used && RingRun(&io->ring, used, results))
+	{
+		for (unsigned int i = 0; i < count; i++)
+		{
+			if (fds[i] < 0) continue;
+			if (results[2 * i + 1] == -ECANCELED) results[2 * i + 1] = close(fds[i]);
+			written[i] = (results[2 * i] >= 0) && ((unsigned int)results[2 * i] == io->writes[i].size) && (results[2 * i + 1] >= 0);
+		}
+	}
+	else if (used)
+	{
+		// descriptors whose linked close has completed are gone already,
+		// the temporary files are removed without the ring
+		for (unsigned int i = 0; i < count; i++)
+		{
+			if (fds[i] < 0) continue;
+			if ( (results[2 * i + 1] == FILEIO_PENDING) || (results[2 * i + 1] == -ECANCELED) ) close(fds[i]);
+			unlink(tempnames[i]);
+			fds[i] = -1;
+		}
+	}
+
+	// rename complete outputs into place, remove the others
+	used = 0;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		if (fds[i] < 0) continue;
+
+		if (written[i]) {
+			RingPrep(&io->ring, IORING_OP_RENAMEAT, AT_FDCWD, tempnames[i], AT_FDCWD, (unsigned long long)(size_t)io->writes[i].filename.c_str(), i);
+		} else {
+			RingPrep(&io->ring, IORING_OP_UNLINKAT, AT_FDCWD, tempnames[i], 0, 0, i);
+		}
+		used++;
+	}
+
+	if (used && !RingRun(&io->ring, used, results))
+		for (unsigned int i = 0; i < count; i++) written[i] = false;
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		if (fds[i] >= 0) {
+			if (results[i] < 0) written[i] = false;
+		}
+
+		if (!written[i]) {
+			if (result && io->failed.empty()) io->failed = io->writes[i].filename;
+			result = false;
+		}
+		free(tempnames[i]);
+	}
+
+	return result;
+}
+
+#endif
+
+//=======================================================
+// FileIOReadPlain
+//=======================================================
+/** Read one file with the plain system calls
+*/
+static void FileIOReadPlain(FILEIO * io, FILEIOREAD * read, unsigned int * offset)
+{
+#ifdef _WIN32
+	int fd = _open(read->filename, _O_RDONLY | _O_BINARY);
+	struct _stat info;
+	if (fd < 0) return;
+	if ( (_fstat(fd, &info) != 0) || (info.st_size > 0x7FFFFFFF) ) {
+		_close(fd);
+		return;
+	}
+#else
+	int fd = open(read->filename, O_RDONLY);
+	struct stat info;
+	if (fd < 0) return;
+	if ( (fstat(fd, &info) != 0) || (info.st_size > 0x7FFFFFFF) ) {
+		close(fd);
+		return;
+	}
+#endif
+
+	unsigned int size = (unsigned int)info.st_size;
+	unsigned char * buffer;
+
+	if (size <= FILEIO_ARENA_SIZE - *offset) {
+		buffer = io->arena + *offset;
+		*offset += FILEIO_ALIGN(size);
+	} else {
+		buffer = (unsigned char *)malloc(size);
+		if (buffer) io->buffers.push_back(buffer);
+	}
+
+	unsigned int done = 0;
+	while (buffer && (done < size))
+	{
+#ifdef _WIN32
+		int got = _read(fd, buffer + done, size - done);
+#else
+		int got = (int)pread(fd, buffer + done, size - done, done);
+#endif
+		if (got <= 0) break;
+		done += got;
+	}
+
+#ifdef _WIN32
+	_close(fd);
+#else
+	close(fd);
+#endif
+
+	read->data = buffer;
+	read->size = size;
+	read->ok = buffer && (done == size);
+}
+
+//=======================================================
+// FileIOCreate
+//=======================================================
+/** Create the I/O state of one thread
+	@param uring Use io_uring if the kernel supports it
+	@return Returns the state, or NULL if out of memory
+*/
+FILEIO * FileIOCreate(bool uring)
+{
+	FILEIO * io = new FILEIO;
+
+	io->uring = false;
+	io->arena_used = 0;
+#ifdef FILEIO_USE_URING
+	io->ring.failed = false;
+#endif
+	io->arena = (unsigned char *)malloc(FILEIO_ARENA_SIZE);
+	if (!io->arena) {
+		delete io;
+		return NULL;
+	}
+
+#ifdef FILEIO_USE_URING
+	io->registered = false;
+	if (uring && RingSetup(&io->ring, 2 * FILEIO_BATCH))
+	{
+		if (RingSupports(&io->ring)) {
+			struct iovec arena;
+
+			io->uring = true;
+
+			// without a registered buffer (e.g. memlock limit) plain reads and writes are used
+			arena.iov_base = io->arena;
+			arena.iov_len = FILEIO_ARENA_SIZE;
+			io->registered = syscall(__NR_io_uring_register, io->ring.fd, IORING_REGISTER_BUFFERS, &arena, 1) == 0;
+		} else {
+			RingClose(&io->ring);
+		}
+	}
+#endif
+
+	return io;
+}
+
+//=======================================================
+// FileIODestroy
+//=======================================================
+/** Release the I/O state, queued outputs have to be flushed before
+*/
+void FileIODestroy(FILEIO * io)
+{
+	if (!io) return;
+
+#ifdef FILEIO_USE_URING
+	if (io->uring || io->ring.failed) RingClose(&io->ring);
+#endif
+	for (size_t i = 0; i < io->buffers.size(); i++) free(io->buffers[i]);
+	free(io->arena);
+	delete io;
+}
+
+//=======================================================
+// FileIOUring
+//=======================================================
+/** @return Returns true if the state uses io_uring
+*/
+bool FileIOUring(const FILEIO * io)
+{
+	return io->uring;
+}
+
+//=======================================================
+// FileIORead
+//=======================================================
+/** Read a group of files completely. Files that cannot be read have ok
+	set to false. Queued outputs are written first, they share the arena.
+	@param io I/O state
+	@param reads Files to read
+	@param count Number of files
+*/
+void FileIORead(FILEIO * io, FILEIOREAD * reads, unsigned int count)
+{
+	unsigned int offset = 0;
+
+	if (!io->writes.empty()) FileIOFlush(io);
+
+	for (size_t i = 0; i < io->buffers.size(); i++) free(io->buffers[i]);
+	io->buffers.clear();
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		reads[i].data = NULL;
+		reads[i].size = 0;
+		reads[i].ok = false;
+	}
+
+	for (unsigned int first = 0; first < count; first += FILEIO_BATCH)
+	{
+		unsigned int group = (count - first < FILEIO_BATCH) ? count - first : FILEIO_BATCH;
+
+#ifdef FILEIO_USE_URING
+		if (io->uring) {
+			FileIOReadUring(io, reads + first, group, &offset);
+			if (!io->ring.failed) continue;
+
+			// read/write from now on, the group is read again
+			io->uring = false;
+			for (unsigned int i = first; i < first + group; i++) reads[i].ok = false;
+		}
+#endif
+		for (unsigned int i = 0; i < group; i++) FileIOReadPlain(io, &reads[first + i], &offset);
+	}
+}
+
+//=======================================================
+// FileIOQueueWrite
+//=======================================================
+/** Queue an output, it is written atomically by the next FileIOFlush.
+	Header and payload are copied, a queued output of the same name is
+	dropped.
+	@param io I/O state
+	@param filename Name of the output file
+	@param header Header bytes, may be NULL
+	@param headersize Number of bytes in header
+	@param data Payload
+	@param size Number of bytes in data
+	@return Returns false if a flush of the queue failed
+*/
+bool FileIOQueueWrite(FILEIO * io, const char * filename, const void * header, unsigned int headersize, const void * data, unsigned int size)
+{
+	unsigned int total = headersize + size;
+
+	// outputs larger than the arena are written directly
+	if (total > FILEIO_ARENA_SIZE)
+	{
+		if (!FileIOFlush(io)) return false;
+		if (OutFileWrite(filename, header, headersize, data, size)) return true;
+		if (io->failed.empty()) io->failed = filename;
+		return false;
+	}
+
+	if ( (total > FILEIO_ARENA_SIZE - io->arena_used) || (io->writes.size() == FILEIO_BATCH) )
+	{
+		if (!FileIOFlush(io)) return false;
+	}
+
+	// an output written again (shared palette) replaces the queued one,
+	// two renames of the same temporary file would fail
+	for (size_t i = 0; i < io->writes.size(); i++)
+	{
+		if (io->writes[i].filename == filename) {
+			io->writes.erase(io->writes.begin() + i);
+			break;
+		}
+	}
+
+	FILEIOWRITE write;
+	write.filename = filename;
+	write.offset = io->arena_used;
+	write.size = total;
+
+	if (headersize) memcpy(io->arena + io->arena_used, header, headersize);
+	memcpy(io->arena + io->arena_used + headersize, data, size);
+	io->arena_used += FILEIO_ALIGN(total);
+	io->writes.push_back(write);
+	return true;
+}
+
+//=======================================================
+// FileIOFlush
+//=======================================================
+/** Write all queued outputs
+	@param io I/O state
+	@return Returns false if an output could not be written, see FileIOFailed
+*/
+bool FileIOFlush(FILEIO * io)
+{
+	bool result = true;
+
+	if (io->writes.empty()) return true;
+
+#ifdef FILEIO_USE_URING
+	if (io->uring) {
+		// the outputs of a failed ring are reported, later ones use read/write
+		result = FileIOFlushUring(io);
+		if (io->ring.failed) io->uring = false;
+	} else
+#endif
+	{
+		for (size_t i = 0; i < io->writes.size(); i++)
+		{
+			const FILEIOWRITE & write = io->writes[i];
+			if (!OutFileWrite(write.filename.c_str(), NULL, 0, io->arena + write.offset, write.size)) {
+				if (result && io->failed.empty()) io->failed = write.filename;
+				result = false;
+			}
+		}
+	}
+
+	io->writes.clear();
+	io->arena_used = 0;
+	return result;
+}
+
+//=======================================================
+// FileIOFailed
+//=======================================================
+/** @return Returns the name of the first output that could not be written
+*/
+const char * FileIOFailed(const FILEIO * io)
+{
+	return io->failed.c_str();
+}
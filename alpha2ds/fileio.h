@@ -0,0 +1,48 @@
+//=======================================================
+// fileio.h
+//
+// Batched file I/O (-u) for runs over many small images, where the
+// open/read/write/close calls per file cost more than the conversion.
+// Input files are read in groups, outputs are queued and written in
+// groups, each group with a few submissions to io_uring on Linux:
+//
+//   read    openat + statx, then read + close
+//   write   openat of the temporary files, then write + close, then
+//           renameat into place (same atomic outputs as outfile.h)
+//
+// Data goes through a registered buffer (arena) per FILEIO, one FILEIO
+// per thread. Where io_uring is not available (other systems, old
+// kernels, FILEIO_USE_URING not defined) the same calls run one file
+// after the other with read / OutFileWrite.
+//=======================================================
+
+#pragma once
+
+#if defined(__linux__) && !defined(FILEIO_NO_URING)
+#define FILEIO_USE_URING
+#endif
+
+#define FILEIO_BATCH		(64)				// files per group
+#define FILEIO_ARENA_SIZE	(4 * 1024 * 1024)	// bytes per arena, larger files get their own buffer
+
+struct FILEIO;
+
+/** One file of a read group
+*/
+struct FILEIOREAD
+{
+	const char * filename;
+	const unsigned char * data;	// valid until the next FileIORead on the same FILEIO
+	unsigned int size;
+	bool ok;
+};
+
+FILEIO * FileIOCreate(bool uring);
+void FileIODestroy(FILEIO * io);
+bool FileIOUring(const FILEIO * io);
+
+void FileIORead(FILEIO * io, FILEIOREAD * reads, unsigned int count);
+
+bool FileIOQueueWrite(FILEIO * io, const char * filename, const void * header, unsigned int headersize, const void * data, unsigned int size);
+bool FileIOFlush(FILEIO * io);
+const char * FileIOFailed(const FILEIO * io);
@@ -0,0 +1,96 @@
+//=======================================================
+// loader.cpp
+//
+// libalpha2ds image loading: files and in-memory file images are
+// decoded by FreeImage and described as CONVERTIMAGE for the
+// conversion stages.
+//=======================================================
+
+#include "stdafx.h"
+
+#include "loader.h"
+
+//=======================================================
+// GenericLoader
+//=======================================================
+/** Generic image loader
+	@param lpszPathName Pointer to the full file name
+	@param flag Optional load flag constant
+	@return Returns the loaded dib if successful, returns NULL otherwise
+*/
+FIBITMAP* GenericLoader(const char* lpszPathName, int flag) {
+	FREE_IMAGE_FORMAT fif = FIF_UNKNOWN;
+
+	// check the file signature and deduce its format
+	// (the second argument is currently not used by FreeImage)
+	fif = FreeImage_GetFileType(lpszPathName, 0);
+	if(fif == FIF_UNKNOWN) {
+		// no signature ?
+		// try to guess the file format from the file extension
+		fif = FreeImage_GetFIFFromFilename(lpszPathName);
+	}
+	// check that the plugin has reading capabilities ...
+	if((fif != FIF_UNKNOWN) && FreeImage_FIFSupportsReading(fif)) {
+		// ok, let's load the file
+		FIBITMAP *dib = FreeImage_Load(fif, lpszPathName, flag);
+		// unless a bad file format, we are done !
+		return dib;
+	}
+	return NULL;
+}
+
+//=======================================================
+// GenericLoaderMemory
+//=======================================================
+/** Image loader for a file image held in memory
+	@param data File contents
+	@param size Number of bytes in data
+	@param flag Optional load flag constant
+	@return Returns the loaded dib if successful, returns NULL otherwise
+*/
+FIBITMAP* GenericLoaderMemory(BYTE* data, DWORD size, int flag) {
+	FIMEMORY *memory = FreeImage_OpenMemory(data, size);
+	FIBITMAP *dib = NULL;
+
+	if (!memory) return NULL;
+
+	// only the signature can tell the format, there is no file name
+	FREE_IMAGE_FORMAT fif = FreeImage_GetFileTypeFromMemory(memory, 0);
+	if((fif != FIF_UNKNOWN) && FreeImage_FIFSupportsReading(fif)) {
+		dib = FreeImage_LoadFromMemory(fif, memory, flag);
+	}
+	FreeImage_CloseMemory(memory);
+	return dib;
+}
+
+//=======================================================
+// LoaderImage
+//=======================================================
+/** Describe a loaded image for ConvertPixels. Images with other than
+	32 bits per pixel are converted first.
+	@param dib Loaded image
+	@param image Receives the description
+	@return Returns the 32-bit dib the description refers to (dib itself
+	or a converted copy, which has to be unloaded), NULL on error
+*/
+FIBITMAP* LoaderImage(FIBITMAP* dib, CONVERTIMAGE* image) {
+	FIBITMAP *dib32 = dib;
+
+	if (FreeImage_GetBPP(dib) != 32) {
+		dib32 = FreeImage_ConvertTo32Bits(dib);
+		if (!dib32) return NULL;
+	}
+
+	// FreeImage stores the bottom line first
+	image->width = FreeImage_GetWidth(dib32);
+	image->height = FreeImage_GetHeight(dib32);
+	image->pixels = FreeImage_GetScanLine(dib32, image->height - 1);
+	image->pitch = -(int)FreeImage_GetPitch(dib32);
+	image->bytespp = 4;
+	image->red = FI_RGBA_RED;
+	image->green = FI_RGBA_GREEN;
+	image->blue = FI_RGBA_BLUE;
+	image->alpha = FI_RGBA_ALPHA;
+
+	return dib32;
+}
@@ -0,0 +1,14 @@
+//=======================================================
+// loader.h
+//
+// libalpha2ds image loading through FreeImage
+//=======================================================
+
+#pragma once
+
+#include "FreeImage.h"
+#include "convert.h"
+
+FIBITMAP* GenericLoader(const char* lpszPathName, int flag);
+FIBITMAP* GenericLoaderMemory(BYTE* data, DWORD size, int flag);
+FIBITMAP* LoaderImage(FIBITMAP* dib, CONVERTIMAGE* image);
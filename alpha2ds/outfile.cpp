@@ -0,0 +1,302 @@
+//=======================================================
+// outfile.cpp
+//
+// Atomic output files: one write per file into a temporary name in the
+// same directory, then a rename over the target. Outputs produced in
+// blocks (C sources, object files) are appended to the temporary file
+// with OutFileAppend and renamed by OutFileClose. Pipeline mode writes
+// to the original stdout instead.
+//=======================================================
+
+#include "stdafx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <process.h>
+#else
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+#include "outfile.h"
+
+//=======================================================
+// OutFileTempName
+//=======================================================
+/** Name of the temporary file for an output, unique per process
+	@param filename Name of the output file
+	@return Returns the malloc'ed name, or NULL if out of memory
+*/
+char * OutFileTempName(const char * filename)
+{
+	size_t length = strlen(filename) + 32;
+	char * name = (char *)malloc(length);
+
+	if (!name) return NULL;
+#ifdef _WIN32
+	_snprintf(name, length, "%s.%d.tmp", filename, _getpid());
+#else
+	snprintf(name, length, "%s.%d.tmp", filename, (int)getpid());
+#endif
+	return name;
+}
+
+#ifdef _WIN32
+
+//=======================================================
+// OutFileWriteAll (Windows)
+//=======================================================
+/** Write header and payload with one _write call on a joined buffer
+*/
+static bool OutFileWriteAll(int fd, const void * header, unsigned int headersize, const void * data, unsigned int size)
+{
+	const unsigned char * buffer = (const unsigned char *)data;
+	unsigned char * joined = NULL;
+	unsigned int total = headersize + size;
+	bool result = true;
+
+	if (headersize > 0)
+	{
+		joined = (unsigned char *)malloc(total);
+		if (!joined) return false;
+		memcpy(joined, header, headersize);
+		memcpy(joined + headersize, data, size);
+		buffer = joined;
+	}
+
+	while (total > 0)
+	{
+		int written = _write(fd, buffer, total);
+		if (written <= 0) { result = false; break; }
+		buffer += written;
+		total -= written;
+	}
+
+	free(joined);
+	return result;
+}
+
+#else
+
+//=======================================================
+// OutFileWriteAll (POSIX)
+//=======================================================
+/** Write header and payload with one writev call, continuing after
+	short writes and writes interrupted by a signal
+*/
+static bool OutFileWriteAll(int fd, const void * header, unsigned int headersize, const void * data, unsigned int size)
+{
+	struct iovec vector[2];
+	struct iovec * next = vector;
+	int count = 0;
+
+	if (headersize > 0)
+	{
+		vector[count].iov_base = (void *)header;
+		vector[count].iov_len = headersize;
+		count++;
+	}
+	if (size > 0)
+	{
+		vector[count].iov_base = (void *)data;
+		vector[count].iov_len = size;
+		count++;
+	}
+
+	while (count > 0)
+	{
+		ssize_t written = writev(fd, next, count);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+
+		while (count > 0 && (size_t)written >= next->iov_len)
+		{
+			written -= next->iov_len;
+			next++;
+			count--;
+		}
+		if (count > 0)
+		{
+			next->iov_base = (char *)next->iov_base + written;
+			next->iov_len -= written;
+		}
+	}
+	return true;
+}
+
+#endif
+
+//=======================================================
+// OutFileOpen
+//=======================================================
+/** Create the temporary file for an output written in several blocks
+	@param file Output file state
+	@param filename Name of the output file
+	@return Returns true if successful
+*/
+bool OutFileOpen(OUTFILE * file, const char * filename)
+{
+	file->fd = -1;
+	file->failed = false;
+	file->filename = (char *)malloc(strlen(filename) + 1);
+	file->tempname = OutFileTempName(filename);
+	if (!file->filename || !file->tempname)
+	{
+		free(file->filename);
+		free(file->tempname);
+		return false;
+	}
+	strcpy(file->filename, filename);
+
+#ifdef _WIN32
+	file->fd = _open(file->tempname, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+	file->fd = open(file->tempname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+	if (file->fd < 0)
+	{
+		free(file->filename);
+		free(file->tempname);
+		return false;
+	}
+	return true;
+}
+
+//=======================================================
+// OutFileAppend
+//=======================================================
+/** Append a block to an output opened by OutFileOpen
+	@param file Output file state
+	@param data Block
+	@param size Number of bytes in data
+	@return Returns true if successful
+*/
+bool OutFileAppend(OUTFILE * file, const void * data, unsigned int size)
+{
+	if (!file->failed && !OutFileWriteAll(file->fd, 0, 0, data, size)) file->failed = true;
+	return !file->failed;
+}
+
+//=======================================================
+// OutFilePatch
+//=======================================================
+/** Overwrite a block written before (e.g. a header completed at the end),
+	later blocks are still appended at the end
+	@param file Output file state
+	@param offset Position of the block in the file
+	@param data Block
+	@param size Number of bytes in data
+	@return Returns true if successful
+*/
+bool OutFilePatch(OUTFILE * file, unsigned int offset, const void * data, unsigned int size)
+{
+	if (file->failed) return false;
+#ifdef _WIN32
+	if ( (_lseek(file->fd, offset, SEEK_SET) < 0) || !OutFileWriteAll(file->fd, 0, 0, data, size) ||
+		 (_lseek(file->fd, 0, SEEK_END) < 0) ) file->failed = true;
+#else
+	if ( (lseek(file->fd, offset, SEEK_SET) < 0) || !OutFileWriteAll(file->fd, 0, 0, data, size) ||
+		 (lseek(file->fd, 0, SEEK_END) < 0) ) file->failed = true;
+#endif
+	return !file->failed;
+}
+
+//=======================================================
+// OutFileClose
+//=======================================================
+/** Close an output opened by OutFileOpen and rename it into place. If a
+	block could not be written, the temporary file is removed instead.
+	@param file Output file state
+	@return Returns true if the output is complete
+*/
+bool OutFileClose(OUTFILE * file)
+{
+	bool result = !file->failed;
+
+#ifdef _WIN32
+	if (_close(file->fd) != 0) result = false;
+	if (result) result = MoveFileExA(file->tempname, file->filename, MOVEFILE_REPLACE_EXISTING) != 0;
+	if (!result) _unlink(file->tempname);
+#else
+	if (close(file->fd) != 0) result = false;
+	if (result) result = rename(file->tempname, file->filename) == 0;
+	if (!result) unlink(file->tempname);
+#endif
+
+	free(file->filename);
+	free(file->tempname);
+	file->fd = -1;
+	return result;
+}
+
+//=======================================================
+// OutFileWrite
+//=======================================================
+/** Write header and payload to a file, replacing it atomically
+	@param filename Name of the output file
+	@param header Header bytes, may be NULL
+	@param headersize Number of bytes in header
+	@param data Payload
+	@param size Number of bytes in data
+	@return Returns true if successful
+*/
+bool OutFileWrite(const char * filename, const void * header, unsigned int headersize, const void * data, unsigned int size)
+{
+	OUTFILE file;
+
+	if (!OutFileOpen(&file, filename)) return false;
+	if (!OutFileWriteAll(file.fd, header, headersize, data, size)) file.failed = true;
+	return OutFileClose(&file);
+}
+
+//=======================================================
+// OutFileWriteTo
+//=======================================================
+/** Write header and payload to an open descriptor (e.g. stdout) with a
+	single gathered write
+	@param fd Descriptor
+	@param header Header bytes, may be NULL
+	@param headersize Number of bytes in header
+	@param data Payload
+	@param size Number of bytes in data
+	@return Returns true if successful
+*/
+bool OutFileWriteTo(int fd, const void * header, unsigned int headersize, const void * data, unsigned int size)
+{
+	return OutFileWriteAll(fd, header, headersize, data, size);
+}
+
+//=======================================================
+// OutFileRedirectStdout
+//=======================================================
+/** Keep stdout for binary output and send everything printed to it
+	(progress and error messages) to stderr instead
+	@return Returns the descriptor of the original stdout, -1 on error
+*/
+int OutFileRedirectStdout()
+{
+	int fd;
+
+	fflush(stdout);
+#ifdef _WIN32
+	fd = _dup(_fileno(stdout));
+	if (fd < 0) return -1;
+	_setmode(fd, _O_BINARY);
+	if (_dup2(_fileno(stderr), _fileno(stdout)) != 0) return -1;
+#else
+	fd = dup(fileno(stdout));
+	if (fd < 0) return -1;
+	if (dup2(fileno(stderr), fileno(stdout)) < 0) return -1;
+#endif
+	return fd;
+}
@@ -0,0 +1,39 @@
+//=======================================================
+// outfile.h
+//
+// Writes an output file in one piece: header and payload go to a
+// temporary file next to the target with a single gathered write, and
+// the temporary file is renamed into place once it is complete. An
+// interrupted run never leaves a truncated output behind.
+//=======================================================
+
+#pragma once
+
+/** State of an output written in several blocks
+*/
+struct OUTFILE
+{
+	int fd;
+	bool failed;
+	char * filename;
+	char * tempname;
+};
+
+char * OutFileTempName(const char * filename);
+bool OutFileOpen(OUTFILE * file, const char * filename);
+bool OutFileAppend(OUTFILE * file, const void * data, unsigned int size);
+bool OutFilePatch(OUTFILE * file, unsigned int offset, const void * data, unsigned int size);
+bool OutFileClose(OUTFILE * file);
+
+/** Write header and payload to a file, replacing it atomically
+	@param filename Name of the output file
+	@param header Header bytes, may be NULL
+	@param headersize Number of bytes in header
+	@param data Payload
+	@param size Number of bytes in data
+	@return Returns true if successful
+*/
+bool OutFileWrite(const char * filename, const void * header, unsigned int headersize, const void * data, unsigned int size);
+
+bool OutFileWriteTo(int fd, const void * header, unsigned int headersize, const void * data, unsigned int size);
+int OutFileRedirectStdout();
@@ -0,0 +1,164 @@
+//=======================================================
+// palmap.cpp
+//
+// Nearest color search for fixed palettes. Colors are compared by the
+// squared distance of their three 5-bit components; the first of several
+// equally near entries wins, so the table does not depend on the host.
+//=======================================================
+
+#include "stdafx.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "byteorder.h"
+#include "outfile.h"
+#include "palmap.h"
+
+//=======================================================
+// PalMapHeader
+//=======================================================
+/** Cache header for a palette, entries are stored little-endian
+*/
+static void PalMapHeader(const unsigned short palette[256], const PIXELFORMAT * format, unsigned char header[PALMAP_HEADER_SIZE])
+{
+	memcpy(header, PALMAP_MAGIC, 4);
+	Store16(header + 4, format->format, false);
+	for (int i = 0; i < 256; i++) Store16(header + 6 + i * 2, palette[i], false);
+}
+
+//=======================================================
+// PalMapComponent
+//=======================================================
+/** One channel of a palette entry, cut or widened to 5 bits
+*/
+static int PalMapComponent(const PIXELFORMAT * format, unsigned short entry, int channel)
+{
+	int size = format->size[channel];
+	int value = (entry >> format->shift[channel]) & ((1 << size) - 1);
+
+	return (size >= 5) ? (value >> (size - 5)) : (value << (5 - size));
+}
+
+//=======================================================
+// PalMapColor
+//=======================================================
+unsigned short PalMapColor(const PIXELFORMAT * format, unsigned short entry)
+{
+	return (unsigned short)((PalMapComponent(format, entry, PIXELFORMAT_BLUE) << 10) |
+		(PalMapComponent(format, entry, PIXELFORMAT_GREEN) << 5) | PalMapComponent(format, entry, PIXELFORMAT_RED));
+}
+
+//=======================================================
+// PalMapEntry
+//=======================================================
+unsigned short PalMapEntry(const PIXELFORMAT * format, unsigned short color)
+{
+	return (unsigned short)PixelFormatPack(format, (unsigned char)((color & 0x1F) << 3), (unsigned char)(((color >> 5) & 0x1F) << 3), (unsigned char)(((color >> 10) & 0x1F) << 3), 0);
+}
+
+//=======================================================
+// PalMapBuild
+//=======================================================
+void PalMapBuild(const unsigned short palette[256], const PIXELFORMAT * format, unsigned char map[PALMAP_COLORS])
+{
+	PalMapBuildRange(palette, format, map, 0, PALMAP_COLORS, NULL);
+}
+
+//=======================================================
+// PalMapBuildRange
+//=======================================================
+void PalMapBuildRange(const unsigned short palette[256], const PIXELFORMAT * format, unsigned char map[PALMAP_COLORS], unsigned int first, unsigned int last, const unsigned int * used)
+{
+	unsigned char index[256];
+	int components[256][3];
+	int count = 0;
+
+	// black is always at position 1, then the entries in use
+	index[count] = 1;
+	components[count][0] = components[count][1] = components[count][2] = 0;
+	count++;
+
+	for (int i = 2; (i < 256) && (palette[i] != 0); i++)
+	{
+		index[count] = (unsigned char)i;
+		// in the order of the RGB555 colors: blue, green, red
+		components[count][0] = PalMapComponent(format, palette[i], PIXELFORMAT_BLUE);
+		components[count][1] = PalMapComponent(format, palette[i], PIXELFORMAT_GREEN);
+		components[count][2] = PalMapComponent(format, palette[i], PIXELFORMAT_RED);
+		count++;
+	}
+
+	for (unsigned int color = first; color < last; color++)
+	{
+		if (used && !used[color]) continue;
+
+		int c0 = (color >> 10) & 0x1F;
+		int c1 = (color >> 5) & 0x1F;
+		int c2 = color & 0x1F;
+		int best = 0;
+		int best_distance = 0x7FFFFFFF;
+
+		for (int i = 0; (i < count) && best_distance; i++)
+		{
+			int d0 = c0 - components[i][0];
+			int d1 = c1 - components[i][1];
+			int d2 = c2 - components[i][2];
+			int distance = d0 * d0 + d1 * d1 + d2 * d2;
+
+			if (distance < best_distance) {
+				best_distance = distance;
+				best = i;
+			}
+		}
+
+		map[color] = index[best];
+	}
+}
+
+//=======================================================
+// PalMapLoad
+//=======================================================
+/** Read a cached table
+	@param filename Name of the cache file
+	@param palette Palette the table must have been built from
+	@param format Format of the palette entries
+	@param map Receives the table
+	@return Returns false if the file is missing, damaged or was built
+	from a different palette
+*/
+bool PalMapLoad(const char * filename, const unsigned short palette[256], const PIXELFORMAT * format, unsigned char map[PALMAP_COLORS])
+{
+	unsigned char expected[PALMAP_HEADER_SIZE];
+	unsigned char header[PALMAP_HEADER_SIZE];
+	FILE * file = fopen(filename, "rb");
+
+	if (!file) return false;
+
+	PalMapHeader(palette, format, expected);
+	bool ok = (fread(header, 1, PALMAP_HEADER_SIZE, file) == PALMAP_HEADER_SIZE) &&
+		!memcmp(header, expected, PALMAP_HEADER_SIZE) &&
+		(fread(map, 1, PALMAP_COLORS, file) == PALMAP_COLORS) &&
+		(fgetc(file) == EOF);
+
+	fclose(file);
+	return ok;
+}
+
+//=======================================================
+// PalMapSave
+//=======================================================
+/** Write a table to its cache file
+	@param filename Name of the cache file
+	@param palette Palette the table was built from
+	@param format Format of the palette entries
+	@param map Table
+	@return Returns true if successful
+*/
+bool PalMapSave(const char * filename, const unsigned short palette[256], const PIXELFORMAT * format, const unsigned char map[PALMAP_COLORS])
+{
+	unsigned char header[PALMAP_HEADER_SIZE];
+
+	PalMapHeader(palette, format, header);
+	return OutFileWrite(filename, header, PALMAP_HEADER_SIZE, map, PALMAP_COLORS);
+}
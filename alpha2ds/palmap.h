@@ -0,0 +1,60 @@
+//=======================================================
+// palmap.h
+//
+// libalpha2ds fixed palettes (-F): an inverse lookup table holding the
+// nearest palette index for each of the 32768 RGB555 colors, so an image
+// is mapped onto a palette with one table read per pixel. The table is
+// built once per palette and cached on disk next to the palette file.
+//
+// Palette entries are decoded by their direct color format, so palettes
+// written with -6 or -7 are matched like RGB555 ones.
+//
+// Cache file (<palette file>.lut):
+//   4 bytes    "A2LT"
+//   2 bytes    ARCHIVE_FORMAT_* of the palette entries, little-endian
+//   512 bytes  palette the table was built from, 16-bit little-endian
+//   32768      palette index per RGB555 color
+//=======================================================
+
+#pragma once
+
+#include "pixelformat.h"
+
+#define PALMAP_COLORS		(32768)
+#define PALMAP_MAGIC		"A2LT"
+#define PALMAP_HEADER_SIZE	(4 + 2 + 256 * 2)
+
+/** Build the table: entry 1 is black, entries 2..255 are used up to the
+	first empty one, entry 0 (transparent) is never chosen
+	@param palette Palette in host byte order
+	@param format Format of the palette entries
+	@param map Receives the index of the nearest entry per RGB555 color
+*/
+void PalMapBuild(const unsigned short palette[256], const PIXELFORMAT * format, unsigned char map[PALMAP_COLORS]);
+
+/** Build part of the table, several threads may fill separate ranges
+	@param palette Palette in host byte order
+	@param format Format of the palette entries
+	@param map Table to fill
+	@param first First color
+	@param last Color after the last one
+	@param used Pixel count per color, only colors in use are mapped; NULL for all
+*/
+void PalMapBuildRange(const unsigned short palette[256], const PIXELFORMAT * format, unsigned char map[PALMAP_COLORS], unsigned int first, unsigned int last, const unsigned int * used);
+
+/** RGB555 color of a palette entry
+	@param format Format of the palette entry
+	@param entry Palette entry
+	@return Returns the color, red in the low bits
+*/
+unsigned short PalMapColor(const PIXELFORMAT * format, unsigned short entry);
+
+/** Palette entry of an RGB555 color
+	@param format Format of the palette entry
+	@param color Color, red in the low bits
+	@return Returns the entry
+*/
+unsigned short PalMapEntry(const PIXELFORMAT * format, unsigned short color);
+
+bool PalMapLoad(const char * filename, const unsigned short palette[256], const PIXELFORMAT * format, unsigned char map[PALMAP_COLORS]);
+bool PalMapSave(const char * filename, const unsigned short palette[256], const PIXELFORMAT * format, const unsigned char map[PALMAP_COLORS]);
@@ -0,0 +1,146 @@
+//=======================================================
+// pipeline.cpp
+//
+// Stage scheduling of a batch. The write stage runs on the calling
+// thread and waits for each job in list order, so outputs, archive
+// entries and messages come out exactly as in a sequential run.
+//=======================================================
+
+#include "stdafx.h"
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "pipeline.h"
+
+/** Shared state of the stages
+*/
+struct PIPELINESTATE
+{
+	const PIPELINE * pipeline;
+	size_t count;
+	std::mutex lock;
+	std::condition_variable changed;
+	std::deque<size_t> loaded;		// jobs waiting for a convert worker
+	std::vector<char> converted;	// per job, set when ready to be written
+	size_t written;					// jobs before this index are written
+	bool loading_done;
+	bool stop;
+};
+
+//=======================================================
+// PipelineLoad
+//=======================================================
+/** Load thread, runs ahead of the write stage by at most depth jobs
+*/
+static void PipelineLoad(PIPELINESTATE * state)
+{
+	const PIPELINE * pipeline = state->pipeline;
+
+	for (size_t i = 0; i < state->count; i++)
+	{
+		{
+			std::unique_lock<std::mutex> guard(state->lock);
+			while (!state->stop && (i >= state->written + pipeline->depth)) state->changed.wait(guard);
+			if (state->stop) break;
+		}
+
+		pipeline->load(pipeline->context, i);
+
+		{
+			std::lock_guard<std::mutex> guard(state->lock);
+			state->loaded.push_back(i);
+		}
+		state->changed.notify_all();
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(state->lock);
+		state->loading_done = true;
+	}
+	state->changed.notify_all();
+}
+
+//=======================================================
+// PipelineConvert
+//=======================================================
+/** Convert worker, takes loaded jobs until loading is done
+*/
+static void PipelineConvert(PIPELINESTATE * state)
+{
+	const PIPELINE * pipeline = state->pipeline;
+
+	for (;;)
+	{
+		size_t index;
+
+		{
+			std::unique_lock<std::mutex> guard(state->lock);
+			while (state->loaded.empty() && !state->loading_done) state->changed.wait(guard);
+			if (state->loaded.empty()) break;
+			index = state->loaded.front();
+			state->loaded.pop_front();
+		}
+
+		pipeline->convert(pipeline->context, index);
+
+		{
+			std::lock_guard<std::mutex> guard(state->lock);
+			state->converted[index] = 1;
+		}
+		state->changed.notify_all();
+	}
+}
+
+//=======================================================
+// PipelineRun
+//=======================================================
+/** Run all jobs through the stages
+	@param pipeline Stages and their configuration
+	@param count Number of jobs
+	@return Returns 0 if all jobs were written, the exit code of the write stage otherwise
+*/
+int PipelineRun(const PIPELINE * pipeline, size_t count)
+{
+	PIPELINESTATE state;
+	std::vector<std::thread> workers;
+	int exitcode = 0;
+
+	state.pipeline = pipeline;
+	state.count = count;
+	state.converted.assign(count, 0);
+	state.written = 0;
+	state.loading_done = false;
+	state.stop = false;
+
+	std::thread loader(PipelineLoad, &state);
+	for (unsigned int i = 0; i < pipeline->workers; i++)
+		workers.push_back(std::thread(PipelineConvert, &state));
+
+	for (size_t i = 0; i < count; i++)
+	{
+		{
+			std::unique_lock<std::mutex> guard(state.lock);
+			while (!state.converted[i]) state.changed.wait(guard);
+		}
+
+		exitcode = pipeline->write(pipeline->context, i);
+
+		{
+			std::lock_guard<std::mutex> guard(state.lock);
+			state.written = i + 1;
+			if (exitcode) state.stop = true;
+		}
+		state.changed.notify_all();
+
+		if (exitcode) break;
+	}
+
+	loader.join();
+	for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+
+	return exitcode;
+}
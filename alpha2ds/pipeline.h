@@ -0,0 +1,37 @@
+//=======================================================
+// pipeline.h
+//
+// Runs the stages of a batch overlapped: while image N is converted,
+// image N+1 is loaded and image N-1 is written.
+//
+//   load     one thread, in list order
+//   convert  a pool of worker threads, any order
+//   write    the calling thread, in list order
+//
+// At most "depth" images are between the start of their load and the
+// end of their write, which caps the memory held by the batch. The
+// stages work on jobs addressed by their index in the list.
+//=======================================================
+
+#pragma once
+
+#include <stddef.h>
+
+/** Stage function
+	@param context Pointer passed in the PIPELINE
+	@param index Index of the job
+	@return Returns 0 to continue, an exit code to stop the batch (write stage only)
+*/
+typedef int (*PIPELINESTAGE)(void * context, size_t index);
+
+struct PIPELINE
+{
+	PIPELINESTAGE load;
+	PIPELINESTAGE convert;
+	PIPELINESTAGE write;
+	void * context;
+	unsigned int workers;		// convert threads, at least 1
+	unsigned int depth;			// jobs in flight, at least workers + 2
+};
+
+int PipelineRun(const PIPELINE * pipeline, size_t count);
@@ -0,0 +1,195 @@
+//=======================================================
+// pixelformat.cpp
+//
+// Table of the direct color formats and their converter. With SSE2 and
+// 4 bytes per source pixel eight pixels are converted at a time: each
+// channel is extracted from the 32-bit lanes, cut to its width and
+// shifted into place, so every format of the table uses the same code.
+//=======================================================
+
+#include "stdafx.h"
+
+#include <string.h>
+
+#if (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(_M_X64) || defined(__SSE2__)
+#define PIXELFORMAT_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "archive.h"
+#include "pixelformat.h"
+
+// BGR565 and RGB565 keep 5 bits of green at bit 6, as they always did
+static const PIXELFORMAT PixelFormats[] =
+{
+	//  name		format						bits	  R  G  B  A		  R  G  B  A	alpha_visible
+	{ "rgb555",		ARCHIVE_FORMAT_RGB555,		16,		{ 5, 5, 5, 1 },	{  0, 5,10,15 },	true },
+	{ "bgr565",		ARCHIVE_FORMAT_BGR565,		16,		{ 5, 5, 5, 0 },	{ 11, 6, 0, 0 },	false },
+	{ "rgb565",		ARCHIVE_FORMAT_RGB565,		16,		{ 5, 5, 5, 0 },	{ 11, 6, 0, 0 },	false },
+	{ NULL,			ARCHIVE_FORMAT_RGB444,		12,		{ 4, 4, 4, 0 },	{  8, 4, 0, 0 },	false },
+	{ "rgb332",		ARCHIVE_FORMAT_RGB332,		8,		{ 3, 3, 2, 0 },	{  5, 2, 0, 0 },	false },
+	{ "argb4444",	ARCHIVE_FORMAT_ARGB4444,	16,		{ 4, 4, 4, 4 },	{  8, 4, 0,12 },	false },
+	{ "argb1555",	ARCHIVE_FORMAT_ARGB1555,	16,		{ 5, 5, 5, 1 },	{ 10, 5, 0,15 },	false },
+};
+
+#define PIXELFORMAT_COUNT	(sizeof(PixelFormats) / sizeof(PixelFormats[0]))
+
+//=======================================================
+// PixelFormatGet
+//=======================================================
+const PIXELFORMAT * PixelFormatGet(unsigned short format)
+{
+	for (size_t i = 0; i < PIXELFORMAT_COUNT; i++)
+		if (PixelFormats[i].format == format) return &PixelFormats[i];
+	return NULL;
+}
+
+//=======================================================
+// PixelFormatFind
+//=======================================================
+const PIXELFORMAT * PixelFormatFind(const char * name)
+{
+	for (size_t i = 0; i < PIXELFORMAT_COUNT; i++)
+		if (PixelFormats[i].name && !strcmp(PixelFormats[i].name, name)) return &PixelFormats[i];
+	return NULL;
+}
+
+//=======================================================
+// PixelFormatPack
+//=======================================================
+unsigned int PixelFormatPack(const PIXELFORMAT * format, unsigned char red, unsigned char green, unsigned char blue, unsigned char alpha)
+{
+	unsigned char value[4] = { red, green, blue, alpha };
+	unsigned int pixel = 0;
+
+	if (format->alpha_visible && alpha) value[PIXELFORMAT_ALPHA] = 255;
+
+	for (int c = 0; c < 4; c++)
+		if (format->size[c]) pixel |= (unsigned int)(value[c] >> (8 - format->size[c])) << format->shift[c];
+	return pixel;
+}
+
+//=======================================================
+// PixelFormatPremultiply
+//=======================================================
+/** round(value * alpha / 255), which is (x + (x >> 8)) >> 8 with
+	x = value * alpha + 128
+*/
+static unsigned char PixelFormatPremultiply(unsigned char value, unsigned char alpha)
+{
+	unsigned int x = value * alpha + 128;
+	return (unsigned char)((x + (x >> 8)) >> 8);
+}
+
+#ifdef PIXELFORMAT_USE_SSE2
+/** Shift counts of the channels of a format for a source layout
+*/
+struct PIXELFORMATSSE2
+{
+	__m128i offset[4];			// right shift of the channel to the low byte of the lane
+	__m128i drop[4];			// right shift cutting the channel to its width
+	__m128i shift[4];			// left shift to its position
+	bool alpha_transparent;
+	bool alpha_visible;
+	bool premultiply;
+	unsigned char size[4];
+};
+
+//=======================================================
+// PixelFormatLanes
+//=======================================================
+/** Convert the four source pixels in the 32-bit lanes of v
+	@return Returns the pixels in the low bits of the lanes
+*/
+static __m128i PixelFormatLanes(const PIXELFORMATSSE2 * k, __m128i v)
+{
+	const __m128i byte = _mm_set1_epi32(0xFF);
+	__m128i pixels = _mm_setzero_si128();
+	__m128i alpha = _mm_and_si128(_mm_srl_epi32(v, k->offset[PIXELFORMAT_ALPHA]), byte);
+
+	if (k->alpha_transparent) alpha = _mm_and_si128(_mm_cmpeq_epi32(alpha, byte), byte);
+
+	for (int c = 0; c < 4; c++)
+	{
+		if (!k->size[c]) continue;
+
+		__m128i channel = _mm_and_si128(_mm_srl_epi32(v, k->offset[c]), byte);
+		if (c == PIXELFORMAT_ALPHA)
+		{
+			channel = alpha;
+			if (k->alpha_visible) channel = _mm_andnot_si128(_mm_cmpeq_epi32(channel, _mm_setzero_si128()), byte);
+		}
+		else if (k->premultiply)
+		{
+			// the product fits the low word of the lane
+			__m128i x = _mm_add_epi32(_mm_mullo_epi16(channel, alpha), _mm_set1_epi32(128));
+			channel = _mm_srli_epi32(_mm_add_epi32(x, _mm_srli_epi32(x, 8)), 8);
+		}
+		pixels = _mm_or_si128(pixels, _mm_sll_epi32(_mm_srl_epi32(channel, k->drop[c]), k->shift[c]));
+	}
+	return pixels;
+}
+#endif
+
+//=======================================================
+// PixelFormatConvert
+//=======================================================
+void PixelFormatConvert(const PIXELFORMAT * format, const CONVERTIMAGE * image, const unsigned char * bits, bool alpha_transparent, bool premultiply, void * dest, unsigned int count)
+{
+	unsigned char * dest8 = (unsigned char *)dest;
+	unsigned short * dest16 = (unsigned short *)dest;
+	bool wide = (format->bits > 8);
+	unsigned int i = 0;
+
+#ifdef PIXELFORMAT_USE_SSE2
+	if (image->bytespp == 4)
+	{
+		PIXELFORMATSSE2 k;
+		const unsigned char offsets[4] = { image->red, image->green, image->blue, image->alpha };
+
+		for (int c = 0; c < 4; c++)
+		{
+			k.offset[c] = _mm_cvtsi32_si128(offsets[c] * 8);
+			k.drop[c] = _mm_cvtsi32_si128(8 - format->size[c]);
+			k.shift[c] = _mm_cvtsi32_si128(format->shift[c]);
+			k.size[c] = format->size[c];
+		}
+		k.alpha_transparent = alpha_transparent;
+		k.alpha_visible = format->alpha_visible;
+		k.premultiply = premultiply;
+
+		for ( ; i + 8 <= count; i += 8, bits += 32)
+		{
+			__m128i low = PixelFormatLanes(&k, _mm_loadu_si128((const __m128i *)bits));
+			__m128i high = PixelFormatLanes(&k, _mm_loadu_si128((const __m128i *)(bits + 16)));
+
+			// sign extend the low words so the saturating pack keeps them
+			low = _mm_srai_epi32(_mm_slli_epi32(low, 16), 16);
+			high = _mm_srai_epi32(_mm_slli_epi32(high, 16), 16);
+			__m128i words = _mm_packs_epi32(low, high);
+
+			if (wide) _mm_storeu_si128((__m128i *)&dest16[i], words);
+			else _mm_storel_epi64((__m128i *)&dest8[i], _mm_packus_epi16(words, words));
+		}
+	}
+#endif
+	for ( ; i < count; i++, bits += image->bytespp)
+	{
+		unsigned char alpha = bits[image->alpha];
+		if (alpha_transparent && (alpha != 255)) alpha = 0;
+
+		unsigned char red = bits[image->red];
+		unsigned char green = bits[image->green];
+		unsigned char blue = bits[image->blue];
+
+		if (premultiply) {
+			red = PixelFormatPremultiply(red, alpha);
+			green = PixelFormatPremultiply(green, alpha);
+			blue = PixelFormatPremultiply(blue, alpha);
+		}
+
+		unsigned int pixel = PixelFormatPack(format, red, green, blue, alpha);
+		if (wide) dest16[i] = (unsigned short)pixel;
+		else dest8[i] = (unsigned char)pixel;
+	}
+}
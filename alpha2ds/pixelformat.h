@@ -0,0 +1,60 @@
+//=======================================================
+// pixelformat.h
+//
+// libalpha2ds direct color formats. Each format is described by the
+// width and position of its red, green, blue and alpha bits; a single
+// converter builds any of them from the 8-bit channels of a source line,
+// so a new format only needs a line in the table of pixelformat.cpp.
+//
+// A channel keeps its most significant bits. The alpha bits of a format
+// with alpha_visible are set for every pixel that is not fully
+// transparent, like the transparency bit of RGB555. Premultiplied colors
+// (-M) are rounded to the nearest value before they are cut.
+//=======================================================
+
+#pragma once
+
+#include "convert.h"
+
+#define PIXELFORMAT_RED			(0)
+#define PIXELFORMAT_GREEN		(1)
+#define PIXELFORMAT_BLUE		(2)
+#define PIXELFORMAT_ALPHA		(3)
+
+/** Description of a direct color format
+*/
+struct PIXELFORMAT
+{
+	const char * name;			// name for -O, NULL if not selectable
+	unsigned short format;		// ARCHIVE_FORMAT_*
+	unsigned char bits;			// bits per pixel, stored in a byte up to 8, a 16-bit word otherwise
+	unsigned char size[4];		// bits of red, green, blue and alpha, 0 if missing
+	unsigned char shift[4];		// position of the lowest bit of each channel
+	bool alpha_visible;			// alpha set for every pixel that is not fully transparent
+};
+
+/** Format with the given ARCHIVE_FORMAT_*
+	@return Returns NULL if the format has no description
+*/
+const PIXELFORMAT * PixelFormatGet(unsigned short format);
+
+/** Selectable format with the given name
+	@return Returns NULL if there is none
+*/
+const PIXELFORMAT * PixelFormatFind(const char * name);
+
+/** Build one pixel
+	@return Returns the pixel in the low bits
+*/
+unsigned int PixelFormatPack(const PIXELFORMAT * format, unsigned char red, unsigned char green, unsigned char blue, unsigned char alpha);
+
+/** Convert pixels of a source line
+	@param format Target format
+	@param image Source image, bytespp and the channel offsets are used
+	@param bits First source pixel
+	@param alpha_transparent Pixels that are not fully opaque count as fully transparent (-c)
+	@param premultiply Multiply red, green and blue by alpha (-M)
+	@param dest Receives bytes or 16-bit words, depending on format->bits
+	@param count Number of pixels
+*/
+void PixelFormatConvert(const PIXELFORMAT * format, const CONVERTIMAGE * image, const unsigned char * bits, bool alpha_transparent, bool premultiply, void * dest, unsigned int count);
@@ -0,0 +1,329 @@
+//=======================================================
+// quantize.cpp
+//
+// Median cut over the RGB555 histogram: the box with the most pixels
+// times its longest side is split at the weighted median of that side
+// until the free palette entries are used up. Each box becomes the
+// pixel weighted mean of its colors. Ties are broken by the color value,
+// so the palette does not depend on the number of threads.
+//=======================================================
+
+#include "stdafx.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "archive.h"
+#include "quantize.h"
+
+// images with fewer pixels per thread are counted on the calling thread
+#define QUANTIZE_THREAD_PIXELS	(65536)
+
+/** Colors [begin, end) of the sorted color list
+*/
+struct QUANTIZEBOX
+{
+	unsigned int begin;
+	unsigned int end;
+	unsigned int count;			// pixels
+	int low[3];
+	int high[3];
+};
+
+/** Orders colors by one component, then by value
+*/
+struct QUANTIZEORDER
+{
+	int shift;
+
+	bool operator()(unsigned short a, unsigned short b) const
+	{
+		int ca = (a >> shift) & 0x1F;
+		int cb = (b >> shift) & 0x1F;
+		return (ca != cb) ? (ca < cb) : (a < b);
+	}
+};
+
+//=======================================================
+// QuantizeCount
+//=======================================================
+/** Count the opaque pixels of some lines by color, black excluded
+*/
+static void QuantizeCount(const CONVERTOPTIONS * options, const CONVERTIMAGE * image, unsigned int first_line, unsigned int last_line, unsigned int * histogram)
+{
+	for (unsigned int y_c = first_line; y_c < last_line; y_c++)
+	{
+		const unsigned char * bits = image->pixels + (ptrdiff_t)image->pitch * (int)y_c;
+
+		for (unsigned int x_c = 0; x_c < image->width; x_c++, bits += image->bytespp)
+		{
+			unsigned char alpha = bits[image->alpha];
+			if ( (alpha == 0) || (options->optAlphaTransparent && alpha != 255) ) continue;
+
+			// same layout as the palette entries, red in the low bits
+			unsigned int color = ((bits[image->blue] >> 3) << 10) | ((bits[image->green] >> 3) << 5) | (bits[image->red] >> 3);
+			if (color) histogram[color]++;
+		}
+	}
+}
+
+//=======================================================
+// QuantizeBounds
+//=======================================================
+/** Pixel count and bounding box of the colors of a box
+*/
+static void QuantizeBounds(QUANTIZEBOX * box, const unsigned short * colors, const unsigned int * histogram)
+{
+	box->count = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		box->low[axis] = 31;
+		box->high[axis] = 0;
+	}
+
+	for (unsigned int i = box->begin; i < box->end; i++)
+	{
+		box->count += histogram[colors[i]];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			int component = (colors[i] >> (10 - 5 * axis)) & 0x1F;
+			if (component < box->low[axis]) box->low[axis] = component;
+			if (component > box->high[axis]) box->high[axis] = component;
+		}
+	}
+}
+
+//=======================================================
+// QuantizeMedianCut
+//=======================================================
+/** Reduce a color list to at most count colors
+	@param colors Colors in use, reordered
+	@param colorcount Number of colors
+	@param histogram Pixel count per color
+	@param entries Receives the colors, 0 only for a box of black alone
+	@param count Number of colors to produce
+	@return Returns the number of colors produced
+*/
+unsigned int QuantizeMedianCut(unsigned short * colors, unsigned int colorcount, const unsigned int * histogram, unsigned short * entries, unsigned int count)
+{
+	std::vector<QUANTIZEBOX> boxes;
+	QUANTIZEBOX box;
+
+	if (!colorcount || !count) return 0;
+
+	box.begin = 0;
+	box.end = colorcount;
+	QuantizeBounds(&box, colors, histogram);
+	boxes.push_back(box);
+
+	while (boxes.size() < count)
+	{
+		// the box with the most pixels along the longest side is split next
+		size_t split = boxes.size();
+		unsigned long long best = 0;
+		int axis = 0;
+
+		for (size_t i = 0; i < boxes.size(); i++)
+		{
+			if (boxes[i].end - boxes[i].begin < 2) continue;
+
+			int longest = 0;
+			for (int a = 1; a < 3; a++)
+				if (boxes[i].high[a] - boxes[i].low[a] > boxes[i].high[longest] - boxes[i].low[longest]) longest = a;
+
+			unsigned long long priority = (unsigned long long)boxes[i].count * (boxes[i].high[longest] - boxes[i].low[longest]);
+			if (priority > best) {
+				best = priority;
+				split = i;
+				axis = longest;
+			}
+		}
+
+		if (split == boxes.size()) break;
+
+		QUANTIZEBOX & parent = boxes[split];
+		QUANTIZEORDER order;
+		order.shift = 10 - 5 * axis;
+		std::sort(colors + parent.begin, colors + parent.end, order);
+
+		// weighted median, both halves keep at least one color
+		unsigned int half = parent.begin;
+		unsigned int sum = 0;
+		while (half < parent.end - 1) {
+			sum += histogram[colors[half]];
+			half++;
+			if (2ULL * sum >= parent.count) break;
+		}
+
+		QUANTIZEBOX upper;
+		upper.begin = half;
+		upper.end = parent.end;
+		parent.end = half;
+		QuantizeBounds(&parent, colors, histogram);
+		QuantizeBounds(&upper, colors, histogram);
+		boxes.push_back(upper);
+	}
+
+	for (size_t i = 0; i < boxes.size(); i++)
+	{
+		unsigned long long sums[3] = { 0, 0, 0 };
+		unsigned short frequent = colors[boxes[i].begin];
+
+		for (unsigned int c = boxes[i].begin; c < boxes[i].end; c++)
+		{
+			for (int axis = 0; axis < 3; axis++)
+				sums[axis] += (unsigned long long)((colors[c] >> (10 - 5 * axis)) & 0x1F) * histogram[colors[c]];
+			if (histogram[colors[c]] > histogram[frequent]) frequent = colors[c];
+		}
+
+		unsigned short entry = 0;
+		for (int axis = 0; axis < 3; axis++)
+			entry |= (unsigned short)(((sums[axis] + boxes[i].count / 2) / boxes[i].count) << (10 - 5 * axis));
+
+		// 0 ends the palette, a box of dark colors keeps its most frequent one
+		entries[i] = entry ? entry : frequent;
+	}
+
+	return (unsigned int)boxes.size();
+}
+
+//=======================================================
+// QuantizeHistogram
+//=======================================================
+/** Add the opaque pixels of an image to a histogram, black excluded
+	@param options Conversion options, Threads is used
+	@param image Source image
+	@param histogram Pixel count per RGB555 color, counts are added
+	@return Returns CONVERT_OK or CONVERT_ERROR_MEMORY
+*/
+int QuantizeHistogram(const CONVERTOPTIONS * options, const CONVERTIMAGE * image, unsigned int histogram[PALMAP_COLORS])
+{
+	unsigned int threads = options->Threads ? options->Threads : 1;
+	unsigned int pixel_count = image->width * image->height;
+
+	if (threads > pixel_count / QUANTIZE_THREAD_PIXELS) threads = pixel_count / QUANTIZE_THREAD_PIXELS;
+	if (threads > image->height) threads = image->height;
+	if (threads <= 1) {
+		QuantizeCount(options, image, 0, image->height, histogram);
+		return CONVERT_OK;
+	}
+
+	// the calling thread counts into the histogram, the others into their own
+	unsigned int * partial = (unsigned int *)calloc((size_t)(threads - 1) * PALMAP_COLORS, sizeof(unsigned int));
+	if (!partial) return CONVERT_ERROR_MEMORY;
+
+	std::vector<std::thread> workers;
+
+	for (unsigned int t = 1; t < threads; t++)
+		workers.push_back(std::thread(QuantizeCount, options, image, image->height * t / threads, image->height * (t + 1) / threads, partial + (size_t)(t - 1) * PALMAP_COLORS));
+	QuantizeCount(options, image, 0, image->height / threads, histogram);
+
+	for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+	for (size_t i = 0; i < (size_t)(threads - 1) * PALMAP_COLORS; i++) histogram[i % PALMAP_COLORS] += partial[i];
+
+	free(partial);
+	return CONVERT_OK;
+}
+
+//=======================================================
+// QuantizePalette
+//=======================================================
+/** Choose the free entries of a palette for the colors of a histogram
+	and map every color in use to its nearest entry
+	@param options Conversion options, Threads, OutputWidth and the palette
+	format (-6, -7) are used
+	@param histogram Pixel count per RGB555 color
+	@param palette Palette in the format of the options, entries 2..255
+	(2..15 for 4-bit output) are extended by the chosen colors
+	@param map Receives the palette index per color in use
+	@param quantized NULL to choose the entries in any case. Otherwise set
+	to false, and nothing is chosen, if the new colors fit into the free
+	entries as they are.
+	@return Returns CONVERT_OK or CONVERT_ERROR_MEMORY
+*/
+int QuantizePalette(const CONVERTOPTIONS * options, const unsigned int histogram[PALMAP_COLORS], unsigned short palette[256], unsigned char map[PALMAP_COLORS], bool * quantized)
+{
+	unsigned short * colors = (unsigned short *)malloc(PALMAP_COLORS * sizeof(unsigned short));
+	bool * known = (bool *)calloc(PALMAP_COLORS, sizeof(bool));
+
+	if (quantized) *quantized = false;
+
+	if (!colors || !known)
+	{
+		free(colors);
+		free(known);
+		return CONVERT_ERROR_MEMORY;
+	}
+
+	// colors not in the palette yet
+	const PIXELFORMAT * format = PixelFormatGet(ConvertPaletteFormat(options));
+	unsigned int size = (options->OutputWidth == OutputWidth4Bit) ? 16 : 256;
+	unsigned int used = 2;
+	while ( (used < size) && (palette[used] != 0) ) {
+		known[PalMapColor(format, palette[used])] = true;
+		used++;
+	}
+
+	unsigned int colorcount = 0;
+	for (unsigned int c = 1; c < PALMAP_COLORS; c++)
+		if (histogram[c] && !known[c]) colors[colorcount++] = (unsigned short)c;
+
+	if (!quantized || (colorcount > size - used))
+	{
+		unsigned int threads = options->Threads ? options->Threads : 1;
+		if (threads > colorcount / 1024) threads = colorcount / 1024;
+		if (threads < 1) threads = 1;
+
+		unsigned int chosen = QuantizeMedianCut(colors, colorcount, histogram, palette + used, size - used);
+		for (unsigned int i = used; i < used + chosen; i++) palette[i] = PalMapEntry(format, palette[i]);
+		used += chosen;
+
+		// nearest entry of each color in use
+		std::vector<std::thread> workers;
+
+		for (unsigned int t = 1; t < threads; t++)
+			workers.push_back(std::thread(PalMapBuildRange, palette, format, map, PALMAP_COLORS * t / threads, PALMAP_COLORS * (t + 1) / threads, histogram));
+		PalMapBuildRange(palette, format, map, 0, PALMAP_COLORS / threads, histogram);
+
+		for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+		if (quantized) *quantized = true;
+	}
+
+	free(colors);
+	free(known);
+	return CONVERT_OK;
+}
+
+//=======================================================
+// QuantizeImage
+//=======================================================
+/** Reduce the colors of an image to the free entries of the palette
+	@param options Conversion options, Threads, OutputWidth and the palette
+	format (-6, -7) are used
+	@param image Source image
+	@param palette Palette, entries 2..255 (2..15 for 4-bit output) are
+	extended by the reduced colors
+	@param map Receives the palette index per color in use if quantized
+	@param quantized Set to false if the colors fit into the palette, the
+	image is converted as without -Q then
+	@return Returns CONVERT_OK or CONVERT_ERROR_MEMORY
+*/
+int QuantizeImage(const CONVERTOPTIONS * options, const CONVERTIMAGE * image, unsigned short palette[256], unsigned char map[PALMAP_COLORS], bool * quantized)
+{
+	unsigned int * histogram = (unsigned int *)calloc(PALMAP_COLORS, sizeof(unsigned int));
+	int error = CONVERT_ERROR_MEMORY;
+
+	*quantized = false;
+
+	if (histogram) {
+		error = QuantizeHistogram(options, image, histogram);
+		if (error == CONVERT_OK) error = QuantizePalette(options, histogram, palette, map, quantized);
+	}
+
+	free(histogram);
+	return error;
+}
@@ -0,0 +1,26 @@
+//=======================================================
+// quantize.h
+//
+// libalpha2ds color reduction for 8-bit and 4-bit output (-Q). The
+// opaque pixels are counted in a histogram of the 32768 RGB555 colors; if
+// more colors are used than the palette has free entries, the colors not
+// yet in the palette are reduced by median cut into the free entries and
+// every color is mapped to its nearest entry (palmap.h). Time and memory
+// are bounded by the histogram, not by the number of colors in the image.
+//
+// Palettes written with -6 or -7 are read and extended in that format.
+//
+// Histogram and mapping are split over options->Threads threads. A run
+// sharing one palette (-G) adds the histograms of all its images and
+// chooses the palette from the sum.
+//=======================================================
+
+#pragma once
+
+#include "convert.h"
+#include "palmap.h"
+
+unsigned int QuantizeMedianCut(unsigned short * colors, unsigned int colorcount, const unsigned int * histogram, unsigned short * entries, unsigned int count);
+int QuantizeHistogram(const CONVERTOPTIONS * options, const CONVERTIMAGE * image, unsigned int histogram[PALMAP_COLORS]);
+int QuantizePalette(const CONVERTOPTIONS * options, const unsigned int histogram[PALMAP_COLORS], unsigned short palette[256], unsigned char map[PALMAP_COLORS], bool * quantized);
+int QuantizeImage(const CONVERTOPTIONS * options, const CONVERTIMAGE * image, unsigned short palette[256], unsigned char map[PALMAP_COLORS], bool * quantized);
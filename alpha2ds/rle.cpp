@@ -1,4 +1,20 @@
 #include "stdafx.h"
+#include <stdlib.h>
+#include <string.h>
+#include "rle.h"
+
+#if (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(_M_X64) || defined(__SSE2__)
+#define RLE_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/* Longest runs of the marker based coders */
+#define RLE16_MAXRUN    32768
+#define RLE8_MAXRUN     16384
 /*************************************************************************
 * Name:        rle.c
 * Author:      Marcus Geelnard
@@ -73,6 +89,315 @@
 *************************************************************************/
 
 
+/*************************************************************************
+* _RLE_Ctz() - Index of the lowest set bit of 'mask' (mask != 0).
+*************************************************************************/
+
+static unsigned int _RLE_Ctz( unsigned int mask )
+{
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward( &idx, mask );
+    return idx;
+#else
+    return __builtin_ctz( mask );
+#endif
+}
+
+
+/*************************************************************************
+* _RLE_RunLength() - Number of symbols starting at 'in[pos]' which are
+* equal to 'in[pos]', looking no further than 'end'. 16 symbols are
+* compared against the broadcast symbol at a time, the first mismatch is
+* located from the compare mask.
+*************************************************************************/
+
+static unsigned int _RLE_RunLength8( const unsigned char *in,
+    unsigned int pos, unsigned int end )
+{
+    unsigned char symbol;
+    unsigned int  i;
+
+    symbol = in[ pos ];
+    i = pos + 1;
+#ifdef RLE_USE_SSE2
+    {
+        __m128i v = _mm_set1_epi8( (char) symbol );
+        unsigned int mask;
+
+        for( ; i + 16 <= end; i += 16 )
+        {
+            mask = _mm_movemask_epi8( _mm_cmpeq_epi8(
+                _mm_loadu_si128( (const __m128i *) &in[ i ] ), v ) );
+            if( mask != 0xffff )
+            {
+                return i - pos + _RLE_Ctz( ~mask );
+            }
+        }
+    }
+#endif
+    while( (i < end) && (in[ i ] == symbol) )
+    {
+        ++ i;
+    }
+    return i - pos;
+}
+
+static unsigned int _RLE_RunLength16( const unsigned short int *in,
+    unsigned int pos, unsigned int end )
+{
+    unsigned short int symbol;
+    unsigned int  i;
+
+    symbol = in[ pos ];
+    i = pos + 1;
+#ifdef RLE_USE_SSE2
+    {
+        __m128i v = _mm_set1_epi16( (short) symbol );
+        unsigned int mask;
+
+        for( ; i + 16 <= end; i += 16 )
+        {
+            /* Two bits per symbol in the combined mask */
+            mask = _mm_movemask_epi8( _mm_cmpeq_epi16(
+                       _mm_loadu_si128( (const __m128i *) &in[ i ] ), v ) ) |
+                   (_mm_movemask_epi8( _mm_cmpeq_epi16(
+                       _mm_loadu_si128( (const __m128i *) &in[ i + 8 ] ), v ) ) << 16);
+            if( mask != 0xffffffff )
+            {
+                return i - pos + (_RLE_Ctz( ~mask ) >> 1);
+            }
+        }
+    }
+#endif
+    while( (i < end) && (in[ i ] == symbol) )
+    {
+        ++ i;
+    }
+    return i - pos;
+}
+
+
+/*************************************************************************
+* _RLE_FindPair() - Position of the first pair of equal neighbours at or
+* after 'pos', i.e. the end of a literal stretch. Returns 'insize' if
+* there is none. Each symbol is compared with its successor, 16 at a time.
+*************************************************************************/
+
+static unsigned int _RLE_FindPair8( const unsigned char *in,
+    unsigned int pos, unsigned int insize )
+{
+    unsigned int i;
+
+    i = pos;
+#ifdef RLE_USE_SSE2
+    {
+        unsigned int mask;
+
+        for( ; i + 17 <= insize; i += 16 )
+        {
+            mask = _mm_movemask_epi8( _mm_cmpeq_epi8(
+                _mm_loadu_si128( (const __m128i *) &in[ i ] ),
+                _mm_loadu_si128( (const __m128i *) &in[ i + 1 ] ) ) );
+            if( mask != 0 )
+            {
+                return i + _RLE_Ctz( mask );
+            }
+        }
+    }
+#endif
+    for( ; i + 1 < insize; ++ i )
+    {
+        if( in[ i ] == in[ i + 1 ] )
+        {
+            return i;
+        }
+    }
+    return insize;
+}
+
+static unsigned int _RLE_FindPair16( const unsigned short int *in,
+    unsigned int pos, unsigned int insize )
+{
+    unsigned int i;
+
+    i = pos;
+#ifdef RLE_USE_SSE2
+    {
+        unsigned int mask;
+
+        for( ; i + 17 <= insize; i += 16 )
+        {
+            /* Two bits per symbol in the combined mask */
+            mask = _mm_movemask_epi8( _mm_cmpeq_epi16(
+                       _mm_loadu_si128( (const __m128i *) &in[ i ] ),
+                       _mm_loadu_si128( (const __m128i *) &in[ i + 1 ] ) ) ) |
+                   (_mm_movemask_epi8( _mm_cmpeq_epi16(
+                       _mm_loadu_si128( (const __m128i *) &in[ i + 8 ] ),
+                       _mm_loadu_si128( (const __m128i *) &in[ i + 9 ] ) ) ) << 16);
+            if( mask != 0 )
+            {
+                return i + (_RLE_Ctz( mask ) >> 1);
+            }
+        }
+    }
+#endif
+    for( ; i + 1 < insize; ++ i )
+    {
+        if( in[ i ] == in[ i + 1 ] )
+        {
+            return i;
+        }
+    }
+    return insize;
+}
+
+
+/*************************************************************************
+* _RLE_Fill16() - Fill 'count' words at 'out' with 'symbol', using 64-bit
+* stores for the bulk of the run.
+*************************************************************************/
+
+static void _RLE_Fill16( unsigned short int *out, unsigned short int symbol,
+    unsigned int count )
+{
+    unsigned int i, pattern32;
+    unsigned long long pattern;
+
+    if( count < 8 )
+    {
+        for( i = 0; i < count; ++ i )
+        {
+            out[ i ] = symbol;
+        }
+        return;
+    }
+
+    pattern32 = symbol | ((unsigned int) symbol << 16);
+    pattern = pattern32 | ((unsigned long long) pattern32 << 32);
+
+    for( i = 0; i + 4 <= count; i += 4 )
+    {
+        memcpy( &out[ i ], &pattern, 8 );
+    }
+    for( ; i < count; ++ i )
+    {
+        out[ i ] = symbol;
+    }
+}
+
+
+/*************************************************************************
+* _RLE_FindSymbol16() - Position of the first occurrence of 'symbol' at or
+* after 'pos', or 'end' if there is none.
+*************************************************************************/
+
+static unsigned int _RLE_FindSymbol16( const unsigned short int *in,
+    unsigned int pos, unsigned int end, unsigned short int symbol )
+{
+    unsigned int i;
+
+    i = pos;
+#ifdef RLE_USE_SSE2
+    {
+        __m128i v = _mm_set1_epi16( (short) symbol );
+        unsigned int mask;
+
+        for( ; i + 8 <= end; i += 8 )
+        {
+            mask = _mm_movemask_epi8( _mm_cmpeq_epi16(
+                _mm_loadu_si128( (const __m128i *) &in[ i ] ), v ) );
+            if( mask != 0 )
+            {
+                return i + (_RLE_Ctz( mask ) >> 1);
+            }
+        }
+    }
+#endif
+    while( (i < end) && (in[ i ] != symbol) )
+    {
+        ++ i;
+    }
+    return i;
+}
+
+
+/*************************************************************************
+* _RLE_FindUnused16() - Find the smallest symbol which does not occur in
+* the input. Used symbols are recorded in a bitset, which is then scanned
+* a word at a time. Since the input holds only 'insize' symbols, one of
+* the values 0..insize is always unused, so only that many bits need to
+* be tracked. Returns 0 if all 65536 symbols are in use.
+*************************************************************************/
+
+static int _RLE_FindUnused16( const unsigned short int *in,
+    unsigned int insize, unsigned short int *marker )
+{
+    unsigned int used[ 65536 / 32 ];
+    unsigned int i, limit, words;
+
+    limit = insize < 65536 ? insize + 1 : 65536;
+    words = (limit + 31) / 32;
+    memset( used, 0, words * sizeof( used[ 0 ] ) );
+
+    for( i = 0; i < insize; ++ i )
+    {
+        if( in[ i ] < limit )
+        {
+            used[ in[ i ] >> 5 ] |= 1u << (in[ i ] & 31);
+        }
+    }
+
+    for( i = 0; i < words; ++ i )
+    {
+        if( used[ i ] != 0xffffffff )
+        {
+            *marker = (unsigned short int) ((i << 5) + _RLE_Ctz( ~used[ i ] ));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/*************************************************************************
+* _RLE_LeastCommon16() - Find the least common symbol using a full
+* histogram. Only needed when every symbol occurs in the input. The
+* histogram is allocated per call, so several threads can compress at
+* the same time. Any symbol is a valid marker, so symbol 0 is used if
+* the histogram cannot be allocated.
+*************************************************************************/
+
+static unsigned short int _RLE_LeastCommon16( const unsigned short int *in,
+    unsigned int insize )
+{
+    unsigned int i, marker;
+    unsigned int *histogram;
+
+    histogram = (unsigned int *) calloc( 65536, sizeof( unsigned int ) );
+    if( !histogram )
+    {
+        return 0;
+    }
+
+    for( i = 0; i < insize; ++ i )
+    {
+        ++ histogram[ in[ i ] ];
+    }
+
+    marker = 0;
+    for( i = 1; i < 65536; ++ i )
+    {
+        if( histogram[ i ] < histogram[ marker ] )
+        {
+            marker = i;
+        }
+    }
+    free( histogram );
+    return (unsigned short int) marker;
+}
+
+
 /*************************************************************************
 * _RLE_WriteRep() - Encode a repetition of 'symbol' repeated 'count'
 * times.
@@ -116,25 +441,23 @@ static void _RLE_WriteRep16( unsigned short int *out, unsigned int *outpos,
 
 
 /*************************************************************************
-* _RLE_WriteNonRep() - Encode a non-repeating symbol, 'symbol'. 'marker'
-* is the marker symbol, and special care has to be taken for the case
-* when 'symbol' == 'marker'.
+* _RLE_WriteLiterals() - Encode the non-repeating symbols in[0..count-1].
 *************************************************************************/
 
-static void _RLE_WriteNonRep16( unsigned short int *out, unsigned int *outpos,
-    unsigned short int marker, unsigned short int symbol )
+static void _RLE_WriteLiterals16( unsigned short int *out,
+    unsigned int *outpos, unsigned short int marker,
+    const unsigned short int *in, unsigned int count )
 {
-    unsigned int idx;
+    unsigned int i, idx;
 
     idx = *outpos;
-    if( symbol == marker )
-    {
-        out[ idx ++ ] = marker;
-        out[ idx ++ ] = 0;
-    }
-    else
+    for( i = 0; i < count; ++ i )
     {
-        out[ idx ++ ] = symbol;
+        out[ idx ++ ] = in[ i ];
+        if( in[ i ] == marker )
+        {
+            out[ idx ++ ] = 0;
+        }
     }
     *outpos = idx;
 }
@@ -154,13 +477,12 @@ static void _RLE_WriteNonRep16( unsigned short int *out, unsigned int *outpos,
 *  insize - Number of input bytes.
 * The function returns the size of the compressed data.
 *************************************************************************/
-unsigned int histogram[ 65535 ];
 
 int RLE_Compress16( unsigned short int *in, unsigned short int *out,
     unsigned int insize )
 {
-    unsigned short int byte1, byte2, marker;
-    unsigned int  inpos, outpos, count, i;
+    unsigned short int marker;
+    unsigned int  inpos, outpos, count, end;
 
     /* Do we have anything to compress? */
     if( insize < 1 )
@@ -168,93 +490,36 @@ int RLE_Compress16( unsigned short int *in, unsigned short int *out,
         return 0;
     }
 
-    /* Create histogram */
-    for( i = 0; i < 65535; ++ i )
-    {
-        histogram[ i ] = 0;
-    }
-    for( i = 0; i < insize; ++ i )
-    {
-        ++ histogram[ in[ i ] ];
-    }
-
-    /* Find the least common byte, and use it as the repetition marker */
-    marker = 0;
-    for( i = 1; i < 65535; ++ i )
+    /* Use the first unused symbol as the repetition marker if there is
+       one, otherwise the least common symbol */
+    if( !_RLE_FindUnused16( in, insize, &marker ) )
     {
-        if( histogram[ i ] < histogram[ marker ] )
-        {
-            marker = i;
-        }
+        marker = _RLE_LeastCommon16( in, insize );
     }
 
     /* Remember the repetition marker for the decoder */
     out[ 0 ] = marker;
     outpos = 1;
 
-    /* Start of compression */
-    byte1 = in[ 0 ];
-    inpos = 1;
-    count = 1;
-
-    /* Are there at least two bytes? */
-    if( insize >= 2 )
+    /* Main compression loop: alternate between repeating runs and
+       stretches of non-repeating symbols */
+    inpos = 0;
+    while( inpos < insize )
     {
-        byte2 = in[ inpos ++ ];
-        count = 2;
-
-        /* Main compression loop */
-        do
+        end = insize - inpos > RLE16_MAXRUN ? inpos + RLE16_MAXRUN : insize;
+        count = _RLE_RunLength16( in, inpos, end );
+        if( count >= 2 )
         {
-            if( byte1 == byte2 )
-            {
-                /* Do we meet only a sequence of identical bytes? */
-                while( (inpos < insize) && (byte1 == byte2) &&
-                       (count < 32768) )
-                {
-                    byte2 = in[ inpos ++ ];
-                    ++ count;
-                }
-                if( byte1 == byte2 )
-                {
-                    _RLE_WriteRep16( out, &outpos, marker, byte1, count );
-                    if( inpos < insize )
-                    {
-                        byte1 = in[ inpos ++ ];
-                        count = 1;
-                    }
-                    else
-                    {
-                        count = 0;
-                    }
-                }
-                else
-                {
-                    _RLE_WriteRep16( out, &outpos, marker, byte1, count-1 );
-                    byte1 = byte2;
-                    count = 1;
-                }
-            }
-            else
-            {
-                /* No, then don't handle the last byte */
-                _RLE_WriteNonRep16( out, &outpos, marker, byte1 );
-                byte1 = byte2;
-                count = 1;
-            }
-            if( inpos < insize )
-            {
-                byte2 = in[ inpos ++ ];
-                count = 2;
-            }
+            _RLE_WriteRep16( out, &outpos, marker, in[ inpos ], count );
+            inpos += count;
+        }
+        else
+        {
+            end = _RLE_FindPair16( in, inpos, insize );
+            _RLE_WriteLiterals16( out, &outpos, marker, &in[ inpos ],
+                end - inpos );
+            inpos = end;
         }
-        while( (inpos < insize) || (count >= 2) );
-    }
-
-    /* One byte left? */
-    if( count == 1 )
-    {
-        _RLE_WriteNonRep16( out, &outpos, marker, byte1 );
     }
 
     return outpos;
@@ -262,23 +527,33 @@ int RLE_Compress16( unsigned short int *in, unsigned short int *out,
 
 
 /*************************************************************************
-* RLE_Uncompress() - Uncompress a block of data using an RLE decoder.
+* RLE_Decode() - Uncompress a block of data using an RLE decoder, with
+* bounds checking on both buffers.
 *  in      - Input (compressed) buffer.
-*  out     - Output (uncompressed) buffer. This buffer must be large
-*            enough to hold the uncompressed data.
-*  insize  - Number of input bytes.
+*  insize  - Number of input symbols.
+*  out     - Output (uncompressed) buffer.
+*  outsize - Capacity of the output buffer in symbols.
+*  outlen  - Receives the number of symbols written (may be NULL).
+* The function returns RLE_OK, or RLE_ERROR_TRUNCATED if the input ends
+* inside a code, or RLE_ERROR_OVERFLOW if the data does not fit into the
+* output buffer. Literal stretches are copied with memcpy(), runs are
+* filled with wide stores.
 *************************************************************************/
 
-void RLE_Uncompress16( unsigned short int *in, unsigned short int *out,
-    unsigned int insize )
+int RLE_Decode16( const unsigned short int *in, unsigned int insize,
+    unsigned short int *out, unsigned int outsize, unsigned int *outlen )
 {
     unsigned short int marker, symbol;
-    unsigned int  i, inpos, outpos, count;
+    unsigned int  inpos, outpos, count, end;
+    int result;
+
+    result = RLE_OK;
+    outpos = 0;
 
     /* Do we have anything to uncompress? */
     if( insize < 1 )
     {
-        return;
+        goto done;
     }
 
     /* Get marker symbol from input stream */
@@ -286,39 +561,76 @@ void RLE_Uncompress16( unsigned short int *in, unsigned short int *out,
     marker = in[ inpos ++ ];
 
     /* Main decompression loop */
-    outpos = 0;
-    do
+    while( inpos < insize )
     {
-        symbol = in[ inpos ++ ];
-        if( symbol == marker )
+        /* Plain copy up to the next marker */
+        end = _RLE_FindSymbol16( in, inpos, insize, marker );
+        count = end - inpos;
+        if( count > outsize - outpos )
         {
-            /* We had a marker byte */
-            count = in[ inpos ++ ];
-            if( count <= 2 )
-            {
-                /* Counts 0, 1 and 2 are used for marker byte repetition
-                   only */
-                for( i = 0; i <= count; ++ i )
-                {
-                    out[ outpos ++ ] = marker;
-                }
-            }
-            else
+            result = RLE_ERROR_OVERFLOW;
+            goto done;
+        }
+        memcpy( &out[ outpos ], &in[ inpos ], count * 2 );
+        outpos += count;
+        inpos = end;
+        if( inpos >= insize )
+        {
+            break;
+        }
+
+        /* We had a marker symbol */
+        if( ++ inpos >= insize )
+        {
+            result = RLE_ERROR_TRUNCATED;
+            goto done;
+        }
+        count = in[ inpos ++ ];
+        if( count <= 2 )
+        {
+            /* Counts 0, 1 and 2 are used for marker repetition only */
+            symbol = marker;
+        }
+        else
+        {
+            if( inpos >= insize )
             {
-                symbol = in[ inpos ++ ];
-                for( i = 0; i <= count; ++ i )
-                {
-                    out[ outpos ++ ] = symbol;
-                }
+                result = RLE_ERROR_TRUNCATED;
+                goto done;
             }
+            symbol = in[ inpos ++ ];
         }
-        else
+        ++ count;
+        if( count > outsize - outpos )
         {
-            /* No marker, plain copy */
-            out[ outpos ++ ] = symbol;
+            result = RLE_ERROR_OVERFLOW;
+            goto done;
         }
+        _RLE_Fill16( &out[ outpos ], symbol, count );
+        outpos += count;
+    }
+
+done:
+    if( outlen )
+    {
+        *outlen = outpos;
     }
-    while( inpos < insize );
+    return result;
+}
+
+
+/*************************************************************************
+* RLE_Uncompress() - Uncompress a block of data using an RLE decoder.
+*  in      - Input (compressed) buffer.
+*  out     - Output (uncompressed) buffer. This buffer must be large
+*            enough to hold the uncompressed data.
+*  insize  - Number of input bytes.
+*************************************************************************/
+
+void RLE_Uncompress16( unsigned short int *in, unsigned short int *out,
+    unsigned int insize )
+{
+    RLE_Decode16( in, insize, out, 0xffffffff, 0 );
 }
 
 
@@ -365,25 +677,32 @@ static void _RLE_WriteRep8( unsigned char *out, unsigned int *outpos,
 
 
 /*************************************************************************
-* _RLE_WriteNonRep() - Encode a non-repeating symbol, 'symbol'. 'marker'
-* is the marker symbol, and special care has to be taken for the case
-* when 'symbol' == 'marker'.
+* _RLE_WriteLiterals() - Encode the non-repeating symbols in[0..count-1].
+* The stretches between marker symbols are copied in one piece.
 *************************************************************************/
 
-static void _RLE_WriteNonRep8( unsigned char *out, unsigned int *outpos,
-    unsigned char marker, unsigned char symbol )
+static void _RLE_WriteLiterals8( unsigned char *out, unsigned int *outpos,
+    unsigned char marker, const unsigned char *in, unsigned int count )
 {
-    unsigned int idx;
+    const unsigned char *hit;
+    unsigned int idx, chunk;
 
     idx = *outpos;
-    if( symbol == marker )
-    {
-        out[ idx ++ ] = marker;
-        out[ idx ++ ] = 0;
-    }
-    else
+    while( count > 0 )
     {
-        out[ idx ++ ] = symbol;
+        hit = (const unsigned char *) memchr( in, marker, count );
+        chunk = hit ? (unsigned int) (hit - in) : count;
+        memcpy( &out[ idx ], in, chunk );
+        idx += chunk;
+        in += chunk;
+        count -= chunk;
+        if( hit )
+        {
+            out[ idx ++ ] = marker;
+            out[ idx ++ ] = 0;
+            ++ in;
+            -- count;
+        }
     }
     *outpos = idx;
 }
@@ -407,8 +726,8 @@ static void _RLE_WriteNonRep8( unsigned char *out, unsigned int *outpos,
 int RLE_Compress8( unsigned char *in, unsigned char *out,
     unsigned int insize )
 {
-    unsigned char byte1, byte2, marker;
-    unsigned int  inpos, outpos, count, i, histogram[ 256 ];
+    unsigned char marker;
+    unsigned int  inpos, outpos, count, end, i, histogram[ 256 ];
 
     /* Do we have anything to compress? */
     if( insize < 1 )
@@ -440,72 +759,131 @@ int RLE_Compress8( unsigned char *in, unsigned char *out,
     out[ 0 ] = marker;
     outpos = 1;
 
-    /* Start of compression */
-    byte1 = in[ 0 ];
-    inpos = 1;
-    count = 1;
-
-    /* Are there at least two bytes? */
-    if( insize >= 2 )
+    /* Main compression loop: alternate between repeating runs and
+       stretches of non-repeating symbols */
+    inpos = 0;
+    while( inpos < insize )
     {
-        byte2 = in[ inpos ++ ];
-        count = 2;
-
-        /* Main compression loop */
-        do
+        end = insize - inpos > RLE8_MAXRUN ? inpos + RLE8_MAXRUN : insize;
+        count = _RLE_RunLength8( in, inpos, end );
+        if( count >= 2 )
         {
-            if( byte1 == byte2 )
-            {
-                /* Do we meet only a sequence of identical bytes? */
-                while( (inpos < insize) && (byte1 == byte2) &&
-                       (count < /* 32768 */ 16384) )
-                {
-                    byte2 = in[ inpos ++ ];
-                    ++ count;
-                }
-                if( byte1 == byte2 )
-                {
-                    _RLE_WriteRep8( out, &outpos, marker, byte1, count );
-                    if( inpos < insize )
-                    {
-                        byte1 = in[ inpos ++ ];
-                        count = 1;
-                    }
-                    else
-                    {
-                        count = 0;
-                    }
-                }
-                else
+            _RLE_WriteRep8( out, &outpos, marker, in[ inpos ], count );
+            inpos += count;
+        }
+        else
+        {
+            end = _RLE_FindPair8( in, inpos, insize );
+            _RLE_WriteLiterals8( out, &outpos, marker, &in[ inpos ],
+                end - inpos );
+            inpos = end;
+        }
+    }
+
+    return outpos;
+}
+
+
+/*************************************************************************
+* RLE_Decode() - Uncompress a block of data using an RLE decoder, with
+* bounds checking on both buffers.
+*  in      - Input (compressed) buffer.
+*  insize  - Number of input bytes.
+*  out     - Output (uncompressed) buffer.
+*  outsize - Capacity of the output buffer in bytes.
+*  outlen  - Receives the number of bytes written (may be NULL).
+* The function returns RLE_OK, RLE_ERROR_TRUNCATED or RLE_ERROR_OVERFLOW
+* (see RLE_Decode16).
+*************************************************************************/
+
+int RLE_Decode8( const unsigned char *in, unsigned int insize,
+    unsigned char *out, unsigned int outsize, unsigned int *outlen )
+{
+    const unsigned char *hit;
+    unsigned char marker, symbol;
+    unsigned int  inpos, outpos, count;
+    int result;
+
+    result = RLE_OK;
+    outpos = 0;
+
+    /* Do we have anything to uncompress? */
+    if( insize < 1 )
+    {
+        goto done;
+    }
+
+    /* Get marker symbol from input stream */
+    inpos = 0;
+    marker = in[ inpos ++ ];
+
+    /* Main decompression loop */
+    while( inpos < insize )
+    {
+        /* Plain copy up to the next marker */
+        hit = (const unsigned char *) memchr( &in[ inpos ], marker,
+            insize - inpos );
+        count = hit ? (unsigned int) (hit - &in[ inpos ]) : insize - inpos;
+        if( count > outsize - outpos )
+        {
+            result = RLE_ERROR_OVERFLOW;
+            goto done;
+        }
+        memcpy( &out[ outpos ], &in[ inpos ], count );
+        outpos += count;
+        inpos += count;
+        if( !hit )
+        {
+            break;
+        }
+
+        /* We had a marker byte */
+        if( ++ inpos >= insize )
+        {
+            result = RLE_ERROR_TRUNCATED;
+            goto done;
+        }
+        count = in[ inpos ++ ];
+        if( count <= 2 )
+        {
+            /* Counts 0, 1 and 2 are used for marker byte repetition
+               only */
+            symbol = marker;
+        }
+        else
+        {
+            if( count & 0x80 )
+            {
+                if( inpos >= insize )
                 {
-                    _RLE_WriteRep8( out, &outpos, marker, byte1, count-1 );
-                    byte1 = byte2;
-                    count = 1;
+                    result = RLE_ERROR_TRUNCATED;
+                    goto done;
                 }
+                count = ((count & 0x7f) << 8) + in[ inpos ++ ];
             }
-            else
+            if( inpos >= insize )
             {
-                /* No, then don't handle the last byte */
-                _RLE_WriteNonRep8( out, &outpos, marker, byte1 );
-                byte1 = byte2;
-                count = 1;
-            }
-            if( inpos < insize )
-            {
-                byte2 = in[ inpos ++ ];
-                count = 2;
+                result = RLE_ERROR_TRUNCATED;
+                goto done;
             }
+            symbol = in[ inpos ++ ];
         }
-        while( (inpos < insize) || (count >= 2) );
+        ++ count;
+        if( count > outsize - outpos )
+        {
+            result = RLE_ERROR_OVERFLOW;
+            goto done;
+        }
+        memset( &out[ outpos ], symbol, count );
+        outpos += count;
     }
 
-    /* One byte left? */
-    if( count == 1 )
+done:
+    if( outlen )
     {
-        _RLE_WriteNonRep8( out, &outpos, marker, byte1 );
+        *outlen = outpos;
     }
-
-    return outpos;
+    return result;
 }
 
 
@@ -520,55 +898,612 @@ int RLE_Compress8( unsigned char *in, unsigned char *out,
 void RLE_Uncompress8( unsigned char *in, unsigned char *out,
     unsigned int insize )
 {
-    unsigned char marker, symbol;
-    unsigned int  i, inpos, outpos, count;
+    RLE_Decode8( in, insize, out, 0xffffffff, 0 );
+}
 
-    /* Do we have anything to uncompress? */
-    if( insize < 1 )
+
+/*************************************************************************
+*                         STREAMING RLE ENCODER                          *
+*************************************************************************/
+
+/*************************************************************************
+* The streaming encoder produces the same format as RLE_Compress8/16,
+* but takes its input in arbitrary pieces (e.g. one scan line at a time)
+* and hands the encoded data to a sink function in blocks. The pending
+* run is carried over from one call to the next. Since there is no
+* pre-pass over the input, the marker symbol has to be chosen by the
+* caller. Given the same marker, the output is identical to the one of
+* the block encoder.
+*************************************************************************/
+
+/*************************************************************************
+* _RLE_StreamFlush() - Pass the buffered output to the sink.
+*************************************************************************/
+
+static void _RLE_StreamFlush16( RLE_Stream16 *stream )
+{
+    if( stream->fill > 0 )
+    {
+        stream->sink( stream->context, stream->buffer, stream->fill * 2 );
+        stream->total += stream->fill;
+        stream->fill = 0;
+    }
+}
+
+static void _RLE_StreamFlush8( RLE_Stream8 *stream )
+{
+    if( stream->fill > 0 )
+    {
+        stream->sink( stream->context, stream->buffer, stream->fill );
+        stream->total += stream->fill;
+        stream->fill = 0;
+    }
+}
+
+
+/*************************************************************************
+* _RLE_StreamEndRun() - Encode the pending run, if any.
+*************************************************************************/
+
+static void _RLE_StreamEndRun16( RLE_Stream16 *stream )
+{
+    if( stream->count == 0 )
     {
         return;
     }
+    if( stream->fill + 3 > RLE_STREAM_BUFFER )
+    {
+        _RLE_StreamFlush16( stream );
+    }
+    if( stream->count >= 2 )
+    {
+        _RLE_WriteRep16( stream->buffer, &stream->fill, stream->marker,
+            stream->symbol, stream->count );
+    }
+    else
+    {
+        _RLE_WriteLiterals16( stream->buffer, &stream->fill, stream->marker,
+            &stream->symbol, 1 );
+    }
+    stream->count = 0;
+}
+
+static void _RLE_StreamEndRun8( RLE_Stream8 *stream )
+{
+    if( stream->count == 0 )
+    {
+        return;
+    }
+    if( stream->fill + 4 > RLE_STREAM_BUFFER )
+    {
+        _RLE_StreamFlush8( stream );
+    }
+    if( stream->count >= 2 )
+    {
+        _RLE_WriteRep8( stream->buffer, &stream->fill, stream->marker,
+            stream->symbol, stream->count );
+    }
+    else
+    {
+        _RLE_WriteLiterals8( stream->buffer, &stream->fill, stream->marker,
+            &stream->symbol, 1 );
+    }
+    stream->count = 0;
+}
+
+
+/*************************************************************************
+* _RLE_StreamLiterals() - Encode a stretch of non-repeating symbols,
+* flushing the buffer as needed (each literal takes at most two symbols).
+*************************************************************************/
+
+static void _RLE_StreamLiterals16( RLE_Stream16 *stream,
+    const unsigned short int *in, unsigned int count )
+{
+    unsigned int chunk;
+
+    while( count > 0 )
+    {
+        chunk = (RLE_STREAM_BUFFER - stream->fill) / 2;
+        if( chunk == 0 )
+        {
+            _RLE_StreamFlush16( stream );
+            continue;
+        }
+        if( chunk > count )
+        {
+            chunk = count;
+        }
+        _RLE_WriteLiterals16( stream->buffer, &stream->fill, stream->marker,
+            in, chunk );
+        in += chunk;
+        count -= chunk;
+    }
+}
+
+static void _RLE_StreamLiterals8( RLE_Stream8 *stream,
+    const unsigned char *in, unsigned int count )
+{
+    unsigned int chunk;
+
+    while( count > 0 )
+    {
+        chunk = (RLE_STREAM_BUFFER - stream->fill) / 2;
+        if( chunk == 0 )
+        {
+            _RLE_StreamFlush8( stream );
+            continue;
+        }
+        if( chunk > count )
+        {
+            chunk = count;
+        }
+        _RLE_WriteLiterals8( stream->buffer, &stream->fill, stream->marker,
+            in, chunk );
+        in += chunk;
+        count -= chunk;
+    }
+}
+
+
+/*************************************************************************
+* RLE_StreamInit() - Start a new compressed stream.
+*  stream  - Encoder state.
+*  marker  - Repetition marker. Any value works, but a symbol which is
+*            rare in the input gives the best compression.
+*  sink    - Function receiving the encoded data.
+*  context - Passed through to the sink.
+*************************************************************************/
+
+void RLE_StreamInit16( RLE_Stream16 *stream, unsigned short int marker,
+    RLE_Sink sink, void *context )
+{
+    stream->sink = sink;
+    stream->context = context;
+    stream->marker = marker;
+    stream->symbol = 0;
+    stream->count = 0;
+    stream->total = 0;
+
+    /* Remember the repetition marker for the decoder */
+    stream->buffer[ 0 ] = marker;
+    stream->fill = 1;
+}
+
+void RLE_StreamInit8( RLE_Stream8 *stream, unsigned char marker,
+    RLE_Sink sink, void *context )
+{
+    stream->sink = sink;
+    stream->context = context;
+    stream->marker = marker;
+    stream->symbol = 0;
+    stream->count = 0;
+    stream->total = 0;
+
+    /* Remember the repetition marker for the decoder */
+    stream->buffer[ 0 ] = marker;
+    stream->fill = 1;
+}
+
+
+/*************************************************************************
+* RLE_StreamFeed() - Compress the next piece of input.
+*  stream  - Encoder state.
+*  in      - Input (uncompressed) data.
+*  insize  - Number of input symbols.
+*************************************************************************/
+
+void RLE_StreamFeed16( RLE_Stream16 *stream, const unsigned short int *in,
+    unsigned int insize )
+{
+    unsigned int pos, end, count;
+
+    pos = 0;
+    while( pos < insize )
+    {
+        /* Extend the pending run */
+        if( (stream->count > 0) && (in[ pos ] == stream->symbol) )
+        {
+            count = RLE16_MAXRUN - stream->count;
+            end = insize - pos > count ? pos + count : insize;
+            count = _RLE_RunLength16( in, pos, end );
+            stream->count += count;
+            pos += count;
+            if( stream->count == RLE16_MAXRUN )
+            {
+                _RLE_StreamEndRun16( stream );
+            }
+            continue;
+        }
+        _RLE_StreamEndRun16( stream );
+
+        /* Copy the non-repeating stretch, except for its last symbol
+           which may continue in the next piece of input */
+        end = _RLE_FindPair16( in, pos, insize );
+        if( end == insize )
+        {
+            -- end;
+        }
+        _RLE_StreamLiterals16( stream, &in[ pos ], end - pos );
+        pos = end;
+
+        /* Start a new run */
+        stream->symbol = in[ pos ++ ];
+        stream->count = 1;
+    }
+}
+
+void RLE_StreamFeed8( RLE_Stream8 *stream, const unsigned char *in,
+    unsigned int insize )
+{
+    unsigned int pos, end, count;
+
+    pos = 0;
+    while( pos < insize )
+    {
+        /* Extend the pending run */
+        if( (stream->count > 0) && (in[ pos ] == stream->symbol) )
+        {
+            count = RLE8_MAXRUN - stream->count;
+            end = insize - pos > count ? pos + count : insize;
+            count = _RLE_RunLength8( in, pos, end );
+            stream->count += count;
+            pos += count;
+            if( stream->count == RLE8_MAXRUN )
+            {
+                _RLE_StreamEndRun8( stream );
+            }
+            continue;
+        }
+        _RLE_StreamEndRun8( stream );
+
+        /* Copy the non-repeating stretch, except for its last symbol
+           which may continue in the next piece of input */
+        end = _RLE_FindPair8( in, pos, insize );
+        if( end == insize )
+        {
+            -- end;
+        }
+        _RLE_StreamLiterals8( stream, &in[ pos ], end - pos );
+        pos = end;
+
+        /* Start a new run */
+        stream->symbol = in[ pos ++ ];
+        stream->count = 1;
+    }
+}
+
+
+/*************************************************************************
+* RLE_StreamFinish() - Encode the pending run and flush all data to the
+* sink. The function returns the total size of the compressed data in
+* symbols, including the marker.
+*************************************************************************/
+
+unsigned int RLE_StreamFinish16( RLE_Stream16 *stream )
+{
+    _RLE_StreamEndRun16( stream );
+    _RLE_StreamFlush16( stream );
+    return stream->total;
+}
+
+unsigned int RLE_StreamFinish8( RLE_Stream8 *stream )
+{
+    _RLE_StreamEndRun8( stream );
+    _RLE_StreamFlush8( stream );
+    return stream->total;
+}
+
+
+/*************************************************************************
+*                       PACKBITS-STYLE RLE VARIANT                       *
+*************************************************************************/
+
+/*************************************************************************
+* The PackBits variant does not use a marker symbol. Instead, the stream
+* consists of control codes, each followed by its payload:
+*
+*  8-bit:  0x00..0x7F  literal run, (c + 1) bytes follow (1..128)
+*          0x80..0xFF  repeat run, next byte repeated (c & 0x7F) + 3
+*                      times (3..130)
+*
+*  16-bit: 0x0000..0x7FFF  literal run, (c + 1) words follow (1..32768)
+*          0x8000..0xFFFF  repeat run, next word repeated (c & 0x7FFF)
+*                          + 3 times (3..32770)
+*
+* Runs of less than three symbols are kept inside the literal runs, so
+* the encoded data is never larger than insize + ceil(insize/128) bytes
+* (8-bit) or insize + ceil(insize/32768) words (16-bit). The decoder can
+* copy whole literal runs with memcpy() and fill repeat runs with wide
+* stores, since no symbol has to be compared against a marker.
+*************************************************************************/
+
+#define RLE_PB8_MAXLITERAL      128
+#define RLE_PB8_MAXRUN          130
+#define RLE_PB16_MAXLITERAL     32768
+#define RLE_PB16_MAXRUN         32770
+#define RLE_PB_MINRUN           3
+
+
+/*************************************************************************
+* _RLE_WriteLiteralPB() - Encode 'count' literal symbols starting at
+* 'in', split into as many literal runs as needed.
+*************************************************************************/
+
+static void _RLE_WriteLiteralPB8( unsigned char *out, unsigned int *outpos,
+    unsigned char *in, unsigned int count )
+{
+    unsigned int idx, chunk;
+
+    idx = *outpos;
+    while( count > 0 )
+    {
+        chunk = count < RLE_PB8_MAXLITERAL ? count : RLE_PB8_MAXLITERAL;
+        out[ idx ++ ] = (unsigned char) (chunk - 1);
+        memcpy( &out[ idx ], in, chunk );
+        idx += chunk;
+        in += chunk;
+        count -= chunk;
+    }
+    *outpos = idx;
+}
+
+static void _RLE_WriteLiteralPB16( unsigned short int *out,
+    unsigned int *outpos, unsigned short int *in, unsigned int count )
+{
+    unsigned int idx, chunk;
+
+    idx = *outpos;
+    while( count > 0 )
+    {
+        chunk = count < RLE_PB16_MAXLITERAL ? count : RLE_PB16_MAXLITERAL;
+        out[ idx ++ ] = (unsigned short int) (chunk - 1);
+        memcpy( &out[ idx ], in, chunk * 2 );
+        idx += chunk;
+        in += chunk;
+        count -= chunk;
+    }
+    *outpos = idx;
+}
+
+
+/*************************************************************************
+* RLE_CompressPB() - Compress a block of data using the PackBits-style
+* RLE coder.
+*  in     - Input (uncompressed) buffer.
+*  out    - Output (compressed) buffer. This buffer must be 1/128 larger
+*           than the input buffer, plus one symbol.
+*  insize - Number of input symbols.
+* The function returns the size of the compressed data in symbols.
+*************************************************************************/
+
+int RLE_CompressPB8( unsigned char *in, unsigned char *out,
+    unsigned int insize )
+{
+    unsigned char symbol;
+    unsigned int  inpos, outpos, litstart, count;
 
-    /* Get marker symbol from input stream */
     inpos = 0;
-    marker = in[ inpos ++ ];
+    outpos = 0;
+    litstart = 0;
 
-    /* Main decompression loop */
+    while( inpos < insize )
+    {
+        /* Measure the run starting at the current position */
+        symbol = in[ inpos ];
+        count = 1;
+        while( (inpos + count < insize) && (in[ inpos + count ] == symbol) &&
+               (count < RLE_PB8_MAXRUN) )
+        {
+            ++ count;
+        }
+
+        if( count >= RLE_PB_MINRUN )
+        {
+            /* Flush pending literals, then code the repeat run */
+            _RLE_WriteLiteralPB8( out, &outpos, &in[ litstart ],
+                inpos - litstart );
+            out[ outpos ++ ] = (unsigned char) (0x80 | (count - RLE_PB_MINRUN));
+            out[ outpos ++ ] = symbol;
+            inpos += count;
+            litstart = inpos;
+        }
+        else
+        {
+            /* Short runs become part of the literal run */
+            inpos += count;
+        }
+    }
+
+    _RLE_WriteLiteralPB8( out, &outpos, &in[ litstart ], inpos - litstart );
+
+    return outpos;
+}
+
+int RLE_CompressPB16( unsigned short int *in, unsigned short int *out,
+    unsigned int insize )
+{
+    unsigned short int symbol;
+    unsigned int  inpos, outpos, litstart, count;
+
+    inpos = 0;
     outpos = 0;
-    do
+    litstart = 0;
+
+    while( inpos < insize )
     {
-        symbol = in[ inpos ++ ];
-        if( symbol == marker )
+        /* Measure the run starting at the current position */
+        symbol = in[ inpos ];
+        count = 1;
+        while( (inpos + count < insize) && (in[ inpos + count ] == symbol) &&
+               (count < RLE_PB16_MAXRUN) )
+        {
+            ++ count;
+        }
+
+        if( count >= RLE_PB_MINRUN )
+        {
+            /* Flush pending literals, then code the repeat run */
+            _RLE_WriteLiteralPB16( out, &outpos, &in[ litstart ],
+                inpos - litstart );
+            out[ outpos ++ ] = (unsigned short int) (0x8000 | (count - RLE_PB_MINRUN));
+            out[ outpos ++ ] = symbol;
+            inpos += count;
+            litstart = inpos;
+        }
+        else
         {
-            /* We had a marker byte */
-            count = in[ inpos ++ ];
-            if( count <= 2 )
+            /* Short runs become part of the literal run */
+            inpos += count;
+        }
+    }
+
+    _RLE_WriteLiteralPB16( out, &outpos, &in[ litstart ], inpos - litstart );
+
+    return outpos;
+}
+
+
+/*************************************************************************
+* RLE_DecodePB() - Uncompress a block of data using the PackBits-style
+* RLE decoder, with bounds checking on both buffers.
+*  in      - Input (compressed) buffer.
+*  insize  - Number of input symbols.
+*  out     - Output (uncompressed) buffer.
+*  outsize - Capacity of the output buffer in symbols.
+*  outlen  - Receives the number of symbols written (may be NULL).
+* The function returns RLE_OK, RLE_ERROR_TRUNCATED or RLE_ERROR_OVERFLOW
+* (see RLE_Decode16).
+*************************************************************************/
+
+int RLE_DecodePB8( const unsigned char *in, unsigned int insize,
+    unsigned char *out, unsigned int outsize, unsigned int *outlen )
+{
+    unsigned int  inpos, outpos, control, count;
+    int result;
+
+    result = RLE_OK;
+    inpos = 0;
+    outpos = 0;
+    while( inpos < insize )
+    {
+        control = in[ inpos ++ ];
+        if( control & 0x80 )
+        {
+            /* Repeat run */
+            count = (control & 0x7f) + RLE_PB_MINRUN;
+            if( inpos >= insize )
             {
-                /* Counts 0, 1 and 2 are used for marker byte repetition
-                   only */
-                for( i = 0; i <= count; ++ i )
-                {
-                    out[ outpos ++ ] = marker;
-                }
+                result = RLE_ERROR_TRUNCATED;
+                break;
             }
-            else
+            if( count > outsize - outpos )
             {
-                if( count & 0x80 )
-                {
-                    count = ((count & 0x7f) << 8) + in[ inpos ++ ];
-                }
-                symbol = in[ inpos ++ ];
-                for( i = 0; i <= count; ++ i )
-                {
-                    out[ outpos ++ ] = symbol;
-                }
+                result = RLE_ERROR_OVERFLOW;
+                break;
             }
+            memset( &out[ outpos ], in[ inpos ++ ], count );
         }
         else
         {
-            /* No marker, plain copy */
-            out[ outpos ++ ] = symbol;
+            /* Literal run */
+            count = control + 1;
+            if( count > insize - inpos )
+            {
+                result = RLE_ERROR_TRUNCATED;
+                break;
+            }
+            if( count > outsize - outpos )
+            {
+                result = RLE_ERROR_OVERFLOW;
+                break;
+            }
+            memcpy( &out[ outpos ], &in[ inpos ], count );
+            inpos += count;
+        }
+        outpos += count;
+    }
+
+    if( outlen )
+    {
+        *outlen = outpos;
+    }
+    return result;
+}
+
+int RLE_DecodePB16( const unsigned short int *in, unsigned int insize,
+    unsigned short int *out, unsigned int outsize, unsigned int *outlen )
+{
+    unsigned int  inpos, outpos, control, count;
+    int result;
+
+    result = RLE_OK;
+    inpos = 0;
+    outpos = 0;
+    while( inpos < insize )
+    {
+        control = in[ inpos ++ ];
+        if( control & 0x8000 )
+        {
+            /* Repeat run */
+            count = (control & 0x7fff) + RLE_PB_MINRUN;
+            if( inpos >= insize )
+            {
+                result = RLE_ERROR_TRUNCATED;
+                break;
+            }
+            if( count > outsize - outpos )
+            {
+                result = RLE_ERROR_OVERFLOW;
+                break;
+            }
+            _RLE_Fill16( &out[ outpos ], in[ inpos ++ ], count );
         }
+        else
+        {
+            /* Literal run */
+            count = control + 1;
+            if( count > insize - inpos )
+            {
+                result = RLE_ERROR_TRUNCATED;
+                break;
+            }
+            if( count > outsize - outpos )
+            {
+                result = RLE_ERROR_OVERFLOW;
+                break;
+            }
+            memcpy( &out[ outpos ], &in[ inpos ], count * 2 );
+            inpos += count;
+        }
+        outpos += count;
+    }
+
+    if( outlen )
+    {
+        *outlen = outpos;
     }
-    while( inpos < insize );
+    return result;
+}
+
+
+/*************************************************************************
+* RLE_UncompressPB() - Uncompress a block of data using the PackBits-style
+* RLE decoder.
+*  in      - Input (compressed) buffer.
+*  out     - Output (uncompressed) buffer. This buffer must be large
+*            enough to hold the uncompressed data.
+*  insize  - Number of input symbols.
+*************************************************************************/
+
+void RLE_UncompressPB8( unsigned char *in, unsigned char *out,
+    unsigned int insize )
+{
+    RLE_DecodePB8( in, insize, out, 0xffffffff, 0 );
+}
+
+void RLE_UncompressPB16( unsigned short int *in, unsigned short int *out,
+    unsigned int insize )
+{
+    RLE_DecodePB16( in, insize, out, 0xffffffff, 0 );
 }
@@ -34,6 +34,50 @@
 
 
 
+/*************************************************************************
+* Result codes of the RLE_Decode functions
+*************************************************************************/
+
+#define RLE_OK                  0
+#define RLE_ERROR_TRUNCATED     -1  /* input ends inside a code */
+#define RLE_ERROR_OVERFLOW      -2  /* output buffer too small */
+
+
+/*************************************************************************
+* Streaming encoder state
+*************************************************************************/
+
+#define RLE_STREAM_BUFFER       4096
+
+/* Receives 'size' bytes of encoded data */
+typedef void (*RLE_Sink)( void *context, const void *data,
+    unsigned int size );
+
+typedef struct
+{
+    RLE_Sink            sink;
+    void               *context;
+    unsigned short int  marker;
+    unsigned short int  symbol;         /* symbol of the pending run */
+    unsigned int        count;          /* length of the pending run */
+    unsigned int        total;          /* symbols passed to the sink */
+    unsigned int        fill;           /* symbols in buffer */
+    unsigned short int  buffer[ RLE_STREAM_BUFFER ];
+} RLE_Stream16;
+
+typedef struct
+{
+    RLE_Sink            sink;
+    void               *context;
+    unsigned char       marker;
+    unsigned char       symbol;         /* symbol of the pending run */
+    unsigned int        count;          /* length of the pending run */
+    unsigned int        total;          /* symbols passed to the sink */
+    unsigned int        fill;           /* symbols in buffer */
+    unsigned char       buffer[ RLE_STREAM_BUFFER ];
+} RLE_Stream8;
+
+
 /*************************************************************************
 * Function prototypes
 *************************************************************************/
@@ -51,4 +95,37 @@ void RLE_Uncompress8( unsigned char *in, unsigned char *out,
                      unsigned int insize );
 
 
+int RLE_CompressPB16( unsigned short int *in, unsigned short int *out,
+    unsigned int insize );
+void RLE_UncompressPB16( unsigned short int *in, unsigned short int *out,
+                unsigned int insize );
+
+int RLE_CompressPB8( unsigned char *in, unsigned char *out,
+                  unsigned int insize );
+void RLE_UncompressPB8( unsigned char *in, unsigned char *out,
+                     unsigned int insize );
+
+int RLE_Decode16( const unsigned short int *in, unsigned int insize,
+    unsigned short int *out, unsigned int outsize, unsigned int *outlen );
+int RLE_Decode8( const unsigned char *in, unsigned int insize,
+    unsigned char *out, unsigned int outsize, unsigned int *outlen );
+
+int RLE_DecodePB16( const unsigned short int *in, unsigned int insize,
+    unsigned short int *out, unsigned int outsize, unsigned int *outlen );
+int RLE_DecodePB8( const unsigned char *in, unsigned int insize,
+    unsigned char *out, unsigned int outsize, unsigned int *outlen );
+
+
+void RLE_StreamInit16( RLE_Stream16 *stream, unsigned short int marker,
+    RLE_Sink sink, void *context );
+void RLE_StreamFeed16( RLE_Stream16 *stream, const unsigned short int *in,
+    unsigned int insize );
+unsigned int RLE_StreamFinish16( RLE_Stream16 *stream );
+
+void RLE_StreamInit8( RLE_Stream8 *stream, unsigned char marker,
+    RLE_Sink sink, void *context );
+void RLE_StreamFeed8( RLE_Stream8 *stream, const unsigned char *in,
+    unsigned int insize );
+unsigned int RLE_StreamFinish8( RLE_Stream8 *stream );
+
 #endif /* _rle_h_ */
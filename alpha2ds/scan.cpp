@@ -0,0 +1,249 @@
+//=======================================================
+// scan.cpp
+//
+// Collects the input images of a run from the directory tree or from a
+// manifest. Entries are sorted by name within each directory, so runs
+// sharing a palette (-p) are reproducible on every file system.
+//=======================================================
+
+#include "stdafx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#endif
+
+#include "scan.h"
+#include "watch.h"
+
+//=======================================================
+// ScanAdd
+//=======================================================
+/** Append an entry without overrides
+*/
+static void ScanAdd(std::vector<SCANENTRY> & entries, const std::string & directory, const std::string & name)
+{
+	SCANENTRY entry;
+
+	entry.directory = directory;
+	entry.name = name;
+	entry.format = SCAN_FORMAT_DEFAULT;
+	entry.tilesize = 0;
+	entries.push_back(entry);
+}
+
+//=======================================================
+// ScanDirectory
+//=======================================================
+/** Collect the images in a directory matching a wildcard expression
+	@param directory Directory with trailing separator, empty for the current one
+	@param filter Wildcard expression the file names have to match
+	@param recursive Descend into subdirectories
+	@param entries Receives the images
+	@return Returns false if the directory cannot be read
+*/
+bool ScanDirectory(const char * directory, const char * filter, bool recursive, std::vector<SCANENTRY> & entries)
+{
+	std::vector<std::string> files;
+	std::vector<std::string> subdirectories;
+	std::string path = directory;
+
+#ifdef _WIN32
+	_finddata_t finddata;
+	intptr_t handle = _findfirst((path.empty() ? std::string(".\\*") : path + "*").c_str(), &finddata);
+
+	if (handle == -1) return path.empty();	// an empty current directory is no error
+
+	do {
+		if (!strcmp(finddata.name, ".") || !strcmp(finddata.name, "..")) continue;
+
+		if (finddata.attrib & _A_SUBDIR) {
+			if (recursive) subdirectories.push_back(finddata.name);
+		} else if (WatchMatch(filter, finddata.name)) {
+			files.push_back(finddata.name);
+		}
+	} while (_findnext(handle, &finddata) == 0);
+
+	_findclose(handle);
+#else
+	DIR * dir = opendir(path.empty() ? "." : path.c_str());
+	struct dirent * item;
+
+	if (!dir) return false;
+
+	while ((item = readdir(dir)) != NULL)
+	{
+		if (!strcmp(item->d_name, ".") || !strcmp(item->d_name, "..")) continue;
+
+		// symbolic links to directories are not followed
+		bool subdirectory = (item->d_type == DT_DIR);
+		if (item->d_type == DT_UNKNOWN) {
+			struct stat info;
+			subdirectory = !lstat((path + item->d_name).c_str(), &info) && S_ISDIR(info.st_mode);
+		}
+
+		if (subdirectory) {
+			if (recursive) subdirectories.push_back(item->d_name);
+		} else if (!fnmatch(filter, item->d_name, 0)) {
+			files.push_back(item->d_name);
+		}
+	}
+
+	closedir(dir);
+#endif
+
+	std::sort(files.begin(), files.end());
+	std::sort(subdirectories.begin(), subdirectories.end());
+
+	for (size_t i = 0; i < files.size(); i++)
+		ScanAdd(entries, path, files[i]);
+
+	for (size_t i = 0; i < subdirectories.size(); i++)
+	{
+		std::string subdirectory = path + subdirectories[i] + SCAN_SEPARATOR;
+		if (!ScanDirectory(subdirectory.c_str(), filter, recursive, entries)) return false;
+	}
+
+	return true;
+}
+
+//=======================================================
+// ScanOption
+//=======================================================
+/** Parse one key=value override of a manifest line
+	@return Returns false if the key or value is invalid
+*/
+static bool ScanOption(SCANENTRY & entry, const char * option)
+{
+	const char * value = strchr(option, '=');
+	if (!value || !value[1]) return false;
+
+	std::string key(option, value - option);
+	value++;
+
+	if (key == "format") {
+		int format = atoi(value);
+		if ( (format != 1) && (format != 4) && (format != 5) && (format != 6) && (format != 7) && (format != 8) && (format != 16) ) return false;
+		entry.format = format;
+	} else if (key == "tile") {
+		int tilesize = atoi(value);
+		if ( (tilesize < 2) || (tilesize > 64) || (tilesize & 1) ) return false;
+		entry.tilesize = (unsigned short int)tilesize;
+	} else if (key == "palette") {
+		entry.palette = value;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+//=======================================================
+// ScanManifest
+//=======================================================
+/** Read the images and their overrides from a manifest file
+	@param filename Name of the manifest
+	@param entries Receives the images
+	@param errorline Receives the number of the invalid line, 0 if the file cannot be read
+	@return Returns false on error
+*/
+bool ScanManifest(const char * filename, std::vector<SCANENTRY> & entries, unsigned int * errorline)
+{
+	char line[4096];
+	unsigned int number = 0;
+	FILE * file = fopen(filename, "r");
+
+	*errorline = 0;
+	if (!file) return false;
+
+	while (fgets(line, sizeof(line), file))
+	{
+		number++;
+
+		char * comment = strchr(line, '#');
+		if (comment) *comment = '\0';
+
+		// the path may be quoted if it contains spaces
+		char * path = line;
+		char * rest;
+		while (isspace((unsigned char)*path)) path++;
+		if (!*path) continue;
+
+		if (*path == '"') {
+			path++;
+			rest = strchr(path, '"');
+			if (!rest) {
+				*errorline = number;
+				fclose(file);
+				return false;
+			}
+		} else {
+			rest = path;
+			while (*rest && !isspace((unsigned char)*rest)) rest++;
+		}
+		if (*rest) *rest++ = '\0';
+
+		// split directory and file name, Windows accepts both separators
+		char * separator = strrchr(path, '/');
+#ifdef _WIN32
+		char * backslash = strrchr(path, '\\');
+		if (backslash > separator) separator = backslash;
+#endif
+		std::string directory = separator ? std::string(path, separator + 1 - path) : std::string();
+		ScanAdd(entries, directory, separator ? separator + 1 : path);
+
+		for (char * option = strtok(rest, " \t\r\n"); option; option = strtok(NULL, " \t\r\n"))
+		{
+			if (!ScanOption(entries.back(), option)) {
+				*errorline = number;
+				fclose(file);
+				return false;
+			}
+		}
+	}
+
+	fclose(file);
+	return true;
+}
+
+//=======================================================
+// ScanApply
+//=======================================================
+/** Apply the overrides of an entry to the options of the run
+*/
+void ScanApply(const SCANENTRY * entry, CONVERTOPTIONS * options)
+{
+	if (entry->format != SCAN_FORMAT_DEFAULT)
+	{
+		options->OutputWidth = OutputWidth16Bit;
+		options->optBGR565 = false;
+		options->optRGB565 = false;
+		options->DirectFormat = 0;
+
+		switch (entry->format)
+		{
+		case 1: options->OutputWidth = OutputWidth1Bit; break;
+		case 4: options->OutputWidth = OutputWidth4Bit; break;
+		case 5: options->OutputWidth = OutputWidth3x4Bit; break;
+		case 6: options->optBGR565 = true; break;
+		case 7: options->optRGB565 = true; break;
+		case 8: options->OutputWidth = OutputWidth8Bit; break;
+		}
+	}
+
+	if (entry->tilesize)
+	{
+		options->optTile = true;
+		options->TileSize = entry->tilesize;
+	}
+}
@@ -0,0 +1,47 @@
+//=======================================================
+// scan.h
+//
+// Input lists: the images of a run are collected before the first one
+// is converted, either by scanning the current directory (recursively
+// with -R) or from a manifest file (-m). The list is the whole job; each
+// entry is converted on its own and writes its outputs next to the
+// input.
+//
+// Manifest format, one image per line, # starts a comment:
+//
+//   path/to/image.png [format=1|4|5|6|7|8|16] [tile=<size>] [palette=<file>]
+//
+// format selects the output like the switch of the same digit (16 is
+// RGB555), tile enables tiles of the given size (-t -d) and palette
+// shares a palette file with other entries (-p).
+//=======================================================
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "convert.h"
+
+#ifdef _WIN32
+#define SCAN_SEPARATOR	'\\'
+#else
+#define SCAN_SEPARATOR	'/'
+#endif
+
+#define SCAN_FORMAT_DEFAULT	(0)		// no format override
+
+/** One input image and its overrides
+*/
+struct SCANENTRY
+{
+	std::string directory;		// with trailing separator, empty for the current directory
+	std::string name;			// file name
+	int format;					// SCAN_FORMAT_DEFAULT or the digit of the format switch
+	unsigned short int tilesize;	// 0 = no override
+	std::string palette;		// empty = no override
+};
+
+bool ScanDirectory(const char * directory, const char * filter, bool recursive, std::vector<SCANENTRY> & entries);
+bool ScanManifest(const char * filename, std::vector<SCANENTRY> & entries, unsigned int * errorline);
+void ScanApply(const SCANENTRY * entry, CONVERTOPTIONS * options);
@@ -8,7 +8,9 @@
 
 #define WIN32_LEAN_AND_MEAN		// Exclude rarely-used stuff from Windows headers
 #include <stdio.h>
+#ifdef _WIN32
 #include <tchar.h>
+#endif
 
 
 
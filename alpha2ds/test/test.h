@@ -0,0 +1,52 @@
+//=======================================================
+// test.h
+//
+// Round-trip tests of libalpha2ds: images are converted through the
+// library, decoded again by the tests and compared with the source
+// pixels, so a change of an output format shows up as a failed check.
+// Run by "make check" or the alpha2ds_test project.
+//=======================================================
+
+#pragma once
+
+#include <vector>
+
+#include "convert.h"
+
+/** Count a failed check and print where it is
+*/
+#define CHECK(condition) TestCheck((condition), #condition, __FILE__, __LINE__)
+
+void TestCheck(bool ok, const char * text, const char * file, int line);
+
+/** RGBA test image with runs of transparent, opaque and partly
+	transparent pixels and a few colors, the same for every seed
+	@param width Width in pixels
+	@param height Height in pixels
+	@param seed Varies colors and alpha
+	@return Returns width * height RGBA pixels
+*/
+std::vector<unsigned char> TestImage(unsigned int width, unsigned int height, unsigned int seed);
+
+/** Convert an RGBA image with an empty palette
+	@param options Conversion options
+	@param rgba Image from TestImage
+	@param result Receives the outputs, release with ConvertFreeResult
+	@return Returns true if successful
+*/
+bool TestConvert(const CONVERTOPTIONS * options, const std::vector<unsigned char> & rgba, unsigned int width, unsigned int height, CONVERTRESULT * result);
+
+/** Convert an RGBA image with a given palette
+	@param palette Palette in host byte order, extended unless the options
+	map onto it
+*/
+bool TestConvertPalette(const CONVERTOPTIONS * options, const std::vector<unsigned char> & rgba, unsigned int width, unsigned int height, unsigned short palette[256], CONVERTRESULT * result);
+
+void TestRLE();
+void TestArchive();
+void Test4Bit();
+void TestAlpha();
+void TestSpans();
+void TestPremultiply();
+void TestInterleave();
+void TestPalette();
@@ -0,0 +1,145 @@
+//=======================================================
+// test_4bit.cpp
+//
+// 4-bit output (-4): greyscale nibbles against the luminance of the
+// source, and 16 color indices (-4 -Q) against their palette
+//=======================================================
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rle.h"
+#include "test.h"
+
+//=======================================================
+// TestNibble
+//=======================================================
+/** Pixel of 4-bit data, the first of a byte in the low nibble
+*/
+static unsigned int TestNibble(const unsigned char * data, unsigned int i)
+{
+	return (data[i / 2] >> ((i & 1) * 4)) & 15;
+}
+
+//=======================================================
+// TestGrey
+//=======================================================
+/** Luminance with the BT.601 weights 77/150/29 of 256, cut to 4 bits.
+	-r output decodes to the packed bytes.
+*/
+static void TestGrey(unsigned int width, unsigned int height)
+{
+	std::vector<unsigned char> rgba = TestImage(width, height, 4);
+	CONVERTOPTIONS options;
+	CONVERTRESULT raw, compressed;
+
+	ConvertDefaults(&options);
+	options.OutputWidth = OutputWidth4Bit;
+	CHECK(TestConvert(&options, rgba, width, height, &raw));
+	options.optRLE = true;
+	CHECK(TestConvert(&options, rgba, width, height, &compressed));
+
+	unsigned int count = width * height;
+	unsigned int size = (count + 1) / 2;
+	const unsigned char * data = raw.image.data;
+
+	CHECK(raw.image.format == ARCHIVE_FORMAT_GREY4);
+	CHECK(raw.image.config == CONFIG_4BIT);
+	CHECK(raw.image.size == size);
+	CHECK(!raw.palette.data);
+	if (!data || (raw.image.size != size)) {
+		ConvertFreeResult(&raw);
+		ConvertFreeResult(&compressed);
+		return;
+	}
+
+	unsigned int wrong = 0;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		const unsigned char * pixel = &rgba[i * 4];
+		if (TestNibble(data, i) != (pixel[0] * 77u + pixel[1] * 150u + pixel[2] * 29u) / 4096) wrong++;
+	}
+	CHECK(wrong == 0);
+	if (count & 1) CHECK((data[size - 1] >> 4) == 0);
+
+	std::vector<unsigned char> decoded(size);
+	unsigned int length;
+
+	CHECK(compressed.image.config == (CONFIG_4BIT | CONFIG_COMPRESSED));
+	CHECK(RLE_Decode8(compressed.image.data, compressed.image.count, &decoded[0], size, &length) == RLE_OK);
+	CHECK(length == size);
+	CHECK(!memcmp(&decoded[0], data, size));
+
+	ConvertFreeResult(&raw);
+	ConvertFreeResult(&compressed);
+}
+
+//=======================================================
+// TestIndex4
+//=======================================================
+/** -4 -Q of an image with fewer colors than the palette: every pixel
+	finds its own color, transparent pixels index 0
+*/
+static void TestIndex4(unsigned int width, unsigned int height)
+{
+	static const unsigned char colors[][3] =
+	{
+		{ 248, 0, 0 }, { 0, 248, 0 }, { 0, 0, 248 }, { 248, 248, 0 }, { 0, 248, 248 },
+		{ 248, 0, 248 }, { 128, 64, 32 }, { 32, 64, 128 }, { 200, 200, 200 }, { 0, 0, 0 },
+	};
+	std::vector<unsigned char> rgba = TestImage(width, height, 5);
+	CONVERTOPTIONS options;
+	CONVERTRESULT result;
+
+	unsigned int count = width * height;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		const unsigned char * color = colors[(i / 5) % (sizeof(colors) / sizeof(colors[0]))];
+		memcpy(&rgba[i * 4], color, 3);
+		if (rgba[i * 4 + 3]) rgba[i * 4 + 3] = 255;
+	}
+
+	ConvertDefaults(&options);
+	options.OutputWidth = OutputWidth4Bit;
+	options.optQuantize = true;
+	CHECK(TestConvert(&options, rgba, width, height, &result));
+
+	const unsigned char * data = result.image.data;
+	const unsigned short * palette = (const unsigned short *)result.palette.data;
+
+	CHECK(result.image.format == ARCHIVE_FORMAT_INDEX4);
+	CHECK(result.image.size == (count + 1) / 2);
+	CHECK(palette && (result.palette.size == 16 * 2));
+	if (!data || !palette || (result.image.size != (count + 1) / 2) || (result.palette.size != 16 * 2)) {
+		ConvertFreeResult(&result);
+		return;
+	}
+
+	unsigned int wrong = 0;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		const unsigned char * pixel = &rgba[i * 4];
+		unsigned int index = TestNibble(data, i);
+
+		if (!pixel[3]) {
+			if (index != 0) wrong++;
+			continue;
+		}
+		unsigned int color = (pixel[0] >> 3) | ((pixel[1] >> 3) << 5) | ((pixel[2] >> 3) << 10);
+		if ((index == 0) || ((palette[index] & 0x7FFF) != color)) wrong++;
+	}
+	CHECK(wrong == 0);
+
+	ConvertFreeResult(&result);
+}
+
+//=======================================================
+// Test4Bit
+//=======================================================
+void Test4Bit()
+{
+	// an odd number of pixels leaves the high nibble of the last byte
+	TestGrey(77, 41);
+	TestGrey(64, 40);
+	TestIndex4(77, 41);
+}
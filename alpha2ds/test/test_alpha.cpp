@@ -0,0 +1,92 @@
+//=======================================================
+// test_alpha.cpp
+//
+// Alpha file with -A 4 and -A 2: the packed values unpacked again
+// against the source alpha rounded to 15 or 3 levels
+//=======================================================
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rle.h"
+#include "test.h"
+
+//=======================================================
+// TestAlphaLevel
+//=======================================================
+/** round(alpha * levels / 255) computed the long way
+*/
+static unsigned int TestAlphaLevel(unsigned char alpha, unsigned int levels)
+{
+	return (alpha * levels * 2 + 255) / 510;
+}
+
+//=======================================================
+// TestAlphaBits
+//=======================================================
+/** Values are packed first pixel in the low bits, the unused bits of
+	the last byte are 0. -r output decodes to the packed bytes.
+*/
+static void TestAlphaBits(unsigned int bits, unsigned int width, unsigned int height)
+{
+	std::vector<unsigned char> rgba = TestImage(width, height, bits);
+	CONVERTOPTIONS options;
+	CONVERTRESULT raw, compressed;
+
+	ConvertDefaults(&options);
+	options.optAlphaExternal = true;
+	options.AlphaBits = bits;
+	CHECK(TestConvert(&options, rgba, width, height, &raw));
+	options.optRLE = true;
+	CHECK(TestConvert(&options, rgba, width, height, &compressed));
+
+	unsigned int count = width * height;
+	unsigned int per_byte = 8 / bits;
+	unsigned int levels = (1 << bits) - 1;
+	unsigned int size = (count + per_byte - 1) / per_byte;
+	const unsigned char * packed = raw.alpha.data;
+
+	CHECK(raw.alpha.format == ((bits == 4) ? ARCHIVE_FORMAT_ALPHA4 : ARCHIVE_FORMAT_ALPHA2));
+	CHECK(raw.alpha.config == ((bits == 4) ? CONFIG_4BIT : CONFIG_2BIT));
+	CHECK(raw.alpha.size == size);
+	if (!packed || (raw.alpha.size != size)) {
+		ConvertFreeResult(&raw);
+		ConvertFreeResult(&compressed);
+		return;
+	}
+
+	unsigned int wrong = 0;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		unsigned int value = (packed[i / per_byte] >> ((i % per_byte) * bits)) & levels;
+		if (value != TestAlphaLevel(rgba[i * 4 + 3], levels)) wrong++;
+	}
+	CHECK(wrong == 0);
+
+	// unused bits of the last byte
+	if (count % per_byte) CHECK((packed[size - 1] >> ((count % per_byte) * bits)) == 0);
+
+	std::vector<unsigned char> decoded(size);
+	unsigned int length;
+
+	CHECK(compressed.alpha.config == (raw.alpha.config | CONFIG_COMPRESSED));
+	CHECK(RLE_Decode8(compressed.alpha.data, compressed.alpha.count, &decoded[0], size, &length) == RLE_OK);
+	CHECK(length == size);
+	CHECK(!memcmp(&decoded[0], packed, size));
+
+	ConvertFreeResult(&raw);
+	ConvertFreeResult(&compressed);
+}
+
+//=======================================================
+// TestAlpha
+//=======================================================
+void TestAlpha()
+{
+	// 77 * 41 leaves an odd value over, 64 * 40 fills every byte
+	TestAlphaBits(4, 77, 41);
+	TestAlphaBits(4, 64, 40);
+	TestAlphaBits(2, 77, 41);
+	TestAlphaBits(2, 64, 40);
+	TestAlphaBits(2, 3, 1);
+}
@@ -0,0 +1,217 @@
+//=======================================================
+// test_archive.cpp
+//
+// Archive (-P): an archive written through archive.h read back field by
+// field as little-endian, its index, payloads and shared palettes
+//=======================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "archive.h"
+#include "test.h"
+
+#define TEST_ARCHIVE	"alpha2ds_test.a2dp"
+
+//=======================================================
+// TestLoad32
+//=======================================================
+static unsigned int TestLoad32(const unsigned char * data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((unsigned int)data[3] << 24);
+}
+
+//=======================================================
+// TestLoad16
+//=======================================================
+static unsigned int TestLoad16(const unsigned char * data)
+{
+	return data[0] | (data[1] << 8);
+}
+
+//=======================================================
+// TestReadFile
+//=======================================================
+/** Whole file, empty if it does not exist
+*/
+static std::vector<unsigned char> TestReadFile(const char * filename)
+{
+	std::vector<unsigned char> data;
+	FILE * file = fopen(filename, "rb");
+	unsigned char buffer[4096];
+	size_t size;
+
+	if (!file) return data;
+	while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) data.insert(data.end(), buffer, buffer + size);
+	fclose(file);
+	return data;
+}
+
+//=======================================================
+// TestFileExists
+//=======================================================
+static bool TestFileExists(const char * filename)
+{
+	FILE * file = fopen(filename, "rb");
+
+	if (!file) return false;
+	fclose(file);
+	return true;
+}
+
+//=======================================================
+// TestPayload
+//=======================================================
+/** Payload of the given size, different per seed
+*/
+static std::vector<unsigned char> TestPayload(unsigned int size, unsigned int seed)
+{
+	std::vector<unsigned char> data(size);
+
+	for (unsigned int i = 0; i < size; i++) data[i] = (unsigned char)(i * 7 + seed * 31);
+	return data;
+}
+
+//=======================================================
+// TestArchiveEntry
+//=======================================================
+/** Index entry of a name, NULL if there is none
+*/
+static const unsigned char * TestArchiveEntry(const std::vector<unsigned char> & file, const char * name)
+{
+	unsigned int count = TestLoad32(&file[12]);
+	unsigned int index = TestLoad32(&file[16]);
+	unsigned int names = TestLoad32(&file[20]);
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		const unsigned char * entry = &file[index + i * ARCHIVE_ENTRY_SIZE];
+		if (!strcmp((const char *)&file[names + TestLoad32(entry + 4)], name)) return entry;
+	}
+	return NULL;
+}
+
+//=======================================================
+// TestArchiveLayout
+//=======================================================
+/** Header, sorted index, alignment and payloads of an archive with
+	images, two equal palettes, one other palette and a name added twice
+*/
+static void TestArchiveLayout(unsigned int alignment)
+{
+	std::vector<unsigned char> image1 = TestPayload(1000, 1);
+	std::vector<unsigned char> image2 = TestPayload(77, 2);
+	std::vector<unsigned char> image3 = TestPayload(300, 3);
+	std::vector<unsigned char> palette1 = TestPayload(512, 4);
+	std::vector<unsigned char> palette2 = TestPayload(512, 5);
+	ARCHIVE archive;
+
+	CHECK(ArchiveOpen(&archive, TEST_ARCHIVE, alignment));
+	CHECK(ArchiveAdd(&archive, "a.img.bin", &image1[0], 1000, ARCHIVE_CODEC_RAW, ARCHIVE_FORMAT_RGB555, 20, 25, CONFIG_16BIT));
+	CHECK(ArchiveAdd(&archive, "a.pal.bin", &palette1[0], 512, ARCHIVE_CODEC_RAW, ARCHIVE_FORMAT_PALETTE, 256, 1, 0));
+	CHECK(ArchiveAdd(&archive, "b.img.bin", &image2[0], 77, ARCHIVE_CODEC_RLE, ARCHIVE_FORMAT_INDEX8, 7, 11, CONFIG_8BIT | CONFIG_COMPRESSED));
+	CHECK(ArchiveAdd(&archive, "b.pal.bin", &palette1[0], 512, ARCHIVE_CODEC_RAW, ARCHIVE_FORMAT_PALETTE, 256, 1, 0));
+	CHECK(ArchiveAdd(&archive, "c.pal.bin", &palette2[0], 512, ARCHIVE_CODEC_RAW, ARCHIVE_FORMAT_PALETTE, 256, 1, 0));
+	CHECK(ArchiveAdd(&archive, "a.img.bin", &image3[0], 300, ARCHIVE_CODEC_RAW, ARCHIVE_FORMAT_RGB555, 10, 15, CONFIG_16BIT));
+	CHECK(ArchiveClose(&archive));
+
+	char * tempname = OutFileTempName(TEST_ARCHIVE);
+	CHECK(tempname && !TestFileExists(tempname));
+	free(tempname);
+
+	std::vector<unsigned char> file = TestReadFile(TEST_ARCHIVE);
+	CHECK(file.size() >= ARCHIVE_HEADER_SIZE);
+	if (file.size() < ARCHIVE_HEADER_SIZE) return;
+
+	unsigned int count = TestLoad32(&file[12]);
+	unsigned int index = TestLoad32(&file[16]);
+	unsigned int names = TestLoad32(&file[20]);
+	unsigned int names_size = TestLoad32(&file[24]);
+
+	CHECK(TestLoad32(&file[0]) == ARCHIVE_MAGIC);
+	CHECK(!memcmp(&file[0], "A2DP", 4));
+	CHECK(TestLoad16(&file[4]) == ARCHIVE_VERSION);
+	CHECK(TestLoad16(&file[6]) == ARCHIVE_HEADER_SIZE);
+	CHECK(TestLoad32(&file[8]) == alignment);
+	CHECK(TestLoad32(&file[28]) == 0);
+	CHECK(count == 5);
+	CHECK(names == index + count * ARCHIVE_ENTRY_SIZE);
+	CHECK(names + names_size == file.size());
+	if ((count != 5) || (names + names_size != file.size())) return;
+
+	// sorted by hash, every hash matches its name
+	for (unsigned int i = 0; i < count; i++)
+	{
+		const unsigned char * entry = &file[index + i * ARCHIVE_ENTRY_SIZE];
+		unsigned int offset = TestLoad32(entry + 8);
+
+		CHECK(TestLoad32(entry) == ArchiveHash((const char *)&file[names + TestLoad32(entry + 4)]));
+		if (i) CHECK(TestLoad32(entry - ARCHIVE_ENTRY_SIZE) <= TestLoad32(entry));
+		CHECK(offset % alignment == 0);
+		CHECK(offset >= ARCHIVE_HEADER_SIZE);
+		CHECK(offset + TestLoad32(entry + 12) <= index);
+	}
+
+	// the last payload of a name wins
+	const unsigned char * entry = TestArchiveEntry(file, "a.img.bin");
+	CHECK(entry && (TestLoad32(entry + 12) == 300) && !memcmp(&file[TestLoad32(entry + 8)], &image3[0], 300));
+	CHECK(entry && (TestLoad32(entry + 16) == 10) && (TestLoad32(entry + 20) == 15));
+	CHECK(entry && (TestLoad16(entry + 24) == ARCHIVE_CODEC_RAW) && (TestLoad16(entry + 26) == ARCHIVE_FORMAT_RGB555));
+
+	entry = TestArchiveEntry(file, "b.img.bin");
+	CHECK(entry && (TestLoad32(entry + 12) == 77) && !memcmp(&file[TestLoad32(entry + 8)], &image2[0], 77));
+	CHECK(entry && (TestLoad16(entry + 24) == ARCHIVE_CODEC_RLE) && (TestLoad16(entry + 26) == ARCHIVE_FORMAT_INDEX8));
+	CHECK(entry && (TestLoad16(entry + 28) == (CONFIG_8BIT | CONFIG_COMPRESSED)) && (TestLoad16(entry + 30) == 0));
+
+	// equal palettes share one payload after the images
+	const unsigned char * pal_a = TestArchiveEntry(file, "a.pal.bin");
+	const unsigned char * pal_b = TestArchiveEntry(file, "b.pal.bin");
+	const unsigned char * pal_c = TestArchiveEntry(file, "c.pal.bin");
+
+	CHECK(pal_a && pal_b && pal_c);
+	if (!pal_a || !pal_b || !pal_c) return;
+
+	CHECK(TestLoad32(pal_a + 8) == TestLoad32(pal_b + 8));
+	CHECK(TestLoad32(pal_a + 8) != TestLoad32(pal_c + 8));
+	CHECK(TestLoad32(pal_a + 8) > TestLoad32(TestArchiveEntry(file, "b.img.bin") + 8));
+	CHECK(!memcmp(&file[TestLoad32(pal_a + 8)], &palette1[0], 512));
+	CHECK(!memcmp(&file[TestLoad32(pal_c + 8)], &palette2[0], 512));
+	CHECK(TestLoad16(pal_c + 26) == ARCHIVE_FORMAT_PALETTE);
+}
+
+//=======================================================
+// TestArchiveAbort
+//=======================================================
+/** An aborted archive leaves an existing one as it is and no temporary
+	file behind
+*/
+static void TestArchiveAbort()
+{
+	std::vector<unsigned char> before = TestReadFile(TEST_ARCHIVE);
+	std::vector<unsigned char> image = TestPayload(100, 6);
+	ARCHIVE archive;
+
+	CHECK(!before.empty());
+	CHECK(ArchiveOpen(&archive, TEST_ARCHIVE, 4));
+	CHECK(ArchiveAdd(&archive, "d.img.bin", &image[0], 100, ARCHIVE_CODEC_RAW, ARCHIVE_FORMAT_RGB555, 10, 5, CONFIG_16BIT));
+	ArchiveAbort(&archive);
+
+	char * tempname = OutFileTempName(TEST_ARCHIVE);
+	CHECK(tempname && !TestFileExists(tempname));
+	free(tempname);
+
+	CHECK(TestReadFile(TEST_ARCHIVE) == before);
+}
+
+//=======================================================
+// TestArchive
+//=======================================================
+void TestArchive()
+{
+	TestArchiveLayout(4);
+	TestArchiveLayout(512);
+	TestArchiveAbort();
+
+	remove(TEST_ARCHIVE);
+}
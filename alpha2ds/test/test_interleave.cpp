@@ -0,0 +1,123 @@
+//=======================================================
+// test_interleave.cpp
+//
+// RGB565 interleaved with alpha (-I 24 and -I 20): the layouts taken
+// apart again against the source colors and alpha
+//=======================================================
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rle.h"
+#include "test.h"
+
+//=======================================================
+// TestColor565
+//=======================================================
+/** RGB565 as pixelformat.cpp packs it, 5 bits of green at bit 6
+*/
+static unsigned int TestColor565(const unsigned char * rgba)
+{
+	return ((rgba[0] >> 3) << 11) | ((rgba[1] >> 3) << 6) | (rgba[2] >> 3);
+}
+
+//=======================================================
+// TestLoad16
+//=======================================================
+static unsigned int TestLoad16(const unsigned char * data, bool bigendian)
+{
+	return bigendian ? (data[0] << 8) | data[1] : data[0] | (data[1] << 8);
+}
+
+//=======================================================
+// TestInterleaveImage
+//=======================================================
+/** 24: a color word and an alpha byte per pixel. 20: per block of 8
+	pixels 8 color words and 4 bytes of alpha rounded to 4 bits, the
+	first pixel in the low nibble, the rest of the last block 0.
+	-r output decodes to the same bytes.
+*/
+static void TestInterleaveImage(unsigned int layout, bool bigendian, unsigned int width, unsigned int height)
+{
+	std::vector<unsigned char> rgba = TestImage(width, height, layout);
+	CONVERTOPTIONS options;
+	CONVERTRESULT raw, compressed;
+
+	ConvertDefaults(&options);
+	options.Interleave = layout;
+	options.optBigEndian = bigendian;
+	CHECK(TestConvert(&options, rgba, width, height, &raw));
+	options.optRLE = true;
+	CHECK(TestConvert(&options, rgba, width, height, &compressed));
+
+	unsigned int count = width * height;
+	unsigned int size = (layout == 20) ? (count + 7) / 8 * 20 : count * 3;
+	const unsigned char * data = raw.image.data;
+
+	CHECK(raw.image.format == ((layout == 20) ? ARCHIVE_FORMAT_RGB565A4 : ARCHIVE_FORMAT_RGB565A8));
+	CHECK(raw.image.config == (CONFIG_INTERLEAVED | ((layout == 20) ? CONFIG_4BIT : CONFIG_8BIT)));
+	CHECK(raw.image.size == size);
+	if (!data || (raw.image.size != size)) {
+		ConvertFreeResult(&raw);
+		ConvertFreeResult(&compressed);
+		return;
+	}
+
+	unsigned int wrong = 0;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		const unsigned char * pixel = &rgba[i * 4];
+		unsigned int color, alpha;
+
+		if (layout == 20)
+		{
+			const unsigned char * block = data + i / 8 * 20;
+			color = TestLoad16(block + (i % 8) * 2, bigendian);
+			alpha = (block[16 + (i % 8) / 2] >> ((i & 1) * 4)) & 15;
+			if (alpha != (pixel[3] * 15 * 2 + 255) / 510u) wrong++;
+		}
+		else
+		{
+			color = TestLoad16(data + i * 3, bigendian);
+			alpha = data[i * 3 + 2];
+			if (alpha != pixel[3]) wrong++;
+		}
+		if (color != TestColor565(pixel)) wrong++;
+	}
+	CHECK(wrong == 0);
+
+	// fill of the last block
+	if ((layout == 20) && (count % 8))
+	{
+		const unsigned char * block = data + count / 8 * 20;
+		bool zero = true;
+
+		for (unsigned int j = count % 8; j < 8; j++)
+			if (TestLoad16(block + j * 2, bigendian) || ((block[16 + j / 2] >> ((j & 1) * 4)) & 15)) zero = false;
+		CHECK(zero);
+	}
+
+	std::vector<unsigned char> decoded(size);
+	unsigned int length;
+
+	CHECK(compressed.image.config == (raw.image.config | CONFIG_COMPRESSED));
+	CHECK(RLE_Decode8(compressed.image.data, compressed.image.count, &decoded[0], size, &length) == RLE_OK);
+	CHECK(length == size);
+	CHECK(!memcmp(&decoded[0], data, size));
+
+	ConvertFreeResult(&raw);
+	ConvertFreeResult(&compressed);
+}
+
+//=======================================================
+// TestInterleave
+//=======================================================
+void TestInterleave()
+{
+	// 77 * 41 ends in a partial block of 20
+	TestInterleaveImage(24, false, 77, 41);
+	TestInterleaveImage(24, true, 77, 41);
+	TestInterleaveImage(20, false, 77, 41);
+	TestInterleaveImage(20, true, 77, 41);
+	TestInterleaveImage(20, false, 64, 40);
+}
@@ -0,0 +1,98 @@
+//=======================================================
+// test_main.cpp
+//
+// Runs all tests, the exit code is 1 if a check failed
+//=======================================================
+
+#include <stdio.h>
+#include <string.h>
+
+#include "test.h"
+
+static unsigned int Checks = 0;
+static unsigned int Failures = 0;
+
+//=======================================================
+// TestCheck
+//=======================================================
+void TestCheck(bool ok, const char * text, const char * file, int line)
+{
+	Checks++;
+	if (ok) return;
+
+	Failures++;
+	printf("%s(%d): check failed: %s\n", file, line, text);
+}
+
+//=======================================================
+// TestImage
+//=======================================================
+std::vector<unsigned char> TestImage(unsigned int width, unsigned int height, unsigned int seed)
+{
+	std::vector<unsigned char> rgba(width * height * 4);
+	unsigned int random = seed * 2654435761u + 1;
+
+	for (unsigned int y = 0; y < height; y++)
+	{
+		for (unsigned int x = 0; x < width; x++)
+		{
+			unsigned char * pixel = &rgba[(y * width + x) * 4];
+
+			random = random * 1103515245u + 12345u;
+
+			// runs of 8 pixels share their kind of alpha
+			switch (((x / 8) + y + seed) % 4)
+			{
+			case 0: pixel[3] = 0; break;
+			case 1: pixel[3] = 255; break;
+			case 2: pixel[3] = (unsigned char)(random >> 16); break;
+			default: pixel[3] = (x & 1) ? 255 : 128; break;
+			}
+
+			pixel[0] = (unsigned char)(x * 16 + seed);
+			pixel[1] = (unsigned char)(y * 8);
+			pixel[2] = (unsigned char)((random >> 8) & 0xE0);
+		}
+	}
+	return rgba;
+}
+
+//=======================================================
+// TestConvert
+//=======================================================
+bool TestConvert(const CONVERTOPTIONS * options, const std::vector<unsigned char> & rgba, unsigned int width, unsigned int height, CONVERTRESULT * result)
+{
+	unsigned short palette[256];
+
+	memset(palette, 0, sizeof(palette));
+	return TestConvertPalette(options, rgba, width, height, palette, result);
+}
+
+//=======================================================
+// TestConvertPalette
+//=======================================================
+bool TestConvertPalette(const CONVERTOPTIONS * options, const std::vector<unsigned char> & rgba, unsigned int width, unsigned int height, unsigned short palette[256], CONVERTRESULT * result)
+{
+	CONVERTIMAGE image;
+
+	ConvertInitRGBA(&image, &rgba[0], width, height);
+	return ConvertImage(options, &image, palette, result) == CONVERT_OK;
+}
+
+//=======================================================
+// main
+//=======================================================
+int main()
+{
+	TestRLE();
+	TestArchive();
+	Test4Bit();
+	TestAlpha();
+	TestSpans();
+	TestPremultiply();
+	TestInterleave();
+	TestPalette();
+
+	printf("%u checks, %u failed\n", Checks, Failures);
+	return Failures ? 1 : 0;
+}
@@ -0,0 +1,387 @@
+//=======================================================
+// test_palette.cpp
+//
+// Palettes chosen or given by the library: fixed palettes (-F), reduced
+// colors (-Q), one palette for several images (-G) and the banks of
+// 4-bit tiles (-B). Every pixel is looked up in the palette written and
+// compared with its nearest entry, for RGB555 entries and those of -6.
+//=======================================================
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "palmap.h"
+#include "quantize.h"
+#include "test.h"
+
+//=======================================================
+// TestColor
+//=======================================================
+/** RGB555 color of a palette entry. Entries of -6 and -7 have red at
+	bit 11 and 5 bits of green at bit 6, as pixelformat.cpp packs them.
+*/
+static unsigned int TestColor(unsigned int entry, bool wide)
+{
+	if (!wide) return entry & 0x7FFF;
+	return ((entry >> 11) & 0x1F) | (((entry >> 6) & 0x1F) << 5) | ((entry & 0x1F) << 10);
+}
+
+//=======================================================
+// TestEntry
+//=======================================================
+static unsigned short TestEntry(unsigned int color, bool wide)
+{
+	if (!wide) return (unsigned short)color;
+	return (unsigned short)(((color & 0x1F) << 11) | (((color >> 5) & 0x1F) << 6) | ((color >> 10) & 0x1F));
+}
+
+//=======================================================
+// TestPixelColor
+//=======================================================
+static unsigned int TestPixelColor(const unsigned char * rgba)
+{
+	return (rgba[0] >> 3) | ((rgba[1] >> 3) << 5) | ((rgba[2] >> 3) << 10);
+}
+
+//=======================================================
+// TestDistance
+//=======================================================
+/** Squared distance of the 5-bit components of two RGB555 colors
+*/
+static int TestDistance(unsigned int a, unsigned int b)
+{
+	int d0 = (int)((a >> 10) & 0x1F) - (int)((b >> 10) & 0x1F);
+	int d1 = (int)((a >> 5) & 0x1F) - (int)((b >> 5) & 0x1F);
+	int d2 = (int)(a & 0x1F) - (int)(b & 0x1F);
+	return d0 * d0 + d1 * d1 + d2 * d2;
+}
+
+//=======================================================
+// TestNearest
+//=======================================================
+/** Index of the nearest palette entry: black at 1, then the entries from
+	2 up to the first empty one, the first of equally near ones
+*/
+static unsigned int TestNearest(const unsigned short * palette, bool wide, unsigned int color)
+{
+	unsigned int best = 1;
+	int best_distance = TestDistance(color, 0);
+
+	for (unsigned int i = 2; (i < 256) && palette[i]; i++)
+	{
+		int distance = TestDistance(color, TestColor(palette[i], wide));
+		if (distance < best_distance) {
+			best_distance = distance;
+			best = i;
+		}
+	}
+	return best;
+}
+
+//=======================================================
+// TestMisses
+//=======================================================
+/** Number of pixels of an 8-bit image that are not at their nearest
+	entry, transparent pixels belong to entry 0
+*/
+static unsigned int TestMisses(const std::vector<unsigned char> & rgba, const unsigned char * data, const unsigned short * palette, bool wide)
+{
+	unsigned int wrong = 0;
+
+	for (size_t i = 0; i < rgba.size() / 4; i++)
+	{
+		const unsigned char * pixel = &rgba[i * 4];
+		unsigned int expected = pixel[3] ? TestNearest(palette, wide, TestPixelColor(pixel)) : 0;
+		if (data[i] != expected) wrong++;
+	}
+	return wrong;
+}
+
+//=======================================================
+// TestFixed
+//=======================================================
+/** -F: the table built in ranges equals the one built at once, and the
+	image maps onto the palette without extending it
+*/
+static void TestFixed(bool wide)
+{
+	const unsigned int width = 77, height = 41;
+	std::vector<unsigned char> rgba = TestImage(width, height, 10);
+	std::vector<unsigned char> map(PALMAP_COLORS), ranges(PALMAP_COLORS);
+	const PIXELFORMAT * format = PixelFormatGet(wide ? ARCHIVE_FORMAT_BGR565 : ARCHIVE_FORMAT_RGB555);
+	unsigned short palette[256], given[256];
+	CONVERTOPTIONS options;
+	CONVERTRESULT result;
+
+	memset(palette, 0, sizeof(palette));
+	for (unsigned int i = 2; i < 42; i++) palette[i] = TestEntry(((i * 2654435761u) >> 17) | 1, wide);
+
+	PalMapBuild(palette, format, &map[0]);
+	PalMapBuildRange(palette, format, &ranges[0], 0, 10000, NULL);
+	PalMapBuildRange(palette, format, &ranges[0], 10000, 20000, NULL);
+	PalMapBuildRange(palette, format, &ranges[0], 20000, PALMAP_COLORS, NULL);
+	CHECK(ranges == map);
+
+	ConvertDefaults(&options);
+	options.OutputWidth = OutputWidth8Bit;
+	options.optBGR565 = wide;
+	options.PaletteMap = &map[0];
+	memcpy(given, palette, sizeof(palette));
+	CHECK(TestConvertPalette(&options, rgba, width, height, given, &result));
+
+	CHECK(result.image.format == ARCHIVE_FORMAT_INDEX8);
+	CHECK(result.image.size == width * height);
+	CHECK(!memcmp(given, palette, sizeof(palette)));
+	CHECK(result.palette.data && (result.palette.size == 256 * 2) && !memcmp(result.palette.data, palette, sizeof(palette)));
+	if (result.image.data && (result.image.size == width * height))
+		CHECK(TestMisses(rgba, result.image.data, palette, wide) == 0);
+
+	ConvertFreeResult(&result);
+}
+
+//=======================================================
+// TestQuantize
+//=======================================================
+/** -Q: an image of more colors than the palette takes fills all free
+	entries, every pixel is at its nearest one. -6 and more threads give
+	the same indices, -6 the same entries in its layout.
+*/
+static void TestQuantize()
+{
+	const unsigned int width = 77, height = 41;
+	std::vector<unsigned char> rgba = TestImage(width, height, 11);
+	CONVERTOPTIONS options;
+	CONVERTRESULT result, threaded, wide;
+
+	ConvertDefaults(&options);
+	options.OutputWidth = OutputWidth8Bit;
+	options.optQuantize = true;
+	CHECK(TestConvert(&options, rgba, width, height, &result));
+	options.Threads = 3;
+	CHECK(TestConvert(&options, rgba, width, height, &threaded));
+	options.Threads = 1;
+	options.optBGR565 = true;
+	CHECK(TestConvert(&options, rgba, width, height, &wide));
+
+	unsigned int count = width * height;
+	const unsigned short * palette = (const unsigned short *)result.palette.data;
+	const unsigned short * palette_wide = (const unsigned short *)wide.palette.data;
+
+	CHECK(result.image.size == count);
+	CHECK(palette && (result.palette.size == 256 * 2));
+	CHECK(palette_wide && (wide.palette.size == 256 * 2));
+	if (!result.image.data || (result.image.size != count) || !palette || !palette_wide || !wide.image.data) {
+		ConvertFreeResult(&result);
+		ConvertFreeResult(&threaded);
+		ConvertFreeResult(&wide);
+		return;
+	}
+
+	CHECK(palette[255] != 0);
+	CHECK(TestMisses(rgba, result.image.data, palette, false) == 0);
+
+	CHECK(threaded.image.data && !memcmp(threaded.image.data, result.image.data, count));
+	CHECK(threaded.palette.data && !memcmp(threaded.palette.data, palette, 256 * 2));
+
+	unsigned int wrong = 0;
+	for (unsigned int i = 2; i < 256; i++) if (TestColor(palette_wide[i], true) != palette[i]) wrong++;
+	CHECK(wrong == 0);
+	CHECK(!memcmp(wide.image.data, result.image.data, count));
+
+	ConvertFreeResult(&result);
+	ConvertFreeResult(&threaded);
+	ConvertFreeResult(&wide);
+}
+
+//=======================================================
+// TestGlobal
+//=======================================================
+/** -G: one palette chosen from the summed histograms of two images, both
+	map onto it without extending it
+*/
+static void TestGlobal(bool wide)
+{
+	const unsigned int width[2] = { 77, 50 }, height[2] = { 41, 30 };
+	std::vector<unsigned char> rgba[2] = { TestImage(width[0], height[0], 12), TestImage(width[1], height[1], 13) };
+	std::vector<unsigned int> histogram(PALMAP_COLORS, 0);
+	std::vector<unsigned char> map(PALMAP_COLORS);
+	unsigned short palette[256], given[256];
+	CONVERTOPTIONS options;
+	CONVERTIMAGE image;
+
+	ConvertDefaults(&options);
+	options.OutputWidth = OutputWidth8Bit;
+	options.optBGR565 = wide;
+
+	for (int n = 0; n < 2; n++)
+	{
+		ConvertInitRGBA(&image, &rgba[n][0], width[n], height[n]);
+		CHECK(QuantizeHistogram(&options, &image, &histogram[0]) == CONVERT_OK);
+	}
+
+	memset(palette, 0, sizeof(palette));
+	CHECK(QuantizePalette(&options, &histogram[0], palette, &map[0], NULL) == CONVERT_OK);
+	PalMapBuild(palette, PixelFormatGet(ConvertPaletteFormat(&options)), &map[0]);
+	CHECK(palette[255] != 0);
+
+	options.PaletteMap = &map[0];
+	for (int n = 0; n < 2; n++)
+	{
+		CONVERTRESULT result;
+
+		memcpy(given, palette, sizeof(palette));
+		CHECK(TestConvertPalette(&options, rgba[n], width[n], height[n], given, &result));
+		CHECK(!memcmp(given, palette, sizeof(palette)));
+		CHECK(result.image.size == width[n] * height[n]);
+		if (result.image.data && (result.image.size == width[n] * height[n]))
+			CHECK(TestMisses(rgba[n], result.image.data, palette, wide) == 0);
+		ConvertFreeResult(&result);
+	}
+}
+
+//=======================================================
+// TestBankPixel
+//=======================================================
+/** Source pixel of index k of a tiled image in tile order
+*/
+static const unsigned char * TestBankPixel(const std::vector<unsigned char> & rgba, unsigned int width, unsigned int tile, unsigned int k)
+{
+	unsigned int t = k / (tile * tile);
+	unsigned int i = k % (tile * tile) / tile;
+	unsigned int j = k % tile;
+	unsigned int tilecount_x = width / tile;
+
+	return &rgba[(((t / tilecount_x) * tile + i) * width + (t % tilecount_x) * tile + j) * 4];
+}
+
+//=======================================================
+// TestBanksExact
+//=======================================================
+/** -B: tiles of four groups of ten colors fit into four banks, every
+	pixel reads back its own color from the bank of its tile
+*/
+static void TestBanksExact(bool wide)
+{
+	const unsigned int width = 64, height = 40, tile = 8;
+	std::vector<unsigned char> rgba(width * height * 4);
+	CONVERTOPTIONS options;
+	CONVERTRESULT result;
+
+	for (unsigned int y = 0; y < height; y++)
+	{
+		for (unsigned int x = 0; x < width; x++)
+		{
+			unsigned char * pixel = &rgba[(y * width + x) * 4];
+			unsigned int group = ((y / tile) * (width / tile) + x / tile) % 4;
+			unsigned int color = (y * tile + x) % 10;
+
+			pixel[0] = (unsigned char)(color * 24 + 8);
+			pixel[1] = (unsigned char)(group * 64 + 8);
+			pixel[2] = (unsigned char)(200 - group * 40);
+			pixel[3] = ((x + y) % 7) ? 255 : 0;
+		}
+	}
+
+	ConvertDefaults(&options);
+	options.OutputWidth = OutputWidth8Bit;
+	options.optTile = true;
+	options.TileSize = tile;
+	options.TileBanks = 4;
+	options.optBGR565 = wide;
+	CHECK(TestConvert(&options, rgba, width, height, &result));
+
+	unsigned int count = width * height;
+	const unsigned short * palette = (const unsigned short *)result.palette.data;
+
+	CHECK(result.image.format == ARCHIVE_FORMAT_INDEX4);
+	CHECK(result.image.size == count / 2);
+	CHECK(result.tile_bank.data && (result.tile_bank.size == count / (tile * tile)));
+	CHECK(palette && (result.palette.size == 256 * 2));
+	if (!result.image.data || (result.image.size != count / 2) || !result.tile_bank.data || !palette) {
+		ConvertFreeResult(&result);
+		return;
+	}
+
+	unsigned int wrong = 0;
+	for (unsigned int k = 0; k < count; k++)
+	{
+		const unsigned char * pixel = TestBankPixel(rgba, width, tile, k);
+		unsigned int nibble = (result.image.data[k / 2] >> ((k & 1) * 4)) & 15;
+		unsigned int bank = result.tile_bank.data[k / (tile * tile)];
+
+		if (!pixel[3]) {
+			if (nibble != 0) wrong++;
+		}
+		else if ( (bank >= 4) || !nibble || (TestColor(palette[bank * 16 + nibble], wide) != TestPixelColor(pixel)) ) wrong++;
+	}
+	CHECK(wrong == 0);
+
+	ConvertFreeResult(&result);
+}
+
+//=======================================================
+// TestBanksReduced
+//=======================================================
+/** -B 1: the many colors of the image are reduced to the 15 entries of
+	one bank, every pixel is at its nearest entry
+*/
+static void TestBanksReduced(bool wide)
+{
+	const unsigned int width = 64, height = 40, tile = 8;
+	std::vector<unsigned char> rgba = TestImage(width, height, 14);
+	CONVERTOPTIONS options;
+	CONVERTRESULT result;
+
+	ConvertDefaults(&options);
+	options.OutputWidth = OutputWidth8Bit;
+	options.optTile = true;
+	options.TileSize = tile;
+	options.TileBanks = 1;
+	options.optBGR565 = wide;
+	CHECK(TestConvert(&options, rgba, width, height, &result));
+
+	unsigned int count = width * height;
+	const unsigned short * palette = (const unsigned short *)result.palette.data;
+
+	CHECK(result.image.size == count / 2);
+	CHECK(palette && (result.palette.size == 256 * 2));
+	if (!result.image.data || (result.image.size != count / 2) || !palette) {
+		ConvertFreeResult(&result);
+		return;
+	}
+
+	unsigned int wrong = 0;
+	for (unsigned int k = 0; k < count; k++)
+	{
+		const unsigned char * pixel = TestBankPixel(rgba, width, tile, k);
+		unsigned int nibble = (result.image.data[k / 2] >> ((k & 1) * 4)) & 15;
+		unsigned int color = TestPixelColor(pixel);
+		unsigned int best = 1;
+
+		// the first of equally near entries
+		for (unsigned int i = 2; i < 16; i++)
+			if (TestDistance(color, TestColor(palette[i], wide)) < TestDistance(color, TestColor(palette[best], wide))) best = i;
+
+		if (nibble != (pixel[3] ? best : 0)) wrong++;
+	}
+	CHECK(wrong == 0);
+	CHECK(palette[16] == 0);
+
+	ConvertFreeResult(&result);
+}
+
+//=======================================================
+// TestPalette
+//=======================================================
+void TestPalette()
+{
+	TestFixed(false);
+	TestFixed(true);
+	TestQuantize();
+	TestGlobal(false);
+	TestGlobal(true);
+	TestBanksExact(false);
+	TestBanksExact(true);
+	TestBanksReduced(false);
+	TestBanksReduced(true);
+}
@@ -0,0 +1,101 @@
+//=======================================================
+// test_premultiply.cpp
+//
+// Premultiplied alpha (-M): direct color output against the source
+// colors multiplied by alpha, packed by a reference of each layout
+//=======================================================
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+/** Bit layout of a direct color format, written out here so the test
+	does not share the table of pixelformat.cpp
+*/
+struct TESTLAYOUT
+{
+	unsigned short format;
+	unsigned int bits;
+	unsigned char size[4];		// R G B A
+	unsigned char shift[4];
+	bool alpha_visible;			// any alpha but 0 sets the alpha bits
+};
+
+static const TESTLAYOUT TestLayouts[] =
+{
+	{ ARCHIVE_FORMAT_RGB555,	16,	{ 5, 5, 5, 1 },	{  0, 5,10,15 },	true },
+	{ ARCHIVE_FORMAT_ARGB4444,	16,	{ 4, 4, 4, 4 },	{  8, 4, 0,12 },	false },
+	{ ARCHIVE_FORMAT_ARGB1555,	16,	{ 5, 5, 5, 1 },	{ 10, 5, 0,15 },	false },
+	{ ARCHIVE_FORMAT_RGB332,	8,	{ 3, 3, 2, 0 },	{  5, 2, 0, 0 },	false },
+};
+
+//=======================================================
+// TestPremultiplyPixel
+//=======================================================
+/** Reference pixel: round(color * alpha / 255) cut to the layout, the
+	alpha channel unchanged. With -c partial alpha counts as 0.
+*/
+static unsigned int TestPremultiplyPixel(const TESTLAYOUT * layout, const unsigned char * rgba, bool transparent)
+{
+	unsigned int alpha = rgba[3];
+	unsigned int value[4];
+	unsigned int pixel = 0;
+
+	if (transparent && (alpha != 255)) alpha = 0;
+
+	for (int c = 0; c < 3; c++) value[c] = (rgba[c] * alpha * 2 + 255) / 510;
+	value[3] = (layout->alpha_visible && alpha) ? 255 : alpha;
+
+	for (int c = 0; c < 4; c++)
+		if (layout->size[c]) pixel |= (value[c] >> (8 - layout->size[c])) << layout->shift[c];
+	return pixel;
+}
+
+//=======================================================
+// TestPremultiplyImage
+//=======================================================
+static void TestPremultiplyImage(const TESTLAYOUT * layout, bool transparent)
+{
+	const unsigned int width = 77, height = 41;
+	std::vector<unsigned char> rgba = TestImage(width, height, layout->format);
+	CONVERTOPTIONS options;
+	CONVERTRESULT result;
+
+	ConvertDefaults(&options);
+	options.DirectFormat = layout->format;
+	options.optPremultiply = true;
+	options.optAlphaTransparent = transparent;
+	CHECK(TestConvert(&options, rgba, width, height, &result));
+
+	unsigned int count = width * height;
+	unsigned int wrong = 0;
+
+	CHECK(result.image.format == layout->format);
+	CHECK(result.image.size == count * layout->bits / 8);
+	if (!result.image.data || (result.image.size != count * layout->bits / 8)) {
+		ConvertFreeResult(&result);
+		return;
+	}
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		unsigned int pixel = (layout->bits == 8) ? result.image.data[i] : ((const unsigned short *)result.image.data)[i];
+		if (pixel != TestPremultiplyPixel(layout, &rgba[i * 4], transparent)) wrong++;
+	}
+	CHECK(wrong == 0);
+
+	ConvertFreeResult(&result);
+}
+
+//=======================================================
+// TestPremultiply
+//=======================================================
+void TestPremultiply()
+{
+	for (size_t i = 0; i < sizeof(TestLayouts) / sizeof(TestLayouts[0]); i++)
+	{
+		TestPremultiplyImage(&TestLayouts[i], false);
+		TestPremultiplyImage(&TestLayouts[i], true);
+	}
+}
@@ -0,0 +1,427 @@
+//=======================================================
+// test_rle.cpp
+//
+// RLE: the streaming encoder against the block encoder, PackBits runs
+// at their limits, the decoders on truncated input and short buffers,
+// and 16-bit images compressed with -r against their uncompressed
+// conversion
+//=======================================================
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rle.h"
+#include "test.h"
+
+//=======================================================
+// TestSymbols
+//=======================================================
+/** Runs of every length class of the encoder: single symbols, short
+	runs, runs over 128 and 32768, and the marker candidates 0 and 0xFFFF
+*/
+static std::vector<unsigned short> TestSymbols(unsigned int count, unsigned int seed)
+{
+	std::vector<unsigned short> symbols;
+	unsigned int random = seed + 7;
+
+	while (symbols.size() < count)
+	{
+		random = random * 1103515245u + 12345u;
+		unsigned int kind = (random >> 16) % 10;
+		unsigned int length = (kind < 5) ? 1 : (kind < 8) ? 2 + (random >> 8) % 6 : (kind < 9) ? 100 + (random >> 4) % 300 : 33000;
+		unsigned short symbol = (kind == 3) ? 0 : (kind == 4) ? 0xFFFF : (unsigned short)(random >> 12);
+
+		for (unsigned int i = 0; (i < length) && (symbols.size() < count); i++) symbols.push_back(symbol);
+	}
+	return symbols;
+}
+
+//=======================================================
+// TestSink
+//=======================================================
+/** RLE sink collecting the encoded data in a vector
+*/
+static void TestSink(void * context, const void * data, unsigned int size)
+{
+	std::vector<unsigned char> * output = (std::vector<unsigned char> *)context;
+	output->insert(output->end(), (const unsigned char *)data, (const unsigned char *)data + size);
+}
+
+//=======================================================
+// TestStream16
+//=======================================================
+/** The stream fed in pieces of varying size writes what the block
+	encoder writes with the same marker, and decodes to its input
+*/
+static void TestStream16(unsigned int count, unsigned int seed)
+{
+	std::vector<unsigned short> symbols = TestSymbols(count, seed);
+	std::vector<unsigned short> block(count * 2 + 16);
+	std::vector<unsigned short> decoded(count + 1);
+	std::vector<unsigned char> output;
+	RLE_Stream16 stream;
+	unsigned int length;
+
+	unsigned int block_count = (unsigned int)RLE_Compress16(&symbols[0], &block[0], count);
+
+	RLE_StreamInit16(&stream, block[0], TestSink, &output);
+	for (unsigned int pos = 0, piece = 1; pos < count; pos += piece, piece = piece * 3 % 1000 + 1)
+		RLE_StreamFeed16(&stream, &symbols[pos], (piece < count - pos) ? piece : count - pos);
+	unsigned int stream_count = RLE_StreamFinish16(&stream);
+
+	CHECK(stream_count == block_count);
+	CHECK(output.size() == stream_count * 2);
+	CHECK(!output.empty() && !memcmp(&output[0], &block[0], block_count * 2));
+
+	CHECK(RLE_Decode16((const unsigned short *)&output[0], stream_count, &decoded[0], count + 1, &length) == RLE_OK);
+	CHECK(length == count);
+	CHECK(!memcmp(&decoded[0], &symbols[0], count * 2));
+}
+
+//=======================================================
+// TestStream8
+//=======================================================
+static void TestStream8(unsigned int count, unsigned int seed)
+{
+	std::vector<unsigned short> symbols16 = TestSymbols(count, seed);
+	std::vector<unsigned char> symbols(count);
+	std::vector<unsigned char> block(count * 2 + 16);
+	std::vector<unsigned char> decoded(count + 1);
+	std::vector<unsigned char> output;
+	RLE_Stream8 stream;
+	unsigned int length;
+
+	for (unsigned int i = 0; i < count; i++) symbols[i] = (unsigned char)symbols16[i];
+	unsigned int block_count = (unsigned int)RLE_Compress8(&symbols[0], &block[0], count);
+
+	RLE_StreamInit8(&stream, block[0], TestSink, &output);
+	for (unsigned int pos = 0, piece = 1; pos < count; pos += piece, piece = piece * 5 % 700 + 1)
+		RLE_StreamFeed8(&stream, &symbols[pos], (piece < count - pos) ? piece : count - pos);
+	unsigned int stream_count = RLE_StreamFinish8(&stream);
+
+	CHECK(stream_count == block_count);
+	CHECK(output.size() == stream_count);
+	CHECK(!output.empty() && !memcmp(&output[0], &block[0], block_count));
+
+	CHECK(RLE_Decode8(&output[0], stream_count, &decoded[0], count + 1, &length) == RLE_OK);
+	CHECK(length == count);
+	CHECK(!memcmp(&decoded[0], &symbols[0], count));
+}
+
+//=======================================================
+// TestPackBitsInput
+//=======================================================
+/** Appends a literal of symbols without neighbours of equal value, or a
+	repeat run of 0
+*/
+static void TestPackBitsInput(std::vector<unsigned short> & symbols, unsigned int count, bool repeat)
+{
+	for (unsigned int i = 0; i < count; i++) symbols.push_back(repeat ? 0 : (unsigned short)(i * 7 + 1));
+}
+
+//=======================================================
+// TestPackBits8
+//=======================================================
+/** The encoder writes the given control bytes, stays within the output
+	size of RLE_CompressPB8 and decodes to its input
+*/
+static void TestPackBits8(const std::vector<unsigned short> & symbols16, const std::vector<unsigned int> & controls)
+{
+	unsigned int count = (unsigned int)symbols16.size();
+	std::vector<unsigned char> symbols(count);
+	std::vector<unsigned char> block(count + (count + 127) / 128 + 1);
+	std::vector<unsigned char> decoded(count);
+	std::vector<unsigned int> written;
+	unsigned int length;
+
+	for (unsigned int i = 0; i < count; i++) symbols[i] = (unsigned char)symbols16[i];
+	unsigned int block_count = (unsigned int)RLE_CompressPB8(&symbols[0], &block[0], count);
+
+	for (unsigned int pos = 0; pos < block_count; pos += (block[pos] & 0x80) ? 2 : block[pos] + 2) written.push_back(block[pos]);
+	CHECK(written == controls);
+
+	CHECK(RLE_DecodePB8(&block[0], block_count, &decoded[0], count, &length) == RLE_OK);
+	CHECK(length == count);
+	CHECK(decoded == symbols);
+}
+
+//=======================================================
+// TestPackBits16
+//=======================================================
+static void TestPackBits16(const std::vector<unsigned short> & symbols, const std::vector<unsigned int> & controls)
+{
+	unsigned int count = (unsigned int)symbols.size();
+	std::vector<unsigned short> block(count + (count + 32767) / 32768 + 1);
+	std::vector<unsigned short> decoded(count);
+	std::vector<unsigned int> written;
+	unsigned int length;
+
+	unsigned int block_count = (unsigned int)RLE_CompressPB16((unsigned short *)&symbols[0], &block[0], count);
+
+	for (unsigned int pos = 0; pos < block_count; pos += (block[pos] & 0x8000) ? 2 : block[pos] + 2) written.push_back(block[pos]);
+	CHECK(written == controls);
+
+	CHECK(RLE_DecodePB16(&block[0], block_count, &decoded[0], count, &length) == RLE_OK);
+	CHECK(length == count);
+	CHECK(decoded == symbols);
+}
+
+//=======================================================
+// TestPackBits
+//=======================================================
+/** Literals around the limit of 128 (32768) symbols and repeat runs
+	around the limit of 130 (32770)
+*/
+static void TestPackBits()
+{
+	static const struct
+	{
+		unsigned int literal, repeat, tail;
+		unsigned int count, controls[5];
+	} cases8[] =
+	{
+		{ 127, 0, 0,	1, { 0x7E } },
+		{ 128, 0, 0,	1, { 0x7F } },
+		{ 129, 0, 0,	2, { 0x7F, 0x00 } },
+		{ 256, 0, 0,	2, { 0x7F, 0x7F } },
+		{ 0, 3, 0,		1, { 0x80 } },
+		{ 0, 130, 0,	1, { 0xFF } },
+		{ 0, 131, 0,	2, { 0xFF, 0x00 } },
+		{ 0, 133, 0,	2, { 0xFF, 0x80 } },
+		{ 128, 130, 1,	3, { 0x7F, 0xFF, 0x00 } },
+		{ 129, 260, 128,	5, { 0x7F, 0x00, 0xFF, 0xFF, 0x7F } },
+	};
+	static const struct
+	{
+		unsigned int literal, repeat;
+		unsigned int count, controls[2];
+	} cases16[] =
+	{
+		{ 32768, 0,		1, { 0x7FFF } },
+		{ 32769, 0,		2, { 0x7FFF, 0x0000 } },
+		{ 0, 32770,		1, { 0xFFFF } },
+		{ 0, 32773,		2, { 0xFFFF, 0x8000 } },
+	};
+
+	for (size_t i = 0; i < sizeof(cases8) / sizeof(cases8[0]); i++)
+	{
+		std::vector<unsigned short> symbols;
+		std::vector<unsigned int> controls;
+
+		TestPackBitsInput(symbols, cases8[i].literal, false);
+		TestPackBitsInput(symbols, cases8[i].repeat, true);
+		TestPackBitsInput(symbols, cases8[i].tail, false);
+		controls.assign(cases8[i].controls, cases8[i].controls + cases8[i].count);
+		TestPackBits8(symbols, controls);
+	}
+
+	for (size_t i = 0; i < sizeof(cases16) / sizeof(cases16[0]); i++)
+	{
+		std::vector<unsigned short> symbols;
+		std::vector<unsigned int> controls;
+
+		TestPackBitsInput(symbols, cases16[i].literal, false);
+		TestPackBitsInput(symbols, cases16[i].repeat, true);
+		controls.assign(cases16[i].controls, cases16[i].controls + cases16[i].count);
+		TestPackBits16(symbols, controls);
+	}
+}
+
+typedef int (*TestDecoder8)(const unsigned char *, unsigned int, unsigned char *, unsigned int, unsigned int *);
+typedef int (*TestDecoder16)(const unsigned short *, unsigned int, unsigned short *, unsigned int, unsigned int *);
+
+#define TEST_GUARD	64
+#define TEST_FILL	0xA5
+
+//=======================================================
+// TestDecodeLimits8
+//=======================================================
+/** Every prefix of the encoded data decodes to a prefix of the symbols
+	or stops with RLE_ERROR_TRUNCATED, and every output buffer shorter
+	than the symbols stops with RLE_ERROR_OVERFLOW. Nothing is written
+	past the output size.
+*/
+static void TestDecodeLimits8(TestDecoder8 decode, const std::vector<unsigned char> & encoded, const std::vector<unsigned char> & symbols)
+{
+	unsigned int count = (unsigned int)symbols.size();
+	unsigned int truncated = 0, wrong = 0;
+	unsigned int length;
+
+	for (unsigned int size = 0; size <= encoded.size(); size++)
+	{
+		std::vector<unsigned char> decoded(count + TEST_GUARD, TEST_FILL);
+		int result = decode(&encoded[0], size, &decoded[0], count, &length);
+
+		if (result == RLE_ERROR_TRUNCATED) truncated++;
+		else if (result != RLE_OK) wrong++;
+		if ((length > count) || memcmp(&decoded[0], &symbols[0], length)) wrong++;
+		for (unsigned int i = count; i < count + TEST_GUARD; i++) if (decoded[i] != TEST_FILL) wrong++;
+		if ((size == encoded.size()) && ((result != RLE_OK) || (length != count))) wrong++;
+	}
+	CHECK(truncated > 0);
+	CHECK(wrong == 0);
+
+	const unsigned int outsizes[] = { 0, 1, count / 2, count - 1 };
+	for (size_t j = 0; j < sizeof(outsizes) / sizeof(outsizes[0]); j++)
+	{
+		unsigned int outsize = outsizes[j];
+		std::vector<unsigned char> decoded(outsize + TEST_GUARD, TEST_FILL);
+		bool guard = true;
+
+		CHECK(decode(&encoded[0], (unsigned int)encoded.size(), &decoded[0], outsize, &length) == RLE_ERROR_OVERFLOW);
+		CHECK((length <= outsize) && !memcmp(&decoded[0], &symbols[0], length));
+		for (unsigned int i = outsize; i < outsize + TEST_GUARD; i++) if (decoded[i] != TEST_FILL) guard = false;
+		CHECK(guard);
+	}
+}
+
+//=======================================================
+// TestDecodeLimits16
+//=======================================================
+static void TestDecodeLimits16(TestDecoder16 decode, const std::vector<unsigned short> & encoded, const std::vector<unsigned short> & symbols)
+{
+	unsigned int count = (unsigned int)symbols.size();
+	unsigned int truncated = 0, wrong = 0;
+	unsigned int length;
+
+	for (unsigned int size = 0; size <= encoded.size(); size++)
+	{
+		std::vector<unsigned short> decoded(count + TEST_GUARD, TEST_FILL);
+		int result = decode(&encoded[0], size, &decoded[0], count, &length);
+
+		if (result == RLE_ERROR_TRUNCATED) truncated++;
+		else if (result != RLE_OK) wrong++;
+		if ((length > count) || memcmp(&decoded[0], &symbols[0], length * 2)) wrong++;
+		for (unsigned int i = count; i < count + TEST_GUARD; i++) if (decoded[i] != TEST_FILL) wrong++;
+		if ((size == encoded.size()) && ((result != RLE_OK) || (length != count))) wrong++;
+	}
+	CHECK(truncated > 0);
+	CHECK(wrong == 0);
+
+	const unsigned int outsizes[] = { 0, 1, count / 2, count - 1 };
+	for (size_t j = 0; j < sizeof(outsizes) / sizeof(outsizes[0]); j++)
+	{
+		unsigned int outsize = outsizes[j];
+		std::vector<unsigned short> decoded(outsize + TEST_GUARD, TEST_FILL);
+		bool guard = true;
+
+		CHECK(decode(&encoded[0], (unsigned int)encoded.size(), &decoded[0], outsize, &length) == RLE_ERROR_OVERFLOW);
+		CHECK((length <= outsize) && !memcmp(&decoded[0], &symbols[0], length * 2));
+		for (unsigned int i = outsize; i < outsize + TEST_GUARD; i++) if (decoded[i] != TEST_FILL) guard = false;
+		CHECK(guard);
+	}
+}
+
+//=======================================================
+// TestDecodeLimits
+//=======================================================
+/** Truncated input and short output buffers for the marker and the
+	PackBits decoders, and codes cut right after their first byte
+*/
+static void TestDecodeLimits(unsigned int count, unsigned int seed)
+{
+	std::vector<unsigned short> symbols16 = TestSymbols(count, seed);
+	std::vector<unsigned char> symbols8(count);
+	std::vector<unsigned short> block16(count * 2 + 16);
+	std::vector<unsigned char> block8(count * 2 + 16);
+	unsigned int length;
+
+	for (unsigned int i = 0; i < count; i++) symbols8[i] = (unsigned char)symbols16[i];
+
+	unsigned int size = (unsigned int)RLE_Compress8(&symbols8[0], &block8[0], count);
+	TestDecodeLimits8(RLE_Decode8, std::vector<unsigned char>(block8.begin(), block8.begin() + size), symbols8);
+	size = (unsigned int)RLE_CompressPB8(&symbols8[0], &block8[0], count);
+	TestDecodeLimits8(RLE_DecodePB8, std::vector<unsigned char>(block8.begin(), block8.begin() + size), symbols8);
+	size = (unsigned int)RLE_Compress16(&symbols16[0], &block16[0], count);
+	TestDecodeLimits16(RLE_Decode16, std::vector<unsigned short>(block16.begin(), block16.begin() + size), symbols16);
+	size = (unsigned int)RLE_CompressPB16(&symbols16[0], &block16[0], count);
+	TestDecodeLimits16(RLE_DecodePB16, std::vector<unsigned short>(block16.begin(), block16.begin() + size), symbols16);
+
+	// marker without count, long count without its second byte, run
+	// without symbol, literal and repeat controls without their data
+	const unsigned char marker8[][3] = { { 0x55, 0x55 }, { 0x55, 0x55, 0x85 }, { 0x55, 0x55, 0x05 } };
+	const unsigned int marker8_size[] = { 2, 3, 3 };
+	const unsigned short marker16[][2] = { { 0x5555, 0x5555 } };
+	const unsigned char packbits8[][3] = { { 0x05, 1, 2 }, { 0x85 } };
+	const unsigned int packbits8_size[] = { 3, 1 };
+	const unsigned short packbits16[][3] = { { 0x0005, 1, 2 }, { 0x8005 } };
+	const unsigned int packbits16_size[] = { 3, 1 };
+	unsigned char out8[16];
+	unsigned short out16[16];
+
+	for (int i = 0; i < 3; i++) CHECK(RLE_Decode8(marker8[i], marker8_size[i], out8, 16, &length) == RLE_ERROR_TRUNCATED);
+	CHECK(RLE_Decode16(marker16[0], 2, out16, 16, &length) == RLE_ERROR_TRUNCATED);
+	for (int i = 0; i < 2; i++) CHECK(RLE_DecodePB8(packbits8[i], packbits8_size[i], out8, 16, &length) == RLE_ERROR_TRUNCATED);
+	for (int i = 0; i < 2; i++) CHECK(RLE_DecodePB16(packbits16[i], packbits16_size[i], out16, 16, &length) == RLE_ERROR_TRUNCATED);
+}
+
+//=======================================================
+// TestImage16
+//=======================================================
+/** -r output decodes to the uncompressed conversion. RGB555 is streamed
+	with STREAM_MARKER16, every other format is compressed as a whole
+	like RLE_Compress16 does.
+*/
+static void TestImage16(unsigned short direct_format, bool bgr565, bool rgb565)
+{
+	const unsigned int width = 77, height = 41;
+	std::vector<unsigned char> rgba = TestImage(width, height, direct_format);
+	CONVERTOPTIONS options;
+	CONVERTRESULT raw, compressed;
+
+	ConvertDefaults(&options);
+	options.DirectFormat = direct_format;
+	options.optBGR565 = bgr565;
+	options.optRGB565 = rgb565;
+	CHECK(TestConvert(&options, rgba, width, height, &raw));
+	options.optRLE = true;
+	CHECK(TestConvert(&options, rgba, width, height, &compressed));
+
+	unsigned int count = width * height;
+	const unsigned short * pixels = (const unsigned short *)raw.image.data;
+	const unsigned short * words = (const unsigned short *)compressed.image.data;
+	std::vector<unsigned short> decoded(count);
+	unsigned int length;
+
+	CHECK(raw.image.size == count * 2);
+	CHECK(compressed.image.config & CONFIG_COMPRESSED);
+	CHECK(compressed.image.size == compressed.image.count * 2);
+	CHECK(RLE_Decode16(words, compressed.image.count, &decoded[0], count, &length) == RLE_OK);
+	CHECK(length == count);
+	CHECK(!memcmp(&decoded[0], pixels, count * 2));
+
+	if (ConvertDirectFormat(&options) == ARCHIVE_FORMAT_RGB555)
+		CHECK(words[0] == STREAM_MARKER16);
+	else
+	{
+		std::vector<unsigned short> source(pixels, pixels + count);
+		std::vector<unsigned short> block(count * 2 + 16);
+		unsigned int block_count = (unsigned int)RLE_Compress16(&source[0], &block[0], count);
+
+		CHECK(block_count == compressed.image.count);
+		CHECK(!memcmp(&block[0], words, block_count * 2));
+	}
+
+	ConvertFreeResult(&raw);
+	ConvertFreeResult(&compressed);
+}
+
+//=======================================================
+// TestRLE
+//=======================================================
+void TestRLE()
+{
+	TestStream16(1, 1);
+	TestStream16(5000, 2);
+	TestStream16(100000, 3);
+	TestStream8(1, 4);
+	TestStream8(5000, 5);
+	TestStream8(100000, 6);
+	TestPackBits();
+	TestDecodeLimits(2000, 7);
+
+	TestImage16(0, false, false);
+	TestImage16(0, true, false);
+	TestImage16(0, false, true);
+	TestImage16(ARCHIVE_FORMAT_ARGB4444, false, false);
+}
@@ -0,0 +1,126 @@
+//=======================================================
+// test_spans.cpp
+//
+// Alpha spans (-S): the spans decoded again against the source alpha,
+// by rows and by tiles (-t)
+//=======================================================
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+//=======================================================
+// TestTileOrder
+//=======================================================
+/** Alpha values of an RGBA image in the order of the output, tile by
+	tile with a size, line by line without
+*/
+static std::vector<unsigned char> TestTileOrder(const std::vector<unsigned char> & rgba, unsigned int width, unsigned int height, unsigned int size)
+{
+	std::vector<unsigned char> alpha;
+
+	if (!size) {
+		for (unsigned int i = 0; i < width * height; i++) alpha.push_back(rgba[i * 4 + 3]);
+		return alpha;
+	}
+
+	for (unsigned int tiley = 0; tiley < height / size; tiley++)
+		for (unsigned int tilex = 0; tilex < width / size; tilex++)
+			for (unsigned int i = 0; i < size; i++)
+				for (unsigned int j = 0; j < size; j++)
+					alpha.push_back(rgba[((tiley * size + i) * width + tilex * size + j) * 4 + 3]);
+	return alpha;
+}
+
+//=======================================================
+// TestDecodeSpans
+//=======================================================
+/** Decode spans, checking that none crosses the end of a row and that
+	none could have been joined with the one before
+	@param row Values per row
+	@param alpha Receives the decoded values
+	@return Returns false if the spans are malformed
+*/
+static bool TestDecodeSpans(const unsigned char * spans, unsigned int size, unsigned int row, std::vector<unsigned char> & alpha)
+{
+	unsigned int pos = 0;
+	int last_type = -1;
+	unsigned int last_length = 0;
+
+	alpha.clear();
+	while (pos < size)
+	{
+		int type = spans[pos] >> 6;
+		unsigned int length = (spans[pos] & 0x3F) + 1;
+		unsigned int column = (unsigned int)alpha.size() % row;
+		pos++;
+
+		if (type > ALPHASPAN_PARTIAL) return false;
+		if (column + length > row) return false;
+		if ((column != 0) && (type == last_type) && (last_length < ALPHASPAN_MAX)) return false;
+
+		for (unsigned int i = 0; i < length; i++)
+		{
+			if (type == ALPHASPAN_TRANSPARENT) alpha.push_back(0);
+			else if (type == ALPHASPAN_OPAQUE) alpha.push_back(255);
+			else
+			{
+				if ((pos >= size) || (spans[pos] == 0) || (spans[pos] == 255)) return false;
+				alpha.push_back(spans[pos++]);
+			}
+		}
+		last_type = type;
+		last_length = length;
+	}
+	return true;
+}
+
+//=======================================================
+// TestSpanImage
+//=======================================================
+/** -S output of an image decodes to its alpha
+	@param width Width, long rows split spans after ALPHASPAN_MAX values
+	@param tile Tile size for -t, 0 for rows
+*/
+static void TestSpanImage(unsigned int width, unsigned int height, unsigned int tile, unsigned int seed)
+{
+	std::vector<unsigned char> rgba = TestImage(width, height, seed);
+	std::vector<unsigned char> decoded;
+	CONVERTOPTIONS options;
+	CONVERTRESULT result;
+
+	// whole rows of one kind give spans longer than ALPHASPAN_MAX
+	for (unsigned int x = 0; x < width; x++) {
+		rgba[x * 4 + 3] = 255;
+		rgba[(width + x) * 4 + 3] = 0;
+		rgba[(2 * width + x) * 4 + 3] = (unsigned char)(1 + x % 254);
+	}
+
+	ConvertDefaults(&options);
+	options.optAlphaExternal = true;
+	options.optAlphaSpans = true;
+	if (tile) {
+		options.optTile = true;
+		options.TileSize = (unsigned short)tile;
+	}
+	CHECK(TestConvert(&options, rgba, width, height, &result));
+
+	CHECK(result.alpha.config == CONFIG_SPANS);
+	CHECK(result.alpha.format == ARCHIVE_FORMAT_ALPHASPAN);
+	CHECK(result.alpha.data && TestDecodeSpans(result.alpha.data, result.alpha.size, tile ? tile : width, decoded));
+	CHECK(decoded == TestTileOrder(rgba, width, height, tile));
+
+	ConvertFreeResult(&result);
+}
+
+//=======================================================
+// TestSpans
+//=======================================================
+void TestSpans()
+{
+	TestSpanImage(77, 41, 0, 1);
+	TestSpanImage(300, 5, 0, 2);
+	TestSpanImage(64, 40, 8, 3);
+	TestSpanImage(64, 64, 32, 4);
+}
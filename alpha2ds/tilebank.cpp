@@ -0,0 +1,309 @@
+//=======================================================
+// tilebank.cpp
+//
+// Tiles are assigned with the most colorful first, each to the bank that
+// takes its colors with the fewest new ones and still fits; a tile that
+// fits nowhere goes to the bank growing least. Everything is ordered by
+// tile index and color value, so the result is reproducible.
+//=======================================================
+
+#include "stdafx.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+#include "quantize.h"
+#include "tilebank.h"
+
+/** Colors of one tile, sorted by value
+*/
+struct TILECOLORS
+{
+	std::vector<unsigned short> colors;
+	std::vector<unsigned int> counts;	// pixels per color
+};
+
+/** Orders tiles by number of colors, most first
+*/
+struct TILEORDER
+{
+	const std::vector<TILECOLORS> * tiles;
+
+	bool operator()(unsigned int a, unsigned int b) const
+	{
+		return (*tiles)[a].colors.size() > (*tiles)[b].colors.size();
+	}
+};
+
+//=======================================================
+// TileBankUnion
+//=======================================================
+/** Number of colors in the union of two sorted color lists
+*/
+static size_t TileBankUnion(const std::vector<unsigned short> & a, const std::vector<unsigned short> & b)
+{
+	size_t i = 0, j = 0, count = 0;
+
+	while ( (i < a.size()) || (j < b.size()) )
+	{
+		if (j == b.size() || ((i < a.size()) && (a[i] < b[j]))) i++;
+		else if (i == a.size() || (b[j] < a[i])) j++;
+		else { i++; j++; }
+		count++;
+	}
+	return count;
+}
+
+//=======================================================
+// TileBankDistance
+//=======================================================
+/** Squared distance of the 5-bit components of two colors
+*/
+static int TileBankDistance(unsigned short a, unsigned short b)
+{
+	int d0 = ((a >> 10) & 0x1F) - ((b >> 10) & 0x1F);
+	int d1 = ((a >> 5) & 0x1F) - ((b >> 5) & 0x1F);
+	int d2 = (a & 0x1F) - (b & 0x1F);
+	return d0 * d0 + d1 * d1 + d2 * d2;
+}
+
+//=======================================================
+// TileBankNearest
+//=======================================================
+/** Nearest color of a bank
+	@return Returns the index within the bank, 1..15
+*/
+static int TileBankNearest(const unsigned short * bank, int count, unsigned short color, int * distance)
+{
+	int best = 1;
+	int best_distance = 0x7FFFFFFF;
+
+	for (int i = 1; i <= count; i++)
+	{
+		int d = TileBankDistance(color, bank[i]);
+		if (d < best_distance) {
+			best_distance = d;
+			best = i;
+			if (!d) break;
+		}
+	}
+
+	if (distance) *distance = best_distance;
+	return best;
+}
+
+//=======================================================
+// TileBankImage
+//=======================================================
+/** Choose the banks and map the image onto them
+	@param options Conversion options, TileBanks, TileSize and the palette
+	format (-6, -7) are used
+	@param image Source image
+	@param palette Receives the banks in the palette format, entries past
+	the last bank are 0
+	@param tiled Receives the bank index (0..15) of every pixel in tile
+	order, x * y bytes
+	@param banks Receives the bank of every tile
+	@return Returns CONVERT_OK or CONVERT_ERROR_MEMORY
+*/
+int TileBankImage(const CONVERTOPTIONS * options, const CONVERTIMAGE * image, unsigned short palette[256], unsigned char * tiled, unsigned char * banks)
+{
+	unsigned int size = options->TileSize;
+	unsigned int tilecount_x = image->width / size;
+	unsigned int tilecount_y = image->height / size;
+	unsigned int tilecount = tilecount_x * tilecount_y;
+	unsigned int bankcount = options->TileBanks;
+
+	if (bankcount < 1) bankcount = 1;
+	if (bankcount > TILEBANK_MAX) bankcount = TILEBANK_MAX;
+
+	std::vector<TILECOLORS> tiles(tilecount);
+	std::vector<unsigned int> order(tilecount);
+	std::vector< std::vector<unsigned short> > sets(bankcount);
+	unsigned short entries[TILEBANK_MAX][TILEBANK_COLORS];
+	int entrycount[TILEBANK_MAX];
+
+	/********************************************************************************/
+	/* Colors of each tile                                                          */
+	/********************************************************************************/
+	for (unsigned int t = 0; t < tilecount; t++)
+	{
+		unsigned int tilex = t % tilecount_x;
+		unsigned int tiley = t / tilecount_x;
+		std::vector<unsigned short> sorted;
+
+		for (unsigned int i = 0; i < size; i++)
+		{
+			const unsigned char * bits = image->pixels + (ptrdiff_t)image->pitch * (int)(tiley * size + i) + (size_t)tilex * size * image->bytespp;
+
+			for (unsigned int j = 0; j < size; j++, bits += image->bytespp)
+			{
+				unsigned char alpha = bits[image->alpha];
+				if ( (alpha == 0) || (options->optAlphaTransparent && alpha != 255) ) continue;
+
+				// same layout as the palette entries, red in the low bits
+				sorted.push_back((unsigned short)(((bits[image->blue] >> 3) << 10) | ((bits[image->green] >> 3) << 5) | (bits[image->red] >> 3)));
+			}
+		}
+
+		std::sort(sorted.begin(), sorted.end());
+		for (size_t i = 0; i < sorted.size(); i++)
+		{
+			if (i && (sorted[i] == sorted[i - 1])) tiles[t].counts.back()++;
+			else {
+				tiles[t].colors.push_back(sorted[i]);
+				tiles[t].counts.push_back(1);
+			}
+		}
+		order[t] = t;
+		banks[t] = 0;
+	}
+
+	/********************************************************************************/
+	/* Group the tiles, most colors first                                           */
+	/********************************************************************************/
+	TILEORDER most_colors;
+	most_colors.tiles = &tiles;
+	std::stable_sort(order.begin(), order.end(), most_colors);
+
+	for (unsigned int i = 0; i < tilecount; i++)
+	{
+		const std::vector<unsigned short> & colors = tiles[order[i]].colors;
+		if (colors.empty()) continue;
+
+		unsigned int best = 0;
+		size_t best_new = (size_t)-1;
+		size_t best_union = (size_t)-1;
+		bool best_fits = false;
+
+		for (unsigned int b = 0; b < bankcount; b++)
+		{
+			size_t merged = TileBankUnion(sets[b], colors);
+			bool fits = (merged < TILEBANK_COLORS);
+			size_t added = merged - sets[b].size();
+
+			if ( (fits && !best_fits) ||
+				 (fits && (added < best_new || (added == best_new && merged < best_union))) ||
+				 (!fits && !best_fits && (merged < best_union)) )
+			{
+				best = b;
+				best_new = added;
+				best_union = merged;
+				best_fits = fits;
+			}
+		}
+
+		std::vector<unsigned short> merged;
+		std::set_union(sets[best].begin(), sets[best].end(), colors.begin(), colors.end(), std::back_inserter(merged));
+		sets[best].swap(merged);
+		banks[order[i]] = (unsigned char)best;
+	}
+
+	/********************************************************************************/
+	/* Colors of each bank, reduced to 15 if needed                                 */
+	/********************************************************************************/
+	unsigned int * histogram = (unsigned int *)calloc(PALMAP_COLORS, sizeof(unsigned int));
+	if (!histogram) return CONVERT_ERROR_MEMORY;
+
+	for (unsigned int b = 0; b < bankcount; b++)
+	{
+		entries[b][0] = 0;
+
+		if (sets[b].size() < TILEBANK_COLORS)
+		{
+			for (size_t i = 0; i < sets[b].size(); i++) entries[b][i + 1] = sets[b][i];
+			entrycount[b] = (int)sets[b].size();
+			continue;
+		}
+
+		for (unsigned int t = 0; t < tilecount; t++)
+			if (banks[t] == b)
+				for (size_t i = 0; i < tiles[t].colors.size(); i++) histogram[tiles[t].colors[i]] += tiles[t].counts[i];
+
+		entrycount[b] = (int)QuantizeMedianCut(&sets[b][0], (unsigned int)sets[b].size(), histogram, &entries[b][1], TILEBANK_COLORS - 1);
+
+		for (size_t i = 0; i < sets[b].size(); i++) histogram[sets[b][i]] = 0;
+	}
+
+	free(histogram);
+
+	/********************************************************************************/
+	/* Each tile takes the bank with the least error, the grouping one on a tie     */
+	/********************************************************************************/
+	if (bankcount > 1)
+	{
+		for (unsigned int t = 0; t < tilecount; t++)
+		{
+			if (tiles[t].colors.empty()) continue;
+
+			unsigned long long best_error = 0;
+			unsigned int best = banks[t];
+
+			for (unsigned int b = 0; b <= bankcount; b++)
+			{
+				// the grouping bank first
+				unsigned int bank = b ? b - 1 : banks[t];
+				if (b && (bank == banks[t])) continue;
+				if (!entrycount[bank]) continue;
+
+				unsigned long long error = 0;
+				for (size_t i = 0; (i < tiles[t].colors.size()) && (!b || error < best_error); i++)
+				{
+					int distance;
+					TileBankNearest(entries[bank], entrycount[bank], tiles[t].colors[i], &distance);
+					error += (unsigned long long)distance * tiles[t].counts[i];
+				}
+
+				if (!b || (error < best_error)) {
+					best_error = error;
+					best = bank;
+				}
+			}
+
+			banks[t] = (unsigned char)best;
+		}
+	}
+
+	/********************************************************************************/
+	/* Map the pixels, tile after tile                                              */
+	/********************************************************************************/
+	unsigned char * tilepointer = tiled;
+
+	for (unsigned int t = 0; t < tilecount; t++)
+	{
+		unsigned int tilex = t % tilecount_x;
+		unsigned int tiley = t / tilecount_x;
+		const unsigned short * bank = entries[banks[t]];
+		int count = entrycount[banks[t]];
+
+		for (unsigned int i = 0; i < size; i++)
+		{
+			const unsigned char * bits = image->pixels + (ptrdiff_t)image->pitch * (int)(tiley * size + i) + (size_t)tilex * size * image->bytespp;
+
+			for (unsigned int j = 0; j < size; j++, bits += image->bytespp)
+			{
+				unsigned char alpha = bits[image->alpha];
+
+				if ( (alpha == 0) || (options->optAlphaTransparent && alpha != 255) ) *tilepointer++ = 0;
+				else {
+					unsigned short color = (unsigned short)(((bits[image->blue] >> 3) << 10) | ((bits[image->green] >> 3) << 5) | (bits[image->red] >> 3));
+					*tilepointer++ = (unsigned char)TileBankNearest(bank, count, color, NULL);
+				}
+			}
+		}
+	}
+
+	// entries in the format the palette is written in (-6, -7)
+	const PIXELFORMAT * format = PixelFormatGet(ConvertPaletteFormat(options));
+
+	for (int i = 0; i < 256; i++) palette[i] = 0;
+	for (unsigned int b = 0; b < bankcount; b++)
+		for (int i = 1; i <= entrycount[b]; i++) palette[b * TILEBANK_COLORS + i] = PalMapEntry(format, entries[b][i]);
+
+	return CONVERT_OK;
+}
@@ -0,0 +1,19 @@
+//=======================================================
+// tilebank.h
+//
+// libalpha2ds palette banks of 4-bit tiles (-B): every tile (-t -d) uses
+// one of up to 16 banks of 16 colors, bank b being entries 16 * b to
+// 16 * b + 15 of the 256 entry palette. Entry 0 of each bank is
+// transparent. Tiles are grouped by the colors they use; a bank needing
+// more than 15 colors is reduced by median cut (quantize.h) and each
+// tile finally picks the bank that shows it with the least error.
+//=======================================================
+
+#pragma once
+
+#include "convert.h"
+
+#define TILEBANK_MAX		(16)
+#define TILEBANK_COLORS		(16)
+
+int TileBankImage(const CONVERTOPTIONS * options, const CONVERTIMAGE * image, unsigned short palette[256], unsigned char * tiled, unsigned char * banks);
@@ -0,0 +1,274 @@
+//=======================================================
+// watch.cpp
+//
+// Directory watching for watch mode. Changed names are queued (each
+// name once) and handed out when no further change arrived for the
+// debounce time.
+//=======================================================
+
+#include "stdafx.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+#include "watch.h"
+
+//=======================================================
+// WatchMatch
+//=======================================================
+/** Match a file name against a wildcard expression, like _findfirst
+	@param filter Expression with * (any characters) and ? (one character)
+	@param name File name
+	@return Returns true if the name matches
+*/
+bool WatchMatch(const char * filter, const char * name)
+{
+	const char * star = NULL;
+	const char * resume = NULL;
+
+	while (*name)
+	{
+#ifdef _WIN32
+		bool same = tolower((unsigned char)*filter) == tolower((unsigned char)*name);
+#else
+		bool same = *filter == *name;
+#endif
+		if ( (*filter == '?') || ((*filter != '*') && same) ) {
+			filter++;
+			name++;
+		} else if (*filter == '*') {
+			star = filter++;
+			resume = name;
+		} else if (star) {
+			// let the last * swallow one more character
+			filter = star + 1;
+			name = ++resume;
+		} else {
+			return false;
+		}
+	}
+
+	while (*filter == '*') filter++;
+	return *filter == '\0';
+}
+
+//=======================================================
+// WatchQueue
+//=======================================================
+/** Queue a changed file once, if it matches the filter
+*/
+static void WatchQueue(std::vector<std::string> & pending, const char * filter, const char * name)
+{
+	if (!WatchMatch(filter, name)) return;
+
+	for (size_t i = 0; i < pending.size(); i++)
+		if (pending[i] == name) return;
+
+	pending.push_back(name);
+}
+
+//=======================================================
+// WatchFlush
+//=======================================================
+/** Hand all queued files to the callback
+*/
+static void WatchFlush(std::vector<std::string> & pending, WATCHCALLBACK callback, void * context)
+{
+	for (size_t i = 0; i < pending.size(); i++)
+		callback(context, pending[i].c_str());
+
+	pending.clear();
+}
+
+#ifdef _WIN32
+
+//=======================================================
+// WatchDirectory (Windows)
+//=======================================================
+bool WatchDirectory(const char * directory, const char * filter, unsigned int debounce, WATCHCALLBACK callback, void * context)
+{
+	std::vector<std::string> pending;
+	DWORD buffer[16384];		// FILE_NOTIFY_INFORMATION is DWORD aligned
+	DWORD last_change = 0;
+	OVERLAPPED overlapped;
+	bool result = true;
+
+	HANDLE dir = CreateFileA(directory, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+	if (dir == INVALID_HANDLE_VALUE) return false;
+
+	memset(&overlapped, 0, sizeof(overlapped));
+	overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!overlapped.hEvent) {
+		CloseHandle(dir);
+		return false;
+	}
+
+	for (;;)
+	{
+		if (!ReadDirectoryChangesW(dir, buffer, sizeof(buffer), FALSE,
+			FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE,
+			NULL, &overlapped, NULL))
+		{
+			result = false;
+			break;
+		}
+
+		// wait for the next change, or until the queued ones are due
+		DWORD bytes = 0;
+		for (;;)
+		{
+			DWORD timeout = INFINITE;
+			if (!pending.empty()) {
+				DWORD quiet = GetTickCount() - last_change;
+				timeout = (quiet < debounce) ? debounce - quiet : 0;
+			}
+
+			if (WaitForSingleObject(overlapped.hEvent, timeout) == WAIT_OBJECT_0) break;
+			WatchFlush(pending, callback, context);
+		}
+
+		if (!GetOverlappedResult(dir, &overlapped, &bytes, FALSE)) {
+			result = false;
+			break;
+		}
+		ResetEvent(overlapped.hEvent);
+
+		// bytes is 0 if the notifications did not fit into the buffer
+		const unsigned char * entry = (const unsigned char *)buffer;
+		while (bytes > 0)
+		{
+			const FILE_NOTIFY_INFORMATION * info = (const FILE_NOTIFY_INFORMATION *)entry;
+
+			if ( (info->Action == FILE_ACTION_ADDED) || (info->Action == FILE_ACTION_MODIFIED) || (info->Action == FILE_ACTION_RENAMED_NEW_NAME) )
+			{
+				char name[MAX_PATH];
+				int length = WideCharToMultiByte(CP_ACP, 0, info->FileName, info->FileNameLength / sizeof(WCHAR), name, MAX_PATH - 1, NULL, NULL);
+				if (length > 0) {
+					name[length] = '\0';
+					WatchQueue(pending, filter, name);
+					last_change = GetTickCount();
+				}
+			}
+
+			if (!info->NextEntryOffset) break;
+			entry += info->NextEntryOffset;
+		}
+	}
+
+	CloseHandle(overlapped.hEvent);
+	CloseHandle(dir);
+	return result;
+}
+
+#elif defined(__linux__)
+
+//=======================================================
+// WatchNow (Linux)
+//=======================================================
+/** Monotonic time in milliseconds
+*/
+static unsigned long long WatchNow()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+//=======================================================
+// WatchDirectory (Linux)
+//=======================================================
+bool WatchDirectory(const char * directory, const char * filter, unsigned int debounce, WATCHCALLBACK callback, void * context)
+{
+	std::vector<std::string> pending;
+	char buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+	unsigned long long last_change = 0;
+	bool result = true;
+
+	int fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0) return false;
+
+	// a file is complete once it is closed after writing, or renamed into
+	// the directory by an editor saving atomically
+	if (inotify_add_watch(fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		close(fd);
+		return false;
+	}
+
+	for (;;)
+	{
+		struct pollfd poll_fd;
+		int timeout = -1;
+
+		if (!pending.empty()) {
+			unsigned long long quiet = WatchNow() - last_change;
+			timeout = (quiet < debounce) ? (int)(debounce - quiet) : 0;
+		}
+
+		poll_fd.fd = fd;
+		poll_fd.events = POLLIN;
+		poll_fd.revents = 0;
+
+		int ready = poll(&poll_fd, 1, timeout);
+		if (ready < 0) {
+			if (errno == EINTR) continue;
+			result = false;
+			break;
+		}
+
+		if (ready == 0) {
+			WatchFlush(pending, callback, context);
+			continue;
+		}
+
+		ssize_t bytes = read(fd, buffer, sizeof(buffer));
+		if (bytes < 0) {
+			if (errno == EINTR) continue;
+			result = false;
+			break;
+		}
+
+		// events that did not fit into the queue (IN_Q_OVERFLOW) are lost
+		for (char * entry = buffer; entry < buffer + bytes; )
+		{
+			const struct inotify_event * event = (const struct inotify_event *)entry;
+
+			if ( (event->len > 0) && !(event->mask & IN_ISDIR) ) {
+				WatchQueue(pending, filter, event->name);
+				last_change = WatchNow();
+			}
+
+			entry += sizeof(struct inotify_event) + event->len;
+		}
+	}
+
+	close(fd);
+	return result;
+}
+
+#else
+
+//=======================================================
+// WatchDirectory
+//=======================================================
+bool WatchDirectory(const char * directory, const char * filter, unsigned int debounce, WATCHCALLBACK callback, void * context)
+{
+	// no change notification available on this platform
+	return false;
+}
+
+#endif
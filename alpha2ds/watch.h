@@ -0,0 +1,32 @@
+//=======================================================
+// watch.h
+//
+// Watch mode (-W): after the first batch the tool keeps running and
+// converts every image matching the filter again as soon as it has been
+// written. Change notifications come from inotify on Linux and from
+// ReadDirectoryChangesW on Windows. Bursts of writes to the same file
+// (editors saving in several steps) are collected until the directory
+// has been quiet for the debounce time, then each file is converted once.
+//=======================================================
+
+#pragma once
+
+#define WATCH_DEBOUNCE		(100)	// milliseconds without changes before converting
+
+/** Called for every changed file matching the filter
+	@param context Pointer passed to WatchDirectory
+	@param name File name without directory
+*/
+typedef void (*WATCHCALLBACK)(void * context, const char * name);
+
+bool WatchMatch(const char * filter, const char * name);
+
+/** Watch a directory and report changed files, returns on error only
+	@param directory Directory to watch
+	@param filter Wildcard expression (* and ?) the file names have to match
+	@param debounce Milliseconds without changes before the callback is called
+	@param callback Called once per changed file
+	@param context Passed to the callback
+	@return Returns false if the directory cannot be watched
+*/
+bool WatchDirectory(const char * directory, const char * filter, unsigned int debounce, WATCHCALLBACK callback, void * context);